@@ -159,6 +159,7 @@ send_init_command (CockpitTransport *transport,
 
       block = json_object_new ();
       json_object_set_boolean_member (block, "explicit-superuser", TRUE);
+      json_object_set_boolean_member (block, "open-batch", TRUE);
       json_object_set_object_member (object, "capabilities", block);
     }
 
@@ -408,6 +409,7 @@ run_bridge (const gchar *interactive,
   cockpit_dbus_process_startup ();
   cockpit_dbus_machines_startup ();
   cockpit_dbus_config_startup ();
+  cockpit_dbus_stats_startup ();
   cockpit_packages_dbus_startup (packages);
   cockpit_dbus_login_messages_startup ();
   cockpit_router_dbus_startup (router);
@@ -0,0 +1,56 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpitbridgesamples.h"
+
+#include "common/cockpitstats.h"
+
+/* Samples of the bridge's own channel traffic, see cockpitstats.c */
+
+static void
+sample_channels (const gchar *payload,
+                 CockpitChannelStats *stats,
+                 gpointer user_data)
+{
+  CockpitSamples *samples = user_data;
+
+  cockpit_samples_sample (samples, "bridge.channel.open", payload, stats->open);
+  cockpit_samples_sample (samples, "bridge.channel.rx", payload, stats->recv_bytes);
+  cockpit_samples_sample (samples, "bridge.channel.tx", payload, stats->sent_bytes);
+  cockpit_samples_sample (samples, "bridge.channel.rx-messages", payload, stats->recv_messages);
+  cockpit_samples_sample (samples, "bridge.channel.tx-messages", payload, stats->sent_messages);
+  cockpit_samples_sample (samples, "bridge.channel.pressure", payload, stats->pressure_usec / 1000);
+  cockpit_samples_sample (samples, "bridge.channel.ready-latency", payload,
+                          cockpit_histogram_percentile (&stats->ready_usec, 0.50) / 1000);
+  cockpit_samples_sample (samples, "bridge.channel.ping-latency", payload,
+                          cockpit_histogram_percentile (&stats->ping_usec, 0.50) / 1000);
+}
+
+void
+cockpit_bridge_samples (CockpitSamples *samples)
+{
+  CockpitTransportStats *transport = cockpit_stats_transport ();
+
+  cockpit_samples_sample (samples, "bridge.transport.rx", NULL, transport->recv_bytes);
+  cockpit_samples_sample (samples, "bridge.transport.tx", NULL, transport->sent_bytes);
+
+  cockpit_stats_foreach_channel (sample_channels, samples);
+}
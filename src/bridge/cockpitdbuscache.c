@@ -28,6 +28,9 @@
 
 #define DEBUG_BATCHES 0
 
+/* Seconds without an unwatch before dropping what is no longer watched */
+guint cockpit_dbus_cache_drop_timeout = 30;
+
 /*
  * This is a cache of properties which tracks updates. The best way to do
  * this is via ObjectManager. But it also does introspection and uses that
@@ -75,6 +78,10 @@ struct _CockpitDBusCache {
   /* The paths and interfaces we should watch */
   CockpitDBusRules *rules;
 
+  /* Paths retrieved by a poke, kept for a while once no watch covers them */
+  GHashTable *poked;
+  guint drop_timeout;
+
   /* Accumulated information about these various paths */
   GTree *managed;
   GTree *managed_not_ready;
@@ -363,6 +370,7 @@ cockpit_dbus_cache_init (CockpitDBusCache *self)
 
   /* All of these are sets. ie: key and value identical */
   self->rules = cockpit_dbus_rules_new ();
+  self->poked = g_hash_table_new (g_str_hash, g_str_equal);
 
   self->introspects = g_queue_new ();
   self->introsent = g_hash_table_new (g_str_hash, g_str_equal);
@@ -1349,6 +1357,12 @@ cockpit_dbus_cache_dispose (GObject *object)
 
   g_cancellable_cancel (self->cancellable);
 
+  if (self->drop_timeout)
+    {
+      g_source_remove (self->drop_timeout);
+      self->drop_timeout = 0;
+    }
+
   if (self->subscribed)
     {
       g_dbus_connection_signal_unsubscribe (self->connection, self->subscribe_properties);
@@ -1376,6 +1390,7 @@ cockpit_dbus_cache_finalize (GObject *object)
   g_free (self->logname);
 
   cockpit_dbus_rules_free (self->rules);
+  g_hash_table_unref (self->poked);
   g_tree_destroy (self->managed);
   g_tree_destroy (self->managed_not_ready);
 
@@ -1910,13 +1925,79 @@ cockpit_dbus_cache_watch (CockpitDBusCache *self,
   batch_unref (self, batch);
 }
 
+static gboolean
+on_drop_unwatched (gpointer user_data)
+{
+  CockpitDBusCache *self = user_data;
+  GHashTableIter iter;
+  GHashTableIter hter;
+  GHashTable *interfaces;
+  gboolean dropped;
+  gpointer path;
+  gpointer interface;
+
+  /* Wait until retrievals in flight have settled */
+  if (self->batches->head)
+    return G_SOURCE_CONTINUE;
+
+  self->drop_timeout = 0;
+
+  /*
+   * Nothing keeps these up to date any longer, so don't hold on to
+   * them. They're retrieved again if they get watched later.
+   */
+  g_hash_table_iter_init (&iter, self->cache);
+  while (g_hash_table_iter_next (&iter, &path, (gpointer *)&interfaces))
+    {
+      /*
+       * Paths that were poked were asked for directly. Once unwatched
+       * they're kept this time, and go with the next scan.
+       */
+      if (g_hash_table_contains (self->poked, path))
+        {
+          if (!cockpit_dbus_rules_match (self->rules, path, NULL, NULL, NULL))
+            g_hash_table_remove (self->poked, path);
+          continue;
+        }
+
+      if (!cockpit_dbus_rules_match (self->rules, path, NULL, NULL, NULL))
+        {
+          g_hash_table_iter_remove (&iter);
+          continue;
+        }
+
+      dropped = FALSE;
+      g_hash_table_iter_init (&hter, interfaces);
+      while (g_hash_table_iter_next (&hter, &interface, NULL))
+        {
+          if (!cockpit_dbus_rules_match (self->rules, path, interface, NULL, NULL))
+            {
+              g_hash_table_iter_remove (&hter);
+              dropped = TRUE;
+            }
+        }
+
+      if (dropped && g_hash_table_size (interfaces) == 0)
+        g_hash_table_iter_remove (&iter);
+    }
+
+  return G_SOURCE_REMOVE;
+}
+
 gboolean
 cockpit_dbus_cache_unwatch (CockpitDBusCache *self,
                             const gchar *path,
                             gboolean is_namespace,
                             const gchar *interface)
 {
-  return cockpit_dbus_rules_remove (self->rules, path, is_namespace, interface, NULL, NULL);
+  if (!cockpit_dbus_rules_remove (self->rules, path, is_namespace, interface, NULL, NULL))
+    return FALSE;
+
+  /* Unwatches tend to come in bursts, so scan once they stop */
+  if (self->drop_timeout)
+    g_source_remove (self->drop_timeout);
+  self->drop_timeout = g_timeout_add_seconds (cockpit_dbus_cache_drop_timeout, on_drop_unwatched, self);
+  return TRUE;
 }
 
 static void
@@ -2066,6 +2147,7 @@ cockpit_dbus_cache_poke (CockpitDBusCache *self,
 
   batch = batch_create (self);
   path = intern_string (self, path);
+  g_hash_table_add (self->poked, (gpointer)path);
 
   if (interface)
     {
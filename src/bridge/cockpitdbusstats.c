@@ -0,0 +1,188 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpitdbusinternal.h"
+
+#include "common/cockpitbufferpool.h"
+#include "common/cockpitstats.h"
+
+static void
+add_histogram (GVariantBuilder *builder,
+               const gchar *name,
+               const CockpitHistogram *histogram)
+{
+  gchar *key;
+
+  key = g_strdup_printf ("%s-count", name);
+  g_variant_builder_add (builder, "{st}", key, histogram->count);
+  g_free (key);
+
+  key = g_strdup_printf ("%s-mean", name);
+  g_variant_builder_add (builder, "{st}", key, cockpit_histogram_mean (histogram));
+  g_free (key);
+
+  key = g_strdup_printf ("%s-p50", name);
+  g_variant_builder_add (builder, "{st}", key, cockpit_histogram_percentile (histogram, 0.50));
+  g_free (key);
+
+  key = g_strdup_printf ("%s-p99", name);
+  g_variant_builder_add (builder, "{st}", key, cockpit_histogram_percentile (histogram, 0.99));
+  g_free (key);
+
+  key = g_strdup_printf ("%s-max", name);
+  g_variant_builder_add (builder, "{st}", key, histogram->max);
+  g_free (key);
+}
+
+static void
+add_channel_stats (const gchar *payload,
+                   CockpitChannelStats *stats,
+                   gpointer user_data)
+{
+  GVariantBuilder *channels = user_data;
+  GVariantBuilder builder;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{st}"));
+  g_variant_builder_add (&builder, "{st}", "opened", stats->opened);
+  g_variant_builder_add (&builder, "{st}", "open", stats->open);
+  g_variant_builder_add (&builder, "{st}", "recv-messages", stats->recv_messages);
+  g_variant_builder_add (&builder, "{st}", "recv-bytes", stats->recv_bytes);
+  g_variant_builder_add (&builder, "{st}", "sent-messages", stats->sent_messages);
+  g_variant_builder_add (&builder, "{st}", "sent-bytes", stats->sent_bytes);
+  g_variant_builder_add (&builder, "{st}", "unacked-high", stats->unacked_high);
+  g_variant_builder_add (&builder, "{st}", "pressure-count", stats->pressure_count);
+  g_variant_builder_add (&builder, "{st}", "pressure-usec", stats->pressure_usec);
+  add_histogram (&builder, "ready-usec", &stats->ready_usec);
+  add_histogram (&builder, "ping-usec", &stats->ping_usec);
+
+  g_variant_builder_add (channels, "{sa{st}}", payload, &builder);
+}
+
+static GVariant *
+build_stats (void)
+{
+  CockpitTransportStats *transport = cockpit_stats_transport ();
+  CockpitRouterStats *router = cockpit_stats_router ();
+  CockpitBufferPoolStats pool;
+  GVariantBuilder channels;
+  GVariantBuilder totals;
+
+  g_variant_builder_init (&channels, G_VARIANT_TYPE ("a{sa{st}}"));
+  cockpit_stats_foreach_channel (add_channel_stats, &channels);
+
+  g_variant_builder_init (&totals, G_VARIANT_TYPE ("a{st}"));
+  g_variant_builder_add (&totals, "{st}", "recv-messages", transport->recv_messages);
+  g_variant_builder_add (&totals, "{st}", "recv-bytes", transport->recv_bytes);
+  g_variant_builder_add (&totals, "{st}", "sent-messages", transport->sent_messages);
+  g_variant_builder_add (&totals, "{st}", "sent-bytes", transport->sent_bytes);
+  g_variant_builder_add (&totals, "{st}", "frozen-high", transport->frozen_high);
+  g_variant_builder_add (&totals, "{st}", "opens", router->opens);
+  g_variant_builder_add (&totals, "{st}", "kills", router->kills);
+  add_histogram (&totals, "route-usec", &router->route_usec);
+
+  cockpit_buffer_pool_get_stats (&pool);
+  g_variant_builder_add (&totals, "{st}", "buffers-allocated", pool.allocated);
+  g_variant_builder_add (&totals, "{st}", "buffers-reused", pool.reused);
+  g_variant_builder_add (&totals, "{st}", "buffers-outstanding", pool.outstanding);
+  g_variant_builder_add (&totals, "{st}", "buffers-cached-bytes", pool.cached_bytes);
+
+  return g_variant_new ("(a{sa{st}}a{st})", &channels, &totals);
+}
+
+static void
+stats_method_call (GDBusConnection *connection,
+                   const gchar *sender,
+                   const gchar *object_path,
+                   const gchar *interface_name,
+                   const gchar *method_name,
+                   GVariant *parameters,
+                   GDBusMethodInvocation *invocation,
+                   gpointer user_data)
+{
+  if (g_str_equal (method_name, "Get"))
+    {
+      g_dbus_method_invocation_return_value (invocation, build_stats ());
+    }
+  else if (g_str_equal (method_name, "Reset"))
+    {
+      cockpit_stats_reset ();
+      g_dbus_method_invocation_return_value (invocation, NULL);
+    }
+  else
+    g_return_if_reached ();
+}
+
+static GDBusInterfaceVTable stats_vtable = {
+  .method_call = stats_method_call,
+};
+
+static GDBusArgInfo stats_channels_arg = {
+  -1, "channels", "a{sa{st}}", NULL
+};
+
+static GDBusArgInfo stats_totals_arg = {
+  -1, "totals", "a{st}", NULL
+};
+
+static GDBusArgInfo *stats_get_out_args[] = {
+  &stats_channels_arg,
+  &stats_totals_arg,
+  NULL
+};
+
+static GDBusMethodInfo stats_get_method = {
+  -1, "Get", NULL, stats_get_out_args, NULL
+};
+
+static GDBusMethodInfo stats_reset_method = {
+  -1, "Reset", NULL, NULL, NULL
+};
+
+static GDBusMethodInfo *stats_methods[] = {
+  &stats_get_method,
+  &stats_reset_method,
+  NULL
+};
+
+static GDBusInterfaceInfo stats_interface = {
+  -1, "cockpit.Stats", stats_methods, NULL, NULL, NULL
+};
+
+void
+cockpit_dbus_stats_startup (void)
+{
+  GDBusConnection *connection;
+  GError *error = NULL;
+
+  connection = cockpit_dbus_internal_server ();
+  g_return_if_fail (connection != NULL);
+
+  g_dbus_connection_register_object (connection, "/stats", &stats_interface,
+                                     &stats_vtable, NULL, NULL, &error);
+
+  if (error != NULL)
+    {
+      g_critical ("couldn't register DBus cockpit.Stats object: %s", error->message);
+      g_error_free (error);
+    }
+
+  g_object_unref (connection);
+}
@@ -32,6 +32,7 @@
 #include "cockpitmountsamples.h"
 #include "cockpitcgroupsamples.h"
 #include "cockpitdisksamples.h"
+#include "cockpitbridgesamples.h"
 
 #include "common/cockpitjson.h"
 
@@ -53,7 +54,8 @@ typedef enum {
   NETWORK_SAMPLER = 1 << 3,
   MOUNT_SAMPLER = 1 << 4,
   CGROUP_SAMPLER = 1 << 5,
-  DISK_SAMPLER = 1 << 6
+  DISK_SAMPLER = 1 << 6,
+  BRIDGE_SAMPLER = 1 << 7
 } SamplerSet;
 
 typedef struct {
@@ -100,6 +102,17 @@ static MetricDescription metric_descriptions[] = {
   { "cgroup.cpu.usage",       "millisec", "counter", TRUE, CGROUP_SAMPLER },
   { "cgroup.cpu.shares",      "count",    "instant", TRUE, CGROUP_SAMPLER },
 
+  { "bridge.transport.rx",           "bytes",    "counter", FALSE, BRIDGE_SAMPLER },
+  { "bridge.transport.tx",           "bytes",    "counter", FALSE, BRIDGE_SAMPLER },
+  { "bridge.channel.open",           "count",    "instant", TRUE,  BRIDGE_SAMPLER },
+  { "bridge.channel.rx",             "bytes",    "counter", TRUE,  BRIDGE_SAMPLER },
+  { "bridge.channel.tx",             "bytes",    "counter", TRUE,  BRIDGE_SAMPLER },
+  { "bridge.channel.rx-messages",    "count",    "counter", TRUE,  BRIDGE_SAMPLER },
+  { "bridge.channel.tx-messages",    "count",    "counter", TRUE,  BRIDGE_SAMPLER },
+  { "bridge.channel.pressure",       "millisec", "counter", TRUE,  BRIDGE_SAMPLER },
+  { "bridge.channel.ready-latency",  "millisec", "instant", TRUE,  BRIDGE_SAMPLER },
+  { "bridge.channel.ping-latency",   "millisec", "instant", TRUE,  BRIDGE_SAMPLER },
+
   { NULL }
 };
 
@@ -334,6 +347,8 @@ cockpit_internal_metrics_tick (CockpitMetrics *metrics,
     cockpit_cgroup_samples (COCKPIT_SAMPLES (self));
   if (self->samplers & DISK_SAMPLER)
     cockpit_disk_samples (COCKPIT_SAMPLES (self));
+  if (self->samplers & BRIDGE_SAMPLER)
+    cockpit_bridge_samples (COCKPIT_SAMPLES (self));
 
   /* Check for disappeared instances
    */
@@ -27,6 +27,7 @@
 #include "cockpitdbusinternal.h"
 
 #include "common/cockpitchannel.h"
+#include "common/cockpitcontentcache.h"
 #include "common/cockpithex.h"
 #include "common/cockpitjson.h"
 #include "common/cockpitlocale.h"
@@ -44,6 +45,7 @@
 
 /* Overridable from tests */
 const gchar **cockpit_bridge_data_dirs = NULL; /* default */
+gsize cockpit_packages_gunzip_cache_size = 16 * 1024 * 1024;
 
 static CockpitPackages *packages_singleton = NULL;
 
@@ -109,6 +111,9 @@ struct _CockpitPackages {
   JsonObject *json;
   gchar *locale;
 
+  /* Decompressed content for clients that don't accept gzip */
+  CockpitContentCache *gunzipped;
+
   gboolean dbus_inited;
   void (*on_change_callback) (gconstpointer data);
   gconstpointer on_change_callback_data;
@@ -927,13 +932,73 @@ handle_package_manifests_json (CockpitWebServer *server,
   return TRUE;
 }
 
+static gboolean
+has_compressed_variant (CockpitPackage *package,
+                        const gchar *chosen)
+{
+  gboolean ret = FALSE;
+  gchar *name;
+
+  if (!package || !package->paths)
+    return FALSE;
+
+  name = g_strconcat (chosen, ".br", NULL);
+  ret = g_hash_table_contains (package->paths, name);
+  g_free (name);
+
+  if (!ret)
+    {
+      name = g_strconcat (chosen, ".gz", NULL);
+      ret = g_hash_table_contains (package->paths, name);
+      g_free (name);
+    }
+
+  return ret;
+}
+
+static GBytes *
+gunzip_content (CockpitPackages *packages,
+                CockpitPackage *package,
+                const gchar *chosen,
+                GBytes *bytes)
+{
+  GBytes *uncompressed;
+  GError *error = NULL;
+  gchar *key = NULL;
+
+  /* The package checksum changes along with any file in it */
+  if (package && package->own_checksum)
+    {
+      key = g_strconcat (package->own_checksum, "\n", chosen, NULL);
+      uncompressed = cockpit_content_cache_lookup (packages->gunzipped, key);
+      if (uncompressed)
+        goto out;
+    }
+
+  uncompressed = cockpit_web_response_gunzip (bytes, &error);
+  if (error)
+    {
+      g_message ("couldn't decompress: %s: %s", chosen, error->message);
+      g_error_free (error);
+      uncompressed = g_bytes_new_static ("", 0);
+    }
+  else if (key)
+    {
+      cockpit_content_cache_insert (packages->gunzipped, key, uncompressed);
+    }
+
+out:
+  g_free (key);
+  return uncompressed;
+}
+
 static gboolean
 package_content (CockpitPackages *packages,
                  CockpitWebResponse *response,
                  const gchar *name,
                  const gchar *path,
                  const gchar *language,
-                 const gchar **encodings,
+                 const gchar *accept_encoding,
                  const gchar *self_origin,
                  GHashTable *headers)
 {
@@ -946,8 +1011,9 @@ package_content (CockpitPackages *packages,
   GBytes *bytes = NULL;
   gchar *chosen = NULL;
   gboolean globbing;
-  gboolean gzipped;
-  gboolean allow_gzipped = FALSE;
+  const gchar *encoding;
+  gboolean compressed;
+  CockpitWebEncodings allowed = COCKPIT_WEB_ENCODING_IDENTITY;
   const gchar *type;
   gchar *policy;
 
@@ -959,20 +1025,15 @@ package_content (CockpitPackages *packages,
     {
       names = g_hash_table_get_keys (packages->listing);
 
-      /* When globbing files together no gzip encoding is possible */
-      allow_gzipped = FALSE;
+      /* When globbing files together no content encoding is possible */
+      allowed = COCKPIT_WEB_ENCODING_IDENTITY;
     }
   else
     {
       names = g_list_append (names, (gchar *)name);
 
-      /* Check if client allows us to send gzipped content */
-      for (gint i = 0; encodings[i] != NULL; i++)
-        {
-          if (g_strcmp0 (encodings[i], "*") == 0 ||
-              g_strcmp0 (encodings[i], "gzip") == 0)
-            allow_gzipped = TRUE;
-        }
+      /* Check which precompressed content the client allows us to send */
+      allowed = cockpit_web_response_accepted_encodings (accept_encoding);
     }
 
   names = g_list_sort (names, (GCompareFunc)g_strcmp0);
@@ -1003,7 +1064,8 @@ package_content (CockpitPackages *packages,
       g_free (chosen);
       chosen = NULL;
 
-      bytes = cockpit_web_response_negotiation (filename, package ? package->paths : NULL, language, &chosen, &error);
+      bytes = cockpit_web_response_negotiation_full (filename, package ? package->paths : NULL, language,
+                                                     allowed, &chosen, &error);
 
       /* When globbing most errors result in a zero length block */
       if (globbing)
@@ -1044,28 +1106,31 @@ package_content (CockpitPackages *packages,
             }
         }
 
+      /* Negotiation only picks a .br file when the client accepts it */
+      encoding = NULL;
+      if (chosen && g_str_has_suffix (chosen, ".br"))
+        encoding = "br";
+      else if (chosen && g_str_has_suffix (chosen, ".gz"))
+        encoding = "gzip";
+      compressed = !globbing && (encoding != NULL || has_compressed_variant (package, chosen));
+
       /* Do we need to decompress this content? */
-      gzipped = chosen && g_str_has_suffix (chosen, ".gz");
-      if (gzipped && !allow_gzipped)
+      if (g_strcmp0 (encoding, "gzip") == 0 && !(allowed & COCKPIT_WEB_ENCODING_GZIP))
         {
-          g_clear_error (&error);
-          uncompressed = cockpit_web_response_gunzip (bytes, &error);
-          if (error)
-            {
-              g_message ("couldn't decompress: %s: %s", chosen, error->message);
-              g_clear_error (&error);
-              uncompressed = g_bytes_new_static ("", 0);
-            }
+          uncompressed = gunzip_content (packages, package, chosen, bytes);
           g_bytes_unref (bytes);
           bytes = uncompressed;
-          gzipped = FALSE;
+          encoding = NULL;
         }
 
       /* The first one */
       if (l == names)
         {
-          if (gzipped)
-            g_hash_table_insert (headers, g_strdup ("Content-Encoding"), g_strdup ("gzip"));
+          /* What we send depends on Accept-Encoding whenever there was a compressed variant */
+          if (compressed)
+            g_hash_table_insert (headers, g_strdup ("Vary"), g_strdup ("Accept-Encoding"));
+          if (encoding)
+            g_hash_table_insert (headers, g_strdup ("Content-Encoding"), g_strdup (encoding));
 
           type = cockpit_web_response_content_type (path);
           if (type)
@@ -1113,7 +1178,6 @@ handle_packages (CockpitWebServer *server,
   const gchar *path;
   GHashTable *out_headers = NULL;
   gchar **languages = NULL;
-  gchar **encodings = NULL;
   gchar *origin = NULL;
   const gchar *protocol;
   const gchar *accept;
@@ -1157,19 +1221,18 @@ handle_packages (CockpitWebServer *server,
   if (origin)
     g_hash_table_insert (out_headers, g_strdup ("Access-Control-Allow-Origin"), origin);
 
+  /* Without Accept-Encoding we've always sent gzip, but not Brotli */
   accept = g_hash_table_lookup (headers, "Accept-Encoding");
   if (!accept)
-    accept = "*";
-  encodings = cockpit_web_server_parse_accept_list (accept, NULL);
+    accept = "gzip";
 
   package_content (packages, response, name, path, languages[0],
-                   (const gchar **)encodings, origin, out_headers);
+                   accept, origin, out_headers);
 
 out:
   if (out_headers)
     g_hash_table_unref (out_headers);
   g_strfreev (languages);
-  g_strfreev (encodings);
   g_free (name);
   return TRUE;
 }
@@ -1217,6 +1280,7 @@ cockpit_packages_new (void)
   packages = g_new0 (CockpitPackages, 1);
 
   packages->web_server = cockpit_web_server_new (NULL, COCKPIT_WEB_SERVER_NONE);
+  packages->gunzipped = cockpit_content_cache_new (cockpit_packages_gunzip_cache_size);
 
   g_signal_connect (packages->web_server, "handle-resource::/checksum",
                     G_CALLBACK (handle_package_checksum), packages);
@@ -1304,6 +1368,7 @@ cockpit_packages_get_bridges (CockpitPackages *packages)
   JsonObject *item;
   JsonObject *match;
   gboolean privileged;
+  gboolean warm;
   const gchar *problem;
   JsonNode *node;
   guint i;
@@ -1358,6 +1423,10 @@ cockpit_packages_get_bridges (CockpitPackages *packages)
             {
               g_message ("%s: invalid \"problem\" field in package manifest", package->name);
             }
+          else if (!cockpit_json_get_bool (item, "warm", FALSE, &warm))
+            {
+              g_message ("%s: invalid \"warm\" field in package manifest", package->name);
+            }
           else
             {
               result = g_list_prepend (result, item);
@@ -1411,6 +1480,7 @@ cockpit_packages_free (CockpitPackages *packages)
   g_free (packages->checksum);
   if (packages->listing)
     g_hash_table_unref (packages->listing);
+  cockpit_content_cache_free (packages->gunzipped);
   g_clear_object (&packages->web_server);
   g_free (packages);
 }
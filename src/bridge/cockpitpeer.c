@@ -48,6 +48,7 @@ struct _CockpitPeer {
   const gchar *name;
   JsonObject *config;
   guint timeout;
+  gboolean warm;
 
   /* The channels we're dealing with */
   GHashTable *channels;
@@ -182,6 +183,19 @@ on_other_recv (CockpitTransport *transport,
   return FALSE;
 }
 
+/* How long to keep the peer running without channels, or -1 */
+static gint64
+peer_idle_timeout (CockpitPeer *self)
+{
+  gint64 timeout;
+
+  if (cockpit_json_get_int (self->config, "timeout", -1, &timeout) && timeout >= 0)
+    return timeout;
+  if (self->warm)
+    return COCKPIT_PEER_WARM_TIMEOUT;
+  return -1;
+}
+
 static gboolean
 on_timeout_reset (gpointer user_data)
 {
@@ -455,6 +469,7 @@ on_other_control (CockpitTransport *transport,
       /* Stop keeping track of channels that are closed */
       if (g_str_equal (command, "close"))
         {
+          cockpit_transport_relay (self->transport, channel, NULL);
           g_hash_table_remove (self->channels, channel);
           if (g_hash_table_size (self->channels) == 0)
             {
@@ -462,7 +477,8 @@ on_other_control (CockpitTransport *transport,
               if (self->timeout)
                 g_source_remove (self->timeout);
               self->timeout = 0;
-              if (cockpit_json_get_int (self->config, "timeout", -1, &timeout) && timeout >= 0)
+              timeout = peer_idle_timeout (self);
+              if (timeout >= 0)
                 self->timeout = g_timeout_add_seconds (timeout, on_timeout_reset, self);
             }
         }
@@ -568,6 +584,7 @@ on_other_closed (CockpitTransport *transport,
   g_signal_handler_disconnect (self->other, self->other_closed);
   g_signal_handler_disconnect (self->other, self->other_recv);
   g_signal_handler_disconnect (self->other, self->other_control);
+  cockpit_transport_relay (self->other, NULL, NULL);
   g_object_unref (self->other);
   self->other = NULL;
 
@@ -579,6 +596,7 @@ on_other_closed (CockpitTransport *transport,
   for (l = channels; l != NULL; l = g_list_next (l))
     {
       channel = l->data;
+      cockpit_transport_relay (self->transport, channel, NULL);
 
       /*
        * If we have a problem code, that either means that we failed
@@ -600,7 +618,8 @@ on_other_closed (CockpitTransport *transport,
   g_list_free_full (channels, g_free);
 
   /* If the timeout is set, then expect that this bridge can cycle back up */
-  if (cockpit_json_get_int (self->config, "timeout", -1, &timeout) && timeout >= 0)
+  timeout = peer_idle_timeout (self);
+  if (timeout >= 0)
     cockpit_peer_reset (self);
 }
 
@@ -643,7 +662,18 @@ on_transport_control (CockpitTransport *transport,
     {
       handled = forward = TRUE;
       if (g_str_equal (command, "close"))
-        g_hash_table_remove (self->channels, channel);
+        {
+          cockpit_transport_relay (self->transport, channel, NULL);
+          g_hash_table_remove (self->channels, channel);
+        }
+
+      /* From now on messages for the channel go straight to the peer */
+      else if (g_str_equal (command, "open") && self->other)
+        {
+          cockpit_transport_send (self->other, NULL, payload);
+          cockpit_transport_relay (self->transport, channel, self->other);
+          forward = FALSE;
+        }
     }
   else if (self->inited)
     {
@@ -780,6 +810,9 @@ cockpit_peer_constructed (GObject *object)
   g_return_if_fail (self->config != NULL);
   g_return_if_fail (self->transport != NULL);
 
+  if (!cockpit_json_get_bool (self->config, "warm", FALSE, &self->warm))
+    self->warm = FALSE;
+
   self->transport_recv = g_signal_connect (self->transport, "recv", G_CALLBACK (on_transport_recv), self);
   self->transport_control = g_signal_connect (self->transport, "control", G_CALLBACK (on_transport_control), self);
 
@@ -1113,6 +1146,9 @@ cockpit_peer_ensure_with_done (CockpitPeer *self,
       self->other_recv = g_signal_connect (self->other, "recv", G_CALLBACK (on_other_recv), self);
       self->other_closed = g_signal_connect (self->other, "closed", G_CALLBACK (on_other_closed), self);
       self->other_control = g_signal_connect (self->other, "control", G_CALLBACK (on_other_control), self);
+
+      /* Everything the peer sends on a channel is passed on as is */
+      cockpit_transport_relay (self->other, NULL, self->transport);
     }
   else
     {
@@ -1123,6 +1159,45 @@ cockpit_peer_ensure_with_done (CockpitPeer *self,
   return self->other;
 }
 
+/**
+ * cockpit_peer_warm:
+ * @peer: The peer object
+ *
+ * Start the peer bridge ahead of time, if its configuration has
+ * "warm" set, so that the first channel doesn't wait for it to
+ * spawn and initialize. A peer that gets no channels is stopped
+ * again after its idle timeout, and then spawned when needed.
+ *
+ * Privileged peers are never warmed, they are started through
+ * the superuser machinery.
+ *
+ * Returns: whether the peer is running
+ */
+gboolean
+cockpit_peer_warm (CockpitPeer *self)
+{
+  gboolean privileged;
+
+  g_return_val_if_fail (COCKPIT_IS_PEER (self), FALSE);
+
+  if (!self->warm || self->closed)
+    return FALSE;
+  if (cockpit_json_get_bool (self->config, "privileged", FALSE, &privileged) && privileged)
+    return FALSE;
+
+  if (!self->other)
+    {
+      g_debug ("%s: warming up peer bridge", self->name);
+      if (!cockpit_peer_ensure (self))
+        return FALSE;
+    }
+
+  if (g_hash_table_size (self->channels) == 0 && !self->timeout)
+    self->timeout = g_timeout_add_seconds (peer_idle_timeout (self), on_timeout_reset, self);
+
+  return TRUE;
+}
+
 void
 cockpit_peer_reset (CockpitPeer *self)
 {
@@ -30,6 +30,9 @@ G_BEGIN_DECLS
 
 typedef struct _CockpitPeer        CockpitPeer;
 
+/* Warm peers without a "timeout" of their own stop after this many idle seconds */
+#define         COCKPIT_PEER_WARM_TIMEOUT   60
+
 typedef void CockpitPeerDoneFunction (const gchar *error, const gchar *stderr, gpointer data);
 
 typedef struct _CockpitPeerClass {
@@ -58,6 +61,8 @@ gboolean            cockpit_peer_handle                          (CockpitPeer *p
                                                                   JsonObject *options,
                                                                   GBytes *data);
 
+gboolean            cockpit_peer_warm                            (CockpitPeer *peer);
+
 void                cockpit_peer_reset                           (CockpitPeer *peer);
 
 G_END_DECLS
@@ -24,12 +24,14 @@
 #include "cockpitconnect.h"
 #include "cockpitpeer.h"
 #include "cockpitdbusinternal.h"
+#include "cockpitroutermatch.h"
 
 #include "common/cockpitchannel.h"
 #include "common/cockpitjson.h"
 #include "common/cockpittransport.h"
 #include "common/cockpitpipe.h"
 #include "common/cockpitpipetransport.h"
+#include "common/cockpitstats.h"
 #include "common/cockpittemplate.h"
 #include "common/cockpithex.h"
 
@@ -37,15 +39,9 @@
 #include <string.h>
 #include <stdio.h>
 
-typedef struct {
-  gchar *name;
-  GPatternSpec *glob;
-  JsonNode *node;
-} RouterMatch;
-
 typedef struct {
   JsonObject *config;
-  RouterMatch *matches;
+  CockpitRouterMatch *match;
   gboolean (* callback) (CockpitRouter *, const gchar *, JsonObject *, GBytes *, gpointer);
   gpointer user_data;
   GDestroyNotify destroy;
@@ -64,14 +60,21 @@ struct _CockpitRouter {
   /* Rules for how to open channels */
   GList *rules;
 
+  /* Compiled from the rules when needed */
+  CockpitRouterIndex *index;
+
   /* All local channels are tracked here, value may be null */
   GHashTable *channels;
 
-  /* Channel groups */
+  /* Channel groups, and the channels in each group */
   GHashTable *groups;
+  GHashTable *members;
   GHashTable *fences;
   GQueue *fenced;
 
+  /* Batches of channels still being opened */
+  GHashTable *batches;
+
   /* Superuser */
   RouterRule *superuser_rule;
   CockpitTransport *superuser_transport;
@@ -107,6 +110,15 @@ typedef struct {
   GHashTable *peers;
 } DynamicPeer;
 
+typedef struct {
+  CockpitRouter *router;
+  gchar *id;
+  GHashTable *pending;
+  JsonObject *ready;
+  JsonObject *problems;
+  gboolean opening;
+} RouterBatch;
+
 static DynamicPeer *
 dynamic_peer_create (JsonObject *config)
 {
@@ -133,72 +145,8 @@ static void
 router_rule_compile (RouterRule *rule,
                      JsonObject *object)
 {
-  RouterMatch *match;
-  GList *names, *l;
-  JsonNode *node;
-  gint i;
-
-  g_assert (rule->matches == NULL);
-
-  if (object == NULL)
-    return;
-
-  names = json_object_get_members (object);
-  rule->matches = g_new0 (RouterMatch, g_list_length (names) + 1);
-  for (l = names, i = 0; l != NULL; l = g_list_next (l), i++)
-    {
-      match = &rule->matches[i];
-      match->name = g_strdup (l->data);
-      node = json_object_get_member (object, l->data);
-
-      /* A glob style string pattern */
-      if (JSON_NODE_HOLDS_VALUE (node) && json_node_get_value_type (node) == G_TYPE_STRING)
-        match->glob = g_pattern_spec_new (json_node_get_string (node));
-
-      /* A null matches anything */
-      if (!JSON_NODE_HOLDS_NULL (node))
-        match->node = json_node_copy (node);
-    }
-
-  /* The last match has a null name */
-  g_list_free (names);
-}
-
-static gboolean
-router_rule_match (RouterRule *rule,
-                   JsonObject *object)
-{
-  RouterMatch *match;
-  const gchar *value;
-  JsonNode *node;
-  guint i;
-
-  if (rule->matches == NULL)
-    return FALSE;
-
-  for (i = 0; rule->matches[i].name != NULL; i++)
-    {
-      match = &rule->matches[i];
-      if (match->glob)
-        {
-          if (!cockpit_json_get_string (object, match->name, NULL, &value) || !value ||
-              !g_pattern_match (match->glob, strlen (value), value, NULL))
-            return FALSE;
-        }
-      else if (match->node)
-        {
-          node = json_object_get_member (object, match->name);
-          if (!node || !cockpit_json_equal (match->node, node))
-            return FALSE;
-        }
-      else
-        {
-          if (!json_object_has_member (object, match->name))
-            return FALSE;
-        }
-    }
-
-  return TRUE;
+  g_assert (rule->match == NULL);
+  rule->match = cockpit_router_match_new (object);
 }
 
 static gboolean
@@ -228,18 +176,9 @@ router_rule_find (GList *rules,
 static void
 router_rule_destroy (RouterRule *rule)
 {
-  gint i;
-
   if (rule->destroy)
     (rule->destroy) (rule->user_data);
-  for (i = 0; rule->matches && rule->matches[i].name != NULL; i++)
-    {
-      g_free (rule->matches[i].name);
-      json_node_free (rule->matches[i].node);
-      if (rule->matches[i].glob)
-        g_pattern_spec_free (rule->matches[i].glob);
-    }
-  g_free (rule->matches);
+  cockpit_router_match_free (rule->match);
   if (rule->config)
     json_object_unref (rule->config);
   g_free (rule);
@@ -248,34 +187,70 @@ router_rule_destroy (RouterRule *rule)
 static void
 router_rule_dump (RouterRule *rule)
 {
-  RouterMatch *match;
   gboolean privileged;
-  gchar *text;
-  guint i;
 
   g_print ("rule:\n");
-  for (i = 0; rule->matches && rule->matches[i].name != NULL; i++)
-    {
-      match = &rule->matches[i];
-      if (match->node)
-        {
-          text = cockpit_json_write (match->node, NULL);
-          g_print ("  %s: %s\n", match->name, text);
-          g_free (text);
-        }
-      else if (match->glob)
-        {
-          g_print ("  %s: glob\n", match->name);
-        }
-      else
-        {
-          g_print ("  %s\n", match->name);
-        }
-    }
+  if (rule->match)
+    cockpit_router_match_dump (rule->match);
   if (rule->config && cockpit_json_get_bool (rule->config, "privileged", FALSE, &privileged) && privileged)
     g_print ("  privileged\n");
 }
 
+static void
+router_rules_changed (CockpitRouter *self)
+{
+  /* Rebuilt on the next open */
+  cockpit_router_index_unref (self->index);
+  self->index = NULL;
+}
+
+static CockpitRouterIndex *
+router_ensure_index (CockpitRouter *self)
+{
+  GList *l;
+
+  if (!self->index)
+    {
+      self->index = cockpit_router_index_new ();
+      for (l = self->rules; l != NULL; l = g_list_next (l))
+        cockpit_router_index_add (self->index, ((RouterRule *)l->data)->match, l->data);
+    }
+
+  return self->index;
+}
+
+typedef struct {
+  CockpitRouter *router;
+  const gchar *channel;
+  JsonObject *options;
+  GBytes *data;
+} RouterOpen;
+
+static gboolean
+router_rule_try (gpointer data,
+                 gpointer user_data)
+{
+  RouterOpen *open = user_data;
+  return router_rule_invoke (data, open->router, open->channel, open->options, open->data);
+}
+
+static gboolean process_open_peer (CockpitRouter *self, const gchar *channel,
+                                   JsonObject *options, GBytes *data, gpointer user_data);
+
+static void
+router_warm_peers (CockpitRouter *self)
+{
+  RouterRule *rule;
+  GList *l;
+
+  for (l = self->rules; l != NULL; l = g_list_next (l))
+    {
+      rule = l->data;
+      if (rule->callback == process_open_peer)
+        cockpit_peer_warm (rule->user_data);
+    }
+}
+
 static void
 process_init (CockpitRouter *self,
               CockpitTransport *transport,
@@ -335,7 +310,51 @@ process_init (CockpitRouter *self,
         }
       else
         superuser_legacy_init (self);
+
+      router_warm_peers (self);
+    }
+}
+
+static void
+router_group_remove (CockpitRouter *self,
+                     const gchar *channel)
+{
+  GHashTable *members;
+  const gchar *group;
+
+  group = g_hash_table_lookup (self->groups, channel);
+  if (!group)
+    return;
+
+  members = g_hash_table_lookup (self->members, group);
+  if (members)
+    {
+      g_hash_table_remove (members, channel);
+      if (g_hash_table_size (members) == 0)
+        g_hash_table_remove (self->members, group);
     }
+
+  g_hash_table_remove (self->groups, channel);
+}
+
+static void
+router_group_add (CockpitRouter *self,
+                  const gchar *channel,
+                  const gchar *group)
+{
+  GHashTable *members;
+
+  router_group_remove (self, channel);
+
+  members = g_hash_table_lookup (self->members, group);
+  if (!members)
+    {
+      members = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+      g_hash_table_insert (self->members, g_strdup (group), members);
+    }
+
+  g_hash_table_add (members, g_strdup (channel));
+  g_hash_table_insert (self->groups, g_strdup (channel), g_strdup (group));
 }
 
 static void
@@ -350,7 +369,7 @@ on_channel_closed (CockpitChannel *local,
 
   channel = cockpit_channel_get_id (local);
   g_hash_table_remove (self->channels, channel);
-  g_hash_table_remove (self->groups, channel);
+  router_group_remove (self, channel);
 
   /*
    * If this was the last channel in the fence group then resume all other channels
@@ -499,7 +518,7 @@ process_open_channel (CockpitRouter *self,
   if (g_str_equal (group, "fence"))
     g_hash_table_add (self->fences, g_strdup (channel));
 
-  g_hash_table_insert (self->groups, g_strdup (channel), g_strdup (group));
+  router_group_add (self, channel, group);
 
   create_channel (self, channel, options, channel_type);
   return TRUE;
@@ -645,7 +664,10 @@ process_open (CockpitRouter *self,
               JsonObject *options,
               GBytes *data)
 {
-  GList *l;
+  CockpitRouterStats *stats = cockpit_stats_router ();
+  CockpitRouterIndex *index;
+  RouterOpen open;
+  gint64 started;
   GBytes *new_payload = NULL;
 
   if (!channel)
@@ -686,16 +708,23 @@ process_open (CockpitRouter *self,
   /* Now go through the rules */
   else
     {
+      started = g_get_monotonic_time ();
+      stats->opens++;
+
       cockpit_router_normalize_host_params (options);
       new_payload = cockpit_json_write_bytes (options);
-      for (l = self->rules; l != NULL; l = g_list_next (l))
-        {
-          if (router_rule_match (l->data, options) &&
-              router_rule_invoke (l->data, self, channel, options, new_payload))
-            {
-              break;
-            }
-        }
+
+      open.router = self;
+      open.channel = channel;
+      open.options = options;
+      open.data = new_payload;
+
+      /* The rules can change while a channel or peer is being set up */
+      index = cockpit_router_index_ref (router_ensure_index (self));
+      cockpit_router_index_lookup (index, options, router_rule_try, &open);
+      cockpit_router_index_unref (index);
+
+      cockpit_histogram_add (&stats->route_usec, g_get_monotonic_time () - started);
     }
   if (new_payload)
     g_bytes_unref (new_payload);
@@ -725,22 +754,26 @@ process_kill (CockpitRouter *self,
   if (host && g_strcmp0 (host, self->init_host) != 0)
     return;
 
+  cockpit_stats_router ()->kills++;
+
   list = NULL;
   if (group)
     {
-      gpointer id, channel_group;
+      GHashTable *members;
+      gpointer id;
 
-      g_hash_table_iter_init (&iter, self->groups);
-      while (g_hash_table_iter_next (&iter, &id, &channel_group))
+      members = g_hash_table_lookup (self->members, group);
+      if (members)
         {
-          CockpitChannel *channel;
-
-          if (!g_str_equal (group, channel_group))
-            continue;
+          g_hash_table_iter_init (&iter, members);
+          while (g_hash_table_iter_next (&iter, &id, NULL))
+            {
+              CockpitChannel *channel;
 
-          channel = g_hash_table_lookup (self->channels, id);
-          if (channel)
-            list = g_list_prepend (list, g_object_ref (channel));
+              channel = g_hash_table_lookup (self->channels, id);
+              if (channel)
+                list = g_list_prepend (list, g_object_ref (channel));
+            }
         }
     }
   else
@@ -765,6 +798,204 @@ process_kill (CockpitRouter *self,
   g_list_free (list);
 }
 
+static void
+router_batch_free (gpointer data)
+{
+  RouterBatch *batch = data;
+  GHashTableIter iter;
+  gpointer channel;
+
+  g_hash_table_iter_init (&iter, batch->pending);
+  while (g_hash_table_iter_next (&iter, &channel, NULL))
+    cockpit_transport_remove_intercept (batch->router->transport, channel);
+
+  g_hash_table_destroy (batch->pending);
+  json_object_unref (batch->ready);
+  json_object_unref (batch->problems);
+  g_free (batch->id);
+  g_free (batch);
+}
+
+static void
+router_batch_maybe_done (RouterBatch *batch)
+{
+  CockpitRouter *self = batch->router;
+  JsonObject *object;
+  GBytes *payload;
+
+  if (batch->opening || g_hash_table_size (batch->pending) > 0)
+    return;
+
+  object = cockpit_transport_build_json ("command", "ready-batch",
+                                         "batch", batch->id,
+                                         NULL);
+  json_object_set_object_member (object, "channels", json_object_ref (batch->ready));
+  if (json_object_get_size (batch->problems) > 0)
+    json_object_set_object_member (object, "problems", json_object_ref (batch->problems));
+
+  payload = cockpit_json_write_bytes (object);
+  cockpit_transport_send (self->transport, NULL, payload);
+  g_bytes_unref (payload);
+  json_object_unref (object);
+
+  /* Frees the batch */
+  g_hash_table_remove (self->batches, batch->id);
+}
+
+static gboolean
+on_batch_control (CockpitTransport *transport,
+                  const gchar *command,
+                  const gchar *channel,
+                  JsonObject *options,
+                  gpointer user_data)
+{
+  RouterBatch *batch = user_data;
+  const gchar *problem;
+  JsonObject *ready;
+  GBytes *payload;
+  GList *members, *l;
+
+  if (g_str_equal (command, "ready"))
+    {
+      /* Keep everything else the channel said about being ready */
+      ready = json_object_new ();
+      members = json_object_get_members (options);
+      for (l = members; l != NULL; l = g_list_next (l))
+        {
+          if (!g_str_equal (l->data, "command") && !g_str_equal (l->data, "channel"))
+            json_object_set_member (ready, l->data, json_object_dup_member (options, l->data));
+        }
+      g_list_free (members);
+
+      json_object_set_object_member (batch->ready, channel, ready);
+      cockpit_transport_remove_intercept (transport, channel);
+    }
+
+  else if (g_str_equal (command, "close"))
+    {
+      if (!cockpit_json_get_string (options, "problem", NULL, &problem) || !problem)
+        problem = "";
+      json_object_set_string_member (batch->problems, channel, problem);
+
+      /* Closing is still reported for each channel, before the batch reply */
+      cockpit_transport_remove_intercept (transport, channel);
+      payload = cockpit_json_write_bytes (options);
+      cockpit_transport_send (transport, NULL, payload);
+      g_bytes_unref (payload);
+    }
+
+  else
+    {
+      return FALSE;
+    }
+
+  g_hash_table_remove (batch->pending, channel);
+  router_batch_maybe_done (batch);
+  return TRUE;
+}
+
+static void
+process_open_batch (CockpitRouter *self,
+                    CockpitTransport *transport,
+                    JsonObject *options)
+{
+  RouterBatch *batch;
+  JsonObject *shared;
+  JsonObject *entry;
+  JsonObject *open;
+  JsonArray *channels;
+  JsonNode *node;
+  GHashTable *seen;
+  const gchar *id;
+  const gchar *channel;
+  GBytes *payload;
+  guint i, length;
+
+  if (!cockpit_json_get_string (options, "batch", NULL, &id) || !id ||
+      g_hash_table_lookup (self->batches, id))
+    {
+      g_warning ("received invalid or duplicate \"batch\" field in open-batch command");
+      cockpit_transport_close (transport, "protocol-error");
+      return;
+    }
+  if (!cockpit_json_get_object (options, "options", NULL, &shared))
+    {
+      g_warning ("received invalid \"options\" field in open-batch command");
+      cockpit_transport_close (transport, "protocol-error");
+      return;
+    }
+
+  node = json_object_get_member (options, "channels");
+  if (!node || !JSON_NODE_HOLDS_ARRAY (node))
+    {
+      g_warning ("received invalid \"channels\" field in open-batch command");
+      cockpit_transport_close (transport, "protocol-error");
+      return;
+    }
+
+  /* Check everything before opening anything */
+  channels = json_node_get_array (node);
+  length = json_array_get_length (channels);
+  seen = g_hash_table_new (g_str_hash, g_str_equal);
+  for (i = 0; i < length; i++)
+    {
+      node = json_array_get_element (channels, i);
+      if (!JSON_NODE_HOLDS_OBJECT (node) ||
+          !cockpit_json_get_string (json_node_get_object (node), "channel", NULL, &channel) ||
+          !channel || strcspn (channel, "\n") != strlen (channel) || channel[0] == '\0')
+        {
+          g_warning ("received invalid channel in open-batch command");
+          cockpit_transport_close (transport, "protocol-error");
+          g_hash_table_destroy (seen);
+          return;
+        }
+
+      /* Same as for a single open, a channel id can't be reused */
+      if (!g_hash_table_add (seen, (gpointer)channel) ||
+          g_hash_table_lookup (self->channels, channel))
+        {
+          g_warning ("%s: received duplicate channel in open-batch command", channel);
+          cockpit_transport_close (transport, "protocol-error");
+          g_hash_table_destroy (seen);
+          return;
+        }
+    }
+  g_hash_table_destroy (seen);
+
+  batch = g_new0 (RouterBatch, 1);
+  batch->router = self;
+  batch->id = g_strdup (id);
+  batch->pending = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  batch->ready = json_object_new ();
+  batch->problems = json_object_new ();
+  g_hash_table_replace (self->batches, batch->id, batch);
+
+  /* Don't reply until every channel has been opened */
+  batch->opening = TRUE;
+
+  for (i = 0; i < length; i++)
+    {
+      entry = json_array_get_object_element (channels, i);
+      cockpit_json_get_string (entry, "channel", NULL, &channel);
+
+      g_hash_table_add (batch->pending, g_strdup (channel));
+      cockpit_transport_intercept_control (transport, channel, on_batch_control, batch);
+
+      open = cockpit_transport_build_batch_open (channel, shared, entry);
+      payload = cockpit_json_write_bytes (open);
+      process_open (self, transport, channel, open, payload);
+      g_bytes_unref (payload);
+      json_object_unref (open);
+
+      /* Something went badly wrong and the batch is gone */
+      if (g_hash_table_lookup (self->batches, id) != batch)
+        return;
+    }
+
+  batch->opening = FALSE;
+  router_batch_maybe_done (batch);
+}
+
 static gboolean
 on_transport_control (CockpitTransport *transport,
                       const char *command,
@@ -807,6 +1038,11 @@ on_transport_control (CockpitTransport *transport,
       process_open (self, transport, channel_id, options, message);
       return TRUE;
     }
+  else if (g_str_equal (command, "open-batch"))
+    {
+      process_open_batch (self, transport, options);
+      return TRUE;
+    }
   else if (g_str_equal (command, "kill"))
     {
       process_kill (self, options);
@@ -839,7 +1075,9 @@ cockpit_router_init (CockpitRouter *self)
   /* Owns the channels */
   self->channels = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, object_unref_if_not_null);
   self->groups = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  self->members = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_hash_table_unref);
   self->fences = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  self->batches = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, router_batch_free);
 
   /* The rules, including a default */
   rule = g_new0 (RouterRule, 1);
@@ -847,6 +1085,7 @@ cockpit_router_init (CockpitRouter *self)
   router_rule_compile (rule, match);
 
   self->rules = g_list_prepend (self->rules, rule);
+  router_rules_changed (self);
   json_object_unref (match);
 }
 
@@ -862,6 +1101,7 @@ cockpit_router_ban_hosts (CockpitRouter *self)
   router_rule_compile (rule, match);
 
   self->rules = g_list_prepend (self->rules, rule);
+  router_rules_changed (self);
   json_object_unref (match);
 }
 
@@ -878,8 +1118,11 @@ cockpit_router_dispose (GObject *object)
 
   g_hash_table_remove_all (self->channels);
   g_hash_table_remove_all (self->groups);
+  g_hash_table_remove_all (self->members);
   g_hash_table_remove_all (self->fences);
+  g_hash_table_remove_all (self->batches);
 
+  router_rules_changed (self);
   g_list_free_full (self->rules, (GDestroyNotify)router_rule_destroy);
   self->rules = NULL;
 }
@@ -898,7 +1141,9 @@ cockpit_router_finalize (GObject *object)
   g_free (self->init_host);
   g_hash_table_destroy (self->channels);
   g_hash_table_destroy (self->groups);
+  g_hash_table_destroy (self->members);
   g_hash_table_destroy (self->fences);
+  g_hash_table_destroy (self->batches);
 
   G_OBJECT_CLASS (cockpit_router_parent_class)->finalize (object);
 }
@@ -1034,6 +1279,7 @@ cockpit_router_add_channel (CockpitRouter *self,
   rule->user_data = function;
   router_rule_compile (rule, match);
   self->rules = g_list_prepend (self->rules, rule);
+  router_rules_changed (self);
 }
 
 /**
@@ -1065,6 +1311,7 @@ cockpit_router_add_peer (CockpitRouter *self,
   router_rule_compile (rule, match);
 
   self->rules = g_list_prepend (self->rules, rule);
+  router_rules_changed (self);
 }
 
 void
@@ -1098,6 +1345,10 @@ cockpit_router_add_bridge (CockpitRouter *self,
                                       "config", config,
                                       NULL);
       rule->destroy = g_object_unref;
+
+      /* Bridges added later, such as when packages change */
+      if (self->init_host)
+        cockpit_peer_warm (rule->user_data);
     }
   else
     {
@@ -1119,6 +1370,7 @@ cockpit_router_add_bridge (CockpitRouter *self,
 
   router_rule_compile (rule, match);
   self->rules = g_list_prepend (self->rules, rule);
+  router_rules_changed (self);
 
  out:
   g_bytes_unref (bytes);
@@ -1148,6 +1400,7 @@ void cockpit_router_set_bridges (CockpitRouter *self,
 
   /* Enumerated in reverse, since the last rule is matched first */
 
+  router_rules_changed (self);
   old_rules = self->rules;
   self->rules = NULL;
   for (l = g_list_last (bridges); l != NULL; l = g_list_previous (l))
@@ -0,0 +1,439 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpitroutermatch.h"
+
+#include "common/cockpitjson.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * CockpitRouterMatch:
+ *
+ * The compiled form of a "match" object from a bridge configuration,
+ * or of a match passed to cockpit_router_add_channel(). Every member
+ * of the match must agree with the same member of an "open" message:
+ *
+ *  - A string is a glob style pattern. Strings without any wildcards
+ *    are compared directly, without a GPatternSpec.
+ *  - A null only requires the member to be present.
+ *  - Anything else must be equal to the member.
+ *
+ * CockpitRouterIndex:
+ *
+ * Finds the matches for an "open" message without testing each of
+ * them in turn. The matches are kept in the order they were added,
+ * which is their precedence. Those that require a literal "payload"
+ * are bucketed by it, the rest are tested for every message. A lookup
+ * merges the bucket for the payload of the message with the rest in
+ * precedence order, so the outcome is the same as testing all of the
+ * matches one after another.
+ */
+
+typedef enum {
+  FIELD_PRESENT,
+  FIELD_STRING,
+  FIELD_NODE,
+  FIELD_GLOB,
+} FieldKind;
+
+typedef struct {
+  FieldKind kind;
+  gchar *name;
+  gchar *string;
+  GPatternSpec *glob;
+  JsonNode *node;
+} MatchField;
+
+struct _CockpitRouterMatch {
+  MatchField *fields;
+  guint n_fields;
+
+  /* When the payload must be exactly this */
+  const gchar *payload;
+};
+
+typedef struct {
+  CockpitRouterMatch *match;
+  gpointer data;
+} IndexEntry;
+
+struct _CockpitRouterIndex {
+  gint refs;
+  GArray *entries;
+
+  /* Positions of entries, by their literal payload */
+  GHashTable *payloads;
+
+  /* Positions of all other entries */
+  GArray *others;
+};
+
+static gboolean
+string_is_literal (const gchar *string)
+{
+  return strpbrk (string, "*?") == NULL;
+}
+
+static void
+compile_field (MatchField *field,
+               const gchar *name,
+               JsonNode *node)
+{
+  const gchar *string;
+
+  field->name = g_strdup (name);
+
+  /* A null matches anything */
+  if (JSON_NODE_HOLDS_NULL (node))
+    {
+      field->kind = FIELD_PRESENT;
+    }
+
+  /* A glob style string pattern, or just a plain string */
+  else if (JSON_NODE_HOLDS_VALUE (node) && json_node_get_value_type (node) == G_TYPE_STRING)
+    {
+      string = json_node_get_string (node);
+      if (string_is_literal (string))
+        {
+          field->kind = FIELD_STRING;
+          field->string = g_strdup (string);
+        }
+      else
+        {
+          field->kind = FIELD_GLOB;
+          field->glob = g_pattern_spec_new (string);
+        }
+    }
+
+  else
+    {
+      field->kind = FIELD_NODE;
+      field->node = json_node_copy (node);
+    }
+}
+
+static gint
+compare_fields (gconstpointer a,
+                gconstpointer b)
+{
+  /* Cheapest checks first */
+  return (gint)((const MatchField *)a)->kind - (gint)((const MatchField *)b)->kind;
+}
+
+/**
+ * cockpit_router_match_new:
+ * @object: (allow-none): the match object
+ *
+ * Compile a match. A NULL @object never matches anything, whereas an
+ * empty object matches everything.
+ *
+ * Returns: (transfer full): the match, free with cockpit_router_match_free()
+ */
+CockpitRouterMatch *
+cockpit_router_match_new (JsonObject *object)
+{
+  CockpitRouterMatch *match;
+  MatchField *field;
+  GList *names, *l;
+  guint i;
+
+  match = g_new0 (CockpitRouterMatch, 1);
+  if (object == NULL)
+    return match;
+
+  names = json_object_get_members (object);
+  match->n_fields = g_list_length (names);
+
+  /* Always allocated, so that an empty object is different from no object */
+  match->fields = g_new0 (MatchField, match->n_fields + 1);
+  for (l = names, i = 0; l != NULL; l = g_list_next (l), i++)
+    compile_field (&match->fields[i], l->data, json_object_get_member (object, l->data));
+  g_list_free (names);
+
+  qsort (match->fields, match->n_fields, sizeof (MatchField), compare_fields);
+
+  for (i = 0; i < match->n_fields; i++)
+    {
+      field = &match->fields[i];
+      if (field->kind == FIELD_STRING && g_str_equal (field->name, "payload"))
+        match->payload = field->string;
+    }
+
+  return match;
+}
+
+/**
+ * cockpit_router_match_test:
+ * @match: the match
+ * @options: the options of an "open" message
+ *
+ * Returns: whether the @options satisfy every field of the @match
+ */
+gboolean
+cockpit_router_match_test (CockpitRouterMatch *match,
+                           JsonObject *options)
+{
+  MatchField *field;
+  const gchar *value;
+  JsonNode *node;
+  guint i;
+
+  g_return_val_if_fail (match != NULL, FALSE);
+  g_return_val_if_fail (options != NULL, FALSE);
+
+  if (match->fields == NULL)
+    return FALSE;
+
+  for (i = 0; i < match->n_fields; i++)
+    {
+      field = &match->fields[i];
+      switch (field->kind)
+        {
+        case FIELD_PRESENT:
+          if (!json_object_has_member (options, field->name))
+            return FALSE;
+          break;
+        case FIELD_STRING:
+          if (!cockpit_json_get_string (options, field->name, NULL, &value) || !value ||
+              !g_str_equal (field->string, value))
+            return FALSE;
+          break;
+        case FIELD_NODE:
+          node = json_object_get_member (options, field->name);
+          if (!node || !cockpit_json_equal (field->node, node))
+            return FALSE;
+          break;
+        case FIELD_GLOB:
+          if (!cockpit_json_get_string (options, field->name, NULL, &value) || !value ||
+              !g_pattern_match (field->glob, strlen (value), value, NULL))
+            return FALSE;
+          break;
+        }
+    }
+
+  return TRUE;
+}
+
+void
+cockpit_router_match_dump (CockpitRouterMatch *match)
+{
+  MatchField *field;
+  gchar *text;
+  guint i;
+
+  g_return_if_fail (match != NULL);
+
+  for (i = 0; i < match->n_fields; i++)
+    {
+      field = &match->fields[i];
+      switch (field->kind)
+        {
+        case FIELD_PRESENT:
+          g_print ("  %s\n", field->name);
+          break;
+        case FIELD_STRING:
+          g_print ("  %s: \"%s\"\n", field->name, field->string);
+          break;
+        case FIELD_NODE:
+          text = cockpit_json_write (field->node, NULL);
+          g_print ("  %s: %s\n", field->name, text);
+          g_free (text);
+          break;
+        case FIELD_GLOB:
+          g_print ("  %s: glob\n", field->name);
+          break;
+        }
+    }
+}
+
+void
+cockpit_router_match_free (CockpitRouterMatch *match)
+{
+  MatchField *field;
+  guint i;
+
+  if (match == NULL)
+    return;
+
+  for (i = 0; i < match->n_fields; i++)
+    {
+      field = &match->fields[i];
+      g_free (field->name);
+      g_free (field->string);
+      if (field->glob)
+        g_pattern_spec_free (field->glob);
+      if (field->node)
+        json_node_free (field->node);
+    }
+  g_free (match->fields);
+  g_free (match);
+}
+
+static void
+positions_free (gpointer data)
+{
+  g_array_free (data, TRUE);
+}
+
+/**
+ * cockpit_router_index_new:
+ *
+ * Create an empty index. Add matches to it in order of precedence
+ * with cockpit_router_index_add().
+ *
+ * Returns: (transfer full): the index
+ */
+CockpitRouterIndex *
+cockpit_router_index_new (void)
+{
+  CockpitRouterIndex *index;
+
+  index = g_new0 (CockpitRouterIndex, 1);
+  index->refs = 1;
+  index->entries = g_array_new (FALSE, FALSE, sizeof (IndexEntry));
+  index->payloads = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, positions_free);
+  index->others = g_array_new (FALSE, FALSE, sizeof (guint));
+  return index;
+}
+
+/**
+ * cockpit_router_index_add:
+ * @index: the index
+ * @match: a match, which must remain valid as long as the index
+ * @data: passed to the lookup function
+ *
+ * Add a match with lower precedence than all those already added.
+ */
+void
+cockpit_router_index_add (CockpitRouterIndex *index,
+                          CockpitRouterMatch *match,
+                          gpointer data)
+{
+  IndexEntry entry = { match, data };
+  GArray *positions;
+  guint position;
+
+  g_return_if_fail (index != NULL);
+  g_return_if_fail (match != NULL);
+
+  /* Can never match anything */
+  if (match->fields == NULL)
+    return;
+
+  position = index->entries->len;
+  g_array_append_val (index->entries, entry);
+
+  if (match->payload)
+    {
+      positions = g_hash_table_lookup (index->payloads, match->payload);
+      if (!positions)
+        {
+          positions = g_array_new (FALSE, FALSE, sizeof (guint));
+          g_hash_table_replace (index->payloads, (gchar *)match->payload, positions);
+        }
+      g_array_append_val (positions, position);
+    }
+  else
+    {
+      g_array_append_val (index->others, position);
+    }
+}
+
+/**
+ * cockpit_router_index_lookup:
+ * @index: the index
+ * @options: the options of an "open" message
+ * @func: called for each match
+ * @user_data: passed to @func
+ *
+ * Call @func with the data of each match that the @options satisfy,
+ * in order of precedence, until it returns TRUE.
+ *
+ * Returns: whether @func returned TRUE
+ */
+gboolean
+cockpit_router_index_lookup (CockpitRouterIndex *index,
+                             JsonObject *options,
+                             CockpitRouterIndexFunc func,
+                             gpointer user_data)
+{
+  GArray *bucket = NULL;
+  const gchar *payload;
+  IndexEntry *entry;
+  guint position;
+  guint i = 0;
+  guint j = 0;
+
+  g_return_val_if_fail (index != NULL, FALSE);
+  g_return_val_if_fail (options != NULL, FALSE);
+  g_return_val_if_fail (func != NULL, FALSE);
+
+  if (cockpit_json_get_string (options, "payload", NULL, &payload) && payload)
+    bucket = g_hash_table_lookup (index->payloads, payload);
+
+  while ((bucket && i < bucket->len) || j < index->others->len)
+    {
+      if (!bucket || i >= bucket->len)
+        position = g_array_index (index->others, guint, j++);
+      else if (j >= index->others->len)
+        position = g_array_index (bucket, guint, i++);
+      else if (g_array_index (bucket, guint, i) < g_array_index (index->others, guint, j))
+        position = g_array_index (bucket, guint, i++);
+      else
+        position = g_array_index (index->others, guint, j++);
+
+      entry = &g_array_index (index->entries, IndexEntry, position);
+      if (cockpit_router_match_test (entry->match, options) &&
+          (func) (entry->data, user_data))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+guint
+cockpit_router_index_size (CockpitRouterIndex *index)
+{
+  g_return_val_if_fail (index != NULL, 0);
+  return index->entries->len;
+}
+
+CockpitRouterIndex *
+cockpit_router_index_ref (CockpitRouterIndex *index)
+{
+  g_return_val_if_fail (index != NULL, NULL);
+  index->refs++;
+  return index;
+}
+
+void
+cockpit_router_index_unref (CockpitRouterIndex *index)
+{
+  if (index == NULL || --index->refs > 0)
+    return;
+
+  g_hash_table_destroy (index->payloads);
+  g_array_free (index->others, TRUE);
+  g_array_free (index->entries, TRUE);
+  g_free (index);
+}
@@ -0,0 +1,62 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COCKPIT_ROUTER_MATCH_H_
+#define COCKPIT_ROUTER_MATCH_H_
+
+#include <json-glib/json-glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _CockpitRouterMatch CockpitRouterMatch;
+
+typedef struct _CockpitRouterIndex CockpitRouterIndex;
+
+typedef gboolean (* CockpitRouterIndexFunc)          (gpointer data,
+                                                      gpointer user_data);
+
+CockpitRouterMatch *  cockpit_router_match_new       (JsonObject *object);
+
+gboolean              cockpit_router_match_test      (CockpitRouterMatch *match,
+                                                      JsonObject *options);
+
+void                  cockpit_router_match_dump      (CockpitRouterMatch *match);
+
+void                  cockpit_router_match_free      (CockpitRouterMatch *match);
+
+CockpitRouterIndex *  cockpit_router_index_new       (void);
+
+void                  cockpit_router_index_add       (CockpitRouterIndex *index,
+                                                      CockpitRouterMatch *match,
+                                                      gpointer data);
+
+gboolean              cockpit_router_index_lookup    (CockpitRouterIndex *index,
+                                                      JsonObject *options,
+                                                      CockpitRouterIndexFunc func,
+                                                      gpointer user_data);
+
+guint                 cockpit_router_index_size      (CockpitRouterIndex *index);
+
+CockpitRouterIndex *  cockpit_router_index_ref       (CockpitRouterIndex *index);
+
+void                  cockpit_router_index_unref     (CockpitRouterIndex *index);
+
+G_END_DECLS
+
+#endif /* COCKPIT_ROUTER_MATCH_H_ */
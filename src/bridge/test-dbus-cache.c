@@ -0,0 +1,290 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpitdbuscache.h"
+#include "cockpitdbusinternal.h"
+
+#include "common/cockpittest.h"
+
+#include <gio/gio.h>
+
+#include <string.h>
+
+/* Mock override from cockpitdbuscache.c */
+extern guint cockpit_dbus_cache_drop_timeout;
+
+static const gchar *test_xml =
+  "<node>"
+  "  <interface name='org.Cockpit.Test.One'>"
+  "    <property name='Name' type='s' access='read'/>"
+  "  </interface>"
+  "  <interface name='org.Cockpit.Test.Two'>"
+  "    <property name='Name' type='s' access='read'/>"
+  "  </interface>"
+  "</node>";
+
+typedef struct {
+  GDBusConnection *server;
+  GDBusNodeInfo *node;
+  GArray *registered;
+  CockpitDBusCache *cache;
+
+  /* "path interface property" for each value in updates */
+  GHashTable *values;
+} TestCase;
+
+static GVariant *
+on_get_property (GDBusConnection *connection,
+                 const gchar *sender,
+                 const gchar *path,
+                 const gchar *interface,
+                 const gchar *property,
+                 GError **error,
+                 gpointer user_data)
+{
+  return g_variant_new_string (path);
+}
+
+static const GDBusInterfaceVTable test_vtable = {
+  NULL, on_get_property, NULL,
+};
+
+static void
+on_cache_update (CockpitDBusCache *cache,
+                 GHashTable *update,
+                 gpointer user_data)
+{
+  TestCase *tc = user_data;
+  GHashTableIter iter;
+  GHashTableIter hter;
+  GHashTableIter pter;
+  GHashTable *interfaces;
+  GHashTable *properties;
+  gpointer path;
+  gpointer interface;
+  gpointer property;
+
+  g_hash_table_iter_init (&iter, update);
+  while (g_hash_table_iter_next (&iter, &path, (gpointer *)&interfaces))
+    {
+      g_hash_table_iter_init (&hter, interfaces);
+      while (g_hash_table_iter_next (&hter, &interface, (gpointer *)&properties))
+        {
+          if (!properties)
+            continue;
+          g_hash_table_iter_init (&pter, properties);
+          while (g_hash_table_iter_next (&pter, &property, NULL))
+            {
+              g_hash_table_add (tc->values, g_strdup_printf ("%s %s %s", (gchar *)path,
+                                                             (gchar *)interface, (gchar *)property));
+            }
+        }
+    }
+}
+
+static void
+setup (TestCase *tc,
+       gconstpointer data)
+{
+  const gchar *paths[] = { "/one", "/two", NULL };
+  GDBusConnection *connection;
+  GError *error = NULL;
+  guint id;
+  guint i;
+  guint j;
+
+  cockpit_dbus_cache_drop_timeout = 1;
+
+  cockpit_dbus_internal_startup (FALSE);
+  tc->server = cockpit_dbus_internal_server ();
+
+  tc->node = g_dbus_node_info_new_for_xml (test_xml, &error);
+  g_assert_no_error (error);
+
+  tc->registered = g_array_new (FALSE, FALSE, sizeof (guint));
+  for (i = 0; paths[i] != NULL; i++)
+    {
+      for (j = 0; tc->node->interfaces[j] != NULL; j++)
+        {
+          id = g_dbus_connection_register_object (tc->server, paths[i], tc->node->interfaces[j],
+                                                  &test_vtable, NULL, NULL, &error);
+          g_assert_no_error (error);
+          g_array_append_val (tc->registered, id);
+        }
+    }
+
+  connection = cockpit_dbus_internal_client ();
+  tc->cache = cockpit_dbus_cache_new (connection, NULL, "test", NULL);
+  g_object_unref (connection);
+
+  tc->values = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  g_signal_connect (tc->cache, "update", G_CALLBACK (on_cache_update), tc);
+}
+
+static void
+teardown (TestCase *tc,
+          gconstpointer data)
+{
+  guint i;
+
+  g_object_add_weak_pointer (G_OBJECT (tc->cache), (gpointer *)&tc->cache);
+  g_object_unref (tc->cache);
+  g_assert (tc->cache == NULL);
+
+  for (i = 0; i < tc->registered->len; i++)
+    g_dbus_connection_unregister_object (tc->server, g_array_index (tc->registered, guint, i));
+  g_array_free (tc->registered, TRUE);
+
+  g_dbus_node_info_unref (tc->node);
+  g_object_unref (tc->server);
+  g_hash_table_unref (tc->values);
+
+  cockpit_dbus_internal_cleanup ();
+  cockpit_dbus_cache_drop_timeout = 30;
+}
+
+static void
+on_barrier_flag (CockpitDBusCache *cache,
+                 gpointer user_data)
+{
+  gboolean *flag = user_data;
+  *flag = TRUE;
+}
+
+static void
+wait_barrier (TestCase *tc)
+{
+  gboolean flag = FALSE;
+
+  cockpit_dbus_cache_barrier (tc->cache, on_barrier_flag, &flag);
+  while (!flag)
+    g_main_context_iteration (NULL, TRUE);
+}
+
+static gboolean
+on_timeout_flag (gpointer user_data)
+{
+  gboolean *flag = user_data;
+  *flag = TRUE;
+  return G_SOURCE_REMOVE;
+}
+
+static void
+wait_drop (TestCase *tc)
+{
+  gboolean flag = FALSE;
+
+  /* Second timeouts fire late by up to a second */
+  g_timeout_add (cockpit_dbus_cache_drop_timeout * 1000 + 1500, on_timeout_flag, &flag);
+  while (!flag)
+    g_main_context_iteration (NULL, TRUE);
+}
+
+/* Watches, and returns whether values were retrieved rather than cached */
+static gboolean
+watch_retrieves (TestCase *tc,
+                 const gchar *path,
+                 const gchar *interface)
+{
+  gchar *key;
+  gboolean ret;
+
+  g_hash_table_remove_all (tc->values);
+  cockpit_dbus_cache_watch (tc->cache, path, FALSE, interface);
+  wait_barrier (tc);
+
+  key = g_strdup_printf ("%s %s Name", path, interface);
+  ret = g_hash_table_contains (tc->values, key);
+  g_free (key);
+
+  return ret;
+}
+
+static void
+test_drop_unwatched (TestCase *tc,
+                     gconstpointer data)
+{
+  g_assert (watch_retrieves (tc, "/one", "org.Cockpit.Test.One"));
+  g_assert (watch_retrieves (tc, "/two", "org.Cockpit.Test.One"));
+
+  /* Still cached when watched again before the quiet period is over */
+  g_assert (cockpit_dbus_cache_unwatch (tc->cache, "/one", FALSE, "org.Cockpit.Test.One"));
+  g_assert (!watch_retrieves (tc, "/one", "org.Cockpit.Test.One"));
+
+  /* Afterwards only what's still watched stays */
+  g_assert (cockpit_dbus_cache_unwatch (tc->cache, "/one", FALSE, "org.Cockpit.Test.One"));
+  wait_drop (tc);
+
+  g_assert (!watch_retrieves (tc, "/two", "org.Cockpit.Test.One"));
+  g_assert (watch_retrieves (tc, "/one", "org.Cockpit.Test.One"));
+}
+
+static void
+test_drop_interface (TestCase *tc,
+                     gconstpointer data)
+{
+  g_assert (watch_retrieves (tc, "/one", "org.Cockpit.Test.One"));
+  g_assert (watch_retrieves (tc, "/one", "org.Cockpit.Test.Two"));
+
+  /* The path is still watched, but not one of its interfaces */
+  g_assert (cockpit_dbus_cache_unwatch (tc->cache, "/one", FALSE, "org.Cockpit.Test.Two"));
+  wait_drop (tc);
+
+  g_assert (watch_retrieves (tc, "/one", "org.Cockpit.Test.Two"));
+  g_assert (!g_hash_table_contains (tc->values, "/one org.Cockpit.Test.One Name"));
+}
+
+static void
+test_drop_poked (TestCase *tc,
+                 gconstpointer data)
+{
+  /* Like a watch with an "id", which pokes the path right after */
+  cockpit_dbus_cache_watch (tc->cache, "/one", FALSE, "org.Cockpit.Test.One");
+  cockpit_dbus_cache_poke (tc->cache, "/one", NULL);
+  wait_barrier (tc);
+  g_assert (g_hash_table_contains (tc->values, "/one org.Cockpit.Test.One Name"));
+
+  /* The poked path survives the first scan */
+  g_assert (cockpit_dbus_cache_unwatch (tc->cache, "/one", FALSE, "org.Cockpit.Test.One"));
+  wait_drop (tc);
+  g_assert (!watch_retrieves (tc, "/one", "org.Cockpit.Test.One"));
+
+  /* But that used up the poke, so the next scan drops it */
+  g_assert (cockpit_dbus_cache_unwatch (tc->cache, "/one", FALSE, "org.Cockpit.Test.One"));
+  wait_drop (tc);
+  g_assert (watch_retrieves (tc, "/one", "org.Cockpit.Test.One"));
+}
+
+int
+main (int argc,
+      char *argv[])
+{
+  cockpit_test_init (&argc, &argv);
+
+  g_test_add ("/dbus-cache/drop-unwatched", TestCase, NULL,
+              setup, test_drop_unwatched, teardown);
+  g_test_add ("/dbus-cache/drop-interface", TestCase, NULL,
+              setup, test_drop_interface, teardown);
+  g_test_add ("/dbus-cache/drop-poked", TestCase, NULL,
+              setup, test_drop_poked, teardown);
+
+  return g_test_run ();
+}
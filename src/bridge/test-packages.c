@@ -27,6 +27,7 @@
 #include "common/cockpitchannel.h"
 #include "common/cockpitjson.h"
 #include "common/cockpitsystem.h"
+#include "common/cockpitwebresponse.h"
 #include "common/cockpittest.h"
 #include "common/mock-transport.h"
 
@@ -45,6 +46,7 @@
 #define CHECKSUM_RELOAD_NEW     "eae62ca12c4a92b4ae7f6b0d2f41cb20be0005a6fc62466fccda1ebe0532cc23"
 #define CHECKSUM_RELOAD_UPDATED "0d1c0b7c6133cc7c3956197fd8a76bef68b158bd78beac75cfa80b75c36aa827"
 #define CHECKSUM_CSP            "80921dc3cde9ff9f2acd2a5851f9b2a3b25ea7b4577128461d9e32fbdd671e16"
+#define CHECKSUM_BROTLI         "ba9de1a4a97921b91e9743a9a9307bb7c144e0239c64ea50df285a67119df9d8"
 
 /* JSON dict snippet for headers that are present in every request */
 #define STATIC_HEADERS "\"X-DNS-Prefetch-Control\":\"off\",\"Referrer-Policy\":\"no-referrer\",\"X-Content-Type-Options\":\"nosniff\",\"Cross-Origin-Resource-Policy\": \"same-origin\",\"X-Frame-Options\": \"sameorigin\""
@@ -52,6 +54,7 @@
 
 extern const gchar **cockpit_bridge_data_dirs;
 extern const gchar *cockpit_bridge_local_address;
+extern gsize cockpit_packages_gunzip_cache_size;
 
 typedef struct {
   CockpitPackages *packages;
@@ -67,6 +70,8 @@ typedef struct {
   const gchar *accept[8];
   const gchar *expect;
   const gchar *headers[8];
+  const gchar *encoding;
+  const gchar *served;
   gboolean cacheable;
   gboolean binary;
   gboolean no_packages_init;
@@ -801,7 +806,7 @@ test_with_gzip (TestCase *tc,
   message = mock_transport_pop_channel (tc->transport, "444");
   object = cockpit_json_parse_bytes (message, &error);
   g_assert_no_error (error);
-  cockpit_assert_json_eq (object, "{\"status\":200,\"reason\":\"OK\",\"headers\":{" STATIC_HEADERS ",\"X-Cockpit-Pkg-Checksum\":\"" CHECKSUM_GZIP "\",\"Content-Encoding\":\"gzip\",\"Content-Type\":\"text/plain\"}}");
+  cockpit_assert_json_eq (object, "{\"status\":200,\"reason\":\"OK\",\"headers\":{" STATIC_HEADERS ",\"X-Cockpit-Pkg-Checksum\":\"" CHECKSUM_GZIP "\",\"Content-Encoding\":\"gzip\",\"Vary\":\"Accept-Encoding\",\"Content-Type\":\"text/plain\"}}");
   json_object_unref (object);
 
   data = mock_transport_combine_output (tc->transport, "444", NULL);
@@ -832,7 +837,7 @@ test_no_gzip (TestCase *tc,
   message = mock_transport_pop_channel (tc->transport, "444");
   object = cockpit_json_parse_bytes (message, &error);
   g_assert_no_error (error);
-  cockpit_assert_json_eq (object, "{\"status\":200,\"reason\":\"OK\",\"headers\":{" STATIC_HEADERS ",\"X-Cockpit-Pkg-Checksum\":\"" CHECKSUM_GZIP "\",\"Content-Type\":\"text/plain\"}}");
+  cockpit_assert_json_eq (object, "{\"status\":200,\"reason\":\"OK\",\"headers\":{" STATIC_HEADERS ",\"X-Cockpit-Pkg-Checksum\":\"" CHECKSUM_GZIP "\",\"Vary\":\"Accept-Encoding\",\"Content-Type\":\"text/plain\"}}");
   json_object_unref (object);
 
   data = mock_transport_combine_output (tc->transport, "444", NULL);
@@ -840,6 +845,237 @@ test_no_gzip (TestCase *tc,
   g_bytes_unref (data);
 }
 
+static void
+on_closed_set_flag (CockpitChannel *channel,
+                    const gchar *problem,
+                    gpointer user_data)
+{
+  gboolean *flag = user_data;
+  g_assert_cmpstr (problem, ==, NULL);
+  *flag = TRUE;
+}
+
+static GBytes *
+fetch_content (const gchar *path,
+               const gchar *accept_encoding)
+{
+  MockTransport *transport;
+  CockpitChannel *channel;
+  JsonObject *options;
+  JsonObject *headers;
+  const gchar *control;
+  gboolean closed = FALSE;
+  GBytes *message;
+  GBytes *bytes;
+
+  transport = mock_transport_new ();
+  g_signal_connect (transport, "closed", G_CALLBACK (on_transport_closed), NULL);
+
+  options = json_object_new ();
+  json_object_set_string_member (options, "internal", "packages");
+  json_object_set_string_member (options, "payload", "http-stream1");
+  json_object_set_string_member (options, "method", "GET");
+  json_object_set_string_member (options, "path", path);
+  json_object_set_string_member (options, "binary", "raw");
+
+  headers = json_object_new ();
+  json_object_set_string_member (headers, "Accept-Encoding", accept_encoding);
+  json_object_set_object_member (options, "headers", headers);
+
+  channel = g_object_new (COCKPIT_TYPE_HTTP_STREAM,
+                          "transport", transport,
+                          "id", "444",
+                          "options", options,
+                          NULL);
+  json_object_unref (options);
+
+  control = "{\"command\": \"done\", \"channel\": \"444\"}";
+  bytes = g_bytes_new_static (control, strlen (control));
+  cockpit_transport_emit_recv (COCKPIT_TRANSPORT (transport), NULL, bytes);
+  g_bytes_unref (bytes);
+
+  g_signal_connect (channel, "closed", G_CALLBACK (on_closed_set_flag), &closed);
+  while (!closed)
+    g_main_context_iteration (NULL, TRUE);
+
+  /* The response headers, then the body */
+  message = mock_transport_pop_channel (transport, "444");
+  g_assert (message != NULL);
+  bytes = mock_transport_combine_output (transport, "444", NULL);
+
+  g_object_unref (channel);
+  g_object_unref (transport);
+  return bytes;
+}
+
+static const Fixture fixture_gunzip_cache = {
+  .no_packages_init = TRUE,
+  .datadirs = { SRCDIR "/src/bridge/mock-resource/gzip", NULL },
+};
+
+static void
+test_gunzip_cache (TestCase *tc,
+                   gconstpointer fixture)
+{
+  GBytes *first;
+  GBytes *second;
+
+  tc->packages = cockpit_packages_new ();
+
+  first = fetch_content ("/package/file.txt", "identity");
+  g_assert_cmpint (g_bytes_get_size (first), ==, 26530);
+
+  /* Served from the cache the second time around */
+  second = fetch_content ("/package/file.txt", "identity");
+  g_assert (g_bytes_equal (first, second));
+
+  g_bytes_unref (first);
+  g_bytes_unref (second);
+}
+
+static void
+test_gunzip_cache_disabled (TestCase *tc,
+                            gconstpointer fixture)
+{
+  gsize previous = cockpit_packages_gunzip_cache_size;
+  GBytes *first;
+  GBytes *second;
+
+  cockpit_packages_gunzip_cache_size = 0;
+  tc->packages = cockpit_packages_new ();
+  cockpit_packages_gunzip_cache_size = previous;
+
+  first = fetch_content ("/package/file.txt", "identity");
+  second = fetch_content ("/package/file.txt", "identity");
+  g_assert_cmpint (g_bytes_get_size (first), ==, 26530);
+  g_assert (g_bytes_equal (first, second));
+
+  g_bytes_unref (first);
+  g_bytes_unref (second);
+}
+
+#define GUNZIP_REQUESTS 500
+
+static void
+perf_gunzip (TestCase *tc,
+             gsize cache_size)
+{
+  gsize previous = cockpit_packages_gunzip_cache_size;
+  gdouble elapsed;
+  GBytes *bytes;
+  guint i;
+
+  cockpit_packages_gunzip_cache_size = cache_size;
+  tc->packages = cockpit_packages_new ();
+  cockpit_packages_gunzip_cache_size = previous;
+
+  g_test_timer_start ();
+
+  for (i = 0; i < GUNZIP_REQUESTS; i++)
+    {
+      bytes = fetch_content ("/package/file.txt", "identity");
+      g_assert_cmpint (g_bytes_get_size (bytes), ==, 26530);
+      g_bytes_unref (bytes);
+    }
+
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "%s: %u requests, %.1f requests/s",
+                           cache_size ? "cached" : "uncached",
+                           GUNZIP_REQUESTS, GUNZIP_REQUESTS / elapsed);
+}
+
+static void
+test_perf_gunzip_cached (TestCase *tc,
+                         gconstpointer fixture)
+{
+  perf_gunzip (tc, cockpit_packages_gunzip_cache_size);
+}
+
+static void
+test_perf_gunzip_uncached (TestCase *tc,
+                           gconstpointer fixture)
+{
+  perf_gunzip (tc, 0);
+}
+
+#define BROTLI_DATADIR SRCDIR "/src/bridge/mock-resource/brotli"
+
+static const Fixture fixtures_encoding[] = {
+  { .datadirs = { BROTLI_DATADIR }, .path = "/package/file.txt", .binary = TRUE,
+    .headers = { "Accept-Encoding", "br" }, .encoding = "br", .served = "file.txt.br" },
+  { .datadirs = { BROTLI_DATADIR }, .path = "/package/file.txt", .binary = TRUE,
+    .headers = { "Accept-Encoding", "gzip" }, .encoding = "gzip", .served = "file.txt.gz" },
+  { .datadirs = { BROTLI_DATADIR }, .path = "/package/file.txt", .binary = TRUE,
+    .headers = { "Accept-Encoding", "gzip, deflate, br" }, .encoding = "br", .served = "file.txt.br" },
+  { .datadirs = { BROTLI_DATADIR }, .path = "/package/file.txt", .binary = TRUE,
+    .headers = { "Accept-Encoding", "br;q=0, gzip" }, .encoding = "gzip", .served = "file.txt.gz" },
+  { .datadirs = { BROTLI_DATADIR }, .path = "/package/file.txt", .binary = TRUE,
+    .headers = { "Accept-Encoding", "*" }, .encoding = "br", .served = "file.txt.br" },
+  { .datadirs = { BROTLI_DATADIR }, .path = "/package/file.txt", .binary = TRUE,
+    .headers = { "Accept-Encoding", "identity" }, .encoding = NULL, .served = "file.txt" },
+  { .datadirs = { BROTLI_DATADIR }, .path = "/package/file.txt", .binary = TRUE,
+    .headers = { NULL }, .encoding = "gzip", .served = "file.txt.gz" },
+  { .datadirs = { BROTLI_DATADIR }, .path = "/package/archive.txt", .binary = TRUE,
+    .headers = { "Accept-Encoding", "br" }, .encoding = "br", .served = "archive.txt.br" },
+  { .datadirs = { BROTLI_DATADIR }, .path = "/package/archive.txt", .binary = TRUE,
+    .headers = { "Accept-Encoding", "gzip" }, .encoding = "gzip", .served = "archive.txt.gz" },
+  { .datadirs = { BROTLI_DATADIR }, .path = "/package/archive.txt", .binary = TRUE,
+    .headers = { "Accept-Encoding", "identity" }, .encoding = NULL, .served = "archive.txt.gz" },
+};
+
+static void
+test_encoding (TestCase *tc,
+               gconstpointer data)
+{
+  const Fixture *fixture = data;
+  GError *error = NULL;
+  JsonObject *headers;
+  JsonObject *object;
+  GBytes *message;
+  GBytes *expected;
+  GBytes *compressed;
+  gchar *contents;
+  gchar *filename;
+  gsize length;
+
+  while (tc->closed == FALSE)
+    g_main_context_iteration (NULL, TRUE);
+  g_assert_cmpstr (tc->problem, ==, NULL);
+
+  message = mock_transport_pop_channel (tc->transport, "444");
+  object = cockpit_json_parse_bytes (message, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (json_object_get_int_member (object, "status"), ==, 200);
+
+  headers = json_object_get_object_member (object, "headers");
+  g_assert_cmpstr (json_object_get_string_member (headers, COCKPIT_CHECKSUM_HEADER), ==, CHECKSUM_BROTLI);
+  g_assert_cmpstr (json_object_get_string_member (headers, "Vary"), ==, "Accept-Encoding");
+  if (fixture->encoding)
+    g_assert_cmpstr (json_object_get_string_member (headers, "Content-Encoding"), ==, fixture->encoding);
+  else
+    g_assert (!json_object_has_member (headers, "Content-Encoding"));
+  json_object_unref (object);
+
+  filename = g_build_filename (BROTLI_DATADIR, "cockpit", "package", fixture->served, NULL);
+  g_assert (g_file_get_contents (filename, &contents, &length, NULL));
+  expected = g_bytes_new_take (contents, length);
+
+  /* A client that only takes identity gets the .gz file decompressed */
+  if (!fixture->encoding && g_str_has_suffix (fixture->served, ".gz"))
+    {
+      compressed = expected;
+      expected = cockpit_web_response_gunzip (compressed, &error);
+      g_assert_no_error (error);
+      g_bytes_unref (compressed);
+    }
+
+  message = mock_transport_combine_output (tc->transport, "444", NULL);
+  g_assert (g_bytes_equal (message, expected));
+  g_bytes_unref (message);
+  g_bytes_unref (expected);
+  g_free (filename);
+}
+
 static void
 setup_basic (TestCase *tc,
              gconstpointer data)
@@ -1202,6 +1438,9 @@ int
 main (int argc,
       char *argv[])
 {
+  gchar *name;
+  guint i;
+
   cockpit_setenv_check ("XDG_DATA_DIRS", SRCDIR "/src/bridge/mock-resource/system", TRUE);
   cockpit_setenv_check ("XDG_DATA_HOME", SRCDIR "/src/bridge/mock-resource/home", TRUE);
 
@@ -1258,6 +1497,27 @@ main (int argc,
   g_test_add ("/packages/no-gzip", TestCase, &fixture_no_gzip,
               setup, test_no_gzip, teardown);
 
+  g_test_add ("/packages/gunzip-cache", TestCase, &fixture_gunzip_cache,
+              setup_basic, test_gunzip_cache, teardown_basic);
+  g_test_add ("/packages/gunzip-cache-disabled", TestCase, &fixture_gunzip_cache,
+              setup_basic, test_gunzip_cache_disabled, teardown_basic);
+
+  if (g_test_perf ())
+    {
+      g_test_add ("/packages/perf/gunzip-cached", TestCase, &fixture_gunzip_cache,
+                  setup_basic, test_perf_gunzip_cached, teardown_basic);
+      g_test_add ("/packages/perf/gunzip-uncached", TestCase, &fixture_gunzip_cache,
+                  setup_basic, test_perf_gunzip_uncached, teardown_basic);
+    }
+
+  for (i = 0; i < G_N_ELEMENTS (fixtures_encoding); i++)
+    {
+      name = g_strdup_printf ("/packages/encoding/%u", i);
+      g_test_add (name, TestCase, fixtures_encoding + i,
+                  setup, test_encoding, teardown);
+      g_free (name);
+    }
+
   g_test_add ("/packages/resolve/simple", TestCase, NULL,
               setup_basic, test_resolve, teardown_basic);
   g_test_add ("/packages/resolve/bad-dots", TestCase, NULL,
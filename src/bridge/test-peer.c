@@ -588,6 +588,234 @@ test_reopen_fail (TestCase *tc,
   g_free (link);
 }
 
+static gboolean
+on_transport_recv_count (CockpitTransport *transport,
+                         const gchar *channel,
+                         GBytes *payload,
+                         gpointer user_data)
+{
+  guint *count = user_data;
+  if (channel)
+    (*count)++;
+  return FALSE;
+}
+
+static void
+test_relay (TestCase *tc,
+            gconstpointer unused)
+{
+  JsonObject *control;
+  GBytes *sent;
+  guint count = 0;
+
+  tc->peer = mock_peer_simple_new (tc->transport, "upper");
+  g_signal_connect (tc->transport, "recv", G_CALLBACK (on_transport_recv_count), &count);
+
+  emit_string (tc, NULL, "{\"command\": \"open\", \"channel\": \"a\", \"payload\": \"upper\"}");
+  emit_string (tc, "a", "oh marmalade");
+
+  while ((sent = mock_transport_pop_channel (tc->transport, "a")) == NULL)
+    g_main_context_iteration (NULL, TRUE);
+  cockpit_assert_bytes_eq (sent, "OH MARMALADE", -1);
+
+  /* Queued while the peer started, and then relayed */
+  g_assert_cmpuint (count, ==, 0);
+
+  emit_string (tc, "a", "zero g");
+  while ((sent = mock_transport_pop_channel (tc->transport, "a")) == NULL)
+    g_main_context_iteration (NULL, TRUE);
+  cockpit_assert_bytes_eq (sent, "ZERO G", -1);
+  g_assert_cmpuint (count, ==, 0);
+
+  /* Once closed the channel is no longer relayed */
+  emit_string (tc, NULL, "{\"command\": \"close\", \"channel\": \"a\"}");
+  while ((control = mock_transport_pop_control (tc->transport)) == NULL)
+    g_main_context_iteration (NULL, TRUE);
+  cockpit_assert_json_eq (control, "{\"command\":\"close\",\"channel\":\"a\"}");
+
+  emit_string (tc, "a", "stale");
+  g_assert_cmpuint (count, ==, 1);
+}
+
+static void
+test_relay_throughput (TestCase *tc,
+                       gconstpointer unused)
+{
+  GError *error = NULL;
+  JsonObject *control;
+  const gchar *command;
+  GBytes *output;
+  gchar *contents;
+  gchar *bridge;
+  gchar *open;
+  gchar *path;
+  gdouble elapsed;
+  guint count;
+  gint fd;
+
+  const gsize size = 64 * 1024 * 1024;
+
+  fd = g_file_open_tmp ("test-peer-relay.XXXXXX", &path, &error);
+  g_assert_no_error (error);
+  close (fd);
+
+  contents = g_malloc (size);
+  memset (contents, 'x', size);
+  g_file_set_contents (path, contents, size, &error);
+  g_assert_no_error (error);
+  g_free (contents);
+
+  /*
+   * Stands in for the superuser bridge, which is another cockpit-bridge
+   * that fsread1 channels are routed to
+   */
+  bridge = g_strdup_printf ("{ \"match\": { \"payload\": \"fsread1\" }, \"spawn\": [ \"%s\" ] }",
+                            BUILDDIR "/cockpit-bridge");
+  tc->peer = peer_new (tc->transport, bridge);
+  g_free (bridge);
+
+  open = g_strdup_printf ("{\"command\": \"open\", \"channel\": \"a\", \"payload\": \"fsread1\","
+                          " \"path\": \"%s\", \"max_read_size\": %" G_GSIZE_FORMAT "}", path, size);
+
+  g_test_timer_start ();
+  emit_string (tc, NULL, open);
+
+  for (;;)
+    {
+      while ((control = mock_transport_pop_control (tc->transport)) == NULL)
+        g_main_context_iteration (NULL, TRUE);
+      g_assert (cockpit_json_get_string (control, "command", NULL, &command));
+      if (g_strcmp0 (command, "close") == 0)
+        break;
+    }
+
+  elapsed = g_test_timer_elapsed ();
+  g_assert (!json_object_has_member (control, "problem"));
+
+  output = mock_transport_combine_output (tc->transport, "a", &count);
+  g_assert_cmpuint (g_bytes_get_size (output), ==, size);
+  g_bytes_unref (output);
+
+  g_test_maximized_result ((size / elapsed) / (1024 * 1024),
+                           "fsread1 through peer: %" G_GSIZE_FORMAT " MB in %u messages, %.1f MB/s",
+                           size / (1024 * 1024), count, (size / elapsed) / (1024 * 1024));
+
+  g_unlink (path);
+  g_free (path);
+  g_free (open);
+}
+
+static void
+test_warm (TestCase *tc,
+           gconstpointer unused)
+{
+  const gchar *bridge;
+  GBytes *sent;
+  JsonObject *control;
+  CockpitTransport *other = NULL;
+  gboolean closed = FALSE;
+
+  bridge = "{ \"match\": { \"payload\": \"upper\" }, \"warm\": true, \"timeout\": 1, \"spawn\": [ \"/" BUILDDIR "/mock-bridge" "\", \"--upper\", \"--count\" ] }";
+  tc->peer = peer_new (tc->transport, bridge);
+
+  /* Started without any channel */
+  g_assert (cockpit_peer_warm (tc->peer));
+  other = g_object_ref (cockpit_peer_ensure (tc->peer));
+  g_signal_connect (other, "closed", G_CALLBACK (on_other_closed), &closed);
+
+  /* Nobody used it, so it goes away again */
+  while (!closed)
+    g_main_context_iteration (NULL, TRUE);
+  g_assert (mock_transport_pop_control (tc->transport) == NULL);
+
+  /* And is started again on demand */
+  emit_string (tc, NULL, "{\"command\": \"open\", \"channel\": \"a\", \"payload\": \"upper\"}");
+  emit_string (tc, "a", "Oh MarmaLade");
+
+  while ((control = mock_transport_pop_control (tc->transport)) == NULL)
+    g_main_context_iteration (NULL, TRUE);
+  cockpit_assert_json_eq (control, "{\"command\":\"ready\",\"channel\":\"a\",\"count\":0}");
+
+  while ((sent = mock_transport_pop_channel (tc->transport, "a")) == NULL)
+    g_main_context_iteration (NULL, TRUE);
+  cockpit_assert_bytes_eq (sent, "OH MARMALADE", -1);
+
+  g_object_unref (other);
+}
+
+static void
+test_warm_not_configured (TestCase *tc,
+                          gconstpointer unused)
+{
+  tc->peer = mock_peer_simple_new (tc->transport, "upper");
+
+  /* Without "warm" in the config nothing is started */
+  g_assert (!cockpit_peer_warm (tc->peer));
+}
+
+static gboolean
+on_timeout_quit (gpointer user_data)
+{
+  gboolean *flag = user_data;
+  *flag = TRUE;
+  return FALSE;
+}
+
+static gdouble
+measure_ready (TestCase *tc,
+               const gchar *channel)
+{
+  JsonObject *control;
+  const gchar *id;
+  gdouble elapsed;
+  gchar *open;
+
+  open = g_strdup_printf ("{\"command\": \"open\", \"channel\": \"%s\", \"payload\": \"upper\"}", channel);
+
+  g_test_timer_start ();
+  emit_string (tc, NULL, open);
+  for (;;)
+    {
+      while ((control = mock_transport_pop_control (tc->transport)) == NULL)
+        g_main_context_iteration (NULL, TRUE);
+      if (cockpit_json_get_string (control, "channel", NULL, &id) && g_strcmp0 (id, channel) == 0)
+        break;
+    }
+  elapsed = g_test_timer_elapsed ();
+
+  g_assert (!json_object_has_member (control, "problem"));
+  g_free (open);
+  return elapsed;
+}
+
+static void
+test_warm_latency (TestCase *tc,
+                   gconstpointer unused)
+{
+  const gchar *bridge;
+  gboolean waited = FALSE;
+  gdouble cold;
+  gdouble warm;
+
+  bridge = "{ \"match\": { \"payload\": \"upper\" }, \"warm\": true, \"spawn\": [ \"/" BUILDDIR "/mock-bridge" "\", \"--upper\" ] }";
+
+  /* Spawned when the first channel arrives */
+  tc->peer = peer_new (tc->transport, bridge);
+  cold = measure_ready (tc, "a");
+  g_clear_object (&tc->peer);
+
+  /* Spawned ahead of time, and given a moment to start */
+  tc->peer = peer_new (tc->transport, bridge);
+  g_assert (cockpit_peer_warm (tc->peer));
+  g_timeout_add (500, on_timeout_quit, &waited);
+  while (!waited)
+    g_main_context_iteration (NULL, TRUE);
+  warm = measure_ready (tc, "b");
+
+  g_test_minimized_result (warm, "first channel ready: cold %.1f ms, warm %.1f ms",
+                           cold * 1000, warm * 1000);
+}
+
 int
 main (int argc,
       char *argv[])
@@ -614,5 +842,18 @@ main (int argc,
               setup, test_reopen_fail, teardown);
   g_test_add ("/peer/timeout", TestCase, NULL,
               setup, test_timeout, teardown);
+  g_test_add ("/peer/warm", TestCase, NULL,
+              setup, test_warm, teardown);
+  g_test_add ("/peer/warm-not-configured", TestCase, NULL,
+              setup, test_warm_not_configured, teardown);
+  g_test_add ("/peer/relay", TestCase, NULL,
+              setup, test_relay, teardown);
+  if (g_test_perf ())
+    {
+      g_test_add ("/peer/relay/throughput", TestCase, NULL,
+                  setup, test_relay_throughput, teardown);
+      g_test_add ("/peer/warm/latency", TestCase, NULL,
+                  setup, test_warm_latency, teardown);
+    }
   return g_test_run ();
 }
@@ -856,6 +856,273 @@ test_superuser_start (TestCase *tc,
   g_object_unref (router);
 }
 
+static CockpitPayloadType batch_payload_types[] = {
+  { "echo", mock_echo_channel_get_type },
+  { NULL },
+};
+
+static JsonObject *
+wait_control (TestCase *tc)
+{
+  JsonObject *control;
+
+  while ((control = mock_transport_pop_control (tc->transport)) == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  return control;
+}
+
+static void
+test_open_batch (TestCase *tc,
+                 gconstpointer unused)
+{
+  CockpitRouter *router;
+  GBytes *sent;
+
+  router = cockpit_router_new (COCKPIT_TRANSPORT (tc->transport), batch_payload_types, NULL);
+
+  emit_string (tc, NULL, "{\"command\": \"init\", \"version\": 1, \"host\": \"localhost\" }");
+  emit_string (tc, NULL, "{\"command\": \"open-batch\", \"batch\": \"one\", \"options\": { \"payload\": \"echo\" },"
+               " \"channels\": [ { \"channel\": \"a\" }, { \"channel\": \"b\" }, { \"channel\": \"c\" } ] }");
+
+  /* One reply for all of them, and no separate ready messages */
+  cockpit_assert_json_eq (wait_control (tc),
+                          "{'command':'ready-batch','batch':'one','channels':{'a':{},'b':{},'c':{}}}");
+  g_assert (mock_transport_pop_control (tc->transport) == NULL);
+
+  /* The channels work as usual */
+  emit_string (tc, "b", "oh marmalade");
+  while ((sent = mock_transport_pop_channel (tc->transport, "b")) == NULL)
+    g_main_context_iteration (NULL, TRUE);
+  cockpit_assert_bytes_eq (sent, "oh marmalade", -1);
+
+  g_object_unref (router);
+}
+
+static void
+test_open_batch_problems (TestCase *tc,
+                          gconstpointer unused)
+{
+  CockpitRouter *router;
+
+  router = cockpit_router_new (COCKPIT_TRANSPORT (tc->transport), batch_payload_types, NULL);
+
+  emit_string (tc, NULL, "{\"command\": \"init\", \"version\": 1, \"host\": \"localhost\" }");
+  emit_string (tc, NULL, "{\"command\": \"open-batch\", \"batch\": \"two\", \"options\": { \"payload\": \"echo\" },"
+               " \"channels\": [ { \"channel\": \"a\" }, { \"channel\": \"b\", \"payload\": \"unknown\" } ] }");
+
+  /* The failed channel is closed as usual, before the reply */
+  cockpit_assert_json_eq (wait_control (tc),
+                          "{'command':'close','channel':'b','problem':'not-supported'}");
+  cockpit_assert_json_eq (wait_control (tc),
+                          "{'command':'ready-batch','batch':'two','channels':{'a':{}},"
+                          "'problems':{'b':'not-supported'}}");
+
+  g_object_unref (router);
+}
+
+static void
+test_open_batch_external (TestCase *tc,
+                          gconstpointer unused)
+{
+  CockpitRouter *router;
+  CockpitPeer *peer;
+  GBytes *sent;
+
+  router = cockpit_router_new (COCKPIT_TRANSPORT (tc->transport), batch_payload_types, NULL);
+  peer = cockpit_peer_new (COCKPIT_TRANSPORT (tc->transport), tc->mock_config);
+  cockpit_router_add_peer (router, tc->mock_match, peer);
+
+  emit_string (tc, NULL, "{\"command\": \"init\", \"version\": 1, \"host\": \"localhost\" }");
+  emit_string (tc, NULL, "{\"command\": \"open-batch\", \"batch\": \"three\", \"options\": { \"payload\": \"upper\" },"
+               " \"channels\": [ { \"channel\": \"a\" }, { \"channel\": \"b\" }, { \"channel\": \"c\", \"payload\": \"echo\" } ] }");
+
+  /* The ready messages from the other bridge are collected too */
+  cockpit_assert_json_eq (wait_control (tc),
+                          "{'command':'ready-batch','batch':'three','channels':{'c':{},'a':{},'b':{}}}");
+
+  emit_string (tc, "a", "oh marmalade a");
+  while ((sent = mock_transport_pop_channel (tc->transport, "a")) == NULL)
+    g_main_context_iteration (NULL, TRUE);
+  cockpit_assert_bytes_eq (sent, "OH MARMALADE A", -1);
+
+  g_object_unref (peer);
+  g_object_unref (router);
+}
+
+static void
+test_open_batch_invalid (TestCase *tc,
+                         gconstpointer data)
+{
+  CockpitRouter *router;
+  gchar *problem = NULL;
+
+  router = cockpit_router_new (COCKPIT_TRANSPORT (tc->transport), batch_payload_types, NULL);
+  g_signal_connect (tc->transport, "closed", G_CALLBACK (on_transport_closed), &problem);
+
+  cockpit_expect_warning ("*open-batch command*");
+
+  emit_string (tc, NULL, "{\"command\": \"init\", \"version\": 1, \"host\": \"localhost\" }");
+  emit_string (tc, NULL, data);
+
+  while (problem == NULL)
+    g_main_context_iteration (NULL, TRUE);
+  g_assert_cmpstr (problem, ==, "protocol-error");
+
+  /* Nothing was opened */
+  g_assert (mock_transport_pop_control (tc->transport) == NULL);
+
+  g_free (problem);
+  g_object_unref (router);
+}
+
+static void
+test_open_batch_perf (TestCase *tc,
+                      gconstpointer unused)
+{
+  CockpitRouter *router;
+  GString *batch;
+  gchar *open;
+  gdouble single;
+  gdouble batched;
+  const guint n_channels = 200;
+  guint i;
+
+  router = cockpit_router_new (COCKPIT_TRANSPORT (tc->transport), batch_payload_types, NULL);
+  emit_string (tc, NULL, "{\"command\": \"init\", \"version\": 1, \"host\": \"localhost\" }");
+
+  /* Roughly what a shell page load looks like */
+  g_test_timer_start ();
+  for (i = 0; i < n_channels; i++)
+    {
+      open = g_strdup_printf ("{\"command\": \"open\", \"channel\": \"s%u\", \"payload\": \"echo\","
+                              " \"bus\": \"system\", \"name\": \"org.freedesktop.systemd1\", \"superuser\": \"try\" }", i);
+      emit_string (tc, NULL, open);
+      g_free (open);
+    }
+  for (i = 0; i < n_channels; i++)
+    wait_control (tc);
+  single = g_test_timer_elapsed ();
+
+  batch = g_string_new ("{\"command\": \"open-batch\", \"batch\": \"perf\", \"options\": { \"payload\": \"echo\","
+                        " \"bus\": \"system\", \"name\": \"org.freedesktop.systemd1\", \"superuser\": \"try\" }, \"channels\": [");
+  for (i = 0; i < n_channels; i++)
+    g_string_append_printf (batch, "%s{ \"channel\": \"b%u\" }", i ? ", " : "", i);
+  g_string_append (batch, "] }");
+
+  g_test_timer_start ();
+  emit_string (tc, NULL, batch->str);
+  wait_control (tc);
+  batched = g_test_timer_elapsed ();
+
+  g_test_minimized_result (batched, "%u channels: open %.3f ms, open-batch %.3f ms",
+                           n_channels, single * 1000, batched * 1000);
+
+  g_string_free (batch, TRUE);
+  g_object_unref (router);
+}
+
+static void
+test_kill_group (TestCase *tc,
+                 gconstpointer unused)
+{
+  CockpitRouter *router;
+  JsonObject *control;
+  GHashTable *seen;
+  const gchar *channel;
+  GBytes *sent;
+
+  router = cockpit_router_new (COCKPIT_TRANSPORT (tc->transport), batch_payload_types, NULL);
+
+  emit_string (tc, NULL, "{\"command\": \"init\", \"version\": 1, \"host\": \"localhost\" }");
+  emit_string (tc, NULL, "{\"command\": \"open\", \"channel\": \"a\", \"payload\": \"echo\", \"group\": \"one\"}");
+  emit_string (tc, NULL, "{\"command\": \"open\", \"channel\": \"b\", \"payload\": \"echo\", \"group\": \"two\"}");
+  emit_string (tc, NULL, "{\"command\": \"open\", \"channel\": \"c\", \"payload\": \"echo\", \"group\": \"one\"}");
+  emit_string (tc, NULL, "{\"command\": \"open\", \"channel\": \"d\", \"payload\": \"echo\"}");
+
+  /* Closed channels leave their group */
+  emit_string (tc, NULL, "{\"command\": \"close\", \"channel\": \"c\"}");
+  while (mock_transport_pop_control (tc->transport) != NULL);
+
+  emit_string (tc, NULL, "{\"command\": \"kill\", \"group\": \"one\"}");
+  cockpit_assert_json_eq (wait_control (tc), "{'command':'close','channel':'a','problem':'terminated'}");
+  g_assert (mock_transport_pop_control (tc->transport) == NULL);
+
+  /* Killing a group with no channels does nothing */
+  emit_string (tc, NULL, "{\"command\": \"kill\", \"group\": \"one\"}");
+  emit_string (tc, NULL, "{\"command\": \"kill\", \"group\": \"unknown\"}");
+  g_assert (mock_transport_pop_control (tc->transport) == NULL);
+
+  /* The channel in the other group still works */
+  emit_string (tc, "b", "oh marmalade");
+  while ((sent = mock_transport_pop_channel (tc->transport, "b")) == NULL)
+    g_main_context_iteration (NULL, TRUE);
+  cockpit_assert_bytes_eq (sent, "oh marmalade", -1);
+
+  /* The default group */
+  emit_string (tc, NULL, "{\"command\": \"kill\", \"group\": \"default\"}");
+  cockpit_assert_json_eq (wait_control (tc), "{'command':'close','channel':'d','problem':'terminated'}");
+
+  /* And everything else */
+  seen = g_hash_table_new (g_str_hash, g_str_equal);
+  emit_string (tc, NULL, "{\"command\": \"open\", \"channel\": \"e\", \"payload\": \"echo\", \"group\": \"one\"}");
+  while (mock_transport_pop_control (tc->transport) != NULL);
+  emit_string (tc, NULL, "{\"command\": \"kill\"}");
+  while ((control = mock_transport_pop_control (tc->transport)) != NULL)
+    {
+      g_assert (cockpit_json_get_string (control, "channel", NULL, &channel));
+      g_hash_table_add (seen, (gpointer)channel);
+    }
+  g_assert_cmpuint (g_hash_table_size (seen), ==, 2);
+  g_assert (g_hash_table_contains (seen, "b"));
+  g_assert (g_hash_table_contains (seen, "e"));
+
+  g_hash_table_destroy (seen);
+  g_object_unref (router);
+}
+
+static void
+test_kill_group_perf (TestCase *tc,
+                      gconstpointer unused)
+{
+  CockpitRouter *router;
+  gchar *string;
+  gdouble elapsed;
+  const guint n_groups = 200;
+  const guint n_channels = 5000;
+  guint i;
+
+  router = cockpit_router_new (COCKPIT_TRANSPORT (tc->transport), batch_payload_types, NULL);
+  emit_string (tc, NULL, "{\"command\": \"init\", \"version\": 1, \"host\": \"localhost\" }");
+
+  for (i = 0; i < n_channels; i++)
+    {
+      string = g_strdup_printf ("{\"command\": \"open\", \"channel\": \"c%u\", \"payload\": \"echo\","
+                                " \"group\": \"g%u\" }", i, i % n_groups);
+      emit_string (tc, NULL, string);
+      g_free (string);
+    }
+  while (mock_transport_pop_control (tc->transport) != NULL);
+
+  /* Like navigating between pages: one group at a time */
+  g_test_timer_start ();
+  for (i = 0; i < n_groups; i++)
+    {
+      string = g_strdup_printf ("{\"command\": \"kill\", \"group\": \"g%u\" }", i);
+      emit_string (tc, NULL, string);
+      g_free (string);
+    }
+  elapsed = g_test_timer_elapsed ();
+
+  for (i = 0; i < n_channels; i++)
+    g_assert (mock_transport_pop_control (tc->transport) != NULL);
+
+  g_test_minimized_result (elapsed, "%u channels in %u groups: %.3f ms per group kill",
+                           n_channels, n_groups, (elapsed * 1000) / n_groups);
+
+  g_object_unref (router);
+}
+
 int
 main (int argc,
       char *argv[])
@@ -891,5 +1158,33 @@ main (int argc,
   g_test_add ("/router/superuser/start", TestCase, &fixture_superuser,
               setup, test_superuser_start, teardown);
 
+  g_test_add ("/router/open-batch/local", TestCase, NULL,
+              setup, test_open_batch, teardown);
+  g_test_add ("/router/open-batch/problems", TestCase, NULL,
+              setup, test_open_batch_problems, teardown);
+  g_test_add ("/router/open-batch/external", TestCase, NULL,
+              setup, test_open_batch_external, teardown);
+  g_test_add ("/router/open-batch/no-batch", TestCase,
+              "{\"command\": \"open-batch\", \"options\": {}, \"channels\": [ { \"channel\": \"a\" } ] }",
+              setup, test_open_batch_invalid, teardown);
+  g_test_add ("/router/open-batch/no-channel", TestCase,
+              "{\"command\": \"open-batch\", \"batch\": \"x\", \"channels\": [ { \"payload\": \"echo\" } ] }",
+              setup, test_open_batch_invalid, teardown);
+  g_test_add ("/router/open-batch/duplicate-channel", TestCase,
+              "{\"command\": \"open-batch\", \"batch\": \"x\", \"options\": { \"payload\": \"echo\" },"
+              " \"channels\": [ { \"channel\": \"a\" }, { \"channel\": \"a\" } ] }",
+              setup, test_open_batch_invalid, teardown);
+
+  g_test_add ("/router/kill-group", TestCase, NULL,
+              setup, test_kill_group, teardown);
+
+  if (g_test_perf ())
+    {
+      g_test_add ("/router/open-batch/perf", TestCase, NULL,
+                  setup, test_open_batch_perf, teardown);
+      g_test_add ("/router/kill-group/perf", TestCase, NULL,
+                  setup, test_kill_group_perf, teardown);
+    }
+
   return g_test_run ();
 }
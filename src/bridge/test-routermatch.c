@@ -0,0 +1,460 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpitroutermatch.h"
+
+#include "common/cockpitjson.h"
+#include "common/cockpittest.h"
+
+#include <string.h>
+
+static JsonObject *
+parse_object (const gchar *json)
+{
+  GError *error = NULL;
+  JsonObject *object;
+
+  object = cockpit_json_parse_object (json, -1, &error);
+  g_assert_no_error (error);
+  return object;
+}
+
+/*
+ * How the router matched rules before they were indexed. Every
+ * string is a glob, a null only requires presence, and anything
+ * else must be equal.
+ */
+static gboolean
+reference_match (JsonObject *match,
+                 JsonObject *options)
+{
+  GPatternSpec *glob;
+  const gchar *value;
+  gboolean ret = TRUE;
+  JsonNode *node;
+  JsonNode *other;
+  GList *names, *l;
+
+  if (match == NULL)
+    return FALSE;
+
+  names = json_object_get_members (match);
+  for (l = names; ret && l != NULL; l = g_list_next (l))
+    {
+      node = json_object_get_member (match, l->data);
+      if (JSON_NODE_HOLDS_VALUE (node) && json_node_get_value_type (node) == G_TYPE_STRING)
+        {
+          glob = g_pattern_spec_new (json_node_get_string (node));
+          ret = cockpit_json_get_string (options, l->data, NULL, &value) && value &&
+                g_pattern_match (glob, strlen (value), value, NULL);
+          g_pattern_spec_free (glob);
+        }
+      else if (!JSON_NODE_HOLDS_NULL (node))
+        {
+          other = json_object_get_member (options, l->data);
+          ret = other && cockpit_json_equal (node, other);
+        }
+      else
+        {
+          ret = json_object_has_member (options, l->data);
+        }
+    }
+
+  g_list_free (names);
+  return ret;
+}
+
+typedef struct {
+  const gchar *match;
+  const gchar *options;
+  gboolean expected;
+} Fixture;
+
+static const Fixture match_fixtures[] = {
+  { "{ }", "{ }", TRUE },
+  { "{ }", "{ \"payload\": \"echo\" }", TRUE },
+  { "{ \"payload\": \"echo\" }", "{ \"payload\": \"echo\" }", TRUE },
+  { "{ \"payload\": \"echo\" }", "{ \"payload\": \"echo2\" }", FALSE },
+  { "{ \"payload\": \"echo\" }", "{ }", FALSE },
+  { "{ \"payload\": \"echo\" }", "{ \"payload\": 5 }", FALSE },
+  { "{ \"payload\": \"ec*\" }", "{ \"payload\": \"echo\" }", TRUE },
+  { "{ \"payload\": \"e?ho\" }", "{ \"payload\": \"echo\" }", TRUE },
+  { "{ \"payload\": \"e?ho\" }", "{ \"payload\": \"ecccho\" }", FALSE },
+  { "{ \"host\": null }", "{ \"host\": \"other\" }", TRUE },
+  { "{ \"host\": null }", "{ \"host\": null }", TRUE },
+  { "{ \"host\": null }", "{ }", FALSE },
+  { "{ \"number\": 5 }", "{ \"number\": 5 }", TRUE },
+  { "{ \"number\": 5 }", "{ \"number\": \"5\" }", FALSE },
+  { "{ \"spawn\": [ \"a\", \"b\" ] }", "{ \"spawn\": [ \"a\", \"b\" ] }", TRUE },
+  { "{ \"spawn\": [ \"a\", \"b\" ] }", "{ \"spawn\": [ \"a\" ] }", FALSE },
+  { "{ \"payload\": \"echo\", \"host\": null, \"bus\": \"sys*\" }",
+    "{ \"payload\": \"echo\", \"host\": \"h\", \"bus\": \"system\" }", TRUE },
+  { "{ \"payload\": \"echo\", \"host\": null, \"bus\": \"sys*\" }",
+    "{ \"payload\": \"echo\", \"bus\": \"system\" }", FALSE },
+};
+
+static void
+test_match (gconstpointer data)
+{
+  const Fixture *fixture = data;
+  CockpitRouterMatch *match;
+  JsonObject *object;
+  JsonObject *options;
+
+  object = parse_object (fixture->match);
+  options = parse_object (fixture->options);
+
+  match = cockpit_router_match_new (object);
+  g_assert_cmpint (cockpit_router_match_test (match, options), ==, fixture->expected);
+  g_assert_cmpint (reference_match (object, options), ==, fixture->expected);
+
+  cockpit_router_match_free (match);
+  json_object_unref (options);
+  json_object_unref (object);
+}
+
+static void
+test_match_null (void)
+{
+  CockpitRouterMatch *match;
+  JsonObject *options;
+
+  /* Without a match object, nothing matches */
+  options = parse_object ("{ \"payload\": \"echo\" }");
+  match = cockpit_router_match_new (NULL);
+  g_assert (!cockpit_router_match_test (match, options));
+  cockpit_router_match_free (match);
+  json_object_unref (options);
+}
+
+static gboolean
+on_collect (gpointer data,
+            gpointer user_data)
+{
+  GArray *visited = user_data;
+  guint position = GPOINTER_TO_UINT (data);
+  g_array_append_val (visited, position);
+  return FALSE;
+}
+
+static gboolean
+on_accept (gpointer data,
+           gpointer user_data)
+{
+  guint *accepted = user_data;
+  *accepted = GPOINTER_TO_UINT (data);
+  return TRUE;
+}
+
+static void
+test_index_precedence (void)
+{
+  CockpitRouterIndex *index;
+  CockpitRouterMatch *matches[4];
+  JsonObject *options;
+  JsonObject *object;
+  guint accepted = 0;
+  guint i;
+
+  const gchar *rules[] = {
+    "{ \"payload\": \"echo\", \"host\": null }",
+    "{ \"payload\": \"ec*\" }",
+    "{ \"payload\": \"echo\" }",
+    "{ }",
+  };
+
+  index = cockpit_router_index_new ();
+  for (i = 0; i < G_N_ELEMENTS (rules); i++)
+    {
+      object = parse_object (rules[i]);
+      matches[i] = cockpit_router_match_new (object);
+      cockpit_router_index_add (index, matches[i], GUINT_TO_POINTER (i + 1));
+      json_object_unref (object);
+    }
+
+  g_assert_cmpuint (cockpit_router_index_size (index), ==, 4);
+
+  /* The glob comes before the literal payload that was added later */
+  options = parse_object ("{ \"payload\": \"echo\" }");
+  g_assert (cockpit_router_index_lookup (index, options, on_accept, &accepted));
+  g_assert_cmpuint (accepted, ==, 2);
+  json_object_unref (options);
+
+  options = parse_object ("{ \"payload\": \"echo\", \"host\": \"other\" }");
+  g_assert (cockpit_router_index_lookup (index, options, on_accept, &accepted));
+  g_assert_cmpuint (accepted, ==, 1);
+  json_object_unref (options);
+
+  options = parse_object ("{ \"payload\": 5 }");
+  g_assert (cockpit_router_index_lookup (index, options, on_accept, &accepted));
+  g_assert_cmpuint (accepted, ==, 4);
+  json_object_unref (options);
+
+  cockpit_router_index_unref (index);
+  for (i = 0; i < G_N_ELEMENTS (matches); i++)
+    cockpit_router_match_free (matches[i]);
+}
+
+/*
+ * The vocabulary for generating rules and options. Each field of a
+ * rule or an option is either left out or takes one of these values.
+ */
+
+static const gchar *rule_values[] = {
+  "\"echo\"", "\"stream\"", "\"dbus-json3\"", "\"fs*\"", "\"*3\"",
+  "\"?cho\"", "\"*\"", "\"\"", "null", "5", "true", "[ \"echo\" ]",
+};
+
+static const gchar *option_values[] = {
+  "\"echo\"", "\"stream\"", "\"dbus-json3\"", "\"fsread1\"", "\"fswatch1\"",
+  "\"acho\"", "\"\"", "null", "5", "true", "[ \"echo\" ]",
+};
+
+static const gchar *field_names[] = {
+  "payload", "host", "bus",
+};
+
+static JsonObject *
+random_rule (void)
+{
+  JsonObject *object;
+  GString *json;
+  gboolean first = TRUE;
+  guint i;
+
+  json = g_string_new ("{");
+  for (i = 0; i < G_N_ELEMENTS (field_names); i++)
+    {
+      /* Most rules have a payload, fewer have other fields */
+      if (g_test_rand_int_range (0, 100) >= (i == 0 ? 80 : 30))
+        continue;
+      g_string_append_printf (json, "%s \"%s\": %s", first ? "" : ",", field_names[i],
+                              rule_values[g_test_rand_int_range (0, G_N_ELEMENTS (rule_values))]);
+      first = FALSE;
+    }
+  g_string_append (json, " }");
+
+  object = parse_object (json->str);
+  g_string_free (json, TRUE);
+  return object;
+}
+
+static void
+check_equivalence (GPtrArray *objects,
+                   CockpitRouterIndex *index,
+                   JsonObject *options)
+{
+  GArray *visited;
+  guint position;
+  guint i, j;
+
+  visited = g_array_new (FALSE, FALSE, sizeof (guint));
+  g_assert (!cockpit_router_index_lookup (index, options, on_collect, visited));
+
+  /* Every matching rule, and in the same order */
+  for (i = 0, j = 0; i < objects->len; i++)
+    {
+      if (!reference_match (objects->pdata[i], options))
+        continue;
+
+      if (j >= visited->len)
+        {
+          g_error ("index missed rule %u for %s", i,
+                   cockpit_json_write_object (options, NULL));
+        }
+
+      position = g_array_index (visited, guint, j++);
+      g_assert_cmpuint (position, ==, i);
+    }
+  g_assert_cmpuint (j, ==, visited->len);
+
+  g_array_free (visited, TRUE);
+}
+
+static void
+test_index_equivalence (void)
+{
+  CockpitRouterIndex *index;
+  GPtrArray *matches;
+  GPtrArray *objects;
+  JsonObject *options;
+  guint n_values = G_N_ELEMENTS (option_values) + 1;
+  guint combination;
+  guint remainder;
+  guint value;
+  guint round;
+  guint n_rules;
+  guint i;
+
+  for (round = 0; round < 30; round++)
+    {
+      matches = g_ptr_array_new_with_free_func ((GDestroyNotify)cockpit_router_match_free);
+      objects = g_ptr_array_new_with_free_func ((GDestroyNotify)json_object_unref);
+      index = cockpit_router_index_new ();
+
+      n_rules = g_test_rand_int_range (1, 40);
+      for (i = 0; i < n_rules; i++)
+        {
+          g_ptr_array_add (objects, random_rule ());
+          g_ptr_array_add (matches, cockpit_router_match_new (objects->pdata[i]));
+          cockpit_router_index_add (index, matches->pdata[i], GUINT_TO_POINTER (i));
+        }
+
+      /* Every combination of option values, including leaving a field out */
+      for (combination = 0; combination < n_values * n_values * n_values; combination++)
+        {
+          options = json_object_new ();
+          remainder = combination;
+          for (i = 0; i < G_N_ELEMENTS (field_names); i++)
+            {
+              value = remainder % n_values;
+              remainder /= n_values;
+              if (value < G_N_ELEMENTS (option_values))
+                {
+                  json_object_set_member (options, field_names[i],
+                                          cockpit_json_parse (option_values[value], -1, NULL));
+                }
+            }
+
+          check_equivalence (objects, index, options);
+          json_object_unref (options);
+        }
+
+      cockpit_router_index_unref (index);
+      g_ptr_array_free (matches, TRUE);
+      g_ptr_array_free (objects, TRUE);
+    }
+}
+
+static gboolean
+on_count (gpointer data,
+          gpointer user_data)
+{
+  guint *count = user_data;
+  (*count)++;
+  return TRUE;
+}
+
+static void
+test_index_perf (void)
+{
+  CockpitRouterIndex *index;
+  GPtrArray *matches;
+  GPtrArray *opens;
+  JsonObject *object;
+  gdouble linear;
+  gdouble indexed;
+  guint count = 0;
+  gchar *json;
+  guint i, j;
+
+  const guint n_rules = 500;
+  const guint n_opens = 20000;
+
+  matches = g_ptr_array_new_with_free_func ((GDestroyNotify)cockpit_router_match_free);
+  opens = g_ptr_array_new_with_free_func ((GDestroyNotify)json_object_unref);
+  index = cockpit_router_index_new ();
+
+  /* Roughly what many installed packages with "bridges" entries look like */
+  for (i = 0; i < n_rules; i++)
+    {
+      if (i % 10 == 0)
+        json = g_strdup_printf ("{ \"payload\": \"glob%u-*\", \"host\": null }", i);
+      else if (i % 10 == 1)
+        json = g_strdup_printf ("{ \"payload\": \"dbus-json3\", \"bus\": \"internal\", \"name\": \"pkg%u\" }", i);
+      else
+        json = g_strdup_printf ("{ \"payload\": \"pkg%u\" }", i);
+      object = parse_object (json);
+      g_ptr_array_add (matches, cockpit_router_match_new (object));
+      cockpit_router_index_add (index, matches->pdata[i], matches->pdata[i]);
+      json_object_unref (object);
+      g_free (json);
+    }
+
+  /* The default rule */
+  object = json_object_new ();
+  g_ptr_array_add (matches, cockpit_router_match_new (object));
+  cockpit_router_index_add (index, matches->pdata[n_rules], matches->pdata[n_rules]);
+  json_object_unref (object);
+
+  for (i = 0; i < 100; i++)
+    {
+      json = g_strdup_printf ("{ \"payload\": \"pkg%u\", \"channel\": \"4:%u\", \"path\": \"/%u\" }",
+                              g_test_rand_int_range (0, n_rules), i, i);
+      g_ptr_array_add (opens, parse_object (json));
+      g_free (json);
+    }
+
+  g_test_timer_start ();
+  for (i = 0; i < n_opens; i++)
+    {
+      for (j = 0; j < matches->len; j++)
+        {
+          if (cockpit_router_match_test (matches->pdata[j], opens->pdata[i % opens->len]))
+            {
+              count++;
+              break;
+            }
+        }
+    }
+  linear = g_test_timer_elapsed ();
+  g_assert_cmpuint (count, ==, n_opens);
+
+  count = 0;
+  g_test_timer_start ();
+  for (i = 0; i < n_opens; i++)
+    cockpit_router_index_lookup (index, opens->pdata[i % opens->len], on_count, &count);
+  indexed = g_test_timer_elapsed ();
+  g_assert_cmpuint (count, ==, n_opens);
+
+  g_test_minimized_result (indexed, "%u rules, %u opens: linear %.1f us/open, indexed %.1f us/open",
+                           n_rules, n_opens, linear * 1000000 / n_opens, indexed * 1000000 / n_opens);
+
+  cockpit_router_index_unref (index);
+  g_ptr_array_free (matches, TRUE);
+  g_ptr_array_free (opens, TRUE);
+}
+
+int
+main (int argc,
+      char *argv[])
+{
+  gchar *name;
+  guint i;
+
+  cockpit_test_init (&argc, &argv);
+
+  for (i = 0; i < G_N_ELEMENTS (match_fixtures); i++)
+    {
+      name = g_strdup_printf ("/router-match/match/%u", i);
+      g_test_add_data_func (name, match_fixtures + i, test_match);
+      g_free (name);
+    }
+
+  g_test_add_func ("/router-match/match/null", test_match_null);
+  g_test_add_func ("/router-match/index/precedence", test_index_precedence);
+  g_test_add_func ("/router-match/index/equivalence", test_index_equivalence);
+
+  if (g_test_perf ())
+    g_test_add_func ("/router-match/index/perf", test_index_perf);
+
+  return g_test_run ();
+}
@@ -0,0 +1,405 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpitbufferpool.h"
+#include "cockpitmemory.h"
+
+#include <string.h>
+
+/**
+ * CockpitBufferPool:
+ *
+ * A process wide pool of memory blocks for messages as they pass through
+ * pipes, transports and WebSockets. Blocks are rounded up to one of a
+ * handful of size classes, and freed blocks are kept around to be handed
+ * out again rather than going back to malloc every time.
+ *
+ * Each class only caches a bounded amount of memory. Requests larger than
+ * the largest class are passed directly to malloc. When no allocations
+ * happen for COCKPIT_BUFFER_POOL_IDLE_SECONDS the cached blocks are
+ * released, and the allocator is asked to return free memory to the
+ * system.
+ *
+ * Blocks are usually wrapped in a GBytes with cockpit_buffer_pool_take_bytes(),
+ * which then takes care of the reference counting, and returns the block to
+ * the pool when the last reference, or the last slice made with
+ * g_bytes_new_from_bytes(), goes away.
+ */
+
+#define BLOCK_MAGIC   0x43425546
+#define NO_CLASS      G_MAXUINT32
+#define HEADER_SIZE   16
+
+/* Never hold more than this much idle memory per size class */
+#define CLASS_CACHE_BYTES (1024 * 1024)
+#define CLASS_CACHE_MIN   4
+
+typedef union {
+  struct {
+    guint32 klass;
+    guint32 magic;
+    gsize size;
+  } h;
+  guint8 padding[HEADER_SIZE];
+} Block;
+
+G_STATIC_ASSERT (sizeof (Block) == HEADER_SIZE);
+
+static const gsize class_sizes[] = {
+  256, 1024, 4096, 16384, 65536, 262144
+};
+
+#define N_CLASSES G_N_ELEMENTS (class_sizes)
+
+typedef struct {
+  Block *head;
+  guint count;
+} FreeList;
+
+static GMutex pool_mutex;
+static FreeList free_lists[N_CLASSES];
+static CockpitBufferPoolStats pool_stats;
+static guint64 activity = 0;
+static guint64 timer_activity = 0;
+static guint idle_timer = 0;
+
+#define BLOCK_DATA(block) ((gpointer)((guint8 *)(block) + HEADER_SIZE))
+#define DATA_BLOCK(data) ((Block *)((guint8 *)(data) - HEADER_SIZE))
+
+/* The next pointer of a cached block lives where the data would */
+#define BLOCK_NEXT(block) (*(Block **)BLOCK_DATA (block))
+
+static guint
+class_for_size (gsize size)
+{
+  guint i;
+
+  for (i = 0; i < N_CLASSES; i++)
+    {
+      if (size <= class_sizes[i])
+        return i;
+    }
+
+  return NO_CLASS;
+}
+
+static guint
+class_cache_limit (guint klass)
+{
+  return MAX (CLASS_CACHE_MIN, CLASS_CACHE_BYTES / class_sizes[klass]);
+}
+
+/* Called with the mutex held */
+static void
+release_cached (void)
+{
+  Block *block;
+  guint i;
+
+  for (i = 0; i < N_CLASSES; i++)
+    {
+      while (free_lists[i].head)
+        {
+          block = free_lists[i].head;
+          free_lists[i].head = BLOCK_NEXT (block);
+          free_lists[i].count--;
+          pool_stats.released++;
+          g_free (block);
+        }
+    }
+
+  pool_stats.cached = 0;
+  pool_stats.cached_bytes = 0;
+}
+
+static gboolean
+on_idle_timer (gpointer user_data)
+{
+  gboolean ret = TRUE;
+
+  g_mutex_lock (&pool_mutex);
+
+  /* Nothing was allocated for a whole period */
+  if (activity == timer_activity)
+    {
+      g_debug ("releasing %" G_GUINT64_FORMAT " idle buffers", pool_stats.cached);
+      release_cached ();
+      idle_timer = 0;
+      ret = FALSE;
+    }
+
+  timer_activity = activity;
+
+  g_mutex_unlock (&pool_mutex);
+
+  /* The process has been quiet, give back what a burst left behind */
+  if (!ret)
+    cockpit_memory_trim ();
+
+  return ret;
+}
+
+/**
+ * cockpit_buffer_pool_alloc:
+ * @size: the number of bytes needed
+ *
+ * Allocate a block of at least @size bytes. The contents of the
+ * block are undefined. Use cockpit_buffer_pool_free() to return it,
+ * or pass it to cockpit_buffer_pool_take_bytes().
+ *
+ * Returns: (transfer full): the block, never NULL
+ */
+gpointer
+cockpit_buffer_pool_alloc (gsize size)
+{
+  Block *block = NULL;
+  guint klass;
+
+  klass = class_for_size (size);
+
+  g_mutex_lock (&pool_mutex);
+
+  activity++;
+  pool_stats.allocated++;
+  pool_stats.outstanding++;
+
+  if (klass == NO_CLASS)
+    {
+      pool_stats.oversize++;
+    }
+  else if (free_lists[klass].head)
+    {
+      block = free_lists[klass].head;
+      free_lists[klass].head = BLOCK_NEXT (block);
+      free_lists[klass].count--;
+      pool_stats.reused++;
+      pool_stats.cached--;
+      pool_stats.cached_bytes -= class_sizes[klass];
+    }
+
+  g_mutex_unlock (&pool_mutex);
+
+  if (!block)
+    {
+      g_return_val_if_fail (size <= G_MAXSIZE - HEADER_SIZE, NULL);
+      if (klass != NO_CLASS)
+        size = class_sizes[klass];
+      block = g_malloc (HEADER_SIZE + size);
+      block->h.klass = klass;
+      block->h.magic = BLOCK_MAGIC;
+      block->h.size = size;
+    }
+
+  return BLOCK_DATA (block);
+}
+
+/**
+ * cockpit_buffer_pool_free:
+ * @block: a block from cockpit_buffer_pool_alloc()
+ *
+ * Return a block to the pool. The pool may keep it for reuse
+ * or release it to the system.
+ */
+void
+cockpit_buffer_pool_free (gpointer block)
+{
+  Block *header;
+  guint klass;
+
+  if (block == NULL)
+    return;
+
+  header = DATA_BLOCK (block);
+  g_return_if_fail (header->h.magic == BLOCK_MAGIC);
+
+  klass = header->h.klass;
+
+  g_mutex_lock (&pool_mutex);
+
+  pool_stats.freed++;
+  pool_stats.outstanding--;
+
+  if (klass != NO_CLASS && free_lists[klass].count < class_cache_limit (klass))
+    {
+      BLOCK_NEXT (header) = free_lists[klass].head;
+      free_lists[klass].head = header;
+      free_lists[klass].count++;
+      pool_stats.cached++;
+      pool_stats.cached_bytes += class_sizes[klass];
+
+      if (!idle_timer)
+        {
+          timer_activity = activity;
+          idle_timer = g_timeout_add_seconds (COCKPIT_BUFFER_POOL_IDLE_SECONDS, on_idle_timer, NULL);
+        }
+
+      header = NULL;
+    }
+
+  g_mutex_unlock (&pool_mutex);
+
+  g_free (header);
+}
+
+/**
+ * cockpit_buffer_pool_block_size:
+ * @block: a block from cockpit_buffer_pool_alloc()
+ *
+ * Returns: the usable size of the block, which may be larger
+ *          than what was asked for.
+ */
+gsize
+cockpit_buffer_pool_block_size (gconstpointer block)
+{
+  const Block *header;
+
+  g_return_val_if_fail (block != NULL, 0);
+
+  header = DATA_BLOCK (block);
+  g_return_val_if_fail (header->h.magic == BLOCK_MAGIC, 0);
+  return header->h.size;
+}
+
+/**
+ * cockpit_buffer_pool_take_bytes:
+ * @block: (transfer full): a block from cockpit_buffer_pool_alloc()
+ * @length: the number of valid bytes in the block
+ *
+ * Wrap a pooled block in a GBytes. The block goes back to the pool
+ * once the bytes and all slices of it are unreferenced.
+ *
+ * Returns: (transfer full): the bytes
+ */
+GBytes *
+cockpit_buffer_pool_take_bytes (gpointer block,
+                                gsize length)
+{
+  g_return_val_if_fail (block != NULL, NULL);
+  g_return_val_if_fail (length <= cockpit_buffer_pool_block_size (block), NULL);
+
+  return g_bytes_new_with_free_func (block, length, cockpit_buffer_pool_free, block);
+}
+
+/**
+ * cockpit_buffer_pool_copy_bytes:
+ * @data: the data to copy
+ * @length: the length of @data
+ *
+ * Copy data into a pooled block. A null terminator is placed
+ * after the data, but not included in the length of the bytes.
+ *
+ * Returns: (transfer full): the bytes
+ */
+GBytes *
+cockpit_buffer_pool_copy_bytes (gconstpointer data,
+                                gsize length)
+{
+  guint8 *block;
+
+  g_return_val_if_fail (data != NULL || length == 0, NULL);
+  g_return_val_if_fail (length < G_MAXSIZE, NULL);
+
+  block = cockpit_buffer_pool_alloc (length + 1);
+  if (length)
+    memcpy (block, data, length);
+  block[length] = '\0';
+
+  return cockpit_buffer_pool_take_bytes (block, length);
+}
+
+/**
+ * cockpit_buffer_pool_concat_bytes:
+ * @prefix: data to place in front
+ * @prefix_len: the length of @prefix
+ * @payload: the bytes to place after the @prefix
+ *
+ * Copy a prefix and payload together into one pooled block.
+ *
+ * Returns: (transfer full): the bytes
+ */
+GBytes *
+cockpit_buffer_pool_concat_bytes (gconstpointer prefix,
+                                  gsize prefix_len,
+                                  GBytes *payload)
+{
+  gconstpointer data;
+  guint8 *block;
+  gsize length;
+
+  g_return_val_if_fail (prefix != NULL || prefix_len == 0, NULL);
+  g_return_val_if_fail (payload != NULL, NULL);
+
+  data = g_bytes_get_data (payload, &length);
+  g_return_val_if_fail (G_MAXSIZE - length > prefix_len, NULL);
+
+  block = cockpit_buffer_pool_alloc (prefix_len + length);
+  if (prefix_len)
+    memcpy (block, prefix, prefix_len);
+  if (length)
+    memcpy (block + prefix_len, data, length);
+
+  return cockpit_buffer_pool_take_bytes (block, prefix_len + length);
+}
+
+void
+cockpit_buffer_pool_get_stats (CockpitBufferPoolStats *stats)
+{
+  g_return_if_fail (stats != NULL);
+
+  g_mutex_lock (&pool_mutex);
+  *stats = pool_stats;
+  g_mutex_unlock (&pool_mutex);
+}
+
+/**
+ * cockpit_buffer_pool_reset_stats:
+ *
+ * Zero the event counters. The gauges of outstanding and cached
+ * blocks keep their values.
+ */
+void
+cockpit_buffer_pool_reset_stats (void)
+{
+  g_mutex_lock (&pool_mutex);
+  pool_stats.allocated = 0;
+  pool_stats.reused = 0;
+  pool_stats.freed = 0;
+  pool_stats.oversize = 0;
+  pool_stats.released = 0;
+  g_mutex_unlock (&pool_mutex);
+}
+
+/**
+ * cockpit_buffer_pool_trim:
+ *
+ * Release all cached blocks back to the system right away,
+ * without waiting for the pool to become idle.
+ */
+void
+cockpit_buffer_pool_trim (void)
+{
+  g_mutex_lock (&pool_mutex);
+  release_cached ();
+  if (idle_timer)
+    g_source_remove (idle_timer);
+  idle_timer = 0;
+  g_mutex_unlock (&pool_mutex);
+}
@@ -0,0 +1,65 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __COCKPIT_BUFFER_POOL_H__
+#define __COCKPIT_BUFFER_POOL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Cached blocks are released after this many seconds without allocations */
+#define COCKPIT_BUFFER_POOL_IDLE_SECONDS 30
+
+typedef struct {
+  guint64 allocated;
+  guint64 reused;
+  guint64 freed;
+  guint64 oversize;
+  guint64 outstanding;
+  guint64 cached;
+  guint64 cached_bytes;
+  guint64 released;
+} CockpitBufferPoolStats;
+
+gpointer       cockpit_buffer_pool_alloc         (gsize size);
+
+void           cockpit_buffer_pool_free          (gpointer block);
+
+gsize          cockpit_buffer_pool_block_size    (gconstpointer block);
+
+GBytes *       cockpit_buffer_pool_take_bytes    (gpointer block,
+                                                  gsize length);
+
+GBytes *       cockpit_buffer_pool_copy_bytes    (gconstpointer data,
+                                                  gsize length);
+
+GBytes *       cockpit_buffer_pool_concat_bytes  (gconstpointer prefix,
+                                                  gsize prefix_len,
+                                                  GBytes *payload);
+
+void           cockpit_buffer_pool_get_stats     (CockpitBufferPoolStats *stats);
+
+void           cockpit_buffer_pool_reset_stats   (void);
+
+void           cockpit_buffer_pool_trim          (void);
+
+G_END_DECLS
+
+#endif /* __COCKPIT_BUFFER_POOL_H__ */
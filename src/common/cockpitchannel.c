@@ -23,6 +23,7 @@
 
 #include "common/cockpitflow.h"
 #include "common/cockpitjson.h"
+#include "common/cockpitstats.h"
 #include "common/cockpitunicode.h"
 
 #include <json-glib/json-glib.h>
@@ -71,6 +72,14 @@
 /* Allow up to 1MB of data to be sent without ack */
 #define  CHANNEL_FLOW_WINDOW       (2L * 1024L * 1024L)
 
+/* How many unanswered pings we remember for round trip times */
+#define  CHANNEL_PING_TIMES        64
+
+typedef struct {
+    gint64 sequence;
+    gint64 when;
+} PingTime;
+
 typedef struct {
     gulong recv_sig;
     gulong close_sig;
@@ -118,6 +127,12 @@ typedef struct {
     CockpitFlow *pressure;
     gulong pressure_sig;
     GQueue *throttled;
+
+    /* Counters for this channel's payload type, see cockpitstats.c */
+    CockpitChannelStats *stats;
+    gint64 open_time;
+    gint64 pressure_time;
+    GArray *ping_times;
 } CockpitChannelPrivate;
 
 enum {
@@ -155,6 +170,17 @@ cockpit_channel_init (CockpitChannel *self)
 
   priv->out_sequence = 0;
   priv->out_window = CHANNEL_FLOW_WINDOW;
+  priv->ping_times = g_array_new (FALSE, FALSE, sizeof (PingTime));
+}
+
+static void
+stats_pressure_done (CockpitChannelPrivate *priv)
+{
+  if (priv->pressure_time)
+    {
+      priv->stats->pressure_usec += g_get_monotonic_time () - priv->pressure_time;
+      priv->pressure_time = 0;
+    }
 }
 
 static void
@@ -170,6 +196,9 @@ process_recv (CockpitChannel *self,
     }
   else
     {
+      priv->stats->recv_messages++;
+      priv->stats->recv_bytes += g_bytes_get_size (payload);
+
       klass = COCKPIT_CHANNEL_GET_CLASS (self);
       if (klass->recv)
         (klass->recv) (self, payload);
@@ -221,7 +250,9 @@ process_pong (CockpitChannel *self,
               JsonObject *pong)
 {
   CockpitChannelPrivate *priv = cockpit_channel_get_instance_private (self);
+  PingTime *ping;
   gint64 sequence;
+  guint i;
 
   if (!priv->flow_control)
     return;
@@ -239,6 +270,18 @@ process_pong (CockpitChannel *self,
                  priv->id, sequence);
     }
 
+  /* Pongs acknowledge all pings up to their sequence */
+  for (i = 0; i < priv->ping_times->len; i++)
+    {
+      ping = &g_array_index (priv->ping_times, PingTime, i);
+      if (ping->sequence > sequence)
+        break;
+      if (ping->sequence == sequence)
+        cockpit_histogram_add (&priv->stats->ping_usec, g_get_monotonic_time () - ping->when);
+    }
+  if (i > 0)
+    g_array_remove_range (priv->ping_times, 0, i);
+
   if (sequence >= priv->out_window)
     {
       /* Up to this point has been confirmed received */
@@ -248,6 +291,7 @@ process_pong (CockpitChannel *self,
       if (priv->out_sequence <= priv->out_window)
         {
           g_debug ("%s: got acknowledge of enough data, relieving back pressure", priv->id);
+          stats_pressure_done (priv);
           cockpit_flow_emit_pressure (COCKPIT_FLOW (self), FALSE);
         }
     }
@@ -335,6 +379,7 @@ cockpit_channel_actual_send (CockpitChannel *self,
   GBytes *validated = NULL;
   guint64 out_sequence;
   JsonObject *ping;
+  PingTime when;
   gsize size;
 
   g_return_if_fail (priv->out_buffer == NULL);
@@ -348,6 +393,9 @@ cockpit_channel_actual_send (CockpitChannel *self,
 
   cockpit_transport_send (priv->transport, priv->id, payload);
 
+  priv->stats->sent_messages++;
+  priv->stats->sent_bytes += g_bytes_get_size (payload);
+
   /* A wraparound of our gint64 size? */
   if (priv->flow_control)
     {
@@ -371,14 +419,26 @@ cockpit_channel_actual_send (CockpitChannel *self,
           cockpit_channel_control (self, "ping", ping);
           g_debug ("%s: sending ping with sequence: %" G_GINT64_FORMAT, priv->id, out_sequence);
           json_object_unref (ping);
+
+          if (priv->ping_times->len >= CHANNEL_PING_TIMES)
+            g_array_remove_index (priv->ping_times, 0);
+          when.sequence = out_sequence;
+          when.when = g_get_monotonic_time ();
+          g_array_append_val (priv->ping_times, when);
         }
 
       priv->out_sequence = out_sequence;
 
+      /* Data sent but not yet acknowledged by the other side */
+      if (out_sequence + CHANNEL_FLOW_WINDOW - priv->out_window > priv->stats->unacked_high)
+        priv->stats->unacked_high = out_sequence + CHANNEL_FLOW_WINDOW - priv->out_window;
+
       if (trigger_pressure)
         {
           g_debug ("%s: sent too much data without acknowledgement, emitting back pressure until %"
                    G_GINT64_FORMAT, priv->id, priv->out_window);
+          priv->stats->pressure_count++;
+          priv->pressure_time = g_get_monotonic_time ();
           cockpit_flow_emit_pressure (COCKPIT_FLOW (self), TRUE);
         }
     }
@@ -415,9 +475,17 @@ cockpit_channel_constructed (GObject *object)
 {
   CockpitChannel *self = COCKPIT_CHANNEL (object);
   CockpitChannelPrivate *priv = cockpit_channel_get_instance_private (self);
+  const gchar *payload = NULL;
 
   G_OBJECT_CLASS (cockpit_channel_parent_class)->constructed (object);
 
+  if (priv->open_options && !cockpit_json_get_string (priv->open_options, "payload", NULL, &payload))
+    payload = NULL;
+  priv->stats = cockpit_stats_channel (payload);
+  priv->stats->opened++;
+  priv->stats->open++;
+  priv->open_time = g_get_monotonic_time ();
+
   g_return_if_fail (priv->id != NULL);
   g_return_if_fail (priv->transport != NULL);
 
@@ -649,6 +717,7 @@ cockpit_channel_finalize (GObject *object)
 
   g_strfreev (priv->capabilities);
   g_free (priv->id);
+  g_array_free (priv->ping_times, TRUE);
 
   G_OBJECT_CLASS (cockpit_channel_parent_class)->finalize (object);
 }
@@ -803,6 +872,12 @@ cockpit_channel_close (CockpitChannel *self,
     g_signal_handler_disconnect (priv->transport, priv->close_sig);
   priv->close_sig = 0;
 
+  if (!priv->emitted_close)
+    {
+      stats_pressure_done (priv);
+      priv->stats->open--;
+    }
+
   klass = COCKPIT_CHANNEL_GET_CLASS (self);
   g_assert (klass->close != NULL);
   priv->emitted_close = TRUE;
@@ -871,6 +946,12 @@ cockpit_channel_ready (CockpitChannel *self,
 
   g_object_ref (self);
 
+  if (priv->open_time)
+    {
+      cockpit_histogram_add (&priv->stats->ready_usec, g_get_monotonic_time () - priv->open_time);
+      priv->open_time = 0;
+    }
+
   cockpit_transport_thaw (priv->transport, priv->id);
   cockpit_channel_control (self, "ready", message);
 
@@ -0,0 +1,188 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpitcontentcache.h"
+
+/**
+ * CockpitContentCache:
+ *
+ * Holds on to content that is expensive to produce, such as the
+ * decompressed body of a package file, by key. The callers build keys
+ * which change whenever the content would, usually from a checksum.
+ *
+ * The total size of the content is bounded, and the least recently used
+ * entries are dropped to make room. A single entry may not take more
+ * than a quarter of the cache, so one large file can't push out all the
+ * others. A cache with a maximum size of zero never holds anything.
+ */
+
+/* No single entry larger than this fraction of the cache */
+#define ENTRY_FRACTION 4
+
+typedef struct {
+  gchar *key;
+  GBytes *content;
+  GList link;
+} Entry;
+
+struct _CockpitContentCache {
+  GHashTable *entries;
+  GQueue lru;
+  gsize max_size;
+  gsize size;
+};
+
+static void
+entry_free (gpointer data)
+{
+  Entry *entry = data;
+  g_free (entry->key);
+  g_bytes_unref (entry->content);
+  g_slice_free (Entry, entry);
+}
+
+CockpitContentCache *
+cockpit_content_cache_new (gsize max_size)
+{
+  CockpitContentCache *cache;
+
+  cache = g_new0 (CockpitContentCache, 1);
+  cache->entries = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, entry_free);
+  g_queue_init (&cache->lru);
+  cache->max_size = max_size;
+
+  return cache;
+}
+
+static void
+remove_entry (CockpitContentCache *cache,
+              Entry *entry)
+{
+  g_queue_unlink (&cache->lru, &entry->link);
+  cache->size -= g_bytes_get_size (entry->content);
+  g_hash_table_remove (cache->entries, entry->key);
+}
+
+/**
+ * cockpit_content_cache_lookup:
+ * @cache: the cache
+ * @key: the key the content was inserted with
+ *
+ * Returns: (transfer full): the content or NULL if not cached
+ */
+GBytes *
+cockpit_content_cache_lookup (CockpitContentCache *cache,
+                              const gchar *key)
+{
+  Entry *entry;
+
+  g_return_val_if_fail (cache != NULL, NULL);
+  g_return_val_if_fail (key != NULL, NULL);
+
+  entry = g_hash_table_lookup (cache->entries, key);
+  if (!entry)
+    return NULL;
+
+  /* Most recently used at the head */
+  g_queue_unlink (&cache->lru, &entry->link);
+  g_queue_push_head_link (&cache->lru, &entry->link);
+
+  return g_bytes_ref (entry->content);
+}
+
+/**
+ * cockpit_content_cache_insert:
+ * @cache: the cache
+ * @key: a key that identifies the content
+ * @content: the content to hold on to
+ *
+ * Add content to the cache, replacing anything already there for @key,
+ * and dropping older entries as necessary.
+ *
+ * Returns: FALSE if the content is too large to be cached
+ */
+gboolean
+cockpit_content_cache_insert (CockpitContentCache *cache,
+                              const gchar *key,
+                              GBytes *content)
+{
+  Entry *entry;
+  gsize length;
+
+  g_return_val_if_fail (cache != NULL, FALSE);
+  g_return_val_if_fail (key != NULL, FALSE);
+  g_return_val_if_fail (content != NULL, FALSE);
+
+  entry = g_hash_table_lookup (cache->entries, key);
+  if (entry)
+    remove_entry (cache, entry);
+
+  length = g_bytes_get_size (content);
+  if (cache->max_size == 0 || length > cache->max_size / ENTRY_FRACTION)
+    return FALSE;
+
+  while (cache->size + length > cache->max_size)
+    remove_entry (cache, g_queue_peek_tail_link (&cache->lru)->data);
+
+  entry = g_slice_new0 (Entry);
+  entry->key = g_strdup (key);
+  entry->content = g_bytes_ref (content);
+  entry->link.data = entry;
+
+  g_queue_push_head_link (&cache->lru, &entry->link);
+  g_hash_table_replace (cache->entries, entry->key, entry);
+  cache->size += length;
+
+  return TRUE;
+}
+
+void
+cockpit_content_cache_clear (CockpitContentCache *cache)
+{
+  g_return_if_fail (cache != NULL);
+
+  g_queue_init (&cache->lru);
+  g_hash_table_remove_all (cache->entries);
+  cache->size = 0;
+}
+
+/**
+ * cockpit_content_cache_get_size:
+ * @cache: the cache
+ *
+ * Returns: the total size of the cached content
+ */
+gsize
+cockpit_content_cache_get_size (CockpitContentCache *cache)
+{
+  g_return_val_if_fail (cache != NULL, 0);
+  return cache->size;
+}
+
+void
+cockpit_content_cache_free (CockpitContentCache *cache)
+{
+  if (!cache)
+    return;
+
+  g_hash_table_destroy (cache->entries);
+  g_free (cache);
+}
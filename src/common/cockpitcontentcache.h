@@ -0,0 +1,46 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __COCKPIT_CONTENT_CACHE_H__
+#define __COCKPIT_CONTENT_CACHE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _CockpitContentCache CockpitContentCache;
+
+CockpitContentCache *  cockpit_content_cache_new        (gsize max_size);
+
+void                   cockpit_content_cache_free       (CockpitContentCache *cache);
+
+GBytes *               cockpit_content_cache_lookup     (CockpitContentCache *cache,
+                                                         const gchar *key);
+
+gboolean               cockpit_content_cache_insert     (CockpitContentCache *cache,
+                                                         const gchar *key,
+                                                         GBytes *content);
+
+void                   cockpit_content_cache_clear      (CockpitContentCache *cache);
+
+gsize                  cockpit_content_cache_get_size   (CockpitContentCache *cache);
+
+G_END_DECLS
+
+#endif /* __COCKPIT_CONTENT_CACHE_H__ */
@@ -0,0 +1,44 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpitcpu.h"
+
+/**
+ * cockpit_cpu_has_avx2:
+ *
+ * Whether code built for AVX2 can run on this CPU. The answer is
+ * looked up once, so this is cheap to call on hot paths.
+ *
+ * Returns: TRUE if the CPU has AVX2
+ */
+gboolean
+cockpit_cpu_has_avx2 (void)
+{
+#ifdef COCKPIT_CPU_HAVE_AVX2
+  static gint have_avx2 = -1;
+
+  if (G_UNLIKELY (have_avx2 < 0))
+    have_avx2 = __builtin_cpu_supports ("avx2") ? 1 : 0;
+  return have_avx2;
+#else
+  return FALSE;
+#endif
+}
@@ -0,0 +1,42 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __COCKPIT_CPU_H__
+#define __COCKPIT_CPU_H__
+
+#include <glib.h>
+
+/*
+ * SSE2 is part of every x86_64 CPU, so code for it can be used as is.
+ * AVX2 code can be built here, but must only run when
+ * cockpit_cpu_has_avx2() says the CPU has it.
+ */
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define COCKPIT_CPU_HAVE_SSE2 1
+#define COCKPIT_CPU_HAVE_AVX2 1
+#endif
+
+G_BEGIN_DECLS
+
+gboolean      cockpit_cpu_has_avx2          (void);
+
+G_END_DECLS
+
+#endif /* __COCKPIT_CPU_H__ */
@@ -0,0 +1,426 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpithttpparser.h"
+
+#include "websocket/websocket.h"
+
+#include <string.h>
+
+/**
+ * CockpitHttpParser:
+ *
+ * Parses the request line and headers of an HTTP request as the data
+ * trickles in. Each call to cockpit_http_parser_feed() gets all of the
+ * request received so far, but only looks at what it hasn't seen before.
+ *
+ * Header names and values are kept in one string block, with an array of
+ * offsets into it. Looking up a header scans the few headers a request
+ * usually has, and only a request with many headers gets a hash table,
+ * built on the first lookup.
+ *
+ * The rules are those of web_socket_util_parse_req_line() and
+ * web_socket_util_parse_headers(). When a header appears more than once
+ * the last one wins.
+ */
+
+enum {
+  STATE_REQUEST_LINE,
+  STATE_HEADERS,
+  STATE_DONE,
+  STATE_INVALID,
+};
+
+typedef struct {
+  guint name;
+  guint value;
+} Header;
+
+/* Above this many headers, lookups build a hash table */
+#define LINEAR_LOOKUP 16
+
+void
+cockpit_http_parser_init (CockpitHttpParser *parser)
+{
+  memset (parser, 0, sizeof (CockpitHttpParser));
+  parser->state = STATE_REQUEST_LINE;
+  parser->strings = g_string_sized_new (512);
+  parser->headers = g_array_sized_new (FALSE, FALSE, sizeof (Header), 16);
+}
+
+void
+cockpit_http_parser_clear (CockpitHttpParser *parser)
+{
+  g_free (parser->method);
+  g_free (parser->path);
+  if (parser->strings)
+    g_string_free (parser->strings, TRUE);
+  if (parser->headers)
+    g_array_free (parser->headers, TRUE);
+  if (parser->lookup)
+    g_hash_table_unref (parser->lookup);
+  memset (parser, 0, sizeof (CockpitHttpParser));
+}
+
+static gboolean
+is_valid_line (const gchar *string,
+               gsize length)
+{
+  gsize i;
+
+  for (i = 0; i < length; i++)
+    {
+      if (string[i] != '\t')
+        {
+          if (string[i] < ' ' || string[i] & 0x80)
+            return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+static const gchar *
+skip_spaces (const gchar *start,
+             const gchar *end)
+{
+  while (start != end && start[0] == ' ')
+    start++;
+  return start;
+}
+
+static gboolean
+parse_request_line (CockpitHttpParser *parser,
+                    const gchar *data,
+                    const gchar *end)
+{
+  const gchar *method_end;
+  const gchar *path_beg;
+  const gchar *path_end;
+  const gchar *version;
+
+  /* GET /path/to/file HTTP/1.1 */
+  if (data[0] == ' ')
+    return FALSE;
+
+  method_end = memchr (data, ' ', end - data);
+  if (method_end == NULL)
+    return FALSE;
+
+  path_beg = skip_spaces (method_end + 1, end);
+  path_end = memchr (path_beg, ' ', end - path_beg);
+  if (path_end == NULL)
+    return FALSE;
+
+  version = skip_spaces (path_end + 1, end);
+  if (end - version < 8 ||
+      (memcmp (version, "HTTP/1.0", 8) != 0 &&
+       memcmp (version, "HTTP/1.1", 8) != 0))
+    return FALSE;
+
+  /* Acceptable trailing characters */
+  for (version += 8; version != end; version++)
+    {
+      if (version[0] != '\r' && version[0] != ' ')
+        return FALSE;
+    }
+
+  if (!is_valid_line (data, method_end - data) ||
+      !is_valid_line (path_beg, path_end - path_beg))
+    return FALSE;
+
+  parser->method = g_strndup (data, method_end - data);
+  parser->path = g_strndup (path_beg, path_end - path_beg);
+  return TRUE;
+}
+
+/* Strip like g_strstrip() would, which stops at the first null */
+static void
+strip_span (const gchar **data,
+            gsize *length)
+{
+  const gchar *nul;
+
+  nul = memchr (*data, '\0', *length);
+  if (nul)
+    *length = nul - *data;
+
+  while (*length > 0 && g_ascii_isspace ((*data)[0]))
+    {
+      (*data)++;
+      (*length)--;
+    }
+  while (*length > 0 && g_ascii_isspace ((*data)[*length - 1]))
+    (*length)--;
+}
+
+static gboolean
+parse_header_line (CockpitHttpParser *parser,
+                   const gchar *data,
+                   const gchar *line)
+{
+  const gchar *colon;
+  const gchar *name;
+  const gchar *value;
+  gsize name_len;
+  gsize value_len;
+  Header header;
+
+  colon = memchr (data, ':', line - data);
+  if (!colon)
+    {
+      g_debug ("received invalid header line: %.*s", (gint)(line - data), data);
+      return FALSE;
+    }
+
+  name = data;
+  name_len = colon - data;
+  strip_span (&name, &name_len);
+
+  value = colon + 1;
+  value_len = line - value;
+  strip_span (&value, &value_len);
+
+  if (!is_valid_line (name, name_len) || !g_utf8_validate (value, value_len, NULL))
+    {
+      g_debug ("received invalid header");
+      return FALSE;
+    }
+
+  /* The lookup table points into the strings, which may move */
+  if (parser->lookup)
+    {
+      g_hash_table_unref (parser->lookup);
+      parser->lookup = NULL;
+    }
+
+  header.name = parser->strings->len;
+  g_string_append_len (parser->strings, name, name_len);
+  g_string_append_c (parser->strings, '\0');
+  header.value = parser->strings->len;
+  g_string_append_len (parser->strings, value, value_len);
+  g_string_append_c (parser->strings, '\0');
+  g_array_append_val (parser->headers, header);
+
+  return TRUE;
+}
+
+/**
+ * cockpit_http_parser_feed:
+ * @parser: the parser
+ * @data: the request received so far
+ * @length: the length of @data
+ *
+ * Continue parsing the request. The @data must start at the beginning
+ * of the request, and contain everything given to previous calls.
+ *
+ * Returns: %COCKPIT_HTTP_PARSE_MORE when more data is needed,
+ *     %COCKPIT_HTTP_PARSE_DONE once the headers are complete, or an
+ *     error for an invalid request line or header.
+ */
+CockpitHttpParseResult
+cockpit_http_parser_feed (CockpitHttpParser *parser,
+                          const gchar *data,
+                          gsize length)
+{
+  const gchar *start;
+  const gchar *line;
+
+  g_return_val_if_fail (data != NULL || length == 0, COCKPIT_HTTP_PARSE_BAD_REQUEST_LINE);
+  g_return_val_if_fail (length >= parser->offset, COCKPIT_HTTP_PARSE_BAD_REQUEST_LINE);
+
+  while (parser->state == STATE_REQUEST_LINE || parser->state == STATE_HEADERS)
+    {
+      start = data + parser->offset;
+
+      /* Only look for the line ending in what's new */
+      line = memchr (data + parser->scanned, '\n', length - parser->scanned);
+      if (line == NULL)
+        {
+          parser->scanned = length;
+          return COCKPIT_HTTP_PARSE_MORE;
+        }
+      line++;
+
+      if (parser->state == STATE_REQUEST_LINE)
+        {
+          if (!parse_request_line (parser, start, line - 1))
+            {
+              parser->state = STATE_INVALID;
+              return COCKPIT_HTTP_PARSE_BAD_REQUEST_LINE;
+            }
+          parser->state = STATE_HEADERS;
+        }
+
+      /* An empty line, all done */
+      else if ((start[0] == '\r' && start[1] == '\n') || start[0] == '\n')
+        {
+          parser->state = STATE_DONE;
+        }
+
+      else if (!parse_header_line (parser, start, line))
+        {
+          parser->state = STATE_INVALID;
+          return COCKPIT_HTTP_PARSE_BAD_HEADER;
+        }
+
+      parser->offset = parser->scanned = line - data;
+    }
+
+  if (parser->state == STATE_DONE)
+    return COCKPIT_HTTP_PARSE_DONE;
+  else if (parser->method)
+    return COCKPIT_HTTP_PARSE_BAD_HEADER;
+  else
+    return COCKPIT_HTTP_PARSE_BAD_REQUEST_LINE;
+}
+
+/**
+ * cockpit_http_parser_get_length:
+ * @parser: the parser
+ *
+ * Returns: the number of bytes parsed so far, once done the length
+ *     of the request line and headers together
+ */
+gsize
+cockpit_http_parser_get_length (CockpitHttpParser *parser)
+{
+  return parser->offset;
+}
+
+/**
+ * cockpit_http_parser_get_method:
+ * @parser: the parser
+ *
+ * Returns: the method, or NULL if the request line isn't parsed yet
+ */
+const gchar *
+cockpit_http_parser_get_method (CockpitHttpParser *parser)
+{
+  return parser->method;
+}
+
+/**
+ * cockpit_http_parser_get_path:
+ * @parser: the parser
+ *
+ * Returns: the path, or NULL if the request line isn't parsed yet
+ */
+const gchar *
+cockpit_http_parser_get_path (CockpitHttpParser *parser)
+{
+  return parser->path;
+}
+
+guint
+cockpit_http_parser_n_headers (CockpitHttpParser *parser)
+{
+  return parser->headers->len;
+}
+
+static guint
+str_case_hash (gconstpointer v)
+{
+  const signed char *p;
+  guint32 h = 5381;
+  for (p = v; *p != '\0'; p++)
+    h = (h << 5) + h + g_ascii_tolower (*p);
+  return h;
+}
+
+static gboolean
+str_case_equal (gconstpointer v1,
+                gconstpointer v2)
+{
+  return g_ascii_strcasecmp (v1, v2) == 0;
+}
+
+/**
+ * cockpit_http_parser_get_header:
+ * @parser: the parser
+ * @name: the header name, in any case
+ *
+ * Returns: the value of the last header called @name, or NULL
+ */
+const gchar *
+cockpit_http_parser_get_header (CockpitHttpParser *parser,
+                                const gchar *name)
+{
+  const gchar *strings = parser->strings->str;
+  Header *header;
+  gpointer value;
+  guint i;
+
+  g_return_val_if_fail (name != NULL, NULL);
+
+  if (parser->headers->len <= LINEAR_LOOKUP)
+    {
+      for (i = parser->headers->len; i > 0; i--)
+        {
+          header = &g_array_index (parser->headers, Header, i - 1);
+          if (g_ascii_strcasecmp (strings + header->name, name) == 0)
+            return strings + header->value;
+        }
+      return NULL;
+    }
+
+  /* Later headers replace earlier ones of the same name */
+  if (!parser->lookup)
+    {
+      parser->lookup = g_hash_table_new (str_case_hash, str_case_equal);
+      for (i = 0; i < parser->headers->len; i++)
+        {
+          header = &g_array_index (parser->headers, Header, i);
+          g_hash_table_replace (parser->lookup, (gpointer)(strings + header->name),
+                                GUINT_TO_POINTER (header->value));
+        }
+    }
+
+  if (!g_hash_table_lookup_extended (parser->lookup, name, NULL, &value))
+    return NULL;
+  return strings + GPOINTER_TO_UINT (value);
+}
+
+/**
+ * cockpit_http_parser_build_headers:
+ * @parser: the parser
+ *
+ * Build the headers into a table as made by web_socket_util_new_headers().
+ *
+ * Returns: (transfer full): the headers
+ */
+GHashTable *
+cockpit_http_parser_build_headers (CockpitHttpParser *parser)
+{
+  const gchar *strings = parser->strings->str;
+  GHashTable *headers;
+  Header *header;
+  guint i;
+
+  headers = web_socket_util_new_headers ();
+  for (i = 0; i < parser->headers->len; i++)
+    {
+      header = &g_array_index (parser->headers, Header, i);
+      g_hash_table_replace (headers, g_strdup (strings + header->name), g_strdup (strings + header->value));
+    }
+
+  return headers;
+}
@@ -0,0 +1,69 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __COCKPIT_HTTP_PARSER_H__
+#define __COCKPIT_HTTP_PARSER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+  COCKPIT_HTTP_PARSE_MORE = 0,
+  COCKPIT_HTTP_PARSE_DONE,
+  COCKPIT_HTTP_PARSE_BAD_REQUEST_LINE,
+  COCKPIT_HTTP_PARSE_BAD_HEADER,
+} CockpitHttpParseResult;
+
+/* Usually allocated as part of something else, the fields are private */
+typedef struct {
+  gint state;
+  gsize offset;
+  gsize scanned;
+  gchar *method;
+  gchar *path;
+  GString *strings;
+  GArray *headers;
+  GHashTable *lookup;
+} CockpitHttpParser;
+
+void                     cockpit_http_parser_init          (CockpitHttpParser *parser);
+
+void                     cockpit_http_parser_clear         (CockpitHttpParser *parser);
+
+CockpitHttpParseResult   cockpit_http_parser_feed          (CockpitHttpParser *parser,
+                                                            const gchar *data,
+                                                            gsize length);
+
+gsize                    cockpit_http_parser_get_length    (CockpitHttpParser *parser);
+
+const gchar *            cockpit_http_parser_get_method    (CockpitHttpParser *parser);
+
+const gchar *            cockpit_http_parser_get_path      (CockpitHttpParser *parser);
+
+guint                    cockpit_http_parser_n_headers     (CockpitHttpParser *parser);
+
+const gchar *            cockpit_http_parser_get_header    (CockpitHttpParser *parser,
+                                                            const gchar *name);
+
+GHashTable *             cockpit_http_parser_build_headers (CockpitHttpParser *parser);
+
+G_END_DECLS
+
+#endif /* __COCKPIT_HTTP_PARSER_H__ */
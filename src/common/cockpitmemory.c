@@ -28,6 +28,10 @@
 #include <string.h>
 #include <errno.h>
 
+#ifdef HAVE_MALLOC_TRIM
+#include <malloc.h>
+#endif
+
 /**
  * cockpit_memory_clear:
  *
@@ -50,6 +54,21 @@ cockpit_memory_clear (void * data,
   explicit_bzero (data, len);
 }
 
+/**
+ * cockpit_memory_trim:
+ *
+ * Hand memory that the allocator keeps around after a burst of
+ * allocations back to the kernel. Long running processes call this
+ * from time to time, it does nothing where the C library can't.
+ */
+void
+cockpit_memory_trim (void)
+{
+#ifdef HAVE_MALLOC_TRIM
+  malloc_trim (0);
+#endif
+}
+
 static void
 abort_errno (const char *msg)
 {
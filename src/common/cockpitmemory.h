@@ -25,6 +25,8 @@
 void     cockpit_memory_clear            (void *data,
                                           ssize_t length);
 
+void     cockpit_memory_trim             (void);
+
 /* variants of glibc functions that abort() on ENOMEM */
 void *   mallocx                         (size_t size);
 void *   callocx                         (size_t nmemb, size_t size);
@@ -21,6 +21,7 @@
 
 #include "cockpitpipe.h"
 
+#include "cockpitbufferpool.h"
 #include "cockpitcloserange.h"
 #include "cockpitflow.h"
 #include "cockpitunicode.h"
@@ -101,6 +102,7 @@ typedef struct {
   gboolean in_done;
   GSource *in_source;
   GByteArray *in_buffer;
+  gsize in_size;
 
   int err_fd;
   gboolean err_done;
@@ -330,6 +332,7 @@ dispatch_input (gint fd,
   if (cond != G_IO_HUP)
     {
       g_byte_array_set_size (priv->in_buffer, len + DEF_PACKET_SIZE);
+      priv->in_size = MAX (priv->in_size, priv->in_buffer->len);
       g_debug ("%s: reading input %x", priv->name, cond);
       ret = read (priv->in_fd, priv->in_buffer->data + len, DEF_PACKET_SIZE);
 
@@ -1534,6 +1537,51 @@ cockpit_pipe_get_buffer (CockpitPipe *self)
   return priv->in_buffer;
 }
 
+/**
+ * cockpit_pipe_get_memory_size:
+ * @self: a pipe
+ *
+ * Get an estimate of the memory held by the pipe, in its input
+ * buffer and its queue of output.
+ *
+ * Returns: the number of bytes held
+ */
+gsize
+cockpit_pipe_get_memory_size (CockpitPipe *self)
+{
+  CockpitPipePrivate *priv = cockpit_pipe_get_instance_private (self);
+
+  g_return_val_if_fail (COCKPIT_IS_PIPE (self), 0);
+  return MAX (priv->in_size, priv->in_buffer->len) + priv->out_queued;
+}
+
+/**
+ * cockpit_pipe_compact:
+ * @self: a pipe
+ *
+ * The input buffer stays as large as the largest amount of data
+ * that was ever waiting in it. Call this when the pipe has been
+ * quiet for a while, to release that space. The buffer returned
+ * by cockpit_pipe_get_buffer() changes.
+ */
+void
+cockpit_pipe_compact (CockpitPipe *self)
+{
+  CockpitPipePrivate *priv = cockpit_pipe_get_instance_private (self);
+  GByteArray *buffer;
+
+  g_return_if_fail (COCKPIT_IS_PIPE (self));
+
+  if (priv->in_size <= priv->in_buffer->len)
+    return;
+
+  buffer = g_byte_array_sized_new (priv->in_buffer->len);
+  g_byte_array_append (buffer, priv->in_buffer->data, priv->in_buffer->len);
+  g_byte_array_unref (priv->in_buffer);
+  priv->in_buffer = buffer;
+  priv->in_size = buffer->len;
+}
+
 GByteArray *
 cockpit_pipe_get_stderr (CockpitPipe *self)
 {
@@ -1651,7 +1699,7 @@ cockpit_pipe_consume (GByteArray *buffer,
     }
   else
     {
-      bytes = g_bytes_new (buffer->data + before, length);
+      bytes = cockpit_buffer_pool_copy_bytes (buffer->data + before, length);
       g_byte_array_remove_range (buffer, 0, before + length + after);
     }
 
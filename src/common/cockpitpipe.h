@@ -85,6 +85,10 @@ const gchar *      cockpit_pipe_get_name     (CockpitPipe *self);
 
 GByteArray *       cockpit_pipe_get_buffer   (CockpitPipe *self);
 
+gsize              cockpit_pipe_get_memory_size (CockpitPipe *self);
+
+void               cockpit_pipe_compact      (CockpitPipe *self);
+
 GByteArray *       cockpit_pipe_get_stderr   (CockpitPipe *self);
 
 gchar *            cockpit_pipe_take_stderr_as_utf8 (CockpitPipe *self);
@@ -21,6 +21,7 @@
 
 #include "cockpitpipetransport.h"
 
+#include "cockpitbufferpool.h"
 #include "cockpitframe.h"
 #include "cockpitpipe.h"
 
@@ -35,6 +36,9 @@
 #include <string.h>
 #include <unistd.h>
 
+/* Messages up to this size are copied together with their prefix */
+#define SMALL_MESSAGE 4096
+
 /**
  * CockpitPipeTransport:
  *
@@ -215,14 +219,43 @@ cockpit_pipe_transport_finalize (GObject *object)
   G_OBJECT_CLASS (cockpit_pipe_transport_parent_class)->finalize (object);
 }
 
+/* Takes ownership of the pooled prefix */
+static void
+write_message (CockpitPipeTransport *self,
+               gchar *prefix,
+               gsize prefix_len,
+               GBytes *payload)
+{
+  GBytes *message;
+  gsize payload_len;
+
+  payload_len = g_bytes_get_size (payload);
+
+  /* Small messages are written in one piece, large ones aren't copied */
+  if (payload_len <= SMALL_MESSAGE)
+    {
+      message = cockpit_buffer_pool_concat_bytes (prefix, prefix_len, payload);
+      cockpit_buffer_pool_free (prefix);
+      cockpit_pipe_write (self->pipe, message);
+      g_bytes_unref (message);
+    }
+  else
+    {
+      message = cockpit_buffer_pool_take_bytes (prefix, prefix_len);
+      cockpit_pipe_write (self->pipe, message);
+      cockpit_pipe_write (self->pipe, payload);
+      g_bytes_unref (message);
+    }
+}
+
 static void
 cockpit_pipe_transport_send (CockpitTransport *transport,
                              const gchar *channel_id,
                              GBytes *payload)
 {
   CockpitPipeTransport *self = COCKPIT_PIPE_TRANSPORT (transport);
-  GBytes *prefix;
-  gchar *prefix_str;
+  gchar *prefix;
+  gsize prefix_len;
   gsize payload_len;
   gsize channel_len;
 
@@ -235,18 +268,40 @@ cockpit_pipe_transport_send (CockpitTransport *transport,
   channel_len = channel_id ? strlen (channel_id) : 0;
   payload_len = g_bytes_get_size (payload);
 
-  prefix_str = g_strdup_printf ("%" G_GSIZE_FORMAT "\n%s\n",
-                                channel_len + 1 + payload_len,
-                                channel_id ? channel_id : "");
-  prefix = g_bytes_new_take (prefix_str, strlen (prefix_str));
-
-  cockpit_pipe_write (self->pipe, prefix);
-  cockpit_pipe_write (self->pipe, payload);
-  g_bytes_unref (prefix);
+  /* Room for the length, two newlines, the channel and a null */
+  prefix = cockpit_buffer_pool_alloc (channel_len + 24);
+  prefix_len = g_snprintf (prefix, channel_len + 24, "%" G_GSIZE_FORMAT "\n%s\n",
+                           channel_len + 1 + payload_len,
+                           channel_id ? channel_id : "");
 
+  write_message (self, prefix, prefix_len, payload);
   g_debug ("%s: queued %" G_GSIZE_FORMAT " byte payload", self->name, payload_len);
 }
 
+static void
+cockpit_pipe_transport_send_frame (CockpitTransport *transport,
+                                   GBytes *frame)
+{
+  CockpitPipeTransport *self = COCKPIT_PIPE_TRANSPORT (transport);
+  gchar *prefix;
+  gsize prefix_len;
+  gsize frame_len;
+
+  if (self->closed)
+    {
+      g_debug ("dropping message on closed transport");
+      return;
+    }
+
+  /* The frame already has its channel, only the length is needed */
+  frame_len = g_bytes_get_size (frame);
+  prefix = cockpit_buffer_pool_alloc (24);
+  prefix_len = g_snprintf (prefix, 24, "%" G_GSIZE_FORMAT "\n", frame_len);
+
+  write_message (self, prefix, prefix_len, frame);
+  g_debug ("%s: queued %" G_GSIZE_FORMAT " byte frame", self->name, frame_len);
+}
+
 static void
 cockpit_pipe_transport_close (CockpitTransport *transport,
                               const gchar *problem)
@@ -262,6 +317,7 @@ cockpit_pipe_transport_class_init (CockpitPipeTransportClass *klass)
   CockpitTransportClass *transport_class = COCKPIT_TRANSPORT_CLASS (klass);
 
   transport_class->send = cockpit_pipe_transport_send;
+  transport_class->send_frame = cockpit_pipe_transport_send_frame;
   transport_class->close = cockpit_pipe_transport_close;
 
   gobject_class->constructed = cockpit_pipe_transport_constructed;
@@ -369,13 +425,8 @@ cockpit_transport_read_from_pipe (CockpitTransport *self,
         }
 
       g_autoptr(GBytes) message = cockpit_pipe_consume (input, i, size, 0);
-      g_autofree gchar *channel = NULL;
-      g_autoptr(GBytes) payload = cockpit_transport_parse_frame (message, &channel);
-      if (payload)
-        {
-          g_debug ("%s: received a %d byte payload", logname, (int)size);
-          cockpit_transport_emit_recv (self, channel, payload);
-        }
+      g_debug ("%s: received a %d byte frame", logname, (int)size);
+      cockpit_transport_emit_frame (self, message);
     }
 
   if (end_of_data)
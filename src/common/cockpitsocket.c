@@ -22,6 +22,8 @@
 #include <sys/socket.h>
 #include <gio/gio.h>
 
+#include <errno.h>
+
 /* _always_ takes ownership of fd, even in error case */
 static gpointer
 cockpit_socket_new_take_fd (int      fd,
@@ -86,3 +88,61 @@ cockpit_socket_streampair (GIOStream **one,
   *two = cockpit_socket_connection_new_take_fd (G_TYPE_IO_STREAM, sv[1], &error);
   g_assert_no_error (error);
 }
+
+/**
+ * cockpit_socket_write_vectors:
+ * @io: the stream to write to
+ * @output: the pollable output stream of @io
+ * @iov: the vectors to write
+ * @n_iov: the number of vectors, at most COCKPIT_SOCKET_OUTPUT_VECTORS
+ * @error: location to place an error
+ *
+ * Write as much of @iov as possible without blocking. Plain sockets get
+ * all the vectors in one sendmsg() call. GLib doesn't have vectored
+ * writes for pollable streams, so other streams, like TLS, get the
+ * vectors one at a time until one would block.
+ *
+ * Returns: the number of bytes written, or -1 with @error set
+ */
+gssize
+cockpit_socket_write_vectors (GIOStream *io,
+                              GPollableOutputStream *output,
+                              struct iovec *iov,
+                              guint n_iov,
+                              GError **error)
+{
+  struct msghdr msg = { .msg_iov = iov, .msg_iovlen = n_iov };
+  GSocket *socket;
+  gssize written = 0;
+  gssize count;
+  int errn;
+  guint i;
+
+  if (G_IS_SOCKET_CONNECTION (io))
+    {
+      socket = g_socket_connection_get_socket (G_SOCKET_CONNECTION (io));
+      do
+        count = sendmsg (g_socket_get_fd (socket), &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+      while (count < 0 && errno == EINTR);
+
+      if (count < 0)
+        {
+          errn = errno;
+          g_set_error_literal (error, G_IO_ERROR, g_io_error_from_errno (errn), g_strerror (errn));
+        }
+      return count;
+    }
+
+  for (i = 0; i < n_iov; i++)
+    {
+      count = g_pollable_output_stream_write_nonblocking (output, iov[i].iov_base, iov[i].iov_len,
+                                                          NULL, written > 0 ? NULL : error);
+      if (count < 0)
+        return written > 0 ? written : -1;
+      written += count;
+      if ((gsize)count < iov[i].iov_len)
+        break;
+    }
+
+  return written;
+}
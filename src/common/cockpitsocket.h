@@ -21,6 +21,11 @@
 
 #include <gio/gio.h>
 
+#include <sys/uio.h>
+
+/* The most vectors to hand to cockpit_socket_write_vectors() at once */
+#define COCKPIT_SOCKET_OUTPUT_VECTORS 64
+
 void
 cockpit_socket_socketpair (GSocket **one,
                            GSocket **two);
@@ -28,3 +33,10 @@ cockpit_socket_socketpair (GSocket **one,
 void
 cockpit_socket_streampair (GIOStream **one,
                            GIOStream **two);
+
+gssize
+cockpit_socket_write_vectors (GIOStream *io,
+                              GPollableOutputStream *output,
+                              struct iovec *iov,
+                              guint n_iov,
+                              GError **error);
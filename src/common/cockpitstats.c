@@ -0,0 +1,296 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpitstats.h"
+
+#include "cockpitbufferpool.h"
+
+#include <string.h>
+
+/**
+ * CockpitStats:
+ *
+ * Process wide counters about channel traffic. Channels are aggregated
+ * by their payload type, so the amount of bookkeeping does not depend on
+ * how many channels come and go.
+ *
+ * The CockpitChannelStats pointers handed out stay valid for the lifetime
+ * of the process, cockpit_stats_reset() only zeroes them. This allows
+ * channels to hold on to them without any reference counting.
+ *
+ * Times are tracked in microseconds of the monotonic clock.
+ */
+
+static GHashTable *channel_stats = NULL;
+static CockpitTransportStats transport_stats;
+static CockpitRouterStats router_stats;
+
+static guint
+histogram_bucket (guint64 value)
+{
+  guint bucket = 0;
+
+  /* The number of significant bits: 0, 1, 2-3, 4-7, ... */
+  while (value && bucket < COCKPIT_HISTOGRAM_BUCKETS - 1)
+    {
+      value >>= 1;
+      bucket++;
+    }
+
+  return bucket;
+}
+
+void
+cockpit_histogram_add (CockpitHistogram *histogram,
+                       guint64 value)
+{
+  g_return_if_fail (histogram != NULL);
+
+  histogram->count++;
+  histogram->sum += value;
+  if (value > histogram->max)
+    histogram->max = value;
+  histogram->buckets[histogram_bucket (value)]++;
+}
+
+guint64
+cockpit_histogram_mean (const CockpitHistogram *histogram)
+{
+  g_return_val_if_fail (histogram != NULL, 0);
+
+  if (histogram->count == 0)
+    return 0;
+  return histogram->sum / histogram->count;
+}
+
+/**
+ * cockpit_histogram_percentile:
+ * @histogram: the histogram
+ * @fraction: the percentile between 0.0 and 1.0
+ *
+ * Estimate a percentile of the values added to @histogram. The
+ * result is the upper bound of the bucket that contains the percentile,
+ * but never more than the largest value actually seen.
+ *
+ * Returns: the estimated value, or zero if the histogram is empty
+ */
+guint64
+cockpit_histogram_percentile (const CockpitHistogram *histogram,
+                              gdouble fraction)
+{
+  guint64 wanted;
+  guint64 seen = 0;
+  guint64 bound;
+  guint i;
+
+  g_return_val_if_fail (histogram != NULL, 0);
+  g_return_val_if_fail (fraction >= 0.0 && fraction <= 1.0, 0);
+
+  if (histogram->count == 0)
+    return 0;
+
+  wanted = (guint64)(fraction * histogram->count + 0.5);
+  if (wanted == 0)
+    wanted = 1;
+
+  for (i = 0; i < COCKPIT_HISTOGRAM_BUCKETS; i++)
+    {
+      seen += histogram->buckets[i];
+      if (seen >= wanted)
+        break;
+    }
+
+  if (i == 0)
+    return 0;
+  if (i >= COCKPIT_HISTOGRAM_BUCKETS - 1)
+    return histogram->max;
+
+  bound = (G_GUINT64_CONSTANT (1) << i) - 1;
+  return MIN (bound, histogram->max);
+}
+
+/**
+ * cockpit_stats_channel:
+ * @payload: the payload type of the channel or NULL
+ *
+ * Get the counters for channels of the given @payload type.
+ *
+ * Returns: (transfer none): the counters, never NULL
+ */
+CockpitChannelStats *
+cockpit_stats_channel (const gchar *payload)
+{
+  CockpitChannelStats *stats;
+
+  if (payload == NULL)
+    payload = "";
+
+  if (!channel_stats)
+    channel_stats = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  stats = g_hash_table_lookup (channel_stats, payload);
+  if (!stats)
+    {
+      stats = g_new0 (CockpitChannelStats, 1);
+      g_hash_table_insert (channel_stats, g_strdup (payload), stats);
+    }
+
+  return stats;
+}
+
+CockpitTransportStats *
+cockpit_stats_transport (void)
+{
+  return &transport_stats;
+}
+
+CockpitRouterStats *
+cockpit_stats_router (void)
+{
+  return &router_stats;
+}
+
+void
+cockpit_stats_foreach_channel (CockpitStatsChannelFunc func,
+                               gpointer user_data)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_return_if_fail (func != NULL);
+
+  if (!channel_stats)
+    return;
+
+  g_hash_table_iter_init (&iter, channel_stats);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    func (key, value, user_data);
+}
+
+static JsonObject *
+histogram_to_json (const CockpitHistogram *histogram)
+{
+  JsonObject *object = json_object_new ();
+
+  json_object_set_int_member (object, "count", histogram->count);
+  json_object_set_int_member (object, "mean", cockpit_histogram_mean (histogram));
+  json_object_set_int_member (object, "p50", cockpit_histogram_percentile (histogram, 0.50));
+  json_object_set_int_member (object, "p99", cockpit_histogram_percentile (histogram, 0.99));
+  json_object_set_int_member (object, "max", histogram->max);
+
+  return object;
+}
+
+static void
+add_channel_json (const gchar *payload,
+                  CockpitChannelStats *stats,
+                  gpointer user_data)
+{
+  JsonObject *channels = user_data;
+  JsonObject *object = json_object_new ();
+
+  json_object_set_int_member (object, "opened", stats->opened);
+  json_object_set_int_member (object, "open", stats->open);
+  json_object_set_int_member (object, "recv-messages", stats->recv_messages);
+  json_object_set_int_member (object, "recv-bytes", stats->recv_bytes);
+  json_object_set_int_member (object, "sent-messages", stats->sent_messages);
+  json_object_set_int_member (object, "sent-bytes", stats->sent_bytes);
+  json_object_set_int_member (object, "unacked-high", stats->unacked_high);
+  json_object_set_int_member (object, "pressure-count", stats->pressure_count);
+  json_object_set_int_member (object, "pressure-usec", stats->pressure_usec);
+  json_object_set_object_member (object, "ready-usec", histogram_to_json (&stats->ready_usec));
+  json_object_set_object_member (object, "ping-usec", histogram_to_json (&stats->ping_usec));
+
+  json_object_set_object_member (channels, payload, object);
+}
+
+/**
+ * cockpit_stats_to_json:
+ *
+ * Build a snapshot of all the counters, suitable for sending
+ * over the wire or for debugging.
+ *
+ * Returns: (transfer full): a new JSON object
+ */
+JsonObject *
+cockpit_stats_to_json (void)
+{
+  JsonObject *root = json_object_new ();
+  JsonObject *channels = json_object_new ();
+  CockpitBufferPoolStats pool;
+  JsonObject *object;
+
+  cockpit_stats_foreach_channel (add_channel_json, channels);
+  json_object_set_object_member (root, "channels", channels);
+
+  object = json_object_new ();
+  json_object_set_int_member (object, "recv-messages", transport_stats.recv_messages);
+  json_object_set_int_member (object, "recv-bytes", transport_stats.recv_bytes);
+  json_object_set_int_member (object, "sent-messages", transport_stats.sent_messages);
+  json_object_set_int_member (object, "sent-bytes", transport_stats.sent_bytes);
+  json_object_set_int_member (object, "frozen-high", transport_stats.frozen_high);
+  json_object_set_object_member (root, "transport", object);
+
+  object = json_object_new ();
+  json_object_set_int_member (object, "opens", router_stats.opens);
+  json_object_set_int_member (object, "kills", router_stats.kills);
+  json_object_set_object_member (object, "route-usec", histogram_to_json (&router_stats.route_usec));
+  json_object_set_object_member (root, "router", object);
+
+  cockpit_buffer_pool_get_stats (&pool);
+  object = json_object_new ();
+  json_object_set_int_member (object, "allocated", pool.allocated);
+  json_object_set_int_member (object, "reused", pool.reused);
+  json_object_set_int_member (object, "oversize", pool.oversize);
+  json_object_set_int_member (object, "outstanding", pool.outstanding);
+  json_object_set_int_member (object, "cached-bytes", pool.cached_bytes);
+  json_object_set_int_member (object, "released", pool.released);
+  json_object_set_object_member (root, "buffers", object);
+
+  return root;
+}
+
+static void
+reset_channel (const gchar *payload,
+               CockpitChannelStats *stats,
+               gpointer user_data)
+{
+  guint64 open = stats->open;
+
+  /* Channels that are still open will decrement this when they close */
+  memset (stats, 0, sizeof (CockpitChannelStats));
+  stats->open = open;
+}
+
+/**
+ * cockpit_stats_reset:
+ *
+ * Zero all the counters. Pointers previously returned from
+ * cockpit_stats_channel() and friends remain valid.
+ */
+void
+cockpit_stats_reset (void)
+{
+  cockpit_stats_foreach_channel (reset_channel, NULL);
+  memset (&transport_stats, 0, sizeof (transport_stats));
+  memset (&router_stats, 0, sizeof (router_stats));
+  cockpit_buffer_pool_reset_stats ();
+}
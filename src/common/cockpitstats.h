@@ -0,0 +1,93 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __COCKPIT_STATS_H__
+#define __COCKPIT_STATS_H__
+
+#include <glib.h>
+#include <json-glib/json-glib.h>
+
+G_BEGIN_DECLS
+
+/* Power of two buckets, the last one catches everything larger */
+#define COCKPIT_HISTOGRAM_BUCKETS 32
+
+typedef struct {
+  guint64 count;
+  guint64 sum;
+  guint64 max;
+  guint64 buckets[COCKPIT_HISTOGRAM_BUCKETS];
+} CockpitHistogram;
+
+typedef struct {
+  guint64 opened;
+  guint64 open;
+  guint64 recv_messages;
+  guint64 recv_bytes;
+  guint64 sent_messages;
+  guint64 sent_bytes;
+  guint64 unacked_high;
+  guint64 pressure_count;
+  guint64 pressure_usec;
+  CockpitHistogram ready_usec;
+  CockpitHistogram ping_usec;
+} CockpitChannelStats;
+
+typedef struct {
+  guint64 recv_messages;
+  guint64 recv_bytes;
+  guint64 sent_messages;
+  guint64 sent_bytes;
+  guint64 frozen_high;
+} CockpitTransportStats;
+
+typedef struct {
+  guint64 opens;
+  guint64 kills;
+  CockpitHistogram route_usec;
+} CockpitRouterStats;
+
+typedef void      (* CockpitStatsChannelFunc)            (const gchar *payload,
+                                                          CockpitChannelStats *stats,
+                                                          gpointer user_data);
+
+void                    cockpit_histogram_add            (CockpitHistogram *histogram,
+                                                          guint64 value);
+
+guint64                 cockpit_histogram_mean           (const CockpitHistogram *histogram);
+
+guint64                 cockpit_histogram_percentile     (const CockpitHistogram *histogram,
+                                                          gdouble fraction);
+
+CockpitChannelStats *   cockpit_stats_channel            (const gchar *payload);
+
+CockpitTransportStats * cockpit_stats_transport          (void);
+
+CockpitRouterStats *    cockpit_stats_router             (void);
+
+void                    cockpit_stats_foreach_channel    (CockpitStatsChannelFunc func,
+                                                          gpointer user_data);
+
+JsonObject *            cockpit_stats_to_json            (void);
+
+void                    cockpit_stats_reset              (void);
+
+G_END_DECLS
+
+#endif /* __COCKPIT_STATS_H__ */
@@ -22,12 +22,12 @@
 #include "cockpittransport.h"
 
 #include "common/cockpitjson.h"
+#include "common/cockpitstats.h"
 
 #include <stdlib.h>
 #include <string.h>
 
 typedef struct {
-    gconstpointer channel;
     JsonObject *control;
     GBytes *data;
 } FrozenMessage;
@@ -43,6 +43,39 @@ frozen_message_free (gpointer data)
   g_slice_free (FrozenMessage, frozen);
 }
 
+/*
+ * Each frozen channel has its own queue, so that queueing a message
+ * and thawing a channel don't depend on how many other channels are
+ * frozen or how many messages they have queued.
+ */
+typedef struct {
+    gchar *channel;
+    GQueue messages;
+} FrozenChannel;
+
+static void
+frozen_channel_free (gpointer data)
+{
+  FrozenChannel *frozen = data;
+  FrozenMessage *message;
+
+  while ((message = g_queue_pop_head (&frozen->messages)))
+    frozen_message_free (message);
+  g_free (frozen->channel);
+  g_slice_free (FrozenChannel, frozen);
+}
+
+typedef struct {
+    CockpitTransportInterceptFunc func;
+    gpointer user_data;
+} Intercept;
+
+static void
+intercept_free (gpointer data)
+{
+  g_slice_free (Intercept, data);
+}
+
 enum {
   RECV,
   CONTROL,
@@ -53,8 +86,16 @@ enum {
 static guint signals[NUM_SIGNALS];
 
 typedef struct {
+  /* Channel id to FrozenChannel */
   GHashTable *freeze;
-  GQueue *frozen;
+  guint n_frozen;
+
+  /* Channel id to Intercept for outgoing control messages */
+  GHashTable *intercepts;
+
+  /* Channel id to CockpitTransport that its messages are relayed to */
+  GHashTable *relays;
+  CockpitTransport *relay_default;
 } CockpitTransportPrivate;
 
 G_DEFINE_ABSTRACT_TYPE_WITH_CODE (CockpitTransport, cockpit_transport, G_TYPE_OBJECT,
@@ -82,27 +123,29 @@ maybe_freeze_message (CockpitTransport *self,
                       GBytes *data)
 {
   CockpitTransportPrivate *priv = cockpit_transport_get_instance_private (self);
-  FrozenMessage *frozen = NULL;
+  CockpitTransportStats *stats;
+  FrozenChannel *frozen;
+  FrozenMessage *message;
 
-  if (priv->freeze && channel)
-    {
-      /* Note that we dig out the real value for the channel */
-      channel = g_hash_table_lookup (priv->freeze, channel);
-      if (channel)
-        {
-          frozen = g_slice_new0 (FrozenMessage);
-          frozen->channel = channel; /* owned by hashtable */
-          frozen->data = g_bytes_ref (data);
-          if (control)
-            frozen->control = json_object_ref (control);
-          if (!priv->frozen)
-            priv->frozen = g_queue_new ();
-          g_queue_push_tail (priv->frozen, frozen);
-          return TRUE;
-        }
-    }
+  if (!priv->freeze || !channel)
+    return FALSE;
 
-  return FALSE;
+  frozen = g_hash_table_lookup (priv->freeze, channel);
+  if (!frozen)
+    return FALSE;
+
+  message = g_slice_new0 (FrozenMessage);
+  message->data = g_bytes_ref (data);
+  if (control)
+    message->control = json_object_ref (control);
+  g_queue_push_tail (&frozen->messages, message);
+
+  priv->n_frozen++;
+  stats = cockpit_stats_transport ();
+  if (priv->n_frozen > stats->frozen_high)
+    stats->frozen_high = priv->n_frozen;
+
+  return TRUE;
 }
 
 static gboolean
@@ -171,8 +214,11 @@ cockpit_transport_finalize (GObject *object)
 
   if (priv->freeze)
     g_hash_table_destroy (priv->freeze);
-  if (priv->frozen)
-    g_queue_free_full (priv->frozen, frozen_message_free);
+  if (priv->intercepts)
+    g_hash_table_destroy (priv->intercepts);
+  if (priv->relays)
+    g_hash_table_destroy (priv->relays);
+  g_clear_object (&priv->relay_default);
 
   G_OBJECT_CLASS (cockpit_transport_parent_class)->finalize (object);
 }
@@ -211,15 +257,55 @@ cockpit_transport_class_init (CockpitTransportClass *klass)
                                   G_TYPE_NONE, 1, G_TYPE_STRING);
 }
 
+static gboolean
+intercept_control (CockpitTransport *self,
+                   GBytes *data)
+{
+  CockpitTransportPrivate *priv = cockpit_transport_get_instance_private (self);
+  CockpitTransportInterceptFunc func;
+  JsonObject *options = NULL;
+  const gchar *command;
+  const gchar *channel;
+  gpointer user_data;
+  Intercept *intercept;
+  gboolean ret = FALSE;
+
+  if (!cockpit_transport_parse_command (data, &command, &channel, &options))
+    return FALSE;
+
+  intercept = channel ? g_hash_table_lookup (priv->intercepts, channel) : NULL;
+  if (intercept)
+    {
+      /* The function may well remove the intercept */
+      func = intercept->func;
+      user_data = intercept->user_data;
+      ret = (func) (self, command, channel, options, user_data);
+    }
+
+  json_object_unref (options);
+  return ret;
+}
+
 void
 cockpit_transport_send (CockpitTransport *transport,
                         const gchar *channel,
                         GBytes *data)
 {
+  CockpitTransportPrivate *priv = cockpit_transport_get_instance_private (transport);
+  CockpitTransportStats *stats = cockpit_stats_transport ();
   CockpitTransportClass *klass;
 
   g_return_if_fail (COCKPIT_IS_TRANSPORT (transport));
 
+  if (!channel && priv->intercepts && g_hash_table_size (priv->intercepts) > 0)
+    {
+      if (intercept_control (transport, data))
+        return;
+    }
+
+  stats->sent_messages++;
+  stats->sent_bytes += g_bytes_get_size (data);
+
   klass = COCKPIT_TRANSPORT_GET_CLASS (transport);
   g_return_if_fail (klass && klass->send);
   klass->send (transport, channel, data);
@@ -238,24 +324,167 @@ cockpit_transport_close (CockpitTransport *transport,
   klass->close (transport, problem);
 }
 
-void
-cockpit_transport_emit_recv (CockpitTransport *transport,
-                             const gchar *channel,
-                             GBytes *data)
+static CockpitTransport *
+lookup_relay (CockpitTransport *self,
+              const gchar *channel)
 {
-  gboolean result = FALSE;
+  CockpitTransportPrivate *priv = cockpit_transport_get_instance_private (self);
+  CockpitTransport *target = NULL;
 
-  g_return_if_fail (COCKPIT_IS_TRANSPORT (transport));
+  if (priv->relays)
+    target = g_hash_table_lookup (priv->relays, channel);
+  if (!target)
+    target = priv->relay_default;
+
+  return target;
+}
+
+static void
+transport_emit_recv (CockpitTransport *transport,
+                     const gchar *channel,
+                     GBytes *data)
+{
+  CockpitTransport *target;
+  gboolean result = FALSE;
 
   if (maybe_freeze_message (transport, channel, NULL, data))
     return;
 
+  if (channel && (target = lookup_relay (transport, channel)))
+    {
+      cockpit_transport_send (target, channel, data);
+      return;
+    }
+
   g_signal_emit (transport, signals[RECV], 0, channel, data, &result);
 
   if (!result)
     g_debug ("no handler for received message in channel %s", channel);
 }
 
+void
+cockpit_transport_emit_recv (CockpitTransport *transport,
+                             const gchar *channel,
+                             GBytes *data)
+{
+  CockpitTransportStats *stats = cockpit_stats_transport ();
+
+  g_return_if_fail (COCKPIT_IS_TRANSPORT (transport));
+
+  stats->recv_messages++;
+  stats->recv_bytes += g_bytes_get_size (data);
+
+  transport_emit_recv (transport, channel, data);
+}
+
+/**
+ * cockpit_transport_send_frame:
+ * @transport: a transport
+ * @channel: the channel the frame is for
+ * @frame: the channel prefix and payload
+ *
+ * Queue a message that is already framed with its @channel prefix,
+ * such as one that came in over a WebSocket. Transports that can send
+ * the frame as is do so, without taking it apart.
+ */
+void
+cockpit_transport_send_frame (CockpitTransport *transport,
+                              const gchar *channel,
+                              GBytes *frame)
+{
+  CockpitTransportStats *stats = cockpit_stats_transport ();
+  CockpitTransportClass *klass;
+  GBytes *payload;
+  gsize length;
+  gsize offset;
+
+  g_return_if_fail (COCKPIT_IS_TRANSPORT (transport));
+  g_return_if_fail (channel != NULL);
+
+  offset = strlen (channel) + 1;
+  length = g_bytes_get_size (frame);
+  g_return_if_fail (length >= offset);
+
+  stats->sent_messages++;
+  stats->sent_bytes += length - offset;
+
+  klass = COCKPIT_TRANSPORT_GET_CLASS (transport);
+  g_return_if_fail (klass && klass->send);
+
+  if (klass->send_frame)
+    {
+      klass->send_frame (transport, frame);
+    }
+  else
+    {
+      payload = g_bytes_new_from_bytes (frame, offset, length - offset);
+      klass->send (transport, channel, payload);
+      g_bytes_unref (payload);
+    }
+}
+
+/**
+ * cockpit_transport_emit_frame:
+ * @transport: a transport
+ * @frame: a channel prefix and payload, as read
+ *
+ * Used by transports to pass on a message they have read, without
+ * the length. When the channel is relayed to another transport
+ * the @frame is sent there as is, without taking it apart, otherwise
+ * this is the same as cockpit_transport_emit_recv().
+ */
+void
+cockpit_transport_emit_frame (CockpitTransport *transport,
+                              GBytes *frame)
+{
+  CockpitTransportPrivate *priv = cockpit_transport_get_instance_private (transport);
+  CockpitTransportStats *stats = cockpit_stats_transport ();
+  CockpitTransport *target = NULL;
+  const gchar *data;
+  const gchar *line;
+  gchar *channel = NULL;
+  gchar buffer[128];
+  GBytes *payload;
+  gsize length;
+  gsize channel_len = 0;
+
+  g_return_if_fail (COCKPIT_IS_TRANSPORT (transport));
+  g_return_if_fail (frame != NULL);
+
+  data = g_bytes_get_data (frame, &length);
+  line = data ? memchr (data, '\n', length) : NULL;
+
+  /* Only channel messages are relayed, and only when nothing is frozen */
+  if (line && line != data && (priv->relays || priv->relay_default))
+    {
+      channel_len = line - data;
+      if (channel_len < sizeof (buffer) && !memchr (data, '\0', channel_len))
+        {
+          memcpy (buffer, data, channel_len);
+          buffer[channel_len] = '\0';
+
+          if (!priv->freeze || !g_hash_table_lookup (priv->freeze, buffer))
+            target = lookup_relay (transport, buffer);
+        }
+    }
+
+  if (target)
+    {
+      stats->recv_messages++;
+      stats->recv_bytes += length - (channel_len + 1);
+      cockpit_transport_send_frame (target, buffer, frame);
+      return;
+    }
+
+  payload = cockpit_transport_parse_frame (frame, &channel);
+  if (payload)
+    {
+      cockpit_transport_emit_recv (transport, channel, payload);
+      g_bytes_unref (payload);
+    }
+  g_free (channel);
+}
+
 void
 cockpit_transport_emit_control (CockpitTransport *transport,
                                 const gchar *command,
@@ -284,18 +513,123 @@ cockpit_transport_emit_closed (CockpitTransport *transport,
   g_signal_emit (transport, signals[CLOSED], 0, problem);
 }
 
+/**
+ * cockpit_transport_intercept_control:
+ * @self: a transport
+ * @channel: the channel to watch
+ * @func: called for outgoing control messages about @channel
+ * @user_data: passed to @func
+ *
+ * Look at control messages about @channel before they are sent
+ * over the transport. When @func returns %TRUE the message is
+ * not sent.
+ *
+ * Only one function can intercept a given channel, and this stays
+ * in place until cockpit_transport_remove_intercept() is called.
+ */
+void
+cockpit_transport_intercept_control (CockpitTransport *self,
+                                     const gchar *channel,
+                                     CockpitTransportInterceptFunc func,
+                                     gpointer user_data)
+{
+  CockpitTransportPrivate *priv = cockpit_transport_get_instance_private (self);
+  Intercept *intercept;
+
+  g_return_if_fail (COCKPIT_IS_TRANSPORT (self));
+  g_return_if_fail (channel != NULL);
+  g_return_if_fail (func != NULL);
+
+  if (!priv->intercepts)
+    priv->intercepts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, intercept_free);
+
+  intercept = g_slice_new (Intercept);
+  intercept->func = func;
+  intercept->user_data = user_data;
+  g_hash_table_replace (priv->intercepts, g_strdup (channel), intercept);
+}
+
+void
+cockpit_transport_remove_intercept (CockpitTransport *self,
+                                    const gchar *channel)
+{
+  CockpitTransportPrivate *priv = cockpit_transport_get_instance_private (self);
+
+  g_return_if_fail (COCKPIT_IS_TRANSPORT (self));
+  g_return_if_fail (channel != NULL);
+
+  if (priv->intercepts)
+    g_hash_table_remove (priv->intercepts, channel);
+}
+
+/**
+ * cockpit_transport_relay:
+ * @self: a transport
+ * @channel: (allow-none): the channel to relay, or NULL for all channels
+ * @target: (allow-none): the transport to relay to, or NULL to stop
+ *
+ * Send messages received for @channel straight on to @target, without
+ * emitting the "recv" signal. Transports that read framed messages
+ * pass them on without copying or taking them apart. Control messages
+ * are never relayed, and frozen channels are relayed once thawed.
+ *
+ * With a NULL @channel all channels without a relay of their own
+ * are relayed to @target.
+ *
+ * The @target is referenced until the relay is removed, so remove it
+ * when either transport closes.
+ */
+void
+cockpit_transport_relay (CockpitTransport *self,
+                         const gchar *channel,
+                         CockpitTransport *target)
+{
+  CockpitTransportPrivate *priv = cockpit_transport_get_instance_private (self);
+
+  g_return_if_fail (COCKPIT_IS_TRANSPORT (self));
+  g_return_if_fail (target == NULL || COCKPIT_IS_TRANSPORT (target));
+  g_return_if_fail (target != self);
+
+  if (!channel)
+    {
+      if (target)
+        g_object_ref (target);
+      g_clear_object (&priv->relay_default);
+      priv->relay_default = target;
+    }
+  else if (target)
+    {
+      if (!priv->relays)
+        priv->relays = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+      g_hash_table_replace (priv->relays, g_strdup (channel), g_object_ref (target));
+    }
+  else if (priv->relays)
+    {
+      g_hash_table_remove (priv->relays, channel);
+    }
+}
+
 void
 cockpit_transport_freeze (CockpitTransport *self,
                           const gchar *channel)
 {
   CockpitTransportPrivate *priv = cockpit_transport_get_instance_private (self);
+  FrozenChannel *frozen;
 
   g_return_if_fail (COCKPIT_IS_TRANSPORT (self));
   g_return_if_fail (channel != NULL);
 
   if (!priv->freeze)
-    priv->freeze = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
-  g_hash_table_add (priv->freeze, g_strdup (channel));
+    priv->freeze = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, frozen_channel_free);
+
+  /* Already frozen, keep the messages queued so far */
+  if (g_hash_table_lookup (priv->freeze, channel))
+    return;
+
+  frozen = g_slice_new0 (FrozenChannel);
+  frozen->channel = g_strdup (channel);
+  g_queue_init (&frozen->messages);
+  g_hash_table_insert (priv->freeze, frozen->channel, frozen);
 }
 
 void
@@ -303,64 +637,63 @@ cockpit_transport_thaw (CockpitTransport *self,
                         const gchar *channel)
 {
   CockpitTransportPrivate *priv = cockpit_transport_get_instance_private (self);
-  FrozenMessage *frozen;
+  FrozenChannel *frozen = NULL;
+  FrozenMessage *message;
   const gchar *command;
-  gchar *stolen = NULL;
-  GList *l, *flush;
 
   g_return_if_fail (COCKPIT_IS_TRANSPORT (self));
   g_return_if_fail (channel != NULL);
 
   if (priv->freeze)
-    stolen = g_hash_table_lookup (priv->freeze, channel);
-  if (stolen)
-    g_hash_table_steal (priv->freeze, channel);
+    frozen = g_hash_table_lookup (priv->freeze, channel);
+  if (!frozen)
+    return;
+
+  /*
+   * Remove it before emitting anything: handlers may freeze the channel
+   * again, and then the remaining messages are queued again in order.
+   */
+  g_hash_table_steal (priv->freeze, frozen->channel);
 
-  for (l = priv->frozen ? priv->frozen->head : NULL; l != NULL; )
+  g_object_ref (self);
+
+  while ((message = g_queue_pop_head (&frozen->messages)))
     {
-      frozen = l->data;
-      flush = (stolen == frozen->channel) ? l : NULL;
-      l = g_list_next (l);
+      g_assert (priv->n_frozen > 0);
+      priv->n_frozen--;
 
-      if (flush)
+      if (message->control)
         {
-          if (frozen->control)
-            {
-              command = NULL;
-              cockpit_json_get_string (frozen->control, "command", NULL, &command);
-              cockpit_transport_emit_control (self, command, stolen, frozen->control, frozen->data);
-            }
-          else
-            {
-              cockpit_transport_emit_recv (self, stolen, frozen->data);
-            }
-          g_queue_delete_link (priv->frozen, flush);
-          frozen_message_free (frozen);
+          command = NULL;
+          cockpit_json_get_string (message->control, "command", NULL, &command);
+          cockpit_transport_emit_control (self, command, frozen->channel, message->control, message->data);
         }
+      else
+        {
+          transport_emit_recv (self, frozen->channel, message->data);
+        }
+      frozen_message_free (message);
     }
 
-  g_free (stolen);
+  frozen_channel_free (frozen);
+  g_object_unref (self);
 }
 
-static GBytes *
-parse_frame (GBytes *message,
-             gboolean expect,
-             gchar **channel)
+/* The length of the channel prefix of a message, or -1 if it's invalid */
+static gssize
+parse_channel_prefix (const gchar *data,
+                      gsize length,
+                      gboolean expect)
 {
-  const gchar *data;
-  gsize length;
   const gchar *line;
   gsize channel_len;
 
-  g_return_val_if_fail (message != NULL, NULL);
-
-  data = g_bytes_get_data (message, &length);
-  line = memchr (data, '\n', length);
+  line = data ? memchr (data, '\n', length) : NULL;
   if (!line)
     {
       if (expect)
         g_message ("received invalid message without channel prefix");
-      return NULL;
+      return -1;
     }
 
   channel_len = line - data;
@@ -368,9 +701,28 @@ parse_frame (GBytes *message,
     {
       if (expect)
         g_message ("received massage with invalid channel prefix");
-      return NULL;
+      return -1;
     }
 
+  return channel_len;
+}
+
+static GBytes *
+parse_frame (GBytes *message,
+             gboolean expect,
+             gchar **channel)
+{
+  const gchar *data;
+  gsize length;
+  gssize channel_len;
+
+  g_return_val_if_fail (message != NULL, NULL);
+
+  data = g_bytes_get_data (message, &length);
+  channel_len = parse_channel_prefix (data, length, expect);
+  if (channel_len < 0)
+    return NULL;
+
   if (channel_len)
     *channel = g_strndup (data, channel_len);
   else
@@ -407,6 +759,44 @@ cockpit_transport_maybe_frame (GBytes *message,
   return parse_frame (message, FALSE, channel);
 }
 
+/**
+ * cockpit_transport_peek_channel:
+ * @message: message to look at
+ * @buffer: location to place the channel
+ * @size: the size of @buffer
+ *
+ * Check the channel prefix of @message the same way as
+ * cockpit_transport_parse_frame() does, and copy the channel into
+ * @buffer, without copying the payload. The message can then be
+ * passed on whole with cockpit_transport_send_frame().
+ *
+ * Nothing is logged. Messages this returns FALSE for should go through
+ * cockpit_transport_parse_frame().
+ *
+ * Returns: TRUE for a valid payload message whose channel fits in
+ *   @buffer, FALSE for control messages and invalid ones
+ */
+gboolean
+cockpit_transport_peek_channel (GBytes *message,
+                                gchar *buffer,
+                                gsize size)
+{
+  const gchar *data;
+  gsize length;
+  gssize channel_len;
+
+  g_return_val_if_fail (message != NULL, FALSE);
+
+  data = g_bytes_get_data (message, &length);
+  channel_len = parse_channel_prefix (data, length, FALSE);
+  if (channel_len <= 0 || (gsize)channel_len >= size)
+    return FALSE;
+
+  memcpy (buffer, data, channel_len);
+  buffer[channel_len] = '\0';
+  return TRUE;
+}
+
 /**
  * cockpit_transport_parse_command:
  * @payload: command JSON payload to parse
@@ -528,3 +918,49 @@ cockpit_transport_build_control (const gchar *name,
   json_object_unref (object);
   return message;
 }
+
+/**
+ * cockpit_transport_build_batch_open:
+ * @channel: the channel id
+ * @shared: (nullable): the "options" of an "open-batch" command
+ * @entry: the object for @channel in its "channels"
+ *
+ * Build the "open" command for one channel of an "open-batch". The
+ * fields of @entry take precedence over those in @shared.
+ *
+ * Returns: (transfer full): the "open" command
+ */
+JsonObject *
+cockpit_transport_build_batch_open (const gchar *channel,
+                                    JsonObject *shared,
+                                    JsonObject *entry)
+{
+  JsonObject *options;
+  GList *members, *l;
+
+  options = cockpit_transport_build_json ("command", "open",
+                                          "channel", channel,
+                                          NULL);
+
+  /* Options for this channel take precedence over the shared ones */
+  if (shared)
+    {
+      members = json_object_get_members (shared);
+      for (l = members; l != NULL; l = g_list_next (l))
+        {
+          if (!json_object_has_member (entry, l->data))
+            json_object_set_member (options, l->data, json_object_dup_member (shared, l->data));
+        }
+      g_list_free (members);
+    }
+
+  members = json_object_get_members (entry);
+  for (l = members; l != NULL; l = g_list_next (l))
+    {
+      if (!g_str_equal (l->data, "command") && !g_str_equal (l->data, "channel"))
+        json_object_set_member (options, l->data, json_object_dup_member (entry, l->data));
+    }
+  g_list_free (members);
+
+  return options;
+}
@@ -61,12 +61,29 @@ struct _CockpitTransportClass
 
   void        (* close)       (CockpitTransport *transport,
                                const gchar *problem);
+
+  /*
+   * Optional: called to queue a message that was framed elsewhere,
+   * a channel prefix and payload without the length.
+   */
+  void        (* send_frame)  (CockpitTransport *transport,
+                               GBytes *frame);
 };
 
+typedef gboolean (* CockpitTransportInterceptFunc) (CockpitTransport *transport,
+                                                   const gchar *command,
+                                                   const gchar *channel,
+                                                   JsonObject *options,
+                                                   gpointer user_data);
+
 void        cockpit_transport_send           (CockpitTransport *transport,
                                               const gchar *channel,
                                               GBytes *data);
 
+void        cockpit_transport_send_frame     (CockpitTransport *transport,
+                                              const gchar *channel,
+                                              GBytes *frame);
+
 void        cockpit_transport_close          (CockpitTransport *transport,
                                               const gchar *problem);
 
@@ -74,6 +91,9 @@ void        cockpit_transport_emit_recv      (CockpitTransport *transport,
                                               const gchar *channel,
                                               GBytes *data);
 
+void        cockpit_transport_emit_frame     (CockpitTransport *transport,
+                                              GBytes *frame);
+
 void        cockpit_transport_emit_control   (CockpitTransport *transport,
                                               const gchar *command,
                                               const gchar *channel,
@@ -89,12 +109,28 @@ void        cockpit_transport_freeze         (CockpitTransport *transport,
 void        cockpit_transport_thaw           (CockpitTransport *transport,
                                               const gchar *channel);
 
+void        cockpit_transport_relay          (CockpitTransport *transport,
+                                              const gchar *channel,
+                                              CockpitTransport *target);
+
+void        cockpit_transport_intercept_control (CockpitTransport *transport,
+                                                 const gchar *channel,
+                                                 CockpitTransportInterceptFunc func,
+                                                 gpointer user_data);
+
+void        cockpit_transport_remove_intercept  (CockpitTransport *transport,
+                                                 const gchar *channel);
+
 GBytes *    cockpit_transport_parse_frame    (GBytes *message,
                                               gchar **channel);
 
 GBytes *    cockpit_transport_maybe_frame    (GBytes *message,
                                               gchar **channel);
 
+gboolean    cockpit_transport_peek_channel   (GBytes *message,
+                                              gchar *buffer,
+                                              gsize size);
+
 gboolean    cockpit_transport_parse_command  (GBytes *payload,
                                               const gchar **command,
                                               const gchar **channel,
@@ -106,6 +142,10 @@ JsonObject *cockpit_transport_build_json     (const gchar *name,
 GBytes *    cockpit_transport_build_control  (const gchar *name,
                                               ...) G_GNUC_NULL_TERMINATED;
 
+JsonObject *cockpit_transport_build_batch_open (const gchar *channel,
+                                                JsonObject *shared,
+                                                JsonObject *entry);
+
 G_END_DECLS
 
 #endif /* __COCKPIT_TRANSPORT_H__ */
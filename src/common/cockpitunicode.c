@@ -20,57 +20,290 @@
 #include "config.h"
 
 #include "cockpitunicode.h"
+#include "cockpitcpu.h"
 
+#include <string.h>
+
+/*
+ * Validation follows the same rules as g_utf8_validate(): no overlong
+ * forms, no surrogates, nothing above U+10FFFF, and no nul bytes.
+ *
+ * Almost all of the text that passes through here is ASCII JSON, so
+ * runs of ASCII are checked many bytes at a time, and only the other
+ * characters are decoded one by one.
+ */
+
+static const gchar replacement[] = "\xef\xbf\xbd";
+
+static gsize
+ascii_prefix_scalar (const guint8 *data,
+                     gsize length)
+{
+  const guint64 high = G_GUINT64_CONSTANT (0x8080808080808080);
+  const guint64 ones = G_GUINT64_CONSTANT (0x0101010101010101);
+  guint64 word;
+  gsize i = 0;
+
+  /* Eight bytes at a time: no high bits set, and no nul bytes */
+  while (i + 8 <= length)
+    {
+      memcpy (&word, data + i, sizeof (word));
+      if ((word & high) || ((word - ones) & ~word & high))
+        break;
+      i += 8;
+    }
+
+  while (i < length && data[i] != 0 && data[i] < 0x80)
+    i++;
+
+  return i;
+}
+
+#ifdef COCKPIT_CPU_HAVE_SSE2
+
+static gsize
+ascii_prefix_sse2 (const guint8 *data,
+                   gsize length)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  __m128i chunk;
+  gsize i = 0;
+
+  /* A byte with the high bit, or a nul turned into 0xFF */
+  while (i + 16 <= length)
+    {
+      chunk = _mm_loadu_si128 ((const __m128i *)(data + i));
+      if (_mm_movemask_epi8 (_mm_or_si128 (chunk, _mm_cmpeq_epi8 (chunk, zero))))
+        break;
+      i += 16;
+    }
+
+  return i + ascii_prefix_scalar (data + i, length - i);
+}
+
+#endif /* COCKPIT_CPU_HAVE_SSE2 */
+
+#ifdef COCKPIT_CPU_HAVE_AVX2
+
+__attribute__ ((target ("avx2")))
+static gsize
+ascii_prefix_avx2 (const guint8 *data,
+                   gsize length)
+{
+  const __m256i zero = _mm256_setzero_si256 ();
+  __m256i chunk;
+  gsize i = 0;
+
+  while (i + 32 <= length)
+    {
+      chunk = _mm256_loadu_si256 ((const __m256i *)(data + i));
+      if (_mm256_movemask_epi8 (_mm256_or_si256 (chunk, _mm256_cmpeq_epi8 (chunk, zero))))
+        break;
+      i += 32;
+    }
+
+  return i + ascii_prefix_sse2 (data + i, length - i);
+}
+
+#endif /* COCKPIT_CPU_HAVE_AVX2 */
+
+static gsize
+ascii_prefix (const guint8 *data,
+              gsize length)
+{
+#ifdef COCKPIT_CPU_HAVE_AVX2
+  if (cockpit_cpu_has_avx2 ())
+    return ascii_prefix_avx2 (data, length);
+#endif
+
+#ifdef COCKPIT_CPU_HAVE_SSE2
+  return ascii_prefix_sse2 (data, length);
+#else
+  return ascii_prefix_scalar (data, length);
+#endif
+}
+
+/*
+ * Returns the length of the valid non-ASCII character at @data, or
+ * zero if invalid. When the character is only invalid because it is
+ * cut off at @length then @truncated is set.
+ */
+static guint
+multibyte_sequence (const guint8 *data,
+                    gsize length,
+                    gboolean *truncated)
+{
+  guint8 lo = 0x80;
+  guint8 hi = 0xBF;
+  guint len;
+  guint i;
+
+  if (data[0] >= 0xC2 && data[0] <= 0xDF)
+    {
+      len = 2;
+    }
+  else if (data[0] >= 0xE0 && data[0] <= 0xEF)
+    {
+      len = 3;
+      if (data[0] == 0xE0)
+        lo = 0xA0; /* overlong */
+      else if (data[0] == 0xED)
+        hi = 0x9F; /* surrogates */
+    }
+  else if (data[0] >= 0xF0 && data[0] <= 0xF4)
+    {
+      len = 4;
+      if (data[0] == 0xF0)
+        lo = 0x90; /* overlong */
+      else if (data[0] == 0xF4)
+        hi = 0x8F; /* above U+10FFFF */
+    }
+  else
+    {
+      return 0;
+    }
+
+  for (i = 1; i < len; i++)
+    {
+      if (i >= length)
+        {
+          if (truncated)
+            *truncated = TRUE;
+          return 0;
+        }
+      if (data[i] < lo || data[i] > hi)
+        return 0;
+      lo = 0x80;
+      hi = 0xBF;
+    }
+
+  return len;
+}
+
+static gsize
+valid_prefix (const guint8 *data,
+              gsize length)
+{
+  gsize i = 0;
+  guint len;
+
+  while (i < length)
+    {
+      if (data[i] != 0 && data[i] < 0x80)
+        {
+          i += ascii_prefix (data + i, length - i);
+          continue;
+        }
+
+      len = multibyte_sequence (data + i, length - i, NULL);
+      if (len == 0)
+        break;
+      i += len;
+    }
+
+  return i;
+}
+
+/**
+ * cockpit_unicode_validate:
+ * @data: the text to check
+ * @length: the length of @data
+ * @valid_length: (out) (optional): location for the length of the valid part
+ *
+ * Check whether @data is valid UTF-8. Nul bytes are not considered
+ * valid, just as with g_utf8_validate().
+ *
+ * Returns: %TRUE if all of @data is valid
+ */
+gboolean
+cockpit_unicode_validate (gconstpointer data,
+                          gsize length,
+                          gsize *valid_length)
+{
+  gsize valid;
+
+  g_return_val_if_fail (data != NULL || length == 0, FALSE);
+
+  valid = valid_prefix (data, length);
+  if (valid_length)
+    *valid_length = valid;
+
+  return valid == length;
+}
+
+/**
+ * cockpit_unicode_has_incomplete_ending:
+ * @input: the text to check
+ *
+ * Check whether @input ends in the middle of a character, with the
+ * rest of the character likely to follow in more data.
+ *
+ * Only the last few bytes are looked at.
+ *
+ * Returns: %TRUE if the last character is cut off
+ */
 gboolean
 cockpit_unicode_has_incomplete_ending (GBytes *input)
 {
-  const gchar *data;
-  const gchar *end;
+  const guint8 *data;
+  gboolean truncated = FALSE;
   gsize length;
+  gsize at;
 
   data = g_bytes_get_data (input, &length);
-  if (g_utf8_validate (data, length, &end))
-    return FALSE;
 
-  do
+  /* Find where the last character starts */
+  for (at = length; at > 0 && length - at < 4; at--)
     {
-      length -= (end - data) + 1;
-      data = end + 1;
+      if ((data[at - 1] & 0xC0) != 0x80)
+        {
+          multibyte_sequence (data + at - 1, length - at + 1, &truncated);
+          break;
+        }
     }
-  while (!g_utf8_validate (data, length, &end));
 
-  return length == 0;
+  return truncated;
 }
 
+/**
+ * cockpit_unicode_force_utf8:
+ * @input: the text to repair
+ *
+ * Replace each byte that doesn't belong to a valid character in
+ * @input with the U+FFFD replacement character.
+ *
+ * Returns: (transfer full): @input itself if valid, or repaired text
+ */
 GBytes *
 cockpit_unicode_force_utf8 (GBytes *input)
 {
-  const gchar *data;
-  const gchar *end;
+  const guint8 *data;
   gsize length;
+  gsize valid;
   GString *string;
 
   data = g_bytes_get_data (input, &length);
-  if (g_utf8_validate (data, length, &end))
+  valid = valid_prefix (data, length);
+  if (valid == length)
     return g_bytes_ref (input);
 
   string = g_string_sized_new (length + 16);
   do
     {
       /* Valid part of the string */
-      g_string_append_len (string, data, end - data);
+      g_string_append_len (string, (const gchar *)data, valid);
 
       /* Replacement character */
-      g_string_append (string, "\xef\xbf\xbd");
+      g_string_append_len (string, replacement, 3);
 
-      length -= (end - data) + 1;
-      data = end + 1;
+      length -= valid + 1;
+      data += valid + 1;
+      valid = valid_prefix (data, length);
     }
-  while (!g_utf8_validate (data, length, &end));
+  while (valid < length);
 
   if (length)
-    g_string_append_len (string, data, length);
+    g_string_append_len (string, (const gchar *)data, length);
 
   return g_string_free_to_bytes (string);
 }
-
@@ -24,6 +24,10 @@
 
 G_BEGIN_DECLS
 
+gboolean      cockpit_unicode_validate      (gconstpointer data,
+                                             gsize length,
+                                             gsize *valid_length);
+
 GBytes *      cockpit_unicode_force_utf8    (GBytes *input);
 
 gboolean      cockpit_unicode_has_incomplete_ending (GBytes *input);
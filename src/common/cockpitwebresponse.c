@@ -27,13 +27,17 @@
 
 #include "cockpitwebresponse.h"
 #include "cockpitwebfilter.h"
+#include "cockpitwebserver.h"
 
 #include "common/cockpitconf.h"
 #include "common/cockpiterror.h"
 #include "common/cockpitflow.h"
 #include "common/cockpitlocale.h"
+#include "common/cockpitsocket.h"
 #include "common/cockpittemplate.h"
 
+#include <sys/uio.h>
+
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
@@ -86,6 +90,19 @@ struct _CockpitWebResponse {
 /* A megabyte is when we start to consider queue full enough */
 #define QUEUE_PRESSURE 1024UL * 1024UL
 
+/*
+ * A queued block, along with its chunked encoding framing. The size
+ * line is formatted in place, so queuing a chunk doesn't allocate
+ * anything besides this.
+ */
+typedef struct {
+  GBytes *bytes;
+  gsize length;
+  guint8 header_len;
+  gboolean trailer;
+  gchar header[18];
+} OutputBlock;
+
 static guint signal__done;
 
 static void      cockpit_web_response_flow_iface_init      (CockpitFlowInterface *iface);
@@ -151,6 +168,14 @@ cockpit_web_response_dispose (GObject *object)
   G_OBJECT_CLASS (cockpit_web_response_parent_class)->dispose (object);
 }
 
+static void
+output_block_free (gpointer data)
+{
+  OutputBlock *block = data;
+  g_bytes_unref (block->bytes);
+  g_slice_free (OutputBlock, block);
+}
+
 static void
 cockpit_web_response_finalize (GObject *object)
 {
@@ -163,7 +188,7 @@ cockpit_web_response_finalize (GObject *object)
   g_free (self->origin);
   g_assert (self->io == NULL);
   g_assert (self->out == NULL);
-  g_queue_free_full (self->queue, (GDestroyNotify)g_bytes_unref);
+  g_queue_free_full (self->queue, output_block_free);
   self->out_queued = 0;
 
   G_OBJECT_CLASS (cockpit_web_response_parent_class)->finalize (object);
@@ -276,6 +301,24 @@ cockpit_web_response_set_method (CockpitWebResponse *response,
   response->method = g_strdup (method);
 }
 
+/**
+ * cockpit_web_response_set_keep_alive:
+ * @self: the response
+ * @keep_alive: whether the connection may be reused
+ *
+ * Turn off keep-alive even if the request asked for it. The
+ * response then has a "Connection: close" header. Must be called
+ * before the headers are sent.
+ */
+void
+cockpit_web_response_set_keep_alive (CockpitWebResponse *self,
+                                     gboolean keep_alive)
+{
+  g_return_if_fail (COCKPIT_IS_WEB_RESPONSE (self));
+  g_return_if_fail (self->count == 0);
+  self->keep_alive = self->keep_alive && keep_alive;
+}
+
 /**
  * cockpit_web_response_get_path:
  * @self: the response
@@ -378,43 +421,104 @@ on_output_flushed (GObject *stream,
   g_object_unref (self);
 }
 
+static void
+add_vector (struct iovec *iov,
+            guint *n_iov,
+            gsize *skip,
+            gconstpointer data,
+            gsize len)
+{
+  if (*skip >= len)
+    {
+      *skip -= len;
+      return;
+    }
+
+  iov[*n_iov].iov_base = (guint8 *)data + *skip;
+  iov[*n_iov].iov_len = len - *skip;
+  (*n_iov)++;
+  *skip = 0;
+}
+
+/* Fill in vectors for the head of the queue, skipping what was already sent */
+static guint
+build_vectors (CockpitWebResponse *self,
+               struct iovec *iov,
+               gsize *total)
+{
+  OutputBlock *block;
+  gsize skip = self->partial_offset;
+  guint n_iov = 0;
+  GList *l;
+
+  *total = 0;
+  for (l = self->queue->head; l != NULL && n_iov + 3 <= COCKPIT_SOCKET_OUTPUT_VECTORS; l = g_list_next (l))
+    {
+      block = l->data;
+      if (block->header_len)
+        add_vector (iov, &n_iov, &skip, block->header, block->header_len);
+      add_vector (iov, &n_iov, &skip, g_bytes_get_data (block->bytes, NULL),
+                  g_bytes_get_size (block->bytes));
+      if (block->trailer)
+        add_vector (iov, &n_iov, &skip, "\r\n", 2);
+      *total += block->length;
+    }
+
+  *total -= self->partial_offset;
+  return n_iov;
+}
+
+/* Drop what was written from the head of the queue */
+static void
+consume_output (CockpitWebResponse *self,
+                gsize written)
+{
+  OutputBlock *block;
+  gsize remaining;
+
+  while ((block = g_queue_peek_head (self->queue)) != NULL)
+    {
+      remaining = block->length - self->partial_offset;
+      if (remaining > written)
+        {
+          self->partial_offset += written;
+          break;
+        }
+
+      written -= remaining;
+      self->partial_offset = 0;
+      g_queue_pop_head (self->queue);
+      g_assert (block->length <= self->out_queued);
+      self->out_queued -= block->length;
+      output_block_free (block);
+    }
+}
+
 static gboolean
 on_response_output (GObject *pollable,
                     gpointer user_data)
 {
   CockpitWebResponse *self = user_data;
+  struct iovec iov[COCKPIT_SOCKET_OUTPUT_VECTORS];
   GError *error = NULL;
-  const guint8 *data;
-  GBytes *block;
+  gsize before, total, budget;
   gssize count;
-  gsize before, size, len;
+  guint n_iov;
 
-  block = g_queue_peek_head (self->queue);
-  if (block)
-    {
-      data = g_bytes_get_data (block, &len);
-      g_assert (len == 0 || self->partial_offset < len);
-      data += self->partial_offset;
-      len -= self->partial_offset;
-
-      before = self->out_queued;
+  before = self->out_queued;
 
-      if (len > 0)
-        {
-          count = g_pollable_output_stream_write_nonblocking (self->out, data, len,
-                                                              NULL, &error);
-        }
-      else
-        {
-          count = 0;
-        }
+  /* Send as much as the socket takes, but don't starve everything else */
+  for (budget = QUEUE_PRESSURE; budget > 0 && !g_queue_is_empty (self->queue); )
+    {
+      n_iov = build_vectors (self, iov, &total);
+      count = n_iov > 0 ? cockpit_socket_write_vectors (self->io, self->out, iov, n_iov, &error) : 0;
 
       if (count < 0)
         {
           if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
             {
-              g_error_free (error);
-              return TRUE;
+              g_clear_error (&error);
+              break;
             }
 
           if (!cockpit_web_should_suppress_output_error (self->logname, error))
@@ -427,61 +531,94 @@ on_response_output (GObject *pollable,
           return FALSE;
         }
 
-      if (count == len)
-        {
-          g_debug ("%s: sent %d bytes", self->logname, (int)len);
-          self->partial_offset = 0;
-          block = g_queue_pop_head (self->queue);
-          size = g_bytes_get_size (block);
-          g_assert (size <= self->out_queued);
-          self->out_queued -= size;
-          g_bytes_unref (block);
-        }
-      else
-        {
-          g_debug ("%s: sent %d partial", self->logname, (int)count);
-          g_assert (count < len);
-          self->partial_offset += count;
-        }
-
-      /*
-       * If we're controlling another flow, turn it on again when our output
-       * buffer size becomes less than the low mark.
-       */
-      if (before >= QUEUE_PRESSURE && self->out_queued < QUEUE_PRESSURE)
-        cockpit_flow_emit_pressure (COCKPIT_FLOW (self), FALSE);
+      g_debug ("%s: sent %d bytes", self->logname, (int)count);
+      consume_output (self, count);
+      budget -= MIN (budget, (gsize)count);
 
-      return TRUE;
+      if ((gsize)count < total)
+        break;
     }
-  else
+
+  /*
+   * If we're controlling another flow, turn it on again when our output
+   * buffer size becomes less than the low mark.
+   */
+  if (before >= QUEUE_PRESSURE && self->out_queued < QUEUE_PRESSURE)
+    cockpit_flow_emit_pressure (COCKPIT_FLOW (self), FALSE);
+
+  /* A pressure handler may have completed or failed the response */
+  if (!self->source || !g_queue_is_empty (self->queue))
+    return self->source != NULL;
+
+  g_source_destroy (self->source);
+  g_source_unref (self->source);
+  self->source = NULL;
+
+  if (self->complete)
     {
-      g_source_destroy (self->source);
-      g_source_unref (self->source);
-      self->source = NULL;
+      g_debug ("%s: complete flushing output", self->logname);
+      g_output_stream_flush_async (G_OUTPUT_STREAM (self->out), G_PRIORITY_DEFAULT,
+                                   NULL, on_output_flushed, g_object_ref (self));
+    }
+
+  return FALSE;
+}
 
-      if (self->complete)
+static OutputBlock *
+output_block_new (GBytes *bytes,
+                  gboolean chunk)
+{
+  static const gchar hex[] = "0123456789abcdef";
+  OutputBlock *block;
+  gchar digits[16];
+  gsize size;
+  guint n = 0;
+
+  block = g_slice_new (OutputBlock);
+  block->bytes = g_bytes_ref (bytes);
+  block->length = g_bytes_get_size (bytes);
+  block->header_len = 0;
+  block->trailer = chunk;
+
+  /* Required for chunked transfer encoding: "%x\r\n" and a trailing "\r\n" */
+  if (chunk)
+    {
+      size = block->length;
+      do
         {
-          g_debug ("%s: complete flushing output", self->logname);
-          g_output_stream_flush_async (G_OUTPUT_STREAM (self->out), G_PRIORITY_DEFAULT,
-                                       NULL, on_output_flushed, g_object_ref (self));
+          digits[n++] = hex[size & 0xf];
+          size >>= 4;
         }
+      while (size > 0);
 
-      return FALSE;
+      while (n > 0)
+        block->header[block->header_len++] = digits[--n];
+      block->header[block->header_len++] = '\r';
+      block->header[block->header_len++] = '\n';
+      block->length += block->header_len + 2;
     }
+
+  return block;
 }
 
 static void
-queue_bytes (CockpitWebResponse *self,
-             GBytes *block)
+queue_output (CockpitWebResponse *self,
+              GBytes *bytes,
+              gboolean chunk)
 {
-  gsize size, before;
+  OutputBlock *block;
+  gsize before;
 
-  size = g_bytes_get_size (block);
+  block = output_block_new (bytes, chunk);
   before = self->out_queued;
-  g_return_if_fail (G_MAXSIZE - size > self->out_queued);
-  self->out_queued += size;
+  if (G_MAXSIZE - block->length <= self->out_queued)
+    {
+      output_block_free (block);
+      g_return_if_reached ();
+    }
+  self->out_queued += block->length;
 
-  g_queue_push_tail (self->queue, g_bytes_ref (block));
+  g_queue_push_tail (self->queue, block);
 
   self->count++;
 
@@ -496,13 +633,18 @@ queue_bytes (CockpitWebResponse *self,
     cockpit_flow_emit_pressure (COCKPIT_FLOW (self), TRUE);
 }
 
+static void
+queue_bytes (CockpitWebResponse *self,
+             GBytes *block)
+{
+  queue_output (self, block, FALSE);
+}
+
 static void
 queue_block (CockpitWebResponse *self,
              GBytes *block)
 {
   gsize length = g_bytes_get_size (block);
-  GBytes *bytes;
-  gchar *data;
 
   /*
    * We cannot queue chunks of length zero. Besides being silly, this
@@ -521,24 +663,7 @@ queue_block (CockpitWebResponse *self,
   self->out_queueable -= length;
   g_debug ("%s: queued %d bytes", self->logname, (int)length);
 
-  if (!self->chunked)
-    {
-      queue_bytes (self, block);
-    }
-  else
-    {
-      /* Required for chunked transfer encoding. */
-      data = g_strdup_printf ("%x\r\n", (unsigned int)length);
-      bytes = g_bytes_new_take (data, strlen (data));
-      queue_bytes (self, bytes);
-      g_bytes_unref (bytes);
-
-      queue_bytes (self, block);
-
-      bytes = g_bytes_new_static ("\r\n", 2);
-      queue_bytes (self, bytes);
-      g_bytes_unref (bytes);
-    }
+  queue_output (self, block, self->chunked);
 }
 
 typedef struct {
@@ -758,8 +883,17 @@ begin_headers (CockpitWebResponse *response,
 static guint
 append_header (GString *string,
                const gchar *name,
-               const gchar *value)
+               const gchar *value,
+               const gchar **vary)
 {
+  /* Written out along with our own Vary values in finish_headers() */
+  if (g_ascii_strcasecmp ("Vary", name) == 0)
+    {
+      g_return_val_if_fail (value == NULL || cockpit_web_response_is_header_value (value), 0);
+      if (value)
+        *vary = value;
+      return HEADER_VARY;
+    }
   if (value)
     {
       g_return_val_if_fail (cockpit_web_response_is_simple_token (name), 0);
@@ -770,8 +904,6 @@ append_header (GString *string,
     return HEADER_CONTENT_TYPE;
   if (g_ascii_strcasecmp ("Cache-Control", name) == 0)
     return HEADER_CACHE_CONTROL;
-  if (g_ascii_strcasecmp ("Vary", name) == 0)
-    return HEADER_VARY;
   if (g_ascii_strcasecmp ("Content-Encoding", name) == 0)
     return HEADER_CONTENT_ENCODING;
   if (g_ascii_strcasecmp ("X-DNS-Prefetch-Control", name) == 0)
@@ -795,7 +927,8 @@ append_header (GString *string,
 
 static guint
 append_table (GString *string,
-              GHashTable *headers)
+              GHashTable *headers,
+              const gchar **vary)
 {
   GHashTableIter iter;
   gpointer key;
@@ -806,7 +939,7 @@ append_table (GString *string,
     {
       g_hash_table_iter_init (&iter, headers);
       while (g_hash_table_iter_next (&iter, &key, &value))
-        seen |= append_header (string, key, value);
+        seen |= append_header (string, key, value, vary);
     }
 
   return seen;
@@ -814,7 +947,8 @@ append_table (GString *string,
 
 static guint
 append_va (GString *string,
-           va_list va)
+           va_list va,
+           const gchar **vary)
 {
   const gchar *name;
   const gchar *value;
@@ -826,7 +960,7 @@ append_va (GString *string,
       if (!name)
         break;
       value = va_arg (va, const gchar *);
-      seen |= append_header (string, name, value);
+      seen |= append_header (string, name, value, vary);
     }
 
   return seen;
@@ -837,7 +971,8 @@ finish_headers (CockpitWebResponse *self,
                 GString *string,
                 gssize length,
                 gint status,
-                guint seen)
+                guint seen,
+                const gchar *vary)
 {
   const gchar *content_type;
 
@@ -875,10 +1010,19 @@ finish_headers (CockpitWebResponse *self,
         g_string_append (string, "Cache-Control: max-age=86400, private\r\n");
     }
 
-  if ((seen & HEADER_VARY) == 0 && status >= 200 && status <= 299 &&
-      self->cache_type == COCKPIT_WEB_RESPONSE_CACHE_PRIVATE)
+  /* Private content depends on the cookie, whatever else it varies on */
+  if (status >= 200 && status <= 299 &&
+      self->cache_type == COCKPIT_WEB_RESPONSE_CACHE_PRIVATE &&
+      (!vary || !strstr (vary, "Cookie")))
     {
-      g_string_append (string, "Vary: Cookie\r\n");
+      if (vary)
+        g_string_append_printf (string, "Vary: Cookie, %s\r\n", vary);
+      else
+        g_string_append (string, "Vary: Cookie\r\n");
+    }
+  else if (vary)
+    {
+      g_string_append_printf (string, "Vary: %s\r\n", vary);
     }
 
   if (!self->keep_alive)
@@ -943,9 +1087,11 @@ cockpit_web_response_headers (CockpitWebResponse *self,
                               gssize length,
                               ...)
 {
+  const gchar *vary = NULL;
   GString *string;
   GBytes *block;
   va_list va;
+  guint seen;
 
   g_return_if_fail (COCKPIT_IS_WEB_RESPONSE (self));
 
@@ -958,8 +1104,8 @@ cockpit_web_response_headers (CockpitWebResponse *self,
   string = begin_headers (self, status, reason);
 
   va_start (va, length);
-  block = finish_headers (self, string, length, status,
-                          append_va (string, va));
+  seen = append_va (string, va, &vary);
+  block = finish_headers (self, string, length, status, seen, vary);
   va_end (va);
 
   queue_bytes (self, block);
@@ -991,8 +1137,10 @@ cockpit_web_response_headers_full  (CockpitWebResponse *self,
                                     gssize length,
                                     GHashTable *headers)
 {
+  const gchar *vary = NULL;
   GString *string;
   GBytes *block;
+  guint seen;
 
   g_return_if_fail (COCKPIT_IS_WEB_RESPONSE (self));
 
@@ -1004,8 +1152,8 @@ cockpit_web_response_headers_full  (CockpitWebResponse *self,
 
   string = begin_headers (self, status, reason);
 
-  block = finish_headers (self, string, length, status,
-                          append_table (string, headers));
+  seen = append_table (string, headers, &vary);
+  block = finish_headers (self, string, length, status, seen, vary);
 
   queue_bytes (self, block);
   g_bytes_unref (block);
@@ -1149,6 +1297,9 @@ cockpit_web_response_error (CockpitWebResponse *self,
         case 502:
           message = "Remote Page is Unavailable";
           break;
+        case 503:
+          message = "Service Unavailable";
+          break;
         case 500:
           message = "Internal Server Error";
           break;
@@ -1234,6 +1385,9 @@ cockpit_web_response_gerror (CockpitWebResponse *self,
   else if (g_error_matches (error,
                             G_IO_ERROR, G_IO_ERROR_NO_SPACE))
     code = 413;
+  else if (g_error_matches (error,
+                            G_IO_ERROR, G_IO_ERROR_BUSY))
+    code = 503;
   else
     code = 500;
 
@@ -1560,6 +1714,62 @@ cockpit_web_response_gunzip (GBytes *bytes,
     }
 }
 
+/**
+ * cockpit_web_response_gzip:
+ * @bytes: the bytes to compress
+ * @error: place to put an error
+ *
+ * Perform gzip compression on the @bytes, for content that is
+ * compressed once and served many times.
+ *
+ * Returns: the compressed bytes, caller owns return value.
+ */
+GBytes *
+cockpit_web_response_gzip (GBytes *bytes,
+                           GError **error)
+{
+  GConverter *converter;
+  GConverterResult result;
+  const guint8 *in;
+  gsize inl, outl, space, read, written;
+  GByteArray *out;
+
+  converter = G_CONVERTER (g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP, 9));
+
+  in = g_bytes_get_data (bytes, &inl);
+  out = g_byte_array_new ();
+
+  do
+    {
+      /* Incompressible data grows a little, and the trailer needs room */
+      space = inl + 1024;
+      outl = out->len;
+      g_byte_array_set_size (out, outl + space);
+
+      result = g_converter_convert (converter, in, inl, out->data + outl, space,
+                                    G_CONVERTER_INPUT_AT_END, &read, &written, error);
+      if (result == G_CONVERTER_ERROR)
+        break;
+
+      g_byte_array_set_size (out, outl + written);
+      in += read;
+      inl -= read;
+    }
+  while (result != G_CONVERTER_FINISHED);
+
+  g_object_unref (converter);
+
+  if (result != G_CONVERTER_FINISHED)
+    {
+      g_byte_array_unref (out);
+      return NULL;
+    }
+  else
+    {
+      return g_byte_array_free_to_bytes (out);
+    }
+}
+
 static const gchar *
 find_extension (const gchar *path)
 {
@@ -1610,6 +1820,97 @@ load_file (const gchar *filename,
   return NULL;
 }
 
+static gboolean
+parse_accept_quality (const gchar *params)
+{
+  const gchar *param;
+  gchar *end;
+  gdouble q;
+
+  /* Anything but an explicit q=0 means the coding is acceptable */
+  for (param = params; param != NULL; param = strchr (param, ';'))
+    {
+      if (*param == ';')
+        param++;
+      while (g_ascii_isspace (*param))
+        param++;
+      if (g_ascii_tolower (*param) != 'q')
+        continue;
+      param++;
+      while (g_ascii_isspace (*param))
+        param++;
+      if (*param != '=')
+        continue;
+      q = g_ascii_strtod (param + 1, &end);
+      if (end == param + 1)
+        continue;
+      return q > 0;
+    }
+
+  return TRUE;
+}
+
+/**
+ * cockpit_web_response_accepted_encodings:
+ * @accept: the Accept-Encoding header or NULL
+ *
+ * Figure out which of the content encodings we can serve from
+ * precompressed files the client accepts.
+ *
+ * Returns: the encodings, or %COCKPIT_WEB_ENCODING_IDENTITY
+ */
+CockpitWebEncodings
+cockpit_web_response_accepted_encodings (const gchar *accept)
+{
+  CockpitWebEncodings accepted = 0;
+  CockpitWebEncodings named = 0;
+  CockpitWebEncodings flag;
+  gboolean wildcard = FALSE;
+  gchar **tokens;
+  gchar *params;
+  gchar *coding;
+  gint i;
+
+  if (!accept)
+    return COCKPIT_WEB_ENCODING_IDENTITY;
+
+  tokens = g_strsplit (accept, ",", -1);
+  for (i = 0; tokens[i] != NULL; i++)
+    {
+      params = strchr (tokens[i], ';');
+      if (params)
+        *params++ = '\0';
+      coding = g_strstrip (tokens[i]);
+
+      if (g_ascii_strcasecmp (coding, "gzip") == 0)
+        flag = COCKPIT_WEB_ENCODING_GZIP;
+      else if (g_ascii_strcasecmp (coding, "br") == 0)
+        flag = COCKPIT_WEB_ENCODING_BROTLI;
+      else if (g_str_equal (coding, "*"))
+        flag = 0;
+      else
+        continue;
+
+      /* An explicitly named coding overrides the wildcard either way */
+      if (flag)
+        {
+          named |= flag;
+          if (parse_accept_quality (params))
+            accepted |= flag;
+        }
+      else if (parse_accept_quality (params))
+        {
+          wildcard = TRUE;
+        }
+    }
+
+  if (wildcard)
+    accepted |= (COCKPIT_WEB_ENCODING_GZIP | COCKPIT_WEB_ENCODING_BROTLI) & ~named;
+
+  g_strfreev (tokens);
+  return COCKPIT_WEB_ENCODING_IDENTITY | accepted;
+}
+
 /**
  * cockpit_web_response_negotiation:
  * @path: likely filesystem path
@@ -1631,9 +1932,35 @@ cockpit_web_response_negotiation (const gchar *path,
                                   const gchar *language,
                                   gchar **actual,
                                   GError **error)
+{
+  return cockpit_web_response_negotiation_full (path, existing, language,
+                                                COCKPIT_WEB_ENCODING_IDENTITY, actual, error);
+}
+
+/**
+ * cockpit_web_response_negotiation_full:
+ * @path: likely filesystem path
+ * @existing: a table of existing files
+ * @encodings: the encodings the client accepts
+ * @chosen: out, a pointer to the suffix that was chosen
+ * @error: a failure
+ *
+ * Like cockpit_web_response_negotiation() but prefers .br and .gz
+ * variants of each file when they are in @encodings. A .br file is
+ * never chosen unless accepted, but a .gz file is still used after
+ * all else, and the caller needs to decompress it.
+ */
+GBytes *
+cockpit_web_response_negotiation_full (const gchar *path,
+                                       GHashTable *existing,
+                                       const gchar *language,
+                                       CockpitWebEncodings encodings,
+                                       gchar **actual,
+                                       GError **error)
 {
   gchar *base = NULL;
   const gchar *ext;
+  const gchar *suffix;
   gchar *dot;
   gchar *name = NULL;
   GBytes *bytes = NULL;
@@ -1642,8 +1969,9 @@ cockpit_web_response_negotiation (const gchar *path,
   gchar *shorter = NULL;
   gchar *lang = NULL;
   gchar *lang_region = NULL;
-
-  gint i;
+  gchar *stems[2] = { NULL, NULL };
+  gint n_stems;
+  gint i, j, k;
 
   if (language)
       locale = cockpit_locale_from_language (language, NULL, &shorter);
@@ -1665,13 +1993,19 @@ cockpit_web_response_negotiation (const gchar *path,
          order, and serve the first that is found:
 
            base.lang_REGION.ext
-           base.lang_REGION.ext.gz
            base.lang.ext
-           base.lang.ext.gz
            base.ext
            base.min.ext
+
+         For each of these, the compressed variants the client accepts come first, .br before .gz, and
+         then the plain file. When the client doesn't accept gzip, the .gz variant is still tried last:
+
+           base.ext.br
+           base.min.ext.br
            base.ext.gz
-           base.ext.min.gz
+           base.min.ext.gz
+           base.ext
+           base.min.ext
 
          If no locale is requested, or a locale without region, those variants are left out by starting
          further down in the list.
@@ -1687,57 +2021,70 @@ cockpit_web_response_negotiation (const gchar *path,
         i = 0;
       } else if (locale) {
         lang = locale;
-        i = 2;
+        i = 1;
       } else {
-        i = 4;
+        i = 2;
       }
 
-      for (; i < 8; i++)
+      for (; i < 3 && !bytes; i++)
         {
-          g_free (name);
           switch (i)
             {
             case 0:
-              name = g_strconcat (base, ".", lang_region, ext, NULL);
+              stems[0] = g_strconcat (base, ".", lang_region, ext, NULL);
+              n_stems = 1;
               break;
             case 1:
-              name = g_strconcat (base, ".", lang_region, ext, ".gz", NULL);
+              stems[0] = g_strconcat (base, ".", lang, ext, NULL);
+              n_stems = 1;
               break;
             case 2:
-              name = g_strconcat (base, ".", lang, ext, NULL);
-              break;
-            case 3:
-              name = g_strconcat (base, ".", lang, ext, ".gz", NULL);
-              break;
-            case 4:
-              name = g_strconcat (base, ext, NULL);
-              break;
-            case 5:
-              name = g_strconcat (base, ".min", ext, NULL);
-              break;
-            case 6:
-              name = g_strconcat (base, ext, ".gz", NULL);
-              break;
-            case 7:
-              name = g_strconcat (base, ".min", ext, ".gz", NULL);
+              stems[0] = g_strconcat (base, ext, NULL);
+              stems[1] = g_strconcat (base, ".min", ext, NULL);
+              n_stems = 2;
               break;
             default:
               g_assert_not_reached ();
             }
 
-          if (existing)
+          for (j = 0; j < 4 && !bytes; j++)
             {
-              if (!g_hash_table_lookup (existing, name))
-                continue;
+              if (j == 0)
+                suffix = encodings & COCKPIT_WEB_ENCODING_BROTLI ? ".br" : NULL;
+              else if (j == 1)
+                suffix = encodings & COCKPIT_WEB_ENCODING_GZIP ? ".gz" : NULL;
+              else if (j == 2)
+                suffix = "";
+              else
+                suffix = encodings & COCKPIT_WEB_ENCODING_GZIP ? NULL : ".gz";
+
+              for (k = 0; suffix && k < n_stems; k++)
+                {
+                  g_free (name);
+                  name = g_strconcat (stems[k], suffix, NULL);
+
+                  if (existing)
+                    {
+                      if (!g_hash_table_lookup (existing, name))
+                        continue;
+                    }
+
+                  bytes = load_file (name, &local_error);
+                  if (bytes)
+                    break;
+                  if (local_error)
+                    goto out;
+                }
             }
 
-          bytes = load_file (name, &local_error);
-          if (bytes)
-            break;
-          if (local_error)
-            goto out;
+          g_free (stems[0]);
+          g_free (stems[1]);
+          stems[0] = stems[1] = NULL;
         }
 
+      if (bytes)
+        break;
+
       /* Pop one level off the file name */
       dot = (gchar *)find_extension (base);
       if (!dot)
@@ -1754,6 +2101,8 @@ out:
       *actual = name;
       name = NULL;
     }
+  g_free (stems[0]);
+  g_free (stems[1]);
   g_free (name);
   g_free (base);
   g_free (locale);
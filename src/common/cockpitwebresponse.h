@@ -51,6 +51,12 @@ typedef enum {
   COCKPIT_WEB_RESPONSE_CACHE_PRIVATE,
 } CockpitCacheType;
 
+typedef enum {
+  COCKPIT_WEB_ENCODING_IDENTITY = 0,
+  COCKPIT_WEB_ENCODING_GZIP = 1 << 0,
+  COCKPIT_WEB_ENCODING_BROTLI = 1 << 1,
+} CockpitWebEncodings;
+
 #define COCKPIT_CHECKSUM_HEADER "X-Cockpit-Pkg-Checksum"
 
 typedef struct _CockpitWebResponse        CockpitWebResponse;
@@ -65,6 +71,8 @@ CockpitWebResponse *  cockpit_web_response_new           (GIOStream *io,
                                                           CockpitWebResponseFlags flags);
 void                  cockpit_web_response_set_method    (CockpitWebResponse *response,
                                                           const gchar *method);
+void                  cockpit_web_response_set_keep_alive (CockpitWebResponse *self,
+                                                           gboolean keep_alive);
 
 
 const gchar *         cockpit_web_response_get_path      (CockpitWebResponse *self);
@@ -125,12 +133,24 @@ void                  cockpit_web_response_file          (CockpitWebResponse *re
 GBytes *              cockpit_web_response_gunzip        (GBytes *bytes,
                                                           GError **error);
 
+GBytes *              cockpit_web_response_gzip          (GBytes *bytes,
+                                                          GError **error);
+
 GBytes *              cockpit_web_response_negotiation   (const gchar *path,
                                                           GHashTable *existing,
                                                           const gchar *language,
                                                           gchar **actual,
                                                           GError **error);
 
+GBytes *              cockpit_web_response_negotiation_full (const gchar *path,
+                                                             GHashTable *existing,
+                                                             const gchar *language,
+                                                             CockpitWebEncodings encodings,
+                                                             gchar **actual,
+                                                             GError **error);
+
+CockpitWebEncodings   cockpit_web_response_accepted_encodings (const gchar *accept);
+
 const gchar *         cockpit_web_response_content_type  (const gchar *path);
 
 gboolean     cockpit_web_should_suppress_output_error    (const gchar *logname,
@@ -22,6 +22,7 @@
 #include "cockpitwebserver.h"
 
 #include "cockpithash.h"
+#include "cockpithttpparser.h"
 #include "cockpitmemfdread.h"
 #include "cockpitmemory.h"
 #include "cockpitsocket.h"
@@ -55,6 +56,9 @@ struct _CockpitWebServer {
   GSocketService *socket_service;
   GMainContext *main_context;
   GHashTable *requests;
+
+  /* Connections that are still around, whether reading or responding */
+  GHashTable *connections;
 };
 
 enum
@@ -69,11 +73,13 @@ enum
 static gint sig_handle_stream = 0;
 static gint sig_handle_resource = 0;
 
+typedef struct _CockpitRequest CockpitRequest;
+
 static void cockpit_request_free (gpointer data);
 
-static void cockpit_request_start (CockpitWebServer *self,
-                                   GIOStream *stream,
-                                   gboolean first);
+static CockpitRequest * cockpit_request_start (CockpitWebServer *self,
+                                               GIOStream *stream,
+                                               gboolean first);
 
 static gboolean on_incoming (GSocketService *service,
                              GSocketConnection *connection,
@@ -89,6 +95,7 @@ cockpit_web_server_init (CockpitWebServer *server)
 {
   server->requests = g_hash_table_new_full (g_direct_hash, g_direct_equal,
                                             cockpit_request_free, NULL);
+  server->connections = g_hash_table_new (g_direct_hash, g_direct_equal);
   server->main_context = g_main_context_ref_thread_default ();
   server->ssl_exception_prefix = g_string_new ("");
   server->url_root = g_string_new ("");
@@ -102,13 +109,36 @@ cockpit_web_server_init (CockpitWebServer *server)
                     G_CALLBACK (on_incoming), server);
 }
 
+static void
+on_connection_finalized (gpointer data,
+                         GObject *where_the_object_was)
+{
+  CockpitWebServer *self = data;
+  g_hash_table_remove (self->connections, where_the_object_was);
+}
+
+static void
+track_connection (CockpitWebServer *self,
+                  GIOStream *io)
+{
+  g_hash_table_add (self->connections, io);
+  g_object_weak_ref (G_OBJECT (io), on_connection_finalized, self);
+}
+
 static void
 cockpit_web_server_dispose (GObject *object)
 {
   CockpitWebServer *self = COCKPIT_WEB_SERVER (object);
+  GHashTableIter iter;
+  gpointer io;
 
   g_hash_table_remove_all (self->requests);
 
+  g_hash_table_iter_init (&iter, self->connections);
+  while (g_hash_table_iter_next (&iter, &io, NULL))
+    g_object_weak_unref (io, on_connection_finalized, self);
+  g_hash_table_remove_all (self->connections);
+
   G_OBJECT_CLASS (cockpit_web_server_parent_class)->dispose (object);
 }
 
@@ -119,6 +149,7 @@ cockpit_web_server_finalize (GObject *object)
 
   g_clear_object (&server->certificate);
   g_hash_table_destroy (server->requests);
+  g_hash_table_destroy (server->connections);
   if (server->main_context)
     g_main_context_unref (server->main_context);
   g_string_free (server->ssl_exception_prefix, TRUE);
@@ -248,6 +279,25 @@ on_web_response_done (CockpitWebResponse *response,
     close_io_stream (io);
 }
 
+static void
+watch_web_response (CockpitWebServer *self,
+                    CockpitWebResponse *response,
+                    GIOStream *io)
+{
+  /*
+   * The dispatcher of a cockpit-ws with workers picked the worker for a
+   * passed connection by the cookie of its first request. Later requests
+   * may belong to another worker, so don't read them here: close the
+   * connection after each response, and let the browser reconnect
+   * through the dispatcher.
+   */
+  if (g_object_get_qdata (G_OBJECT (io), g_quark_from_static_string ("passed")))
+    cockpit_web_response_set_keep_alive (response, FALSE);
+
+  g_signal_connect_data (response, "done", G_CALLBACK (on_web_response_done),
+                         g_object_ref (self), (GClosureNotify)g_object_unref, 0);
+}
+
 static gboolean
 cockpit_web_server_default_handle_resource (CockpitWebServer *self,
                                             const gchar *path,
@@ -293,8 +343,7 @@ cockpit_web_server_default_handle_stream (CockpitWebServer *self,
                                        (self->flags & COCKPIT_WEB_SERVER_FOR_TLS_PROXY) ?
                                          COCKPIT_WEB_RESPONSE_FOR_TLS_PROXY : COCKPIT_WEB_RESPONSE_NONE);
   cockpit_web_response_set_method (response, method);
-  g_signal_connect_data (response, "done", G_CALLBACK (on_web_response_done),
-                         g_object_ref (self), (GClosureNotify)g_object_unref, 0);
+  watch_web_response (self, response, io_stream);
 
   /*
    * If the path has more than one component, then we search
@@ -601,17 +650,18 @@ cockpit_web_server_parse_accept_list (const gchar *accept,
 
 /* ---------------------------------------------------------------------------------------------------- */
 
-typedef struct {
+struct _CockpitRequest {
   int state;
   GIOStream *io;
   GByteArray *buffer;
+  CockpitHttpParser parser;
   gint delayed_reply;
   CockpitWebServer *web_server;
   gboolean eof_okay;
   GSource *source;
   GSource *timeout;
   gboolean check_tls_redirect;
-} CockpitRequest;
+};
 
 static void
 cockpit_request_free (gpointer data)
@@ -634,6 +684,7 @@ cockpit_request_free (gpointer data)
    * clear it here. The buffer may still be in use.
    */
   g_byte_array_unref (request->buffer);
+  cockpit_http_parser_clear (&request->parser);
   g_object_unref (request->io);
   g_free (request);
 }
@@ -661,8 +712,7 @@ process_delayed_reply (CockpitRequest *request,
   response = cockpit_web_response_new (request->io, NULL, NULL, NULL, headers,
                                        (request->web_server->flags & COCKPIT_WEB_SERVER_FOR_TLS_PROXY) ?
                                          COCKPIT_WEB_RESPONSE_FOR_TLS_PROXY : COCKPIT_WEB_RESPONSE_NONE);
-  g_signal_connect_data (response, "done", G_CALLBACK (on_web_response_done),
-                         g_object_ref (request->web_server), (GClosureNotify)g_object_unref, 0);
+  watch_web_response (request->web_server, response, request->io);
 
   if (request->delayed_reply == 301)
     {
@@ -774,14 +824,14 @@ process_request (CockpitRequest *request,
 static gboolean
 parse_and_process_request (CockpitRequest *request)
 {
+  CockpitHttpParseResult result;
   gboolean again = FALSE;
   GHashTable *headers = NULL;
-  gchar *method = NULL;
-  gchar *path = NULL;
+  const gchar *method;
+  const gchar *path;
   const gchar *str;
   gchar *end = NULL;
-  gssize off1;
-  gssize off2;
+  gsize off;
   guint64 length;
 
   /* The hard input limit, we just terminate the connection */
@@ -791,37 +841,31 @@ parse_and_process_request (CockpitRequest *request)
       goto out;
     }
 
-  off1 = web_socket_util_parse_req_line ((const gchar *)request->buffer->data,
-                                         request->buffer->len,
-                                         &method,
-                                         &path);
-  if (off1 == 0)
-    {
-      again = TRUE;
-      goto out;
-    }
-  if (off1 < 0)
+  /* Only looks at what arrived since the last time */
+  result = cockpit_http_parser_feed (&request->parser,
+                                     (const gchar *)request->buffer->data,
+                                     request->buffer->len);
+  if (result == COCKPIT_HTTP_PARSE_BAD_REQUEST_LINE)
     {
       g_message ("received invalid HTTP request line");
       request->delayed_reply = 400;
       goto out;
     }
-  if (!path || path[0] != '/')
+
+  path = cockpit_http_parser_get_path (&request->parser);
+  if (path && path[0] != '/')
     {
       g_message ("received invalid HTTP path");
       request->delayed_reply = 400;
       goto out;
     }
 
-  off2 = web_socket_util_parse_headers ((const gchar *)request->buffer->data + off1,
-                                        request->buffer->len - off1,
-                                        &headers);
-  if (off2 == 0)
+  if (result == COCKPIT_HTTP_PARSE_MORE)
     {
       again = TRUE;
       goto out;
     }
-  if (off2 < 0)
+  if (result == COCKPIT_HTTP_PARSE_BAD_HEADER)
     {
       g_message ("received invalid HTTP request headers");
       request->delayed_reply = 400;
@@ -830,7 +874,7 @@ parse_and_process_request (CockpitRequest *request)
 
   /* If we get a Content-Length then verify it is zero */
   length = 0;
-  str = g_hash_table_lookup (headers, "Content-Length");
+  str = cockpit_http_parser_get_header (&request->parser, "Content-Length");
   if (str != NULL)
     {
       end = NULL;
@@ -851,33 +895,37 @@ parse_and_process_request (CockpitRequest *request)
     }
 
   /* Not enough data yet */
-  if (request->buffer->len < off1 + off2 + length)
+  off = cockpit_http_parser_get_length (&request->parser);
+  if (request->buffer->len < off + length)
     {
       again = TRUE;
       goto out;
     }
 
+  method = cockpit_http_parser_get_method (&request->parser);
   if (!g_str_equal (method, "GET") && !g_str_equal (method, "HEAD"))
     {
       g_message ("received unsupported HTTP method");
       request->delayed_reply = 405;
     }
 
-  str = g_hash_table_lookup (headers, "Host");
+  str = cockpit_http_parser_get_header (&request->parser, "Host");
   if (!str || g_str_equal (str, ""))
     {
       g_message ("received HTTP request without Host header");
       request->delayed_reply = 400;
     }
 
-  g_byte_array_remove_range (request->buffer, 0, off1 + off2);
+  /* Handlers get the headers as a table, built once the request is complete */
+  headers = cockpit_http_parser_build_headers (&request->parser);
+  str = g_hash_table_lookup (headers, "Host");
+
+  g_byte_array_remove_range (request->buffer, 0, off);
   process_request (request, method, path, str, headers);
 
 out:
   if (headers)
     g_hash_table_unref (headers);
-  g_free (method);
-  g_free (path);
   if (!again)
     cockpit_request_finish (request);
   return again;
@@ -1146,7 +1194,7 @@ on_request_timeout (gpointer data)
   return FALSE;
 }
 
-static void
+static CockpitRequest *
 cockpit_request_start (CockpitWebServer *self,
                        GIOStream *io,
                        gboolean first)
@@ -1159,6 +1207,7 @@ cockpit_request_start (CockpitWebServer *self,
   request->web_server = self;
   request->io = g_object_ref (io);
   request->buffer = g_byte_array_new ();
+  cockpit_http_parser_init (&request->parser);
 
   /* Right before a request, EOF is not unexpected */
   request->eof_okay = TRUE;
@@ -1183,6 +1232,7 @@ cockpit_request_start (CockpitWebServer *self,
 
   /* Owns the request */
   g_hash_table_add (self->requests, request);
+  return request;
 }
 
 static gboolean
@@ -1192,6 +1242,7 @@ on_incoming (GSocketService *service,
              gpointer user_data)
 {
   CockpitWebServer *self = COCKPIT_WEB_SERVER (user_data);
+  track_connection (self, G_IO_STREAM (connection));
   cockpit_request_start (self, G_IO_STREAM (connection), TRUE);
 
   /* handled */
@@ -1260,6 +1311,71 @@ cockpit_web_server_add_fd_listener (CockpitWebServer *self,
   return TRUE;
 }
 
+/**
+ * cockpit_web_server_add_fd_connection:
+ * @self: the web server
+ * @fd: a connected plain text socket, taken over by the server
+ * @received: (nullable): the start of the request, already read from @fd
+ *
+ * Serve a connection that was accepted by another process, such as
+ * the dispatcher of a cockpit-ws with worker processes. Only one
+ * request is served on such a connection, keep-alive is turned off.
+ */
+gboolean
+cockpit_web_server_add_fd_connection (CockpitWebServer *self,
+                                      int fd,
+                                      GBytes *received,
+                                      GError **error)
+{
+  g_autoptr(GSocketConnection) connection = NULL;
+  g_autoptr(GSocket) socket = NULL;
+  CockpitRequest *request;
+  gsize length;
+  gconstpointer data;
+
+  g_return_val_if_fail (COCKPIT_IS_WEB_SERVER (self), FALSE);
+
+  socket = g_socket_new_from_fd (fd, error);
+  if (socket == NULL)
+    {
+      g_prefix_error (error, "Failed to acquire passed connection %i: ", fd);
+      return FALSE;
+    }
+
+  connection = g_socket_connection_factory_create_connection (socket);
+  g_object_set_qdata (G_OBJECT (connection), g_quark_from_static_string ("passed"), GINT_TO_POINTER (1));
+  track_connection (self, G_IO_STREAM (connection));
+
+  /* Already known not to be TLS, so skip straight to reading the request */
+  request = cockpit_request_start (self, G_IO_STREAM (connection), FALSE);
+
+  if (received && g_bytes_get_size (received) > 0)
+    {
+      data = g_bytes_get_data (received, &length);
+      g_byte_array_append (request->buffer, data, length);
+      request->eof_okay = FALSE;
+
+      /* Finishes the request itself when it's not waiting for more */
+      parse_and_process_request (request);
+    }
+
+  return TRUE;
+}
+
+/**
+ * cockpit_web_server_get_n_connections:
+ * @self: the web server
+ *
+ * Returns: the number of connections accepted by or passed to @self
+ *   that are still around, including idle keep-alive connections
+ */
+guint
+cockpit_web_server_get_n_connections (CockpitWebServer *self)
+{
+  g_return_val_if_fail (COCKPIT_IS_WEB_SERVER (self), 0);
+  return g_hash_table_size (self->connections);
+}
+
 void
 cockpit_web_server_start (CockpitWebServer *self)
 {
@@ -28,6 +28,7 @@ G_BEGIN_DECLS
 G_DECLARE_FINAL_TYPE(CockpitWebServer, cockpit_web_server, COCKPIT, WEB_SERVER, GObject)
 
 extern guint cockpit_webserver_request_timeout;
+extern const gsize cockpit_webserver_request_maximum;
 
 typedef enum {
   COCKPIT_WEB_SERVER_NONE = 0,
@@ -64,6 +65,15 @@ cockpit_web_server_add_fd_listener (CockpitWebServer *self,
                                     int fd,
                                     GError **error);
 
+gboolean
+cockpit_web_server_add_fd_connection (CockpitWebServer *self,
+                                      int fd,
+                                      GBytes *received,
+                                      GError **error);
+
+guint
+cockpit_web_server_get_n_connections (CockpitWebServer *self);
+
 GIOStream *
 cockpit_web_server_connect (CockpitWebServer *self);
 
@@ -0,0 +1,349 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpitbufferpool.h"
+#include "cockpittest.h"
+
+#include <string.h>
+
+static void
+reset_pool (void)
+{
+  cockpit_buffer_pool_trim ();
+  cockpit_buffer_pool_reset_stats ();
+}
+
+static void
+test_size_class (void)
+{
+  gpointer block;
+
+  reset_pool ();
+
+  /* Rounded up to the size class */
+  block = cockpit_buffer_pool_alloc (10);
+  g_assert_cmpuint (cockpit_buffer_pool_block_size (block), ==, 256);
+  cockpit_buffer_pool_free (block);
+
+  block = cockpit_buffer_pool_alloc (0);
+  g_assert_cmpuint (cockpit_buffer_pool_block_size (block), ==, 256);
+  cockpit_buffer_pool_free (block);
+
+  block = cockpit_buffer_pool_alloc (257);
+  g_assert_cmpuint (cockpit_buffer_pool_block_size (block), ==, 1024);
+  memset (block, 'x', 1024);
+  cockpit_buffer_pool_free (block);
+
+  /* Larger than any class, exactly the size */
+  block = cockpit_buffer_pool_alloc (300000);
+  g_assert_cmpuint (cockpit_buffer_pool_block_size (block), ==, 300000);
+  memset (block, 'x', 300000);
+  cockpit_buffer_pool_free (block);
+
+  /* Freeing NULL is fine */
+  cockpit_buffer_pool_free (NULL);
+}
+
+static void
+test_reuse (void)
+{
+  CockpitBufferPoolStats stats;
+  gpointer one;
+  gpointer two;
+
+  reset_pool ();
+
+  one = cockpit_buffer_pool_alloc (100);
+  cockpit_buffer_pool_free (one);
+
+  cockpit_buffer_pool_get_stats (&stats);
+  g_assert_cmpuint (stats.allocated, ==, 1);
+  g_assert_cmpuint (stats.reused, ==, 0);
+  g_assert_cmpuint (stats.outstanding, ==, 0);
+  g_assert_cmpuint (stats.cached, ==, 1);
+  g_assert_cmpuint (stats.cached_bytes, ==, 256);
+
+  /* Same size class gets the same block back */
+  two = cockpit_buffer_pool_alloc (200);
+  g_assert (one == two);
+
+  cockpit_buffer_pool_get_stats (&stats);
+  g_assert_cmpuint (stats.allocated, ==, 2);
+  g_assert_cmpuint (stats.reused, ==, 1);
+  g_assert_cmpuint (stats.outstanding, ==, 1);
+  g_assert_cmpuint (stats.cached, ==, 0);
+
+  /* Different size class does not */
+  one = cockpit_buffer_pool_alloc (2000);
+  g_assert (one != two);
+
+  cockpit_buffer_pool_free (one);
+  cockpit_buffer_pool_free (two);
+
+  cockpit_buffer_pool_get_stats (&stats);
+  g_assert_cmpuint (stats.freed, ==, 3);
+  g_assert_cmpuint (stats.outstanding, ==, 0);
+  g_assert_cmpuint (stats.cached, ==, 2);
+}
+
+static void
+test_oversize (void)
+{
+  CockpitBufferPoolStats stats;
+  gpointer block;
+
+  reset_pool ();
+
+  block = cockpit_buffer_pool_alloc (1024 * 1024);
+  cockpit_buffer_pool_free (block);
+
+  /* Never cached */
+  cockpit_buffer_pool_get_stats (&stats);
+  g_assert_cmpuint (stats.oversize, ==, 1);
+  g_assert_cmpuint (stats.cached, ==, 0);
+  g_assert_cmpuint (stats.outstanding, ==, 0);
+}
+
+static void
+test_cache_limit (void)
+{
+  CockpitBufferPoolStats stats;
+  gpointer blocks[64];
+  guint i;
+
+  reset_pool ();
+
+  for (i = 0; i < G_N_ELEMENTS (blocks); i++)
+    blocks[i] = cockpit_buffer_pool_alloc (200000);
+  for (i = 0; i < G_N_ELEMENTS (blocks); i++)
+    cockpit_buffer_pool_free (blocks[i]);
+
+  /* Only a few of the largest class are kept */
+  cockpit_buffer_pool_get_stats (&stats);
+  g_assert_cmpuint (stats.outstanding, ==, 0);
+  g_assert_cmpuint (stats.cached, ==, 4);
+  g_assert_cmpuint (stats.cached_bytes, ==, 4 * 262144);
+}
+
+static void
+test_trim (void)
+{
+  CockpitBufferPoolStats stats;
+  gpointer blocks[8];
+  guint i;
+
+  reset_pool ();
+
+  for (i = 0; i < G_N_ELEMENTS (blocks); i++)
+    blocks[i] = cockpit_buffer_pool_alloc (i * 1000);
+  for (i = 0; i < G_N_ELEMENTS (blocks); i++)
+    cockpit_buffer_pool_free (blocks[i]);
+
+  cockpit_buffer_pool_get_stats (&stats);
+  g_assert_cmpuint (stats.cached, ==, 8);
+
+  cockpit_buffer_pool_trim ();
+
+  cockpit_buffer_pool_get_stats (&stats);
+  g_assert_cmpuint (stats.cached, ==, 0);
+  g_assert_cmpuint (stats.cached_bytes, ==, 0);
+  g_assert_cmpuint (stats.released, ==, 8);
+
+  /* Fresh allocations after trimming */
+  blocks[0] = cockpit_buffer_pool_alloc (10);
+  cockpit_buffer_pool_get_stats (&stats);
+  g_assert_cmpuint (stats.reused, ==, 0);
+  cockpit_buffer_pool_free (blocks[0]);
+}
+
+static void
+test_bytes_slices (void)
+{
+  CockpitBufferPoolStats stats;
+  GBytes *bytes;
+  GBytes *slice;
+  gchar *block;
+
+  reset_pool ();
+
+  block = cockpit_buffer_pool_alloc (11);
+  memcpy (block, "hello world", 11);
+  bytes = cockpit_buffer_pool_take_bytes (block, 11);
+
+  slice = g_bytes_new_from_bytes (bytes, 6, 5);
+  g_bytes_unref (bytes);
+
+  /* The slice keeps the block alive */
+  cockpit_buffer_pool_get_stats (&stats);
+  g_assert_cmpuint (stats.outstanding, ==, 1);
+  cockpit_assert_bytes_eq (slice, "world", 5);
+
+  g_bytes_unref (slice);
+
+  cockpit_buffer_pool_get_stats (&stats);
+  g_assert_cmpuint (stats.outstanding, ==, 0);
+  g_assert_cmpuint (stats.cached, ==, 1);
+}
+
+static void
+test_copy_bytes (void)
+{
+  GBytes *bytes;
+  gsize length;
+  const gchar *data;
+
+  reset_pool ();
+
+  bytes = cockpit_buffer_pool_copy_bytes ("abcdef", 3);
+  data = g_bytes_get_data (bytes, &length);
+  g_assert_cmpuint (length, ==, 3);
+
+  /* Always null terminated */
+  g_assert_cmpstr (data, ==, "abc");
+  g_bytes_unref (bytes);
+
+  bytes = cockpit_buffer_pool_copy_bytes (NULL, 0);
+  data = g_bytes_get_data (bytes, &length);
+  g_assert_cmpuint (length, ==, 0);
+  g_assert_cmpstr (data, ==, "");
+  g_bytes_unref (bytes);
+}
+
+static void
+test_concat_bytes (void)
+{
+  GBytes *payload;
+  GBytes *bytes;
+
+  reset_pool ();
+
+  payload = g_bytes_new_static ("payload", 7);
+  bytes = cockpit_buffer_pool_concat_bytes ("4\n", 2, payload);
+  cockpit_assert_bytes_eq (bytes, "4\npayload", 9);
+  g_bytes_unref (bytes);
+
+  bytes = cockpit_buffer_pool_concat_bytes (NULL, 0, payload);
+  cockpit_assert_bytes_eq (bytes, "payload", 7);
+  g_bytes_unref (bytes);
+  g_bytes_unref (payload);
+}
+
+/* A typical mix of message sizes on a busy connection */
+static const gsize message_sizes[] = {
+  20, 64, 100, 150, 300, 800, 1500, 4000, 8000, 30000, 64000
+};
+
+#define N_MESSAGES 200000
+
+static void
+test_throughput_malloc (void)
+{
+  GByteArray *array;
+  GBytes *bytes;
+  gchar payload[64000];
+  gdouble elapsed;
+  guint64 total = 0;
+  gsize size;
+  guint i;
+
+  memset (payload, 'x', sizeof (payload));
+
+  g_test_timer_start ();
+
+  /* What the layers did before: a fresh array for each frame */
+  for (i = 0; i < N_MESSAGES; i++)
+    {
+      size = message_sizes[i % G_N_ELEMENTS (message_sizes)];
+      array = g_byte_array_sized_new (size + 14);
+      g_byte_array_append (array, (guint8 *)"1234\n", 5);
+      g_byte_array_append (array, (guint8 *)payload, size);
+      bytes = g_byte_array_free_to_bytes (array);
+      total += g_bytes_get_size (bytes);
+      g_bytes_unref (bytes);
+    }
+
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "malloc: %u messages, %u allocations, %.1f MB/s",
+                           N_MESSAGES, N_MESSAGES, (total / elapsed) / (1024 * 1024));
+}
+
+static void
+test_throughput_pool (void)
+{
+  CockpitBufferPoolStats stats;
+  GBytes *bytes;
+  gchar payload[64000];
+  gdouble elapsed;
+  guint64 total = 0;
+  guint8 *block;
+  gsize size;
+  guint i;
+
+  memset (payload, 'x', sizeof (payload));
+  reset_pool ();
+
+  g_test_timer_start ();
+
+  for (i = 0; i < N_MESSAGES; i++)
+    {
+      size = message_sizes[i % G_N_ELEMENTS (message_sizes)];
+      block = cockpit_buffer_pool_alloc (size + 14);
+      memcpy (block, "1234\n", 5);
+      memcpy (block + 5, payload, size);
+      bytes = cockpit_buffer_pool_take_bytes (block, size + 5);
+      total += g_bytes_get_size (bytes);
+      g_bytes_unref (bytes);
+    }
+
+  elapsed = g_test_timer_elapsed ();
+
+  cockpit_buffer_pool_get_stats (&stats);
+  g_assert_cmpuint (stats.allocated, ==, N_MESSAGES);
+  g_assert_cmpuint (stats.outstanding, ==, 0);
+
+  g_test_minimized_result (elapsed, "pool: %u messages, %" G_GUINT64_FORMAT " allocations, %.1f MB/s",
+                           N_MESSAGES, stats.allocated - stats.reused,
+                           (total / elapsed) / (1024 * 1024));
+}
+
+int
+main (int argc,
+      char *argv[])
+{
+  cockpit_test_init (&argc, &argv);
+
+  g_test_add_func ("/buffer-pool/size-class", test_size_class);
+  g_test_add_func ("/buffer-pool/reuse", test_reuse);
+  g_test_add_func ("/buffer-pool/oversize", test_oversize);
+  g_test_add_func ("/buffer-pool/cache-limit", test_cache_limit);
+  g_test_add_func ("/buffer-pool/trim", test_trim);
+  g_test_add_func ("/buffer-pool/bytes-slices", test_bytes_slices);
+  g_test_add_func ("/buffer-pool/copy-bytes", test_copy_bytes);
+  g_test_add_func ("/buffer-pool/concat-bytes", test_concat_bytes);
+
+  if (g_test_perf ())
+    {
+      g_test_add_func ("/buffer-pool/throughput/malloc", test_throughput_malloc);
+      g_test_add_func ("/buffer-pool/throughput/pool", test_throughput_pool);
+    }
+
+  return g_test_run ();
+}
@@ -0,0 +1,160 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpitcontentcache.h"
+#include "cockpittest.h"
+
+#include <string.h>
+
+static GBytes *
+filled_bytes (gchar c,
+              gsize length)
+{
+  gchar *data = g_malloc (length);
+  memset (data, c, length);
+  return g_bytes_new_take (data, length);
+}
+
+static void
+test_lookup (void)
+{
+  CockpitContentCache *cache;
+  GBytes *content;
+  GBytes *found;
+
+  cache = cockpit_content_cache_new (1024);
+
+  content = g_bytes_new_static ("the content", 11);
+  g_assert (cockpit_content_cache_insert (cache, "key", content));
+  g_assert_cmpuint (cockpit_content_cache_get_size (cache), ==, 11);
+
+  found = cockpit_content_cache_lookup (cache, "key");
+  g_assert (found != NULL);
+  g_assert (g_bytes_equal (found, content));
+  g_bytes_unref (found);
+
+  g_assert (cockpit_content_cache_lookup (cache, "other") == NULL);
+
+  /* Replacing the content of a key */
+  g_bytes_unref (content);
+  content = g_bytes_new_static ("new", 3);
+  g_assert (cockpit_content_cache_insert (cache, "key", content));
+  g_assert_cmpuint (cockpit_content_cache_get_size (cache), ==, 3);
+
+  found = cockpit_content_cache_lookup (cache, "key");
+  g_assert (g_bytes_equal (found, content));
+  g_bytes_unref (found);
+  g_bytes_unref (content);
+
+  cockpit_content_cache_clear (cache);
+  g_assert_cmpuint (cockpit_content_cache_get_size (cache), ==, 0);
+  g_assert (cockpit_content_cache_lookup (cache, "key") == NULL);
+
+  cockpit_content_cache_free (cache);
+}
+
+static void
+test_least_recent (void)
+{
+  CockpitContentCache *cache;
+  GBytes *content;
+  GBytes *found;
+  gchar key[8];
+  gint i;
+
+  cache = cockpit_content_cache_new (1000);
+
+  /* Four entries fill the cache */
+  for (i = 0; i < 4; i++)
+    {
+      g_snprintf (key, sizeof (key), "%d", i);
+      content = filled_bytes ('a' + i, 250);
+      g_assert (cockpit_content_cache_insert (cache, key, content));
+      g_bytes_unref (content);
+    }
+
+  g_assert_cmpuint (cockpit_content_cache_get_size (cache), ==, 1000);
+
+  /* Using the oldest one keeps it around */
+  found = cockpit_content_cache_lookup (cache, "0");
+  g_assert (found != NULL);
+  g_bytes_unref (found);
+
+  content = filled_bytes ('z', 200);
+  g_assert (cockpit_content_cache_insert (cache, "4", content));
+  g_bytes_unref (content);
+
+  g_assert_cmpuint (cockpit_content_cache_get_size (cache), ==, 950);
+
+  found = cockpit_content_cache_lookup (cache, "0");
+  g_assert (found != NULL);
+  g_bytes_unref (found);
+
+  g_assert (cockpit_content_cache_lookup (cache, "1") == NULL);
+
+  found = cockpit_content_cache_lookup (cache, "2");
+  g_assert (found != NULL);
+  g_bytes_unref (found);
+
+  cockpit_content_cache_free (cache);
+}
+
+static void
+test_too_large (void)
+{
+  CockpitContentCache *cache;
+  GBytes *content;
+
+  cache = cockpit_content_cache_new (1000);
+
+  content = filled_bytes ('x', 251);
+  g_assert (!cockpit_content_cache_insert (cache, "large", content));
+  g_bytes_unref (content);
+
+  g_assert_cmpuint (cockpit_content_cache_get_size (cache), ==, 0);
+  g_assert (cockpit_content_cache_lookup (cache, "large") == NULL);
+
+  cockpit_content_cache_free (cache);
+
+  /* A cache without any space is disabled */
+  cache = cockpit_content_cache_new (0);
+
+  content = g_bytes_new_static ("", 0);
+  g_assert (!cockpit_content_cache_insert (cache, "empty", content));
+  g_bytes_unref (content);
+
+  g_assert (cockpit_content_cache_lookup (cache, "empty") == NULL);
+
+  cockpit_content_cache_free (cache);
+}
+
+int
+main (int argc,
+      char *argv[])
+{
+  cockpit_test_init (&argc, &argv);
+
+  g_test_add_func ("/content-cache/lookup", test_lookup);
+  g_test_add_func ("/content-cache/least-recent", test_least_recent);
+  g_test_add_func ("/content-cache/too-large", test_too_large);
+
+  return g_test_run ();
+}
@@ -0,0 +1,554 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpithttpparser.h"
+#include "cockpittest.h"
+
+#include "websocket/websocket.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* What a browser sends when loading a page */
+static const gchar browser_request[] =
+  "GET /cockpit/@localhost/system/index.html HTTP/1.1\r\n"
+  "Host: localhost:9090\r\n"
+  "Connection: keep-alive\r\n"
+  "sec-ch-ua: \"Chromium\";v=\"128\", \"Not;A=Brand\";v=\"24\"\r\n"
+  "sec-ch-ua-mobile: ?0\r\n"
+  "sec-ch-ua-platform: \"Linux\"\r\n"
+  "Upgrade-Insecure-Requests: 1\r\n"
+  "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/128.0.0.0 Safari/537.36\r\n"
+  "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+  "Sec-Fetch-Site: same-origin\r\n"
+  "Sec-Fetch-Mode: navigate\r\n"
+  "Sec-Fetch-Dest: iframe\r\n"
+  "Referer: https://localhost:9090/system\r\n"
+  "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+  "Accept-Language: en-US,en;q=0.9,de;q=0.8\r\n"
+  "Cookie: cockpit=dj0yO2s9MTI4O2k9ZjM3ZGQ3YzYtZDQxNi00ZTk1LWJkMTEtZjRmNWYwZGU1OTNk; machine=localhost\r\n"
+  "If-None-Match: \"$0f1e2d3c4b5a69788796a5b4c3d2e1f0\"\r\n"
+  "\r\n";
+
+/*
+ * Compare against the parsers the web server used before. These
+ * validate the path against the wrong pointer, so we only compare
+ * requests with sane paths here.
+ */
+static void
+assert_same_as_websocket (const gchar *data,
+                          gsize length)
+{
+  CockpitHttpParser parser;
+  CockpitHttpParseResult result;
+  GHashTable *headers = NULL;
+  GHashTable *built;
+  GHashTableIter iter;
+  gpointer name, value;
+  gchar *method = NULL;
+  gchar *path = NULL;
+  gssize off1;
+  gssize off2 = 0;
+
+  cockpit_http_parser_init (&parser);
+  result = cockpit_http_parser_feed (&parser, data, length);
+
+  off1 = web_socket_util_parse_req_line (data, length, &method, &path);
+  if (off1 > 0)
+    off2 = web_socket_util_parse_headers (data + off1, length - off1, &headers);
+
+  if (off1 == 0)
+    {
+      g_assert_cmpint (result, ==, COCKPIT_HTTP_PARSE_MORE);
+      g_assert (cockpit_http_parser_get_method (&parser) == NULL);
+    }
+  else if (off1 < 0)
+    {
+      g_assert_cmpint (result, ==, COCKPIT_HTTP_PARSE_BAD_REQUEST_LINE);
+    }
+  else
+    {
+      g_assert_cmpstr (cockpit_http_parser_get_method (&parser), ==, method);
+      g_assert_cmpstr (cockpit_http_parser_get_path (&parser), ==, path);
+
+      if (off2 == 0)
+        {
+          g_assert_cmpint (result, ==, COCKPIT_HTTP_PARSE_MORE);
+        }
+      else if (off2 < 0)
+        {
+          g_assert_cmpint (result, ==, COCKPIT_HTTP_PARSE_BAD_HEADER);
+        }
+      else
+        {
+          g_assert_cmpint (result, ==, COCKPIT_HTTP_PARSE_DONE);
+          g_assert_cmpuint (cockpit_http_parser_get_length (&parser), ==, off1 + off2);
+
+          built = cockpit_http_parser_build_headers (&parser);
+          g_assert_cmpuint (g_hash_table_size (built), ==, g_hash_table_size (headers));
+
+          g_hash_table_iter_init (&iter, headers);
+          while (g_hash_table_iter_next (&iter, &name, &value))
+            {
+              g_assert_cmpstr (g_hash_table_lookup (built, name), ==, value);
+              g_assert_cmpstr (cockpit_http_parser_get_header (&parser, name), ==, value);
+            }
+
+          g_hash_table_unref (built);
+        }
+    }
+
+  if (headers)
+    g_hash_table_unref (headers);
+  g_free (method);
+  g_free (path);
+  cockpit_http_parser_clear (&parser);
+}
+
+static void
+test_browser (void)
+{
+  CockpitHttpParser parser;
+
+  cockpit_http_parser_init (&parser);
+
+  g_assert_cmpint (cockpit_http_parser_feed (&parser, browser_request, strlen (browser_request)),
+                   ==, COCKPIT_HTTP_PARSE_DONE);
+  g_assert_cmpuint (cockpit_http_parser_get_length (&parser), ==, strlen (browser_request));
+  g_assert_cmpstr (cockpit_http_parser_get_method (&parser), ==, "GET");
+  g_assert_cmpstr (cockpit_http_parser_get_path (&parser), ==, "/cockpit/@localhost/system/index.html");
+  g_assert_cmpuint (cockpit_http_parser_n_headers (&parser), ==, 16);
+
+  g_assert_cmpstr (cockpit_http_parser_get_header (&parser, "Host"), ==, "localhost:9090");
+  g_assert_cmpstr (cockpit_http_parser_get_header (&parser, "HOST"), ==, "localhost:9090");
+  g_assert_cmpstr (cockpit_http_parser_get_header (&parser, "accept-encoding"), ==, "gzip, deflate, br, zstd");
+  g_assert (cockpit_http_parser_get_header (&parser, "Content-Length") == NULL);
+
+  /* Feeding more does nothing */
+  g_assert_cmpint (cockpit_http_parser_feed (&parser, browser_request, strlen (browser_request)),
+                   ==, COCKPIT_HTTP_PARSE_DONE);
+  g_assert_cmpuint (cockpit_http_parser_get_length (&parser), ==, strlen (browser_request));
+
+  cockpit_http_parser_clear (&parser);
+
+  assert_same_as_websocket (browser_request, strlen (browser_request));
+}
+
+static void
+test_byte_by_byte (void)
+{
+  CockpitHttpParser parser;
+  gsize length = strlen (browser_request);
+  gsize i;
+
+  cockpit_http_parser_init (&parser);
+
+  for (i = 0; i < length; i++)
+    {
+      g_assert_cmpint (cockpit_http_parser_feed (&parser, browser_request, i), ==, COCKPIT_HTTP_PARSE_MORE);
+
+      /* The request line is available as soon as it's complete */
+      if (i >= strlen ("GET /cockpit/@localhost/system/index.html HTTP/1.1\r\n"))
+        g_assert_cmpstr (cockpit_http_parser_get_path (&parser), ==, "/cockpit/@localhost/system/index.html");
+      else
+        g_assert (cockpit_http_parser_get_path (&parser) == NULL);
+    }
+
+  g_assert_cmpint (cockpit_http_parser_feed (&parser, browser_request, length), ==, COCKPIT_HTTP_PARSE_DONE);
+  g_assert_cmpuint (cockpit_http_parser_n_headers (&parser), ==, 16);
+  g_assert_cmpstr (cockpit_http_parser_get_header (&parser, "cookie"), ==,
+                   "cockpit=dj0yO2s9MTI4O2k9ZjM3ZGQ3YzYtZDQxNi00ZTk1LWJkMTEtZjRmNWYwZGU1OTNk; machine=localhost");
+
+  cockpit_http_parser_clear (&parser);
+}
+
+static void
+test_many_headers (void)
+{
+  CockpitHttpParser parser;
+  GHashTable *headers;
+  GString *request;
+  gchar *name;
+  guint i;
+
+  request = g_string_new ("GET / HTTP/1.1\r\n");
+  for (i = 0; i < 100; i++)
+    g_string_append_printf (request, "X-Header-%u: %u\r\n", i, i);
+  g_string_append (request, "x-header-5: again\r\n");
+
+  cockpit_http_parser_init (&parser);
+
+  /* Look something up before the rest arrives */
+  g_assert_cmpint (cockpit_http_parser_feed (&parser, request->str, request->len), ==, COCKPIT_HTTP_PARSE_MORE);
+  g_assert_cmpstr (cockpit_http_parser_get_header (&parser, "X-HEADER-99"), ==, "99");
+  g_assert_cmpstr (cockpit_http_parser_get_header (&parser, "X-Header-5"), ==, "again");
+
+  g_string_append (request, "X-Header-99: last\r\n\r\n");
+  g_assert_cmpint (cockpit_http_parser_feed (&parser, request->str, request->len), ==, COCKPIT_HTTP_PARSE_DONE);
+  g_assert_cmpuint (cockpit_http_parser_n_headers (&parser), ==, 102);
+
+  for (i = 0; i < 99; i++)
+    {
+      if (i == 5)
+        continue;
+      name = g_strdup_printf ("x-header-%u", i);
+      g_assert_cmpint (atoi (cockpit_http_parser_get_header (&parser, name)), ==, i);
+      g_free (name);
+    }
+
+  /* The last one wins */
+  g_assert_cmpstr (cockpit_http_parser_get_header (&parser, "X-Header-5"), ==, "again");
+  g_assert_cmpstr (cockpit_http_parser_get_header (&parser, "X-Header-99"), ==, "last");
+  g_assert (cockpit_http_parser_get_header (&parser, "X-Header-100") == NULL);
+
+  headers = cockpit_http_parser_build_headers (&parser);
+  g_assert_cmpuint (g_hash_table_size (headers), ==, 100);
+  g_assert_cmpstr (g_hash_table_lookup (headers, "X-HEADER-5"), ==, "again");
+  g_hash_table_unref (headers);
+
+  cockpit_http_parser_clear (&parser);
+
+  assert_same_as_websocket (request->str, request->len);
+  g_string_free (request, TRUE);
+}
+
+typedef struct {
+  const gchar *request;
+  CockpitHttpParseResult result;
+} Fixture;
+
+static const Fixture fixtures[] = {
+  { "GET / HTTP/1.1\r\n\r\n", COCKPIT_HTTP_PARSE_DONE },
+  { "GET / HTTP/1.0\n\n", COCKPIT_HTTP_PARSE_DONE },
+  { "HEAD    /path   HTTP/1.1 \r  \r\nHost: blah\r\n\r\n", COCKPIT_HTTP_PARSE_DONE },
+  { "GET / HTTP/1.1\r\nHost:   spaces   \r\nEmpty:\r\n:\r\n\r\n", COCKPIT_HTTP_PARSE_DONE },
+  { "GET / HTTP/1.1\r\nTab:\tvalue\t\r\n\n", COCKPIT_HTTP_PARSE_DONE },
+  { "GET / HTTP/1.1\r\nUnicode: \xc3\xa4\xc3\xb6\r\n\r\n", COCKPIT_HTTP_PARSE_DONE },
+  { "GET / HTTP/1.1\r\nColons: one:two:three\r\n\r\n", COCKPIT_HTTP_PARSE_DONE },
+  { "GET / HTTP/1.1\r\nHost: blah\r\n\r\ntrailing body data", COCKPIT_HTTP_PARSE_DONE },
+  { "", COCKPIT_HTTP_PARSE_MORE },
+  { "GET / HTTP/1.1", COCKPIT_HTTP_PARSE_MORE },
+  { "GET / HTTP/1.1\r\nHost: bl", COCKPIT_HTTP_PARSE_MORE },
+  { "GET / HTTP/1.1\r\nHost: blah\r\n\r", COCKPIT_HTTP_PARSE_MORE },
+  { "\r\n", COCKPIT_HTTP_PARSE_BAD_REQUEST_LINE },
+  { " GET / HTTP/1.1\r\n\r\n", COCKPIT_HTTP_PARSE_BAD_REQUEST_LINE },
+  { "GET\r\n\r\n", COCKPIT_HTTP_PARSE_BAD_REQUEST_LINE },
+  { "GET /\r\n\r\n", COCKPIT_HTTP_PARSE_BAD_REQUEST_LINE },
+  { "GET / HTTP/2.0\r\n\r\n", COCKPIT_HTTP_PARSE_BAD_REQUEST_LINE },
+  { "GET / HTTP/1.1 x\r\n\r\n", COCKPIT_HTTP_PARSE_BAD_REQUEST_LINE },
+  { "G\x01T / HTTP/1.1\r\n\r\n", COCKPIT_HTTP_PARSE_BAD_REQUEST_LINE },
+  { "G\xc3\xa4T / HTTP/1.1\r\n\r\n", COCKPIT_HTTP_PARSE_BAD_REQUEST_LINE },
+  { "GET / HTTP/1.1\r\nNo colon\r\n\r\n", COCKPIT_HTTP_PARSE_BAD_HEADER },
+  { "GET / HTTP/1.1\r\nBad\x01Name: value\r\n\r\n", COCKPIT_HTTP_PARSE_BAD_HEADER },
+  { "GET / HTTP/1.1\r\nBad\xc3\xa4: value\r\n\r\n", COCKPIT_HTTP_PARSE_BAD_HEADER },
+  { "GET / HTTP/1.1\r\nBad: \xff\xfe\r\n\r\n", COCKPIT_HTTP_PARSE_BAD_HEADER },
+  { "GET / HTTP/1.1\r\nHost: blah\r\nNo colon\r\n", COCKPIT_HTTP_PARSE_BAD_HEADER },
+};
+
+static void
+test_fixture (gconstpointer data)
+{
+  const Fixture *fixture = data;
+  CockpitHttpParser parser;
+  gsize length = strlen (fixture->request);
+
+  cockpit_http_parser_init (&parser);
+  g_assert_cmpint (cockpit_http_parser_feed (&parser, fixture->request, length), ==, fixture->result);
+  cockpit_http_parser_clear (&parser);
+
+  assert_same_as_websocket (fixture->request, length);
+}
+
+static void
+test_bad_path (void)
+{
+  CockpitHttpParser parser;
+  const gchar *request = "GET /pa\x01th HTTP/1.1\r\n\r\n";
+
+  /* The old parser didn't catch this one */
+  cockpit_http_parser_init (&parser);
+  g_assert_cmpint (cockpit_http_parser_feed (&parser, request, strlen (request)),
+                   ==, COCKPIT_HTTP_PARSE_BAD_REQUEST_LINE);
+  cockpit_http_parser_clear (&parser);
+}
+
+static void
+test_nul (void)
+{
+  CockpitHttpParser parser;
+  const gchar request[] = "GET / HTTP/1.1\r\nName: val\0ue\r\nOther\0: x\r\n\r\n";
+  gsize length = sizeof (request) - 1;
+
+  /* Like the old parser, names and values stop at a null */
+  cockpit_http_parser_init (&parser);
+  g_assert_cmpint (cockpit_http_parser_feed (&parser, request, length), ==, COCKPIT_HTTP_PARSE_DONE);
+  g_assert_cmpstr (cockpit_http_parser_get_header (&parser, "Name"), ==, "val");
+  g_assert_cmpstr (cockpit_http_parser_get_header (&parser, "Other"), ==, "x");
+  cockpit_http_parser_clear (&parser);
+
+  assert_same_as_websocket (request, length);
+}
+
+static CockpitHttpParseResult
+feed_in_chunks (CockpitHttpParser *parser,
+                const gchar *data,
+                gsize length)
+{
+  CockpitHttpParseResult result = COCKPIT_HTTP_PARSE_MORE;
+  gsize offset = 0;
+
+  while (result == COCKPIT_HTTP_PARSE_MORE && offset < length)
+    {
+      offset += g_test_rand_int_range (1, 64);
+      result = cockpit_http_parser_feed (parser, data, MIN (offset, length));
+    }
+
+  return result;
+}
+
+static void
+assert_same_parse (CockpitHttpParser *one,
+                   CockpitHttpParser *two)
+{
+  GHashTable *headers1;
+  GHashTable *headers2;
+  GHashTableIter iter;
+  gpointer name, value;
+
+  g_assert_cmpstr (cockpit_http_parser_get_method (one), ==, cockpit_http_parser_get_method (two));
+  g_assert_cmpstr (cockpit_http_parser_get_path (one), ==, cockpit_http_parser_get_path (two));
+  g_assert_cmpuint (cockpit_http_parser_n_headers (one), ==, cockpit_http_parser_n_headers (two));
+
+  headers1 = cockpit_http_parser_build_headers (one);
+  headers2 = cockpit_http_parser_build_headers (two);
+  g_assert_cmpuint (g_hash_table_size (headers1), ==, g_hash_table_size (headers2));
+  g_hash_table_iter_init (&iter, headers1);
+  while (g_hash_table_iter_next (&iter, &name, &value))
+    g_assert_cmpstr (g_hash_table_lookup (headers2, name), ==, value);
+  g_hash_table_unref (headers1);
+  g_hash_table_unref (headers2);
+}
+
+static void
+test_fuzz_split (void)
+{
+  CockpitHttpParser whole;
+  CockpitHttpParser split;
+  CockpitHttpParseResult result;
+  const Fixture *fixture;
+  gsize length;
+  guint i;
+
+  for (i = 0; i < 10000; i++)
+    {
+      if (i % 2)
+        fixture = NULL;
+      else
+        fixture = fixtures + g_test_rand_int_range (0, G_N_ELEMENTS (fixtures));
+
+      length = fixture ? strlen (fixture->request) : strlen (browser_request);
+
+      cockpit_http_parser_init (&whole);
+      cockpit_http_parser_init (&split);
+
+      result = cockpit_http_parser_feed (&whole, fixture ? fixture->request : browser_request, length);
+      g_assert_cmpint (feed_in_chunks (&split, fixture ? fixture->request : browser_request, length), ==, result);
+      g_assert_cmpuint (cockpit_http_parser_get_length (&split), ==, cockpit_http_parser_get_length (&whole));
+      assert_same_parse (&whole, &split);
+
+      cockpit_http_parser_clear (&whole);
+      cockpit_http_parser_clear (&split);
+    }
+}
+
+static void
+test_fuzz_mutate (void)
+{
+  static const gchar specials[] = { '\0', '\r', '\n', ':', ' ', '\t', '\x01', '\x80', '\xc3', '\xff', 'A' };
+  CockpitHttpParser whole;
+  CockpitHttpParser split;
+  CockpitHttpParseResult result;
+  gsize line = strchr (browser_request, '\n') - browser_request + 1;
+  gsize length;
+  gchar *data;
+  guint i, j;
+
+  for (i = 0; i < 10000; i++)
+    {
+      data = g_strdup (browser_request);
+      length = strlen (data);
+
+      /* Mess with the headers, cut off at a random place */
+      for (j = g_test_rand_int_range (1, 8); j > 0; j--)
+        data[g_test_rand_int_range (line, length)] = specials[g_test_rand_int_range (0, G_N_ELEMENTS (specials))];
+      if (g_test_rand_bit ())
+        length = g_test_rand_int_range (0, length);
+
+      cockpit_http_parser_init (&whole);
+      cockpit_http_parser_init (&split);
+
+      result = cockpit_http_parser_feed (&whole, data, length);
+      g_assert_cmpint (feed_in_chunks (&split, data, length), ==, result);
+      if (result == COCKPIT_HTTP_PARSE_DONE)
+        assert_same_parse (&whole, &split);
+
+      assert_same_as_websocket (data, length);
+
+      cockpit_http_parser_clear (&whole);
+      cockpit_http_parser_clear (&split);
+      g_free (data);
+    }
+}
+
+#define N_REQUESTS 100000
+
+/* Reads as small as a TLS record or a slow client would give us */
+#define CHUNK 128
+
+static void
+test_perf_websocket (gconstpointer data)
+{
+  gboolean chunked = data != NULL;
+  gsize total = strlen (browser_request);
+  GHashTable *headers;
+  gchar *method;
+  gchar *path;
+  gdouble elapsed;
+  gssize off1;
+  gssize off2;
+  gsize length;
+  guint i;
+
+  g_test_timer_start ();
+
+  /* What the web server did before: parse from the start on each read */
+  for (i = 0; i < N_REQUESTS; i++)
+    {
+      length = chunked ? 0 : total;
+      for (;;)
+        {
+          if (chunked)
+            length = MIN (length + CHUNK, total);
+
+          headers = NULL;
+          method = path = NULL;
+          off2 = 0;
+          off1 = web_socket_util_parse_req_line (browser_request, length, &method, &path);
+          if (off1 > 0)
+            off2 = web_socket_util_parse_headers (browser_request + off1, length - off1, &headers);
+          g_free (method);
+          g_free (path);
+
+          if (off2 > 0)
+            {
+              g_assert (g_hash_table_lookup (headers, "Host") != NULL);
+              g_hash_table_lookup (headers, "Content-Length");
+              g_hash_table_unref (headers);
+              break;
+            }
+
+          g_assert (length < total);
+        }
+    }
+
+  elapsed = g_test_timer_elapsed ();
+  g_test_maximized_result (N_REQUESTS / elapsed, "websocket %s: %.0f requests/s",
+                           chunked ? "chunked" : "one-shot", N_REQUESTS / elapsed);
+}
+
+static void
+test_perf_parser (gconstpointer data)
+{
+  gboolean chunked = data != NULL;
+  gsize total = strlen (browser_request);
+  CockpitHttpParser parser;
+  CockpitHttpParseResult result;
+  GHashTable *headers;
+  gdouble elapsed;
+  gsize length;
+  guint i;
+
+  g_test_timer_start ();
+
+  for (i = 0; i < N_REQUESTS; i++)
+    {
+      cockpit_http_parser_init (&parser);
+
+      length = chunked ? 0 : total;
+      do
+        {
+          if (chunked)
+            length = MIN (length + CHUNK, total);
+          result = cockpit_http_parser_feed (&parser, browser_request, length);
+        }
+      while (result == COCKPIT_HTTP_PARSE_MORE);
+
+      g_assert_cmpint (result, ==, COCKPIT_HTTP_PARSE_DONE);
+      g_assert (cockpit_http_parser_get_header (&parser, "Host") != NULL);
+      cockpit_http_parser_get_header (&parser, "Content-Length");
+
+      /* As handed to the handlers */
+      headers = cockpit_http_parser_build_headers (&parser);
+      g_hash_table_unref (headers);
+
+      cockpit_http_parser_clear (&parser);
+    }
+
+  elapsed = g_test_timer_elapsed ();
+  g_test_maximized_result (N_REQUESTS / elapsed, "parser %s: %.0f requests/s",
+                           chunked ? "chunked" : "one-shot", N_REQUESTS / elapsed);
+}
+
+int
+main (int argc,
+      char *argv[])
+{
+  gchar *name;
+  guint i;
+
+  cockpit_test_init (&argc, &argv);
+
+  g_test_add_func ("/http-parser/browser", test_browser);
+  g_test_add_func ("/http-parser/byte-by-byte", test_byte_by_byte);
+  g_test_add_func ("/http-parser/many-headers", test_many_headers);
+  g_test_add_func ("/http-parser/bad-path", test_bad_path);
+  g_test_add_func ("/http-parser/nul", test_nul);
+
+  for (i = 0; i < G_N_ELEMENTS (fixtures); i++)
+    {
+      name = g_strdup_printf ("/http-parser/fixture/%u", i);
+      g_test_add_data_func (name, fixtures + i, test_fixture);
+      g_free (name);
+    }
+
+  g_test_add_func ("/http-parser/fuzz/split", test_fuzz_split);
+  g_test_add_func ("/http-parser/fuzz/mutate", test_fuzz_mutate);
+
+  if (g_test_perf ())
+    {
+      g_test_add_data_func ("/http-parser/perf/websocket-one-shot", NULL, test_perf_websocket);
+      g_test_add_data_func ("/http-parser/perf/websocket-chunked", "chunked", test_perf_websocket);
+      g_test_add_data_func ("/http-parser/perf/parser-one-shot", NULL, test_perf_parser);
+      g_test_add_data_func ("/http-parser/perf/parser-chunked", "chunked", test_perf_parser);
+    }
+
+  return g_test_run ();
+}
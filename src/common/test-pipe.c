@@ -806,6 +806,39 @@ test_spawn_and_read (void)
   g_object_unref (pipe);
 }
 
+static void
+test_spawn_and_compact (void)
+{
+  gboolean closed = FALSE;
+  GByteArray *buffer;
+  CockpitPipe *pipe;
+
+  const gchar *argv[] = { "/bin/sh", "-c", "head -c 300000 /dev/zero", NULL };
+
+  pipe = cockpit_pipe_spawn (argv, NULL, NULL, COCKPIT_PIPE_FLAGS_NONE);
+  g_assert (pipe != NULL);
+  g_signal_connect (pipe, "close", G_CALLBACK (on_close_get_flag), &closed);
+
+  while (closed == FALSE)
+    g_main_context_iteration (NULL, TRUE);
+
+  buffer = cockpit_pipe_get_buffer (pipe);
+  g_assert_cmpuint (buffer->len, ==, 300000);
+  g_assert_cmpuint (cockpit_pipe_get_memory_size (pipe), >=, 300000);
+
+  /* Nothing left to hold on to once it's consumed */
+  cockpit_pipe_skip (buffer, buffer->len);
+  g_assert_cmpuint (cockpit_pipe_get_memory_size (pipe), >=, 300000);
+
+  cockpit_pipe_compact (pipe);
+  g_assert_cmpuint (cockpit_pipe_get_memory_size (pipe), ==, 0);
+
+  buffer = cockpit_pipe_get_buffer (pipe);
+  g_assert_cmpuint (buffer->len, ==, 0);
+
+  g_object_unref (pipe);
+}
+
 static void
 test_spawn_and_write (void)
 {
@@ -1331,6 +1364,7 @@ main (int argc,
 
   g_test_add_func ("/pipe/spawn/and-read", test_spawn_and_read);
   g_test_add_func ("/pipe/spawn/and-write", test_spawn_and_write);
+  g_test_add_func ("/pipe/spawn/and-compact", test_spawn_and_compact);
   g_test_add_func ("/pipe/spawn/and-fail", test_spawn_and_fail);
   g_test_add_func ("/pipe/spawn/buffer-stderr", test_spawn_and_buffer_stderr);
 
@@ -0,0 +1,325 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "mock-transport.h"
+
+#include "cockpitchannel.h"
+#include "cockpitjson.h"
+#include "cockpitstats.h"
+#include "cockpittest.h"
+
+#include <string.h>
+
+/* ----------------------------------------------------------------------------
+ * Mock
+ */
+
+static GType mock_echo_channel_get_type (void) G_GNUC_CONST;
+
+typedef CockpitChannel MockEchoChannel;
+typedef CockpitChannelClass MockEchoChannelClass;
+
+G_DEFINE_TYPE (MockEchoChannel, mock_echo_channel, COCKPIT_TYPE_CHANNEL);
+
+static void
+mock_echo_channel_recv (CockpitChannel *channel,
+                        GBytes *message)
+{
+  cockpit_channel_send (channel, message, TRUE);
+}
+
+static void
+mock_echo_channel_init (MockEchoChannel *self)
+{
+
+}
+
+static void
+mock_echo_channel_class_init (MockEchoChannelClass *klass)
+{
+  CockpitChannelClass *channel_class = COCKPIT_CHANNEL_CLASS (klass);
+  channel_class->recv = mock_echo_channel_recv;
+}
+
+/* ----------------------------------------------------------------------------
+ * Testing
+ */
+
+typedef struct {
+  MockTransport *transport;
+  CockpitChannel *channel;
+  CockpitChannelStats *stats;
+} TestCase;
+
+static void
+setup (TestCase *tc,
+       gconstpointer data)
+{
+  JsonObject *options;
+
+  cockpit_stats_reset ();
+
+  tc->transport = mock_transport_new ();
+
+  options = json_object_new ();
+  json_object_set_string_member (options, "payload", "stats-echo");
+  json_object_set_boolean_member (options, "flow-control", data != NULL);
+  tc->channel = g_object_new (mock_echo_channel_get_type (),
+                              "transport", tc->transport,
+                              "id", "548",
+                              "options", options,
+                              NULL);
+  json_object_unref (options);
+
+  cockpit_channel_prepare (tc->channel);
+  tc->stats = cockpit_stats_channel ("stats-echo");
+}
+
+static void
+teardown (TestCase *tc,
+          gconstpointer data)
+{
+  g_object_add_weak_pointer (G_OBJECT (tc->channel), (gpointer *)&tc->channel);
+  g_object_add_weak_pointer (G_OBJECT (tc->transport), (gpointer *)&tc->transport);
+  g_object_unref (tc->channel);
+  g_object_unref (tc->transport);
+  g_assert (tc->channel == NULL);
+  g_assert (tc->transport == NULL);
+
+  cockpit_assert_expected ();
+}
+
+static void
+test_histogram_empty (void)
+{
+  CockpitHistogram histogram = { 0, };
+
+  g_assert_cmpuint (cockpit_histogram_mean (&histogram), ==, 0);
+  g_assert_cmpuint (cockpit_histogram_percentile (&histogram, 0.5), ==, 0);
+  g_assert_cmpuint (cockpit_histogram_percentile (&histogram, 1.0), ==, 0);
+}
+
+static void
+test_histogram_percentile (void)
+{
+  CockpitHistogram histogram = { 0, };
+
+  cockpit_histogram_add (&histogram, 0);
+  cockpit_histogram_add (&histogram, 1);
+  cockpit_histogram_add (&histogram, 2);
+  cockpit_histogram_add (&histogram, 3);
+  cockpit_histogram_add (&histogram, 100);
+
+  g_assert_cmpuint (histogram.count, ==, 5);
+  g_assert_cmpuint (histogram.max, ==, 100);
+  g_assert_cmpuint (cockpit_histogram_mean (&histogram), ==, 21);
+
+  /* Upper bound of the bucket, but never more than the maximum */
+  g_assert_cmpuint (cockpit_histogram_percentile (&histogram, 0.0), ==, 0);
+  g_assert_cmpuint (cockpit_histogram_percentile (&histogram, 0.5), ==, 3);
+  g_assert_cmpuint (cockpit_histogram_percentile (&histogram, 0.99), ==, 100);
+}
+
+static void
+test_histogram_huge (void)
+{
+  CockpitHistogram histogram = { 0, };
+
+  cockpit_histogram_add (&histogram, G_MAXUINT64 / 2);
+  cockpit_histogram_add (&histogram, G_MAXUINT32);
+
+  g_assert_cmpuint (histogram.buckets[COCKPIT_HISTOGRAM_BUCKETS - 1], ==, 2);
+  g_assert_cmpuint (cockpit_histogram_percentile (&histogram, 0.5), ==, G_MAXUINT64 / 2);
+}
+
+static void
+test_payload_aggregate (void)
+{
+  CockpitChannelStats *one;
+  CockpitChannelStats *two;
+
+  cockpit_stats_reset ();
+
+  one = cockpit_stats_channel ("aggregate");
+  one->recv_messages = 5;
+
+  /* Same payload, same counters */
+  two = cockpit_stats_channel ("aggregate");
+  g_assert (one == two);
+  g_assert_cmpuint (two->recv_messages, ==, 5);
+
+  /* Different payload, different counters */
+  two = cockpit_stats_channel ("other");
+  g_assert (one != two);
+  g_assert_cmpuint (two->recv_messages, ==, 0);
+
+  /* Reset zeroes but keeps pointers valid */
+  cockpit_stats_reset ();
+  g_assert (one == cockpit_stats_channel ("aggregate"));
+  g_assert_cmpuint (one->recv_messages, ==, 0);
+}
+
+static void
+test_channel_traffic (TestCase *tc,
+                      gconstpointer data)
+{
+  CockpitTransportStats *transport = cockpit_stats_transport ();
+  GBytes *payload;
+
+  g_assert_cmpuint (tc->stats->opened, ==, 1);
+  g_assert_cmpuint (tc->stats->open, ==, 1);
+  g_assert_cmpuint (tc->stats->ready_usec.count, ==, 0);
+
+  cockpit_channel_ready (tc->channel, NULL);
+  g_assert_cmpuint (tc->stats->ready_usec.count, ==, 1);
+
+  payload = g_bytes_new_static ("Yeehaw!", 7);
+  cockpit_transport_emit_recv (COCKPIT_TRANSPORT (tc->transport), "548", payload);
+  cockpit_transport_emit_recv (COCKPIT_TRANSPORT (tc->transport), "548", payload);
+  g_bytes_unref (payload);
+
+  g_assert_cmpuint (tc->stats->recv_messages, ==, 2);
+  g_assert_cmpuint (tc->stats->recv_bytes, ==, 14);
+  g_assert_cmpuint (tc->stats->sent_messages, ==, 2);
+  g_assert_cmpuint (tc->stats->sent_bytes, ==, 14);
+
+  g_assert_cmpuint (transport->recv_messages, ==, 2);
+  g_assert_cmpuint (transport->recv_bytes, ==, 14);
+
+  /* The ready message and two echoes */
+  g_assert_cmpuint (transport->sent_messages, ==, 3);
+
+  cockpit_channel_close (tc->channel, NULL);
+  g_assert_cmpuint (tc->stats->open, ==, 0);
+  g_assert_cmpuint (tc->stats->opened, ==, 1);
+}
+
+static void
+test_frozen_high (TestCase *tc,
+                  gconstpointer data)
+{
+  GBytes *payload;
+  gint i;
+
+  payload = g_bytes_new_static ("Yeehaw!", 7);
+  for (i = 0; i < 5; i++)
+    cockpit_transport_emit_recv (COCKPIT_TRANSPORT (tc->transport), "548", payload);
+  g_bytes_unref (payload);
+
+  g_assert_cmpuint (cockpit_stats_transport ()->frozen_high, ==, 5);
+  g_assert_cmpuint (tc->stats->recv_messages, ==, 0);
+
+  /* Thawing must not count the messages twice */
+  cockpit_channel_ready (tc->channel, NULL);
+  g_assert_cmpuint (tc->stats->recv_messages, ==, 5);
+  g_assert_cmpuint (cockpit_stats_transport ()->recv_messages, ==, 5);
+}
+
+static void
+emit_pong (TestCase *tc,
+           gint64 sequence)
+{
+  gchar *data = g_strdup_printf ("{ \"command\": \"pong\", \"channel\": \"548\", \"sequence\": %" G_GINT64_FORMAT " }",
+                                 sequence);
+  GBytes *control = g_bytes_new_take (data, strlen (data));
+  cockpit_transport_emit_recv (COCKPIT_TRANSPORT (tc->transport), NULL, control);
+  g_bytes_unref (control);
+}
+
+static void
+test_ping_pressure (TestCase *tc,
+                    gconstpointer data)
+{
+  GBytes *payload;
+  gint i;
+
+  cockpit_channel_ready (tc->channel, NULL);
+
+  /* Every 16K a ping is sent, the mock transport doesn't answer */
+  payload = g_bytes_new_take (g_strnfill (1024 * 1024, '?'), 1024 * 1024);
+  for (i = 0; i < 3; i++)
+    cockpit_channel_send (tc->channel, payload, TRUE);
+  g_bytes_unref (payload);
+
+  g_assert_cmpuint (tc->stats->sent_bytes, ==, 3 * 1024 * 1024);
+  g_assert_cmpuint (tc->stats->unacked_high, ==, 3 * 1024 * 1024);
+  g_assert_cmpuint (tc->stats->pressure_count, ==, 1);
+  g_assert_cmpuint (tc->stats->ping_usec.count, ==, 0);
+
+  /* Acknowledging one ping measures its round trip */
+  emit_pong (tc, 1024 * 1024);
+  g_assert_cmpuint (tc->stats->ping_usec.count, ==, 1);
+  g_assert_cmpuint (tc->stats->pressure_usec, ==, 0);
+
+  /* Acknowledging everything relieves the pressure */
+  emit_pong (tc, 3 * 1024 * 1024);
+  g_assert_cmpuint (tc->stats->ping_usec.count, ==, 2);
+
+  /* A pong for something already acknowledged changes nothing */
+  emit_pong (tc, 1024 * 1024);
+  g_assert_cmpuint (tc->stats->ping_usec.count, ==, 2);
+}
+
+static void
+test_to_json (TestCase *tc,
+              gconstpointer data)
+{
+  JsonObject *object;
+  JsonObject *channels;
+  JsonObject *echo;
+  gint64 value;
+
+  cockpit_channel_ready (tc->channel, NULL);
+
+  object = cockpit_stats_to_json ();
+  g_assert (cockpit_json_get_object (object, "channels", NULL, &channels));
+  g_assert (channels != NULL);
+  g_assert (cockpit_json_get_object (channels, "stats-echo", NULL, &echo));
+  g_assert (echo != NULL);
+  g_assert (cockpit_json_get_int (echo, "open", -1, &value));
+  g_assert_cmpint (value, ==, 1);
+  g_assert (json_object_has_member (object, "transport"));
+  g_assert (json_object_has_member (object, "router"));
+  json_object_unref (object);
+}
+
+int
+main (int argc,
+      char *argv[])
+{
+  cockpit_test_init (&argc, &argv);
+
+  g_test_add_func ("/stats/histogram/empty", test_histogram_empty);
+  g_test_add_func ("/stats/histogram/percentile", test_histogram_percentile);
+  g_test_add_func ("/stats/histogram/huge", test_histogram_huge);
+  g_test_add_func ("/stats/payload-aggregate", test_payload_aggregate);
+
+  g_test_add ("/stats/channel/traffic", TestCase, NULL,
+              setup, test_channel_traffic, teardown);
+  g_test_add ("/stats/channel/frozen-high", TestCase, NULL,
+              setup, test_frozen_high, teardown);
+  g_test_add ("/stats/channel/ping-pressure", TestCase, "flow-control",
+              setup, test_ping_pressure, teardown);
+  g_test_add ("/stats/to-json", TestCase, NULL,
+              setup, test_to_json, teardown);
+
+  return g_test_run ();
+}
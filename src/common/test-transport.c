@@ -23,6 +23,7 @@
 #include "cockpitpipe.h"
 #include "cockpitpipetransport.h"
 
+#include "common/cockpitjson.h"
 #include "common/cockpittest.h"
 #include "common/mock-transport.h"
 
@@ -602,6 +603,36 @@ test_parse_frame_bad (void)
   cockpit_assert_expected ();
 }
 
+static void
+test_peek_channel (void)
+{
+  GBytes *message;
+  gchar buffer[8];
+
+  message = g_bytes_new_static ("134\ntest", 8);
+  g_assert (cockpit_transport_peek_channel (message, buffer, sizeof (buffer)));
+  g_assert_cmpstr (buffer, ==, "134");
+  g_bytes_unref (message);
+
+  /* Same checks as parsing, but without complaining */
+  message = g_bytes_new_static ("b\x00y\ntest", 8);
+  g_assert (!cockpit_transport_peek_channel (message, buffer, sizeof (buffer)));
+  g_bytes_unref (message);
+
+  message = g_bytes_new_static ("test", 4);
+  g_assert (!cockpit_transport_peek_channel (message, buffer, sizeof (buffer)));
+  g_bytes_unref (message);
+
+  /* Control messages and long channels are left to parsing */
+  message = g_bytes_new_static ("\n{}", 3);
+  g_assert (!cockpit_transport_peek_channel (message, buffer, sizeof (buffer)));
+  g_bytes_unref (message);
+
+  message = g_bytes_new_static ("12345678\ntest", 13);
+  g_assert (!cockpit_transport_peek_channel (message, buffer, sizeof (buffer)));
+  g_bytes_unref (message);
+}
+
 static void
 test_parse_frame_maybe (void)
 {
@@ -688,6 +719,30 @@ test_parse_command_nulls (void)
   json_object_unref (options);
 }
 
+static void
+test_build_batch_open (void)
+{
+  JsonObject *shared;
+  JsonObject *entry;
+  JsonObject *open;
+
+  shared = cockpit_json_parse_object ("{ \"payload\": \"dbus-json3\", \"bus\": \"system\" }", -1, NULL);
+  entry = cockpit_json_parse_object ("{ \"channel\": \"a4\", \"bus\": \"session\", \"command\": \"bad\" }", -1, NULL);
+
+  /* The channel's own fields win, and command and channel can't be overridden */
+  open = cockpit_transport_build_batch_open ("a4", shared, entry);
+  cockpit_assert_json_eq (open, "{ \"command\": \"open\", \"channel\": \"a4\","
+                          " \"payload\": \"dbus-json3\", \"bus\": \"session\" }");
+  json_object_unref (open);
+
+  open = cockpit_transport_build_batch_open ("a4", NULL, entry);
+  cockpit_assert_json_eq (open, "{ \"command\": \"open\", \"channel\": \"a4\", \"bus\": \"session\" }");
+  json_object_unref (open);
+
+  json_object_unref (shared);
+  json_object_unref (entry);
+}
+
 struct {
   const char *name;
   const char *json;
@@ -722,6 +777,294 @@ test_parse_command_bad (gconstpointer input)
   cockpit_assert_expected ();
 }
 
+typedef struct {
+  GString *log;
+  const gchar *refreeze;
+  guint count;
+} FreezeLog;
+
+static gboolean
+on_recv_log (CockpitTransport *transport,
+             const gchar *channel,
+             GBytes *payload,
+             gpointer user_data)
+{
+  FreezeLog *log = user_data;
+  gsize length;
+  const gchar *data;
+
+  if (!channel)
+    return FALSE;
+
+  data = g_bytes_get_data (payload, &length);
+  g_string_append_printf (log->log, "%s:%.*s ", channel, (int)length, data);
+  log->count++;
+
+  if (log->refreeze && g_str_equal (log->refreeze, channel))
+    {
+      log->refreeze = NULL;
+      cockpit_transport_freeze (transport, channel);
+    }
+
+  return TRUE;
+}
+
+static gboolean
+on_control_log (CockpitTransport *transport,
+                const gchar *command,
+                const gchar *channel,
+                JsonObject *options,
+                GBytes *payload,
+                gpointer user_data)
+{
+  FreezeLog *log = user_data;
+
+  if (!channel)
+    return FALSE;
+
+  g_string_append_printf (log->log, "%s:%s ", channel, command);
+  log->count++;
+  return TRUE;
+}
+
+static void
+emit_log_recv (CockpitTransport *transport,
+               const gchar *channel,
+               const gchar *data)
+{
+  GBytes *payload = g_bytes_new_static (data, strlen (data));
+  cockpit_transport_emit_recv (transport, channel, payload);
+  g_bytes_unref (payload);
+}
+
+static void
+emit_log_control (CockpitTransport *transport,
+                  const gchar *channel,
+                  const gchar *command)
+{
+  GBytes *payload = cockpit_transport_build_control ("command", command, "channel", channel, NULL);
+  cockpit_transport_emit_recv (transport, NULL, payload);
+  g_bytes_unref (payload);
+}
+
+static void
+test_freeze_interleave (void)
+{
+  CockpitTransport *transport;
+  FreezeLog log = { g_string_new (""), NULL, 0 };
+
+  transport = COCKPIT_TRANSPORT (mock_transport_new ());
+  g_signal_connect (transport, "recv", G_CALLBACK (on_recv_log), &log);
+  g_signal_connect (transport, "control", G_CALLBACK (on_control_log), &log);
+
+  cockpit_transport_freeze (transport, "a");
+  cockpit_transport_freeze (transport, "b");
+
+  emit_log_recv (transport, "a", "1");
+  emit_log_recv (transport, "b", "1");
+  emit_log_recv (transport, "c", "1");
+  emit_log_control (transport, "a", "open");
+  emit_log_recv (transport, "a", "2");
+  emit_log_control (transport, "c", "done");
+  emit_log_recv (transport, "b", "2");
+  emit_log_control (transport, "b", "close");
+
+  /* Channels that are not frozen go straight through */
+  g_assert_cmpstr (log.log->str, ==, "c:1 c:done ");
+  g_string_truncate (log.log, 0);
+
+  /* Thawing one channel only flushes that one, in order */
+  cockpit_transport_thaw (transport, "b");
+  g_assert_cmpstr (log.log->str, ==, "b:1 b:2 b:close ");
+  g_string_truncate (log.log, 0);
+
+  /* Now that it's thawed things go straight through */
+  emit_log_recv (transport, "b", "3");
+  g_assert_cmpstr (log.log->str, ==, "b:3 ");
+  g_string_truncate (log.log, 0);
+
+  cockpit_transport_thaw (transport, "a");
+  g_assert_cmpstr (log.log->str, ==, "a:1 a:open a:2 ");
+  g_string_truncate (log.log, 0);
+
+  /* Thawing something that isn't frozen does nothing */
+  cockpit_transport_thaw (transport, "a");
+  cockpit_transport_thaw (transport, "unknown");
+  g_assert_cmpstr (log.log->str, ==, "");
+
+  g_object_unref (transport);
+  g_string_free (log.log, TRUE);
+}
+
+static void
+test_freeze_twice (void)
+{
+  CockpitTransport *transport;
+  FreezeLog log = { g_string_new (""), NULL, 0 };
+
+  transport = COCKPIT_TRANSPORT (mock_transport_new ());
+  g_signal_connect (transport, "recv", G_CALLBACK (on_recv_log), &log);
+
+  cockpit_transport_freeze (transport, "a");
+  emit_log_recv (transport, "a", "1");
+
+  /* Freezing again must not lose what is queued */
+  cockpit_transport_freeze (transport, "a");
+  emit_log_recv (transport, "a", "2");
+
+  cockpit_transport_thaw (transport, "a");
+  g_assert_cmpstr (log.log->str, ==, "a:1 a:2 ");
+
+  g_object_unref (transport);
+  g_string_free (log.log, TRUE);
+}
+
+static void
+test_freeze_during_thaw (void)
+{
+  CockpitTransport *transport;
+  FreezeLog log = { g_string_new (""), "a", 0 };
+
+  transport = COCKPIT_TRANSPORT (mock_transport_new ());
+  g_signal_connect (transport, "recv", G_CALLBACK (on_recv_log), &log);
+
+  cockpit_transport_freeze (transport, "a");
+  emit_log_recv (transport, "a", "1");
+  emit_log_recv (transport, "a", "2");
+  emit_log_recv (transport, "a", "3");
+
+  /* The handler freezes the channel again after the first message */
+  cockpit_transport_thaw (transport, "a");
+  g_assert_cmpstr (log.log->str, ==, "a:1 ");
+
+  emit_log_recv (transport, "a", "4");
+  g_assert_cmpstr (log.log->str, ==, "a:1 ");
+
+  cockpit_transport_thaw (transport, "a");
+  g_assert_cmpstr (log.log->str, ==, "a:1 a:2 a:3 a:4 ");
+
+  g_object_unref (transport);
+  g_string_free (log.log, TRUE);
+}
+
+static void
+test_freeze_unref_queued (void)
+{
+  CockpitTransport *transport;
+
+  /* Queued messages are freed along with the transport */
+  transport = COCKPIT_TRANSPORT (mock_transport_new ());
+  cockpit_transport_freeze (transport, "a");
+  emit_log_recv (transport, "a", "1");
+  emit_log_control (transport, "a", "open");
+  g_object_unref (transport);
+}
+
+static void
+test_freeze_many (void)
+{
+  CockpitTransport *transport;
+  FreezeLog log = { g_string_new (""), NULL, 0 };
+  const guint n_channels = 500;
+  const guint n_messages = 20;
+  gchar **ids;
+  gdouble elapsed;
+  guint i, j;
+
+  transport = COCKPIT_TRANSPORT (mock_transport_new ());
+  g_signal_connect (transport, "recv", G_CALLBACK (on_recv_log), &log);
+
+  ids = g_new0 (gchar *, n_channels + 1);
+  for (i = 0; i < n_channels; i++)
+    ids[i] = g_strdup_printf ("%u", i);
+
+  g_test_timer_start ();
+
+  for (i = 0; i < n_channels; i++)
+    cockpit_transport_freeze (transport, ids[i]);
+
+  /* Interleave the messages for all the channels */
+  for (j = 0; j < n_messages; j++)
+    {
+      for (i = 0; i < n_channels; i++)
+        emit_log_recv (transport, ids[i], "x");
+    }
+
+  for (i = 0; i < n_channels; i++)
+    cockpit_transport_thaw (transport, ids[i]);
+
+  elapsed = g_test_timer_elapsed ();
+
+  g_assert_cmpuint (log.count, ==, n_channels * n_messages);
+  g_test_minimized_result (elapsed, "%u frozen channels with %u messages each: %.3f ms",
+                           n_channels, n_messages, elapsed * 1000);
+
+  g_strfreev (ids);
+  g_object_unref (transport);
+  g_string_free (log.log, TRUE);
+}
+
+static gboolean
+on_recv_count (CockpitTransport *transport,
+               const gchar *channel,
+               GBytes *payload,
+               gpointer user_data)
+{
+  gint *count = user_data;
+  (*count)++;
+  return TRUE;
+}
+
+static void
+test_relay (void)
+{
+  CockpitTransport *transport;
+  MockTransport *target;
+  GBytes *sent;
+  gint count = 0;
+  gint fds[2];
+  gint out;
+
+  if (pipe(fds) < 0)
+    g_assert_not_reached ();
+
+  out = dup (2);
+  g_assert (out >= 0);
+
+  transport = cockpit_pipe_transport_new_fds ("test", fds[0], out);
+  g_signal_connect (transport, "recv", G_CALLBACK (on_recv_count), &count);
+
+  target = mock_transport_new ();
+  cockpit_transport_relay (transport, "one", COCKPIT_TRANSPORT (target));
+
+  /* Relayed without a recv signal, the other channel isn't */
+  g_assert_cmpint (write (fds[1], "9\none\nfirst10\ntwo\nsecond", 24), ==, 24);
+  WAIT_UNTIL (count == 1);
+  sent = mock_transport_pop_channel (target, "one");
+  g_assert (sent != NULL);
+  cockpit_assert_bytes_eq (sent, "first", 5);
+
+  /* Frozen messages are relayed when thawed */
+  cockpit_transport_freeze (transport, "one");
+  g_assert_cmpint (write (fds[1], "10\none\nsecond10\ntwo\nsecond", 26), ==, 26);
+  WAIT_UNTIL (count == 2);
+  g_assert (mock_transport_pop_channel (target, "one") == NULL);
+  cockpit_transport_thaw (transport, "one");
+  sent = mock_transport_pop_channel (target, "one");
+  g_assert (sent != NULL);
+  cockpit_assert_bytes_eq (sent, "second", 6);
+
+  /* And not at all once removed */
+  cockpit_transport_relay (transport, "one", NULL);
+  g_assert_cmpint (write (fds[1], "9\none\nthird", 11), ==, 11);
+  WAIT_UNTIL (count == 3);
+  g_assert (mock_transport_pop_channel (target, "one") == NULL);
+
+  close (fds[1]);
+  g_object_unref (transport);
+  g_object_unref (target);
+}
+
 int
 main (int argc,
       char *argv[])
@@ -733,10 +1076,19 @@ main (int argc,
   g_test_add_func ("/transport/parse-frame/ok", test_parse_frame);
   g_test_add_func ("/transport/parse-frame/bad", test_parse_frame_bad);
   g_test_add_func ("/transport/parse-frame/maybe", test_parse_frame_maybe);
+  g_test_add_func ("/transport/parse-frame/peek", test_peek_channel);
 
   g_test_add_func ("/transport/parse-command/normal", test_parse_command);
   g_test_add_func ("/transport/parse-command/no-channel", test_parse_command_no_channel);
   g_test_add_func ("/transport/parse-command/nulls", test_parse_command_nulls);
+  g_test_add_func ("/transport/build-batch-open", test_build_batch_open);
+
+  g_test_add_func ("/transport/freeze/interleave", test_freeze_interleave);
+  g_test_add_func ("/transport/freeze/twice", test_freeze_twice);
+  g_test_add_func ("/transport/freeze/during-thaw", test_freeze_during_thaw);
+  g_test_add_func ("/transport/freeze/unref-queued", test_freeze_unref_queued);
+  if (g_test_perf ())
+    g_test_add_func ("/transport/freeze/many", test_freeze_many);
 
   for (i = 0; i < G_N_ELEMENTS (bad_command_payloads); i++)
     {
@@ -792,6 +1144,7 @@ main (int argc,
   g_test_add_func ("/transport/read-error", test_read_error);
   g_test_add_func ("/transport/write-error", test_write_error);
   g_test_add_func ("/transport/read-combined", test_read_combined);
+  g_test_add_func ("/transport/relay", test_relay);
   g_test_add_func ("/transport/read-truncated", test_read_truncated);
   g_test_add_func ("/transport/read-incorrect", test_incorrect_protocol);
 
@@ -81,8 +81,231 @@ static const Fixture fixtures[] = {
   { "\303 this is \303 invalid \303\303", "\357\277\275 this is \357\277\275 invalid \357\277\275\357\277\275", TRUE },
   { "\303 this is \303 invalid \303\303a", "\357\277\275 this is \357\277\275 invalid \357\277\275\357\277\275a", FALSE },
   { "Marmalaade!""\xe2\x94\x80", NULL, FALSE },
+  { "Marmalaade!""\xe2\x94", "Marmalaade!\357\277\275\357\277\275", TRUE },
+  { "stray continuation \x80", "stray continuation \357\277\275", FALSE },
+  { "\xf0\x9f\x98\x80 smile \xf0\x9f\x98", "\xf0\x9f\x98\x80 smile \357\277\275\357\277\275\357\277\275", TRUE },
+  { "surrogate \xed\xa0\x80", "surrogate \357\277\275\357\277\275\357\277\275", FALSE },
+  { "overlong \xc0\xaf", "overlong \357\277\275\357\277\275", FALSE },
 };
 
+static void
+assert_same_as_glib (const guint8 *data,
+                     gsize length)
+{
+  const gchar *end;
+  gboolean expected;
+  gsize valid;
+
+  expected = g_utf8_validate ((const gchar *)data, length, &end);
+  if (cockpit_unicode_validate (data, length, &valid) != expected ||
+      valid != (const guint8 *)end - data)
+    {
+      gchar *copy = g_strndup ((const gchar *)data, length);
+      gchar *escaped = g_strescape (copy, NULL);
+      g_error ("validation differs from g_utf8_validate for \"%s\"", escaped);
+    }
+}
+
+static void
+test_validate_exhaustive (void)
+{
+  static const guint8 tails[] = { 0x00, 0x41, 0x7F, 0x80, 0x8F, 0x90, 0x9F, 0xA0, 0xBF, 0xC0, 0xFF };
+  guint8 data[4];
+  guint a, b, c, d;
+
+  /* Every sequence of up to three bytes */
+  for (a = 0; a < 256; a++)
+    {
+      data[0] = a;
+      assert_same_as_glib (data, 1);
+      for (b = 0; b < 256; b++)
+        {
+          data[1] = b;
+          assert_same_as_glib (data, 2);
+          for (c = 0; c < 256; c++)
+            {
+              data[2] = c;
+              assert_same_as_glib (data, 3);
+            }
+        }
+    }
+
+  /* Four byte lead bytes, with every interesting continuation */
+  for (a = 0xF0; a < 256; a++)
+    {
+      data[0] = a;
+      for (b = 0; b < 256; b++)
+        {
+          data[1] = b;
+          for (c = 0; c < G_N_ELEMENTS (tails); c++)
+            {
+              data[2] = tails[c];
+              for (d = 0; d < G_N_ELEMENTS (tails); d++)
+                {
+                  data[3] = tails[d];
+                  assert_same_as_glib (data, 4);
+                }
+            }
+        }
+    }
+}
+
+static void
+test_validate_boundaries (void)
+{
+  static const gchar *inserts[] = {
+    "\xc3\xa4", "\xe2\x94\x80", "\xf0\x9f\x98\x80", "\x80", "\xc3", "\xe2\x94", "\x00"
+  };
+  guint8 data[100];
+  gsize length;
+  gsize at;
+  guint i;
+
+  /* Every position relative to the vectorized chunks */
+  for (length = 0; length <= sizeof (data); length++)
+    {
+      for (i = 0; i < G_N_ELEMENTS (inserts); i++)
+        {
+          for (at = 0; at < length; at++)
+            {
+              memset (data, 'x', length);
+              memcpy (data + at, inserts[i], MIN (MAX (strlen (inserts[i]), 1), length - at));
+              assert_same_as_glib (data, length);
+            }
+        }
+    }
+}
+
+/* How repair used to be done, one g_utf8_validate() at a time */
+static GBytes *
+reference_force_utf8 (GBytes *input)
+{
+  const gchar *data;
+  const gchar *end;
+  gsize length;
+  GString *string;
+
+  data = g_bytes_get_data (input, &length);
+  string = g_string_sized_new (length + 16);
+  while (!g_utf8_validate (data, length, &end))
+    {
+      g_string_append_len (string, data, end - data);
+      g_string_append (string, "\xef\xbf\xbd");
+      length -= (end - data) + 1;
+      data = end + 1;
+    }
+
+  g_string_append_len (string, data, length);
+  return g_string_free_to_bytes (string);
+}
+
+static void
+test_force_utf8_random (void)
+{
+  static const gchar *pieces[] = {
+    "a", "json", "\xc3\xa4", "\xe2\x94\x80", "\xf0\x9f\x98\x80", "\x80", "\xc3", "\xed\xa0\x80", "\xff", "\xf4\x90"
+  };
+  GString *string;
+  GBytes *input;
+  GBytes *output;
+  GBytes *expected;
+  guint i, j;
+
+  for (i = 0; i < 10000; i++)
+    {
+      string = g_string_new ("");
+      for (j = g_test_rand_int_range (0, 40); j > 0; j--)
+        g_string_append (string, pieces[g_test_rand_int_range (0, G_N_ELEMENTS (pieces))]);
+
+      input = g_string_free_to_bytes (string);
+      output = cockpit_unicode_force_utf8 (input);
+      expected = reference_force_utf8 (input);
+      g_assert (g_bytes_equal (output, expected));
+      g_assert (cockpit_unicode_validate (g_bytes_get_data (output, NULL), g_bytes_get_size (output), NULL));
+
+      g_bytes_unref (input);
+      g_bytes_unref (output);
+      g_bytes_unref (expected);
+    }
+}
+
+static GBytes *
+build_text (gboolean ascii)
+{
+  GString *string = g_string_sized_new (16 * 1024 * 1024);
+
+  while (string->len < 16 * 1024 * 1024)
+    {
+      g_string_append (string, "{ \"command\": \"ready\", \"channel\": \"4:1\", \"data\": [ 1, 2, 3 ] }\n");
+      if (!ascii)
+        g_string_append (string, "Gr\xc3\xbc\xc3\x9f \xe2\x94\x80 \xe4\xbd\xa0\xe5\xa5\xbd \xf0\x9f\x98\x80\n");
+    }
+
+  return g_string_free_to_bytes (string);
+}
+
+static void
+test_perf_validate (gconstpointer data)
+{
+  const gchar *text;
+  gdouble glib_elapsed;
+  gdouble elapsed;
+  GBytes *bytes;
+  gsize length;
+  guint i;
+
+  bytes = build_text (data != NULL);
+  text = g_bytes_get_data (bytes, &length);
+
+  g_test_timer_start ();
+  for (i = 0; i < 10; i++)
+    g_assert (g_utf8_validate (text, length, NULL));
+  glib_elapsed = g_test_timer_elapsed ();
+
+  g_test_timer_start ();
+  for (i = 0; i < 10; i++)
+    g_assert (cockpit_unicode_validate (text, length, NULL));
+  elapsed = g_test_timer_elapsed ();
+
+  g_test_minimized_result (elapsed, "%s: g_utf8_validate %.1f MB/s, cockpit_unicode_validate %.1f MB/s",
+                           data ? "ascii" : "mixed",
+                           (10.0 * length / glib_elapsed) / (1024 * 1024),
+                           (10.0 * length / elapsed) / (1024 * 1024));
+  g_bytes_unref (bytes);
+}
+
+static void
+test_perf_force_utf8 (void)
+{
+  GBytes *input;
+  GBytes *output;
+  GByteArray *array;
+  gdouble ref_elapsed;
+  gdouble elapsed;
+  gsize i;
+
+  /* Mostly valid with an occasional broken byte */
+  array = g_bytes_unref_to_array (build_text (FALSE));
+  for (i = 1000; i < array->len; i += 4096)
+    array->data[i] = 0xFF;
+  input = g_byte_array_free_to_bytes (array);
+
+  g_test_timer_start ();
+  output = reference_force_utf8 (input);
+  ref_elapsed = g_test_timer_elapsed ();
+  g_bytes_unref (output);
+
+  g_test_timer_start ();
+  output = cockpit_unicode_force_utf8 (input);
+  elapsed = g_test_timer_elapsed ();
+  g_bytes_unref (output);
+
+  g_test_minimized_result (elapsed, "repair: before %.1f MB/s, after %.1f MB/s",
+                           (g_bytes_get_size (input) / ref_elapsed) / (1024 * 1024),
+                           (g_bytes_get_size (input) / elapsed) / (1024 * 1024));
+  g_bytes_unref (input);
+}
+
 int
 main (int argc,
       char *argv[])
@@ -108,5 +331,16 @@ main (int argc,
       g_free (name2);
     }
 
+  g_test_add_func ("/unicode/validate/exhaustive", test_validate_exhaustive);
+  g_test_add_func ("/unicode/validate/boundaries", test_validate_boundaries);
+  g_test_add_func ("/unicode/force-utf8/random", test_force_utf8_random);
+
+  if (g_test_perf ())
+    {
+      g_test_add_data_func ("/unicode/perf/validate-ascii", "ascii", test_perf_validate);
+      g_test_add_data_func ("/unicode/perf/validate-mixed", NULL, test_perf_validate);
+      g_test_add_func ("/unicode/perf/force-utf8", test_perf_force_utf8);
+    }
+
   return g_test_run ();
 }
@@ -23,6 +23,7 @@
 #include "cockpitwebresponse.h"
 #include "cockpitwebserver.h"
 
+#include "common/cockpitsocket.h"
 #include "common/cockpittest.h"
 
 #include "websocket/websocket.h"
@@ -31,6 +32,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 /* headers that are present in every request */
 #define STATIC_HEADERS "X-DNS-Prefetch-Control: off\r\nReferrer-Policy: no-referrer\r\nX-Content-Type-Options: nosniff\r\nCross-Origin-Resource-Policy: same-origin\r\nX-Frame-Options: sameorigin\r\n\r\n"
@@ -1070,6 +1072,119 @@ test_origin (TestCase *tc,
   output_as_string (tc);
 }
 
+/* Sends @n_blocks of @block over a socket, and returns what the other end read */
+static GByteArray *
+transfer_over_socket (GBytes *block,
+                      guint n_blocks,
+                      gboolean chunked)
+{
+  CockpitWebResponse *response;
+  GPollableInputStream *input;
+  GIOStream *one, *two;
+  GByteArray *received;
+  GError *error = NULL;
+  gboolean done = FALSE;
+  guint8 buffer[64 * 1024];
+  gssize count;
+  guint i;
+
+  cockpit_socket_streampair (&one, &two);
+  input = G_POLLABLE_INPUT_STREAM (g_io_stream_get_input_stream (two));
+
+  response = cockpit_web_response_new (one, NULL, NULL, NULL, NULL, COCKPIT_WEB_RESPONSE_NONE);
+  g_signal_connect (response, "done", G_CALLBACK (on_response_done), &done);
+
+  cockpit_web_response_headers (response, 200, "OK",
+                                chunked ? -1 : (gssize)(g_bytes_get_size (block) * n_blocks), NULL);
+  for (i = 0; i < n_blocks; i++)
+    cockpit_web_response_queue (response, block);
+  cockpit_web_response_complete (response);
+
+  /* Keep reading so the socket fills and drains, and writes come up short */
+  received = g_byte_array_new ();
+  for (;;)
+    {
+      count = g_pollable_input_stream_read_nonblocking (input, buffer, sizeof (buffer), NULL, &error);
+      if (count > 0)
+        {
+          g_byte_array_append (received, buffer, count);
+          continue;
+        }
+
+      g_assert_error (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK);
+      g_clear_error (&error);
+      if (done)
+        break;
+      g_main_context_iteration (NULL, FALSE);
+    }
+
+  g_object_unref (response);
+  g_object_unref (one);
+  g_object_unref (two);
+  return received;
+}
+
+static void
+test_socket_chunked (void)
+{
+  GByteArray *received;
+  GString *expected;
+  GBytes *block;
+  gchar *data;
+  guint i;
+
+  /* Odd sized blocks, so chunk headers and partial writes land anywhere */
+  data = g_strnfill (4099, 'x');
+  block = g_bytes_new_static (data, 4099);
+  received = transfer_over_socket (block, 1000, TRUE);
+  g_bytes_unref (block);
+
+  expected = g_string_new ("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n" STATIC_HEADERS);
+  for (i = 0; i < 1000; i++)
+    {
+      g_string_append (expected, "1003\r\n");
+      g_string_append (expected, data);
+      g_string_append (expected, "\r\n");
+    }
+  g_string_append (expected, "0\r\n\r\n");
+
+  g_assert_cmpuint (received->len, ==, expected->len);
+  g_assert (memcmp (received->data, expected->str, expected->len) == 0);
+
+  g_string_free (expected, TRUE);
+  g_byte_array_unref (received);
+  g_free (data);
+}
+
+static void
+test_perf_large_asset (gconstpointer data)
+{
+  gboolean chunked = data != NULL;
+  GByteArray *received;
+  GBytes *block;
+  clock_t start;
+  gdouble elapsed;
+  gdouble cpu;
+  gsize length;
+
+  /* Like a big package bundle, 64 MiB in 16 KiB blocks */
+  length = 16 * 1024;
+  block = g_bytes_new_take (g_strnfill (length, 'b'), length);
+
+  start = clock ();
+  g_test_timer_start ();
+  received = transfer_over_socket (block, 4096, chunked);
+  elapsed = g_test_timer_elapsed ();
+  cpu = (gdouble)(clock () - start) / CLOCKS_PER_SEC;
+
+  g_assert_cmpuint (received->len, >, length * 4096);
+  g_test_minimized_result (cpu, "%s transfer of 64 MiB: %.3f s cpu, %.3f s wall",
+                           chunked ? "chunked" : "plain", cpu, elapsed);
+
+  g_byte_array_unref (received);
+  g_bytes_unref (block);
+}
+
 typedef struct {
     GHashTable *headers;
     GIOStream *io;
@@ -1291,6 +1406,61 @@ test_gunzip_large (void)
   g_bytes_unref (bytes);
 }
 
+static void
+test_gzip_roundtrip (void)
+{
+  GError *error = NULL;
+  GMappedFile *file;
+  GBytes *original;
+  GBytes *compressed;
+  GBytes *bytes;
+
+  file = g_mapped_file_new (SRCDIR "/src/common/mock-content/large.min.js.gz", FALSE, &error);
+  g_assert_no_error (error);
+
+  original = g_mapped_file_get_bytes (file);
+  g_mapped_file_unref (file);
+
+  /* Already compressed data doesn't shrink, but must still work */
+  compressed = cockpit_web_response_gzip (original, &error);
+  g_assert_no_error (error);
+
+  bytes = cockpit_web_response_gunzip (compressed, &error);
+  g_assert_no_error (error);
+  g_assert (g_bytes_equal (bytes, original));
+  g_bytes_unref (compressed);
+  g_bytes_unref (original);
+
+  /* And text shrinks */
+  original = bytes;
+  bytes = cockpit_web_response_gunzip (original, &error);
+  g_assert_no_error (error);
+  g_bytes_unref (original);
+
+  compressed = cockpit_web_response_gzip (bytes, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_bytes_get_size (compressed), <, g_bytes_get_size (bytes));
+
+  original = cockpit_web_response_gunzip (compressed, &error);
+  g_assert_no_error (error);
+  g_assert (g_bytes_equal (bytes, original));
+
+  g_bytes_unref (original);
+  g_bytes_unref (compressed);
+  g_bytes_unref (bytes);
+
+  /* Empty input is a valid stream too */
+  original = g_bytes_new_static ("", 0);
+  compressed = cockpit_web_response_gzip (original, &error);
+  g_assert_no_error (error);
+  bytes = cockpit_web_response_gunzip (compressed, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_bytes_get_size (bytes), ==, 0);
+  g_bytes_unref (bytes);
+  g_bytes_unref (compressed);
+  g_bytes_unref (original);
+}
+
 static void
 test_gunzip_invalid (void)
 {
@@ -1388,6 +1558,79 @@ test_negotiation_with_listing (void)
   g_hash_table_unref (existing);
 }
 
+typedef struct {
+  CockpitWebEncodings encodings;
+  const gchar *existing[4];
+  const gchar *chosen;
+} EncodingFixture;
+
+#define MOCK_FILE SRCDIR "/src/common/mock-content/test-file.txt"
+
+static const EncodingFixture encoding_fixtures[] = {
+  { COCKPIT_WEB_ENCODING_IDENTITY, { NULL }, MOCK_FILE },
+  { COCKPIT_WEB_ENCODING_GZIP, { NULL }, MOCK_FILE ".gz" },
+  { COCKPIT_WEB_ENCODING_BROTLI, { NULL }, MOCK_FILE ".br" },
+  { COCKPIT_WEB_ENCODING_GZIP | COCKPIT_WEB_ENCODING_BROTLI, { NULL }, MOCK_FILE ".br" },
+  { COCKPIT_WEB_ENCODING_BROTLI, { MOCK_FILE, MOCK_FILE ".gz" }, MOCK_FILE },
+  { COCKPIT_WEB_ENCODING_GZIP | COCKPIT_WEB_ENCODING_BROTLI, { MOCK_FILE, MOCK_FILE ".gz" }, MOCK_FILE ".gz" },
+  { COCKPIT_WEB_ENCODING_BROTLI, { MOCK_FILE ".gz" }, MOCK_FILE ".gz" },
+  { COCKPIT_WEB_ENCODING_IDENTITY, { MOCK_FILE ".gz", MOCK_FILE ".br" }, MOCK_FILE ".gz" },
+  { COCKPIT_WEB_ENCODING_GZIP, { MOCK_FILE ".br" }, NULL },
+};
+
+static void
+test_negotiation_encoding (gconstpointer data)
+{
+  const EncodingFixture *fixture = data;
+  GHashTable *existing = NULL;
+  gchar *chosen = NULL;
+  GError *error = NULL;
+  GBytes *bytes;
+  guint i;
+
+  if (fixture->existing[0])
+    {
+      existing = g_hash_table_new (g_str_hash, g_str_equal);
+      for (i = 0; fixture->existing[i] != NULL; i++)
+        g_hash_table_add (existing, (gchar *)fixture->existing[i]);
+    }
+
+  bytes = cockpit_web_response_negotiation_full (MOCK_FILE, existing, NULL, fixture->encodings, &chosen, &error);
+  g_assert_no_error (error);
+
+  g_assert_cmpstr (chosen, ==, fixture->chosen);
+  if (fixture->chosen)
+    g_assert (bytes != NULL);
+  else
+    g_assert (bytes == NULL);
+
+  if (bytes)
+    g_bytes_unref (bytes);
+  if (existing)
+    g_hash_table_unref (existing);
+  g_free (chosen);
+}
+
+static void
+test_accepted_encodings (void)
+{
+  g_assert_cmpint (cockpit_web_response_accepted_encodings (NULL), ==, COCKPIT_WEB_ENCODING_IDENTITY);
+  g_assert_cmpint (cockpit_web_response_accepted_encodings ("identity"), ==, COCKPIT_WEB_ENCODING_IDENTITY);
+  g_assert_cmpint (cockpit_web_response_accepted_encodings ("gzip, deflate"), ==, COCKPIT_WEB_ENCODING_GZIP);
+  g_assert_cmpint (cockpit_web_response_accepted_encodings ("br"), ==, COCKPIT_WEB_ENCODING_BROTLI);
+  g_assert_cmpint (cockpit_web_response_accepted_encodings ("gzip, deflate, br"), ==,
+                   COCKPIT_WEB_ENCODING_GZIP | COCKPIT_WEB_ENCODING_BROTLI);
+  g_assert_cmpint (cockpit_web_response_accepted_encodings ("GZip;q=0.5, BR;q=0"), ==, COCKPIT_WEB_ENCODING_GZIP);
+  g_assert_cmpint (cockpit_web_response_accepted_encodings ("*"), ==,
+                   COCKPIT_WEB_ENCODING_GZIP | COCKPIT_WEB_ENCODING_BROTLI);
+  g_assert_cmpint (cockpit_web_response_accepted_encodings ("br; q=0"), ==, COCKPIT_WEB_ENCODING_IDENTITY);
+  g_assert_cmpint (cockpit_web_response_accepted_encodings ("gzip;q=0.0"), ==, COCKPIT_WEB_ENCODING_IDENTITY);
+  g_assert_cmpint (cockpit_web_response_accepted_encodings ("gzip;Q=0, br"), ==, COCKPIT_WEB_ENCODING_BROTLI);
+  g_assert_cmpint (cockpit_web_response_accepted_encodings ("br;level=1;q=0.1"), ==, COCKPIT_WEB_ENCODING_BROTLI);
+  g_assert_cmpint (cockpit_web_response_accepted_encodings ("*, br;q=0"), ==, COCKPIT_WEB_ENCODING_GZIP);
+  g_assert_cmpint (cockpit_web_response_accepted_encodings ("gzip, *;q=0"), ==, COCKPIT_WEB_ENCODING_GZIP);
+}
+
 static void
 test_negotiation_locale (void)
 {
@@ -1448,7 +1691,9 @@ main (int argc,
   cockpit_webresponse_fail_html_text =
     "<html><head><title>@@message@@</title></head><body>@@message@@</body></html>\n";
 
+  gchar *name;
   gint ret;
+  guint i;
 
   srcdir = realpath (SRCDIR, NULL);
   g_assert (srcdir != NULL);
@@ -1541,9 +1786,12 @@ main (int argc,
   g_test_add ("/web-response/path/removed-prefix", TestPlain, NULL,
               setup_plain, test_removed_prefix, teardown_plain);
 
+  g_test_add_func ("/web-response/socket/chunked", test_socket_chunked);
+
   g_test_add_func ("/web-response/gunzip/small", test_gunzip_small);
   g_test_add_func ("/web-response/gunzip/large", test_gunzip_large);
   g_test_add_func ("/web-response/gunzip/invalid", test_gunzip_invalid);
+  g_test_add_func ("/web-response/gzip/roundtrip", test_gzip_roundtrip);
 
   g_test_add_func ("/web-response/negotiation/first", test_negotiation_first);
   g_test_add_func ("/web-response/negotiation/last", test_negotiation_last);
@@ -1552,6 +1800,19 @@ main (int argc,
   g_test_add_func ("/web-response/negotiation/with-listing", test_negotiation_with_listing);
   g_test_add_func ("/web-response/negotiation/notfound", test_negotiation_notfound);
   g_test_add_func ("/web-response/negotiation/failure", test_negotiation_failure);
+  for (i = 0; i < G_N_ELEMENTS (encoding_fixtures); i++)
+    {
+      name = g_strdup_printf ("/web-response/negotiation/encoding/%u", i);
+      g_test_add_data_func (name, encoding_fixtures + i, test_negotiation_encoding);
+      g_free (name);
+    }
+  g_test_add_func ("/web-response/accepted-encodings", test_accepted_encodings);
+
+  if (g_test_perf ())
+    {
+      g_test_add_data_func ("/web-response/perf/large-asset", NULL, test_perf_large_asset);
+      g_test_add_data_func ("/web-response/perf/large-asset-chunked", "chunked", test_perf_large_asset);
+    }
 
   ret = g_test_run ();
 
@@ -28,7 +28,12 @@
 #include "websocket/websocket.h"
 #include "websocket/websocketprivate.h"
 
+#include <glib-unix.h>
+
+#include <sys/socket.h>
+#include <errno.h>
 #include <string.h>
+#include <unistd.h>
 
 typedef struct {
   CockpitWebServer *web_server;
@@ -771,6 +776,112 @@ test_handle_resource (TestCase *tc,
   invoked = NULL;
 }
 
+static void
+test_fd_connection (TestCase *tc,
+                    gconstpointer data)
+{
+  const gchar *invoked = NULL;
+  const gchar *start = "GET /scruffy HTTP/1.0\r\nHo";
+  const gchar *rest = "st:test\r\n\r\n";
+  GError *error = NULL;
+  GString *response;
+  GBytes *received;
+  gchar buffer[1024];
+  gssize count;
+  int fds[2];
+
+  g_signal_connect (tc->web_server, "handle-resource::/scruffy",
+                    G_CALLBACK (on_scruffy_resource), &invoked);
+
+  g_assert_cmpint (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds), ==, 0);
+  g_unix_set_fd_nonblocking (fds[1], TRUE, NULL);
+
+  /* The start of the request was already read by someone else */
+  received = g_bytes_new_static (start, strlen (start));
+  g_assert (cockpit_web_server_add_fd_connection (tc->web_server, fds[0], received, &error));
+  g_assert_no_error (error);
+  g_bytes_unref (received);
+  g_assert_cmpuint (cockpit_web_server_get_n_connections (tc->web_server), ==, 1);
+
+  g_assert_cmpint (write (fds[1], rest, strlen (rest)), ==, strlen (rest));
+
+  response = g_string_new ("");
+  for (;;)
+    {
+      count = read (fds[1], buffer, sizeof (buffer));
+      if (count == 0)
+        break;
+      else if (count > 0)
+        g_string_append_len (response, buffer, count);
+      else if (errno == EAGAIN)
+        g_main_context_iteration (NULL, TRUE);
+      else
+        g_assert_not_reached ();
+    }
+
+  g_assert_cmpstr (invoked, ==, "scruffy");
+  cockpit_assert_strmatch (response->str, "HTTP/1.1 200*Scruffy is here");
+
+  /* An HTTP/1.0 connection is gone after the response */
+  while (cockpit_web_server_get_n_connections (tc->web_server) > 0)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_string_free (response, TRUE);
+  close (fds[1]);
+}
+
+static void
+test_fd_connection_keep_alive (TestCase *tc,
+                               gconstpointer data)
+{
+  const gchar *invoked = NULL;
+  const gchar *requests =
+    "GET /scruffy HTTP/1.1\r\nHost:test\r\nConnection: keep-alive\r\nCookie: cockpit=one\r\n\r\n"
+    "GET /scruffy HTTP/1.1\r\nHost:test\r\nConnection: keep-alive\r\nCookie: cockpit=two\r\n\r\n";
+  GError *error = NULL;
+  GString *response;
+  gchar buffer[1024];
+  gssize count;
+  int fds[2];
+
+  g_signal_connect (tc->web_server, "handle-resource::/scruffy",
+                    G_CALLBACK (on_scruffy_resource), &invoked);
+
+  g_assert_cmpint (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds), ==, 0);
+  g_unix_set_fd_nonblocking (fds[1], TRUE, NULL);
+
+  g_assert (cockpit_web_server_add_fd_connection (tc->web_server, fds[0], NULL, &error));
+  g_assert_no_error (error);
+
+  /* The second request may belong to another worker */
+  g_assert_cmpint (write (fds[1], requests, strlen (requests)), ==, strlen (requests));
+
+  response = g_string_new ("");
+  for (;;)
+    {
+      count = read (fds[1], buffer, sizeof (buffer));
+      if (count == 0)
+        break;
+      else if (count > 0)
+        g_string_append_len (response, buffer, count);
+      else if (errno == EAGAIN)
+        g_main_context_iteration (NULL, TRUE);
+      else
+        g_assert_not_reached ();
+    }
+
+  /* Only the first request is answered, and the connection is closed */
+  g_assert_cmpstr (invoked, ==, "scruffy");
+  cockpit_assert_strmatch (response->str, "HTTP/1.1 200*Connection: close*Scruffy is here");
+  g_assert (strstr (response->str + 1, "HTTP/1.1") == NULL);
+
+  while (cockpit_web_server_get_n_connections (tc->web_server) > 0)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_string_free (response, TRUE);
+  close (fds[1]);
+}
+
 static void
 test_webserver_host_header (TestCase *tc,
                             gconstpointer data)
@@ -1052,6 +1163,10 @@ main (int argc,
 
   g_test_add ("/web-server/handle-resource", TestCase, NULL,
               setup, test_handle_resource, teardown);
+  g_test_add ("/web-server/fd-connection", TestCase, NULL,
+              setup, test_fd_connection, teardown);
+  g_test_add ("/web-server/fd-connection-keep-alive", TestCase, NULL,
+              setup, test_fd_connection_keep_alive, teardown);
 
   g_test_add ("/web-server/url-root", TestCase, NULL,
               setup, test_url_root, teardown);
@@ -22,6 +22,7 @@
 #include "websocket.h"
 #include "websocketprivate.h"
 
+#include "common/cockpitbufferpool.h"
 #include "common/cockpitflow.h"
 #include "common/cockpitsocket.h"
 #include "common/mock-pressure.h"
@@ -664,6 +665,41 @@ test_send_big_packets (Test *test,
   g_bytes_unref (received);
 }
 
+static void
+test_compact (Test *test,
+              gconstpointer data)
+{
+  GBytes *sent = NULL;
+  GBytes *received = NULL;
+
+  g_signal_connect (test->client, "message", G_CALLBACK (on_text_message), &received);
+
+  WAIT_UNTIL (web_socket_connection_get_ready_state (test->server) != WEB_SOCKET_STATE_CONNECTING);
+  g_assert_cmpint (web_socket_connection_get_ready_state (test->server), ==, WEB_SOCKET_STATE_OPEN);
+
+  /* The client's input buffer grows to hold the whole frame */
+  sent = g_bytes_new_take (g_strnfill (100 * 1000, '?'), 100 * 1000);
+  web_socket_connection_send (test->server, WEB_SOCKET_DATA_TEXT, NULL, sent);
+  WAIT_UNTIL (received != NULL);
+  g_assert (g_bytes_equal (sent, received));
+  g_bytes_unref (sent);
+  g_bytes_unref (received);
+  received = NULL;
+
+  g_assert_cmpuint (web_socket_connection_get_memory_size (test->client), >=, 100 * 1000);
+
+  web_socket_connection_compact (test->client);
+  g_assert_cmpuint (web_socket_connection_get_memory_size (test->client), <=, 4 * 1024);
+
+  /* And still works afterwards */
+  sent = g_bytes_new_take (g_strnfill (50 * 1000, '!'), 50 * 1000);
+  web_socket_connection_send (test->server, WEB_SOCKET_DATA_TEXT, NULL, sent);
+  WAIT_UNTIL (received != NULL);
+  g_assert (g_bytes_equal (sent, received));
+  g_bytes_unref (sent);
+  g_bytes_unref (received);
+}
+
 static void
 on_pressure_set_throttle (WebSocketConnection *socket,
                           gboolean throttle,
@@ -1183,6 +1219,147 @@ test_receive_fragmented (void)
   g_object_unref (io_b);
 }
 
+typedef struct {
+  GIOStream *io;
+  const gchar *frames;
+  gsize length;
+} SendFrames;
+
+static gpointer
+send_frames_server_thread (gpointer user_data)
+{
+  SendFrames *sf = user_data;
+  gsize written;
+
+  mock_perform_handshake (sf->io);
+
+  if (!g_output_stream_write_all (g_io_stream_get_output_stream (sf->io),
+                                  sf->frames, sf->length, &written, NULL, NULL))
+    g_assert_not_reached ();
+  g_assert_cmpuint (written, ==, sf->length);
+
+  return NULL;
+}
+
+static void
+on_fragment_record (WebSocketConnection *ws,
+                    WebSocketDataType type,
+                    GBytes *fragment,
+                    gboolean last,
+                    gpointer user_data)
+{
+  GPtrArray *received = user_data;
+  g_assert_cmpint (type, ==, WEB_SOCKET_DATA_TEXT);
+  g_ptr_array_add (received, g_strdup_printf ("%s%s", (gchar *)g_bytes_get_data (fragment, NULL),
+                                              last ? "|" : ""));
+}
+
+static void
+on_message_record (WebSocketConnection *ws,
+                   WebSocketDataType type,
+                   GBytes *message,
+                   gpointer user_data)
+{
+  GPtrArray *received = user_data;
+  g_ptr_array_add (received, g_strdup_printf ("%s.", (gchar *)g_bytes_get_data (message, NULL)));
+}
+
+static void
+test_receive_streamed (void)
+{
+  WebSocketConnection *client;
+  GPtrArray *received;
+  GThread *thread;
+  SendFrames sf;
+  GIOStream *io;
+
+  /* Control frames may come between the fragments of a message */
+  const gchar frames[] = "\x81\x05""first"    /* fin  | opcode */
+                         "\x01\x04""one "     /* !fin | opcode */
+                         "\x89\x02""hi"       /* ping */
+                         "\x00\x00"           /* !fin | no opcode, empty */
+                         "\x00\x04""two "     /* !fin | no opcode */
+                         "\x8A\x00"           /* pong */
+                         "\x80\x05""three"    /* fin  | no opcode */
+                         "\x81\x04""last";    /* fin  | opcode */
+
+  cockpit_socket_streampair (&sf.io, &io);
+  sf.frames = frames;
+  sf.length = sizeof (frames) - 1;
+  thread = g_thread_new ("streamed-thread", send_frames_server_thread, &sf);
+
+  received = g_ptr_array_new_with_free_func (g_free);
+  client = web_socket_client_new_for_stream ("ws://localhost/unix", NULL, NULL, io);
+  g_object_set (client, "streaming", TRUE, NULL);
+  g_signal_connect (client, "error", G_CALLBACK (on_error_not_reached), NULL);
+  g_signal_connect (client, "message", G_CALLBACK (on_message_record), received);
+  g_signal_connect (client, "fragment", G_CALLBACK (on_fragment_record), received);
+
+  WAIT_UNTIL (received->len == 6);
+  g_assert_cmpstr (received->pdata[0], ==, "first.");
+  g_assert_cmpstr (received->pdata[1], ==, "one ");
+  g_assert_cmpstr (received->pdata[2], ==, "");
+  g_assert_cmpstr (received->pdata[3], ==, "two ");
+  g_assert_cmpstr (received->pdata[4], ==, "three|");
+  g_assert_cmpstr (received->pdata[5], ==, "last.");
+
+  g_thread_join (thread);
+  g_ptr_array_free (received, TRUE);
+  g_object_unref (client);
+  g_object_unref (sf.io);
+  g_object_unref (io);
+}
+
+static void
+test_receive_max_message_size (gconstpointer data)
+{
+  gulong limit = GPOINTER_TO_UINT (data);
+  WebSocketConnection *client;
+  GBytes *received = NULL;
+  GBytes *expect;
+  GError *error = NULL;
+  GThread *thread;
+  SendFrames sf;
+  GIOStream *io;
+
+  /* Each frame is small, but together they're thirteen bytes */
+  const gchar frames[] = "\x01\x04""one "
+                         "\x00\x04""two "
+                         "\x80\x05""three";
+
+  cockpit_socket_streampair (&sf.io, &io);
+  sf.frames = frames;
+  sf.length = sizeof (frames) - 1;
+  thread = g_thread_new ("limit-thread", send_frames_server_thread, &sf);
+
+  client = web_socket_client_new_for_stream ("ws://localhost/unix", NULL, NULL, io);
+  g_object_set (client, "max-message-size", limit, NULL);
+  g_signal_connect (client, "error", G_CALLBACK (on_error_copy), &error);
+  g_signal_connect (client, "message", G_CALLBACK (on_text_message), &received);
+
+  if (limit >= 13)
+    {
+      WAIT_UNTIL (received != NULL);
+      expect = g_bytes_new_static ("one two three", 13);
+      g_assert (g_bytes_equal (expect, received));
+      g_assert_no_error (error);
+      g_bytes_unref (expect);
+      g_bytes_unref (received);
+    }
+  else
+    {
+      WAIT_UNTIL (error != NULL);
+      g_assert_error (error, WEB_SOCKET_ERROR, WEB_SOCKET_CLOSE_TOO_BIG);
+      g_assert (received == NULL);
+      g_error_free (error);
+    }
+
+  g_thread_join (thread);
+  g_object_unref (client);
+  g_object_unref (sf.io);
+  g_object_unref (io);
+}
+
 static gpointer
 client_thread (gpointer data)
 {
@@ -1256,6 +1433,422 @@ test_handshake_with_buffer_and_headers (void)
   g_object_unref (ios);
 }
 
+static void
+xor_mask_scalar (const guint8 *mask,
+                 gsize offset,
+                 guint8 *data,
+                 gsize len)
+{
+  gsize n;
+
+  for (n = 0; n < len; n++)
+    data[n] ^= mask[(offset + n) & 3];
+}
+
+static void
+test_xor_mask (void)
+{
+  const guint8 mask[4] = { 0x12, 0x9a, 0xff, 0x01 };
+  guint8 expect[600];
+  guint8 data[600];
+  gsize align, offset, len;
+  gsize i;
+
+  /* Every start alignment, mask rotation and length across the vector sizes */
+  for (align = 0; align < 40; align++)
+    {
+      for (offset = 0; offset < 4; offset++)
+        {
+          for (len = 0; len < 520; len++)
+            {
+              for (i = 0; i < sizeof (data); i++)
+                data[i] = expect[i] = (i * 7 + align) & 0xFF;
+
+              _web_socket_xor_mask (mask, offset, data + align, len);
+              xor_mask_scalar (mask, offset, expect + align, len);
+
+              /* Including that nothing around it was touched */
+              g_assert (memcmp (data, expect, sizeof (data)) == 0);
+            }
+        }
+    }
+}
+
+static void
+test_xor_mask_roundtrip (void)
+{
+  const guint8 mask[4] = { 0xde, 0xad, 0xbe, 0xef };
+  guint8 *data;
+  guint8 *copy;
+  gsize len = 100000;
+  gsize split;
+  gsize i;
+
+  data = g_malloc (len);
+  for (i = 0; i < len; i++)
+    data[i] = g_random_int_range (0, 256);
+  copy = g_memdup (data, len);
+
+  /* Masking in two pieces gives the same as in one */
+  split = 12345;
+  _web_socket_xor_mask (mask, 0, data, split);
+  _web_socket_xor_mask (mask, split, data + split, len - split);
+  g_assert (memcmp (data, copy, len) != 0);
+
+  _web_socket_xor_mask (mask, 0, data, len);
+  g_assert (memcmp (data, copy, len) == 0);
+
+  g_free (data);
+  g_free (copy);
+}
+
+static void
+test_xor_mask_perf (void)
+{
+  const guint8 mask[4] = { 0x12, 0x9a, 0xff, 0x01 };
+  const gsize len = 64 * 1024 * 1024;
+  gdouble scalar;
+  gdouble elapsed;
+  guint8 *data;
+  guint i;
+
+  data = g_malloc0 (len + 1);
+
+  g_test_timer_start ();
+  for (i = 0; i < 4; i++)
+    xor_mask_scalar (mask, 0, data + 1, len);
+  scalar = g_test_timer_elapsed ();
+
+  g_test_timer_start ();
+  for (i = 0; i < 4; i++)
+    _web_socket_xor_mask (mask, 0, data + 1, len);
+  elapsed = g_test_timer_elapsed ();
+
+  g_test_maximized_result ((4.0 * len) / elapsed / (1024 * 1024 * 1024),
+                           "masking: bytewise %.2f GB/s, wide %.2f GB/s",
+                           (4.0 * len) / scalar / (1024 * 1024 * 1024),
+                           (4.0 * len) / elapsed / (1024 * 1024 * 1024));
+
+  g_free (data);
+}
+
+static void
+on_message_check_order (WebSocketConnection *ws,
+                        WebSocketDataType type,
+                        GBytes *message,
+                        gpointer user_data)
+{
+  guint *count = user_data;
+  gchar *expect;
+
+  /* Each message is its number, padded out to a varying length */
+  expect = g_strdup_printf ("%u:%s", *count, "................................" + (*count % 32));
+  g_assert_cmpstr (g_bytes_get_data (message, NULL), ==, expect);
+  g_free (expect);
+
+  (*count)++;
+}
+
+static void
+test_send_burst (Test *test,
+                 gconstpointer data)
+{
+  GBytes *sent;
+  gchar *string;
+  guint count = 0;
+  guint i;
+
+  const guint n_messages = 5000;
+
+  g_signal_connect (test->server, "message", G_CALLBACK (on_message_check_order), &count);
+
+  WAIT_UNTIL (web_socket_connection_get_ready_state (test->client) != WEB_SOCKET_STATE_CONNECTING);
+  g_assert_cmpint (web_socket_connection_get_ready_state (test->client), ==, WEB_SOCKET_STATE_OPEN);
+
+  /* Many frames arrive in each read, and some are split between reads */
+  for (i = 0; i < n_messages; i++)
+    {
+      string = g_strdup_printf ("%u:%s", i, "................................" + (i % 32));
+      sent = g_bytes_new_take (string, strlen (string));
+      web_socket_connection_send (test->client, WEB_SOCKET_DATA_TEXT, NULL, sent);
+      g_bytes_unref (sent);
+    }
+
+  WAIT_UNTIL (count == n_messages);
+}
+
+/* Frames of mixed sizes share vectored writes, and large ones go out in pieces */
+static const gsize slow_reader_sizes[] = { 7, 200, 3000, 40000, 150000 };
+
+static void
+on_message_check_sized (WebSocketConnection *ws,
+                        WebSocketDataType type,
+                        GBytes *message,
+                        gpointer user_data)
+{
+  guint *count = user_data;
+  const gchar *data;
+  gchar *expect;
+  gsize length;
+  gsize size;
+  gsize i;
+
+  size = slow_reader_sizes[*count % G_N_ELEMENTS (slow_reader_sizes)];
+  data = g_bytes_get_data (message, &length);
+  g_assert_cmpuint (length, ==, size);
+
+  /* Each message starts with its number, and is filled with a letter */
+  expect = g_strdup_printf ("%u:", *count);
+  g_assert (strncmp (data, expect, MIN (size, strlen (expect))) == 0);
+  for (i = strlen (expect); i < size; i++)
+    g_assert_cmpint (data[i], ==, 'a' + (*count % 26));
+  g_free (expect);
+
+  (*count)++;
+}
+
+static void
+test_send_slow_reader (Test *test,
+                       gconstpointer data)
+{
+  CockpitFlow *pressure = mock_pressure_new ();
+  gboolean timeout = FALSE;
+  GBytes *sent;
+  gchar *string;
+  gchar *prefix;
+  gsize size;
+  guint count = 0;
+  guint i;
+
+  const guint n_messages = 500;
+
+  cockpit_flow_throttle (COCKPIT_FLOW (test->client), pressure);
+  g_signal_connect (test->client, "message", G_CALLBACK (on_message_check_sized), &count);
+
+  WAIT_UNTIL (web_socket_connection_get_ready_state (test->server) != WEB_SOCKET_STATE_CONNECTING);
+  g_assert_cmpint (web_socket_connection_get_ready_state (test->server), ==, WEB_SOCKET_STATE_OPEN);
+
+  /* The client doesn't read, so the server's writes fill up and go partial */
+  g_signal_emit_by_name (pressure, "pressure", TRUE);
+
+  for (i = 0; i < n_messages; i++)
+    {
+      size = slow_reader_sizes[i % G_N_ELEMENTS (slow_reader_sizes)];
+      string = g_malloc (size);
+      memset (string, 'a' + (i % 26), size);
+      prefix = g_strdup_printf ("%u:", i);
+      memcpy (string, prefix, MIN (size, strlen (prefix)));
+      g_free (prefix);
+      sent = g_bytes_new_take (string, size);
+      web_socket_connection_send (test->server, WEB_SOCKET_DATA_TEXT, NULL, sent);
+      g_bytes_unref (sent);
+    }
+
+  g_timeout_add (200, on_timeout_set_flag, &timeout);
+  WAIT_UNTIL (timeout == TRUE);
+  g_assert_cmpuint (count, ==, 0);
+  g_assert_cmpuint (web_socket_connection_get_buffered_amount (test->server), >, 0);
+
+  /* Once the reader catches up, everything arrives intact and in order */
+  g_signal_emit_by_name (pressure, "pressure", FALSE);
+  WAIT_UNTIL (count == n_messages);
+
+  g_assert_cmpuint (count, ==, n_messages);
+  WAIT_UNTIL (web_socket_connection_get_buffered_amount (test->server) == 0);
+
+  cockpit_flow_throttle (COCKPIT_FLOW (test->client), NULL);
+  g_object_unref (pressure);
+}
+
+typedef struct {
+  GByteArray *data;
+  guint count;
+  gboolean last;
+} Fragments;
+
+static void
+on_fragment_collect (WebSocketConnection *ws,
+                     WebSocketDataType type,
+                     GBytes *fragment,
+                     gboolean last,
+                     gpointer user_data)
+{
+  Fragments *fragments = user_data;
+  const gchar *data;
+  gsize length;
+
+  g_assert (!fragments->last);
+  data = g_bytes_get_data (fragment, &length);
+
+  /* Never more than the fragment size, and never split inside a character */
+  g_assert_cmpuint (length, <=, 101);
+  g_assert (g_utf8_validate (data, length, NULL));
+
+  g_byte_array_append (fragments->data, (const guint8 *)data, length);
+  fragments->count++;
+  fragments->last = last;
+}
+
+static void
+test_send_fragmented (Test *test,
+                      gconstpointer data)
+{
+  Fragments fragments = { NULL, 0, FALSE };
+  GBytes *received = NULL;
+  GBytes *prefix;
+  GBytes *sent;
+  GString *string;
+  GBytes *expect;
+  guint i;
+
+  /* Two byte characters, an odd fragment size would split them */
+  string = g_string_new ("");
+  for (i = 0; i < 1000; i++)
+    g_string_append (string, "\xc3\xa9");
+  sent = g_bytes_new_take (string->str, string->len);
+  g_string_free (string, FALSE);
+
+  prefix = g_bytes_new_static ("chan\n", 5);
+  string = g_string_new ("chan\n");
+  g_string_append_len (string, g_bytes_get_data (sent, NULL), g_bytes_get_size (sent));
+  expect = g_bytes_new_take (string->str, string->len);
+  g_string_free (string, FALSE);
+
+  g_object_set (test->server, "fragment-size", (gulong)101, NULL);
+  g_signal_connect (test->client, "error", G_CALLBACK (on_error_not_reached), NULL);
+
+  WAIT_UNTIL (web_socket_connection_get_ready_state (test->server) != WEB_SOCKET_STATE_CONNECTING);
+  g_assert_cmpint (web_socket_connection_get_ready_state (test->server), ==, WEB_SOCKET_STATE_OPEN);
+
+  /* Reassembled into one message on the other end */
+  g_signal_connect (test->client, "message", G_CALLBACK (on_text_message), &received);
+  web_socket_connection_send (test->server, WEB_SOCKET_DATA_TEXT, prefix, sent);
+  WAIT_UNTIL (received != NULL);
+  g_assert (g_bytes_equal (received, expect));
+  g_bytes_unref (received);
+  received = NULL;
+
+  /* Or seen fragment by fragment */
+  fragments.data = g_byte_array_new ();
+  g_object_set (test->client, "streaming", TRUE, NULL);
+  g_signal_connect (test->client, "fragment", G_CALLBACK (on_fragment_collect), &fragments);
+  web_socket_connection_send (test->server, WEB_SOCKET_DATA_TEXT, prefix, sent);
+  WAIT_UNTIL (fragments.last);
+
+  g_assert_cmpuint (fragments.count, >, 20);
+  g_assert_cmpuint (fragments.data->len, ==, g_bytes_get_size (expect));
+  g_assert (memcmp (fragments.data->data, g_bytes_get_data (expect, NULL), fragments.data->len) == 0);
+  g_assert (received == NULL);
+
+  WAIT_UNTIL (web_socket_connection_get_buffered_amount (test->server) == 0);
+
+  g_byte_array_free (fragments.data, TRUE);
+  g_bytes_unref (expect);
+  g_bytes_unref (prefix);
+  g_bytes_unref (sent);
+}
+
+static void
+on_message_count (WebSocketConnection *ws,
+                  WebSocketDataType type,
+                  GBytes *message,
+                  gpointer user_data)
+{
+  guint *count = user_data;
+  (*count)++;
+}
+
+static void
+measure_frames (Test *test,
+                gsize size,
+                guint n_messages)
+{
+  GBytes *sent;
+  gdouble elapsed;
+  guint count = 0;
+  guint i;
+
+  g_signal_connect (test->server, "message", G_CALLBACK (on_message_count), &count);
+
+  WAIT_UNTIL (web_socket_connection_get_ready_state (test->client) != WEB_SOCKET_STATE_CONNECTING);
+
+  sent = g_bytes_new_take (g_strnfill (size, 'x'), size);
+
+  g_test_timer_start ();
+  for (i = 0; i < n_messages; i++)
+    web_socket_connection_send (test->client, WEB_SOCKET_DATA_TEXT, NULL, sent);
+  WAIT_UNTIL (count == n_messages);
+  elapsed = g_test_timer_elapsed ();
+
+  g_test_maximized_result (n_messages / elapsed, "%" G_GSIZE_FORMAT " byte messages: %.0f frames/s, %.1f MB/s",
+                           size, n_messages / elapsed, (size * n_messages) / elapsed / (1024 * 1024));
+
+  g_bytes_unref (sent);
+}
+
+static void
+test_receive_perf_small (Test *test,
+                         gconstpointer data)
+{
+  measure_frames (test, 32, 200000);
+}
+
+static void
+test_receive_perf_large (Test *test,
+                         gconstpointer data)
+{
+  measure_frames (test, 60000, 5000);
+}
+
+static void
+measure_send (Test *test,
+              gsize size,
+              guint n_messages)
+{
+  CockpitBufferPoolStats before;
+  CockpitBufferPoolStats after;
+  GBytes *sent;
+  gdouble elapsed;
+  guint count = 0;
+  guint i;
+
+  g_signal_connect (test->client, "message", G_CALLBACK (on_message_count), &count);
+
+  WAIT_UNTIL (web_socket_connection_get_ready_state (test->server) != WEB_SOCKET_STATE_CONNECTING);
+
+  sent = g_bytes_new_take (g_strnfill (size, 'x'), size);
+
+  cockpit_buffer_pool_get_stats (&before);
+  g_test_timer_start ();
+  for (i = 0; i < n_messages; i++)
+    web_socket_connection_send (test->server, WEB_SOCKET_DATA_TEXT, NULL, sent);
+  WAIT_UNTIL (count == n_messages);
+  elapsed = g_test_timer_elapsed ();
+  cockpit_buffer_pool_get_stats (&after);
+
+  /* Includes the blocks the receiving side reads into */
+  g_test_maximized_result (n_messages / elapsed, "%" G_GSIZE_FORMAT " byte messages: %.0f messages/s, %.1f MB/s, "
+                           "%.2f buffers per message",
+                           size, n_messages / elapsed, (size * n_messages) / elapsed / (1024 * 1024),
+                           (gdouble)(after.allocated - before.allocated) / n_messages);
+
+  g_bytes_unref (sent);
+}
+
+static void
+test_send_perf_small (Test *test,
+                      gconstpointer data)
+{
+  measure_send (test, 32, 200000);
+}
+
+static void
+test_send_perf_large (Test *test,
+                      gconstpointer data)
+{
+  measure_send (test, 60000, 5000);
+}
+
 int
 main (int argc,
       char *argv[])
@@ -1271,6 +1864,10 @@ main (int argc,
       { test_send_client_to_server, "send-client-to-server" },
       { test_send_server_to_client, "send-server-to-client" },
       { test_send_big_packets, "send-big-packets" },
+      { test_compact, "compact" },
+      { test_send_burst, "send-burst" },
+      { test_send_slow_reader, "send-slow-reader" },
+      { test_send_fragmented, "send-fragmented" },
       { test_send_prefixed, "send-prefixed" },
       { test_send_bad_data, "send-bad-data" },
       { test_pressure_queue, "pressure-queue" },
@@ -1314,6 +1911,10 @@ main (int argc,
   g_test_add_func ("/web-socket/header-equals", test_header_equals);
   g_test_add_func ("/web-socket/header-contains", test_header_contains);
   g_test_add_func ("/web-socket/header-empty", test_header_empty);
+  g_test_add_func ("/web-socket/xor-mask", test_xor_mask);
+  g_test_add_func ("/web-socket/xor-mask-roundtrip", test_xor_mask_roundtrip);
+  if (g_test_perf ())
+    g_test_add_func ("/web-socket/xor-mask/perf", test_xor_mask_perf);
 
   for (j = 0; j < G_N_ELEMENTS (tests_with_client_server_pair); j++)
     {
@@ -1326,9 +1927,22 @@ main (int argc,
   if (g_test_slow ())
     g_test_add_func ("/web-socket/close-after-timeout", test_close_after_timeout);
   g_test_add_func ("/web-socket/receive-fragmented", test_receive_fragmented);
+  g_test_add_func ("/web-socket/receive-streamed", test_receive_streamed);
+  g_test_add_data_func ("/web-socket/receive-max-message-size/over", GUINT_TO_POINTER (12),
+                        test_receive_max_message_size);
+  g_test_add_data_func ("/web-socket/receive-max-message-size/exact", GUINT_TO_POINTER (13),
+                        test_receive_max_message_size);
   g_test_add_func ("/web-socket/handshake-with-buffer-headers", test_handshake_with_buffer_and_headers);
 
   g_test_add ("/web-socket/message-after-closing", Test, NULL, setup_pair, test_message_after_closing, teardown);
 
+  if (g_test_perf ())
+    {
+      g_test_add ("/web-socket/receive-perf/small", Test, NULL, setup_pair, test_receive_perf_small, teardown);
+      g_test_add ("/web-socket/receive-perf/large", Test, NULL, setup_pair, test_receive_perf_large, teardown);
+      g_test_add ("/web-socket/send-perf/small", Test, NULL, setup_pair, test_send_perf_small, teardown);
+      g_test_add ("/web-socket/send-perf/large", Test, NULL, setup_pair, test_send_perf_large, teardown);
+    }
+
   return g_test_run ();
 }
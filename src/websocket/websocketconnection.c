@@ -22,10 +22,16 @@
 #include "websocket.h"
 #include "websocketprivate.h"
 
+#include "common/cockpitbufferpool.h"
+#include "common/cockpitcpu.h"
 #include "common/cockpitflow.h"
+#include "common/cockpitsocket.h"
+#include "common/cockpitunicode.h"
 
 #include <string.h>
 
+#include <sys/uio.h>
+
 /*
  * SECTION:websocketconnection
  * @title: WebSocketConnection
@@ -85,11 +91,15 @@ enum {
   PROP_READY_STATE,
   PROP_BUFFERED_AMOUNT,
   PROP_IO_STREAM,
+  PROP_STREAMING,
+  PROP_MAX_MESSAGE_SIZE,
+  PROP_FRAGMENT_SIZE,
 };
 
 enum {
   OPEN,
   MESSAGE,
+  FRAGMENT,
   ERROR,
   CLOSING,
   CLOSE,
@@ -98,9 +108,15 @@ enum {
 
 static guint signals[NUM_SIGNALS] = { 0, };
 
+/*
+ * The data of a queued frame holds its header and the payload. Or only
+ * the header and prefix, when the payload is sent from its own bytes.
+ */
 typedef struct {
   GBytes *data;
+  GBytes *payload;
   gboolean last;
+  gsize length;
   gsize sent;
   gsize amount;
 } Frame;
@@ -136,15 +152,25 @@ struct _WebSocketConnectionPrivate
   GPollableInputStream *input;
   GSource *input_source;
   GByteArray *incoming;
+  gsize incoming_offset;
+  gsize incoming_size;
+  gsize read_size;
 
   GPollableOutputStream *output;
   GSource *output_source;
   gsize output_queued;
+  gsize buffered_amount;
   GQueue outgoing;
+  gsize fragment_size;
 
-  /* Current message being assembled */
+  /* Current message being assembled, or streamed */
   guint8 message_opcode;
   GByteArray *message_data;
+  gsize message_size;
+
+  /* Hand out fragmented messages as they arrive */
+  gboolean streaming;
+  gsize max_message_size;
 
   /* Pressure which throttles input on this web socket */
   CockpitFlow *pressure;
@@ -153,11 +179,30 @@ struct _WebSocketConnectionPrivate
 
 #define MAX_PAYLOAD   128 * 1024
 
+/* Reads grow towards the larger size while they keep filling the buffer */
+#define MIN_READ_SIZE   (4 * 1024)
+#define MAX_READ_SIZE   (64 * 1024)
+
 /* The queue size above which we consider applying back pressure */
 #define QUEUE_PRESSURE       1UL * 1024UL * 1024UL /* 1 megabyte */
 
+/* Server payloads this large are queued by reference rather than copied */
+#define REFERENCE_MIN   1024
+
+/* Don't hog the main loop writing to a fast peer */
+#define MAX_OUTPUT_BATCH  (256 * 1024)
+
+/* Even with a tiny fragment size, each fragment carries some payload */
+#define MIN_FRAGMENT_PAYLOAD  16
+
 static void    web_socket_connection_flow_iface_init        (CockpitFlowInterface *iface);
 
+static void    queue_frame                                  (WebSocketConnection *self,
+                                                             WebSocketQueueFlags flags,
+                                                             GBytes *data,
+                                                             GBytes *payload,
+                                                             gsize amount);
+
 G_DEFINE_ABSTRACT_TYPE_WITH_CODE (WebSocketConnection, web_socket_connection, G_TYPE_OBJECT,
                                   G_IMPLEMENT_INTERFACE (COCKPIT_TYPE_FLOW, web_socket_connection_flow_iface_init));
 
@@ -168,6 +213,8 @@ frame_free (gpointer data)
   if (frame)
     {
       g_bytes_unref (frame->data);
+      if (frame->payload)
+        g_bytes_unref (frame->payload);
       g_slice_free (Frame, frame);
     }
 }
@@ -344,30 +391,153 @@ close_io_after_timeout (WebSocketConnection *self)
   g_source_attach (pv->close_timeout, pv->main_context);
 }
 
-static void
-xor_with_mask_rfc6455 (const guint8 *mask,
+/*
+ * The mask repeats every four bytes, so it's applied to whole words
+ * or vectors of the data at a time, with @pattern holding the mask
+ * already lined up with the first byte. Each of these returns how
+ * many bytes it handled, always a multiple of four.
+ */
+
+#ifdef COCKPIT_CPU_HAVE_SSE2
+
+static gsize
+xor_with_pattern_sse2 (const guint8 *pattern,
                        guint8 *data,
                        gsize len)
 {
+  const __m128i key = _mm_loadu_si128 ((const __m128i *)pattern);
+  __m128i chunk;
+  gsize n = 0;
+
+  while (n + 16 <= len)
+    {
+      chunk = _mm_loadu_si128 ((const __m128i *)(data + n));
+      _mm_storeu_si128 ((__m128i *)(data + n), _mm_xor_si128 (chunk, key));
+      n += 16;
+    }
+
+  return n;
+}
+
+#endif /* COCKPIT_CPU_HAVE_SSE2 */
+
+#ifdef COCKPIT_CPU_HAVE_AVX2
+
+__attribute__ ((target ("avx2")))
+static gsize
+xor_with_pattern_avx2 (const guint8 *pattern,
+                       guint8 *data,
+                       gsize len)
+{
+  const __m256i key = _mm256_loadu_si256 ((const __m256i *)pattern);
+  __m256i chunk;
+  gsize n = 0;
+
+  while (n + 32 <= len)
+    {
+      chunk = _mm256_loadu_si256 ((const __m256i *)(data + n));
+      _mm256_storeu_si256 ((__m256i *)(data + n), _mm256_xor_si256 (chunk, key));
+      n += 32;
+    }
+
+  return n;
+}
+
+#endif /* COCKPIT_CPU_HAVE_AVX2 */
+
+static gsize
+xor_with_pattern (const guint8 *pattern,
+                  guint8 *data,
+                  gsize len)
+{
+  guint64 key;
+  guint64 word;
+  gsize n = 0;
+
+#ifdef COCKPIT_CPU_HAVE_AVX2
+  if (cockpit_cpu_has_avx2 ())
+    n += xor_with_pattern_avx2 (pattern, data, len);
+#endif
+
+#ifdef COCKPIT_CPU_HAVE_SSE2
+  n += xor_with_pattern_sse2 (pattern, data + n, len - n);
+#endif
+
+  /* Data is aligned by the caller, so these are aligned accesses */
+  memcpy (&key, pattern, sizeof (key));
+  while (n + 8 <= len)
+    {
+      memcpy (&word, data + n, sizeof (word));
+      word ^= key;
+      memcpy (data + n, &word, sizeof (word));
+      n += 8;
+    }
+
+  return n;
+}
+
+/**
+ * _web_socket_xor_mask:
+ * @mask: the four byte frame mask
+ * @offset: the position in the frame payload that @data starts at
+ * @data: the data to mask or unmask in place
+ * @len: length of @data
+ *
+ * Apply an RFC 6455 frame mask. When @data doesn't start at the
+ * beginning of the payload, the mask is rotated by @offset.
+ */
+void
+_web_socket_xor_mask (const guint8 *mask,
+                      gsize offset,
+                      guint8 *data,
+                      gsize len)
+{
+  guint8 pattern[32];
+  gsize n = 0;
+  guint i;
+
   g_assert (mask != NULL);
-  g_assert (data != NULL);
+  g_assert (data != NULL || len == 0);
 
-  /* Do the masking */
-  for (gsize n = 0; n < len; n++)
-    data[n] ^= mask[n & 3];
+  /* Byte at a time until the data is aligned */
+  while (n < len && (GPOINTER_TO_SIZE (data + n) & 7) != 0)
+    {
+      data[n] ^= mask[(offset + n) & 3];
+      n++;
+    }
+
+  if (len - n >= 8)
+    {
+      for (i = 0; i < sizeof (pattern); i++)
+        pattern[i] = mask[(offset + n + i) & 3];
+      n += xor_with_pattern (pattern, data + n, len - n);
+    }
+
+  for (; n < len; n++)
+    data[n] ^= mask[(offset + n) & 3];
+}
+
+static void
+xor_with_mask_rfc6455 (const guint8 *mask,
+                       guint8 *data,
+                       gsize len)
+{
+  _web_socket_xor_mask (mask, 0, data, len);
 }
 
 static void
 send_prefixed_message_rfc6455 (WebSocketConnection *self,
                                WebSocketQueueFlags flags,
                                guint8 opcode,
+                               gboolean fin,
                                const guint8 *prefix,
                                gsize prefix_len,
                                const guint8 *payload,
-                               gsize payload_len)
+                               gsize payload_len,
+                               GBytes *message)
 {
+  GBytes *reference = NULL;
   gsize amount;
-  GByteArray *bytes;
   gsize frame_len;
   guint8 *outer;
   guint8 *mask = 0;
@@ -378,10 +548,6 @@ send_prefixed_message_rfc6455 (WebSocketConnection *self,
   len = payload_len + prefix_len;
   amount = len;
 
-  bytes = g_byte_array_sized_new (14 + len);
-  outer = bytes->data;
-  outer[0] = 0x80 | opcode;
-
   /* If control message, truncate payload */
   if (opcode & 0x08)
     {
@@ -398,18 +564,32 @@ send_prefixed_message_rfc6455 (WebSocketConnection *self,
       amount = 0;
     }
 
+  /*
+   * Unmasked payloads don't need to be copied, they're sent straight
+   * from the caller's bytes after the header and prefix. Small ones are
+   * still copied, so they don't pin a larger buffer they're a slice of.
+   */
+  if (!(opcode & 0x08) && message && self->pv->server_side && payload_len >= REFERENCE_MIN)
+    {
+      g_assert (g_bytes_get_size (message) == payload_len);
+      reference = g_bytes_ref (message);
+    }
+
+  outer = cockpit_buffer_pool_alloc (14 + (reference ? prefix_len : len));
+  outer[0] = (fin ? 0x80 : 0x00) | opcode;
+
   size = len;
   if (size < 126)
     {
       outer[1] = (0xFF & size); /* mask | 7-bit-len */
-      bytes->len = 2;
+      frame_len = 2;
     }
   else if (size < 65536)
     {
       outer[1] = 126; /* mask | 16-bit-len */
       outer[2] = (size >> 8) & 0xFF;
       outer[3] = (size >> 0) & 0xFF;
-      bytes->len = 4;
+      frame_len = 4;
     }
   else
     {
@@ -422,7 +602,7 @@ send_prefixed_message_rfc6455 (WebSocketConnection *self,
       outer[7] = (size >> 16) & 0xFF;
       outer[8] = (size >> 8) & 0xFF;
       outer[9] = (size >> 0) & 0xFF;
-      bytes->len = 10;
+      frame_len = 10;
     }
 
   /*
@@ -434,22 +614,28 @@ send_prefixed_message_rfc6455 (WebSocketConnection *self,
     {
       guint32 rand = g_random_int ();
       outer[1] |= 0x80;
-      mask = outer + bytes->len;
+      mask = outer + frame_len;
       memcpy (mask, &rand, sizeof (guint32));
-      bytes->len += 4;
+      frame_len += 4;
     }
 
-  at = bytes->data + bytes->len;
-  g_byte_array_append (bytes, prefix, prefix_len);
-  g_byte_array_append (bytes, payload, payload_len);
+  at = outer + frame_len;
+  if (prefix_len)
+    memcpy (at, prefix, prefix_len);
+  frame_len += prefix_len;
+
+  if (!reference)
+    {
+      if (payload_len)
+        memcpy (at + prefix_len, payload, payload_len);
+      frame_len += payload_len;
+    }
 
   if (is_client_side)
     xor_with_mask_rfc6455 (mask, at, len);
 
-  frame_len = bytes->len;
-  _web_socket_connection_queue (self, flags, g_byte_array_free (bytes, FALSE),
-                                frame_len, amount);
-  g_debug ("queued rfc6455 %d frame of len %u", (gint)opcode, (guint)frame_len);
+  queue_frame (self, flags, cockpit_buffer_pool_take_bytes (outer, frame_len), reference, amount);
+  g_debug ("queued rfc6455 %d frame of len %u", (gint)opcode, (guint)(frame_len + (reference ? payload_len : 0)));
 }
 
 static void
@@ -459,7 +645,65 @@ send_message_rfc6455 (WebSocketConnection *self,
                       const guint8 *payload,
                       gsize payload_len)
 {
-  return send_prefixed_message_rfc6455 (self, flags, opcode, NULL, 0, payload, payload_len);
+  return send_prefixed_message_rfc6455 (self, flags, opcode, TRUE, NULL, 0, payload, payload_len, NULL);
+}
+
+/*
+ * Split a large message into frames of at most fragment_size. Only control
+ * frames may go between them, but that's enough for a pong or a close not
+ * to wait behind a huge message on a slow link.
+ */
+static void
+send_fragmented_message_rfc6455 (WebSocketConnection *self,
+                                 guint8 opcode,
+                                 const guint8 *prefix,
+                                 gsize prefix_len,
+                                 GBytes *message)
+{
+  const guint8 *payload;
+  gsize payload_len;
+  gsize offset = 0;
+  gsize room;
+  gsize len;
+  gsize back;
+  gboolean fin;
+  GBytes *piece;
+
+  payload = g_bytes_get_data (message, &payload_len);
+
+  do
+    {
+      /* The prefix goes in the first fragment */
+      if (self->pv->fragment_size > prefix_len + MIN_FRAGMENT_PAYLOAD)
+        room = self->pv->fragment_size - prefix_len;
+      else
+        room = MIN_FRAGMENT_PAYLOAD;
+
+      len = MIN (room, payload_len - offset);
+
+      /* Don't split a UTF-8 character between text fragments */
+      if (opcode == 0x01 && offset + len < payload_len)
+        {
+          for (back = 0; back < 3 && back < len; back++)
+            {
+              if ((payload[offset + len - back] & 0xC0) != 0x80)
+                break;
+            }
+          if (back < len)
+            len -= back;
+        }
+
+      fin = (offset + len == payload_len);
+      piece = g_bytes_new_from_bytes (message, offset, len);
+      send_prefixed_message_rfc6455 (self, WEB_SOCKET_QUEUE_NORMAL, offset == 0 ? opcode : 0x00, fin,
+                                     prefix, prefix_len, payload + offset, len, piece);
+      g_bytes_unref (piece);
+
+      offset += len;
+      prefix = NULL;
+      prefix_len = 0;
+    }
+  while (!fin);
 }
 
 static void
@@ -599,15 +843,16 @@ bad_data_error_and_close (WebSocketConnection *self)
 
 static void
 too_big_error_and_close (WebSocketConnection *self,
-                         gsize payload_len)
+                         gsize payload_len,
+                         gsize limit)
 {
   GError *error = g_error_new_literal (WEB_SOCKET_ERROR,
                                        WEB_SOCKET_CLOSE_TOO_BIG,
                                        self->pv->server_side ?
                                            "Received extremely large WebSocket data from the server" :
                                            "Received extremely large WebSocket data from the client");
-  g_message ("%s is trying to frame of size %" G_GSIZE_FORMAT " or greater, but max supported size is 128KiB",
-             self->pv->server_side ? "server" : "client", payload_len);
+  g_message ("%s is trying to send data of size %" G_GSIZE_FORMAT " or greater, but max supported size is %" G_GSIZE_FORMAT,
+             self->pv->server_side ? "server" : "client", payload_len, limit);
   _web_socket_connection_error_and_close (self, error, TRUE);
 
   /* The input is in an invalid state now */
@@ -683,6 +928,18 @@ receive_ping_rfc6455 (WebSocketConnection *self,
   send_message_rfc6455 (self, WEB_SOCKET_QUEUE_URGENT, 0x0A, data, len);
 }
 
+static void
+discard_message (WebSocketConnection *self)
+{
+  WebSocketConnectionPrivate *pv = self->pv;
+
+  if (pv->message_data)
+    g_byte_array_unref (pv->message_data);
+  pv->message_data = NULL;
+  pv->message_opcode = 0;
+  pv->message_size = 0;
+}
+
 static void
 process_contents_rfc6455 (WebSocketConnection *self,
                           gboolean control,
@@ -733,7 +990,7 @@ process_contents_rfc6455 (WebSocketConnection *self,
       /* Initial fragment of a message */
       if (!fin && opcode)
         {
-          if (pv->message_data)
+          if (pv->message_opcode)
             {
               g_message ("received out of order initial message fragment");
               protocol_error_and_close (self);
@@ -745,7 +1002,7 @@ process_contents_rfc6455 (WebSocketConnection *self,
       /* Middle fragment of a message */
       else if (!fin && !opcode)
         {
-          if (!pv->message_data)
+          if (!pv->message_opcode)
             {
               g_message ("received out of order middle message fragment");
               protocol_error_and_close (self);
@@ -757,7 +1014,7 @@ process_contents_rfc6455 (WebSocketConnection *self,
       /* Last fragment of a message */
       else if (fin && !opcode)
         {
-          if (!pv->message_data)
+          if (!pv->message_opcode)
             {
               g_message ("received out of order ending message fragment");
               protocol_error_and_close (self);
@@ -770,7 +1027,7 @@ process_contents_rfc6455 (WebSocketConnection *self,
       else
         {
           g_assert (opcode != 0);
-          if (pv->message_data)
+          if (pv->message_opcode)
             {
               g_message ("received unfragmented message when fragment was expected");
               protocol_error_and_close (self);
@@ -782,46 +1039,92 @@ process_contents_rfc6455 (WebSocketConnection *self,
       if (opcode)
         {
           pv->message_opcode = opcode;
-          pv->message_data = g_byte_array_sized_new (payload_len);
+          pv->message_size = 0;
+
+          /*
+           * Unfragmented messages are copied straight from the frame below,
+           * and streamed ones are handed out a fragment at a time.
+           */
+          if (!fin && !pv->streaming)
+            pv->message_data = g_byte_array_sized_new (payload_len);
+        }
+
+      /* The whole message counts, whether assembled or streamed */
+      if (pv->max_message_size && payload_len > pv->max_message_size - pv->message_size)
+        {
+          payload_len += pv->message_size;
+          discard_message (self);
+          too_big_error_and_close (self, payload_len, pv->max_message_size);
+          return;
         }
+      pv->message_size += payload_len;
 
       switch (pv->message_opcode)
         {
         case 0x01:
-          if (!g_utf8_validate ((gchar *)payload, payload_len, NULL))
+          if (!cockpit_unicode_validate (payload, payload_len, NULL))
             {
               g_message ("received invalid non-UTF8 text data");
 
               /* Discard the entire message */
-              g_byte_array_unref (pv->message_data);
-              pv->message_data = NULL;
-              pv->message_opcode = 0;
-
+              discard_message (self);
               bad_data_error_and_close (self);
               return;
             }
           /* fall through */
         case 0x02:
-          g_byte_array_append (pv->message_data, payload, payload_len);
+          if (pv->message_data)
+            g_byte_array_append (pv->message_data, payload, payload_len);
           break;
         default:
           g_debug ("received unknown data frame: %d", (gint)opcode);
           break;
         }
 
-      /* Actually deliver the message? */
-      if (fin)
+      /* A fragment of a streamed message */
+      if (!pv->message_data && !(fin && opcode))
         {
-          /* Always null terminate, as a convenience */
-          g_byte_array_append (pv->message_data, (guchar *)"\0", 1);
+          opcode = pv->message_opcode;
+          if (fin)
+            {
+              pv->message_opcode = 0;
+              pv->message_size = 0;
+            }
 
-          /* But don't include the null terminator in the byte count */
-          pv->message_data->len--;
+          if (opcode != 0x01 && opcode != 0x02)
+            payload_len = 0;
+          message = cockpit_buffer_pool_copy_bytes (payload, payload_len);
+          g_debug ("message: delivering %s fragment %d with %d length",
+                   fin ? "last" : "next", (int)opcode, (int)payload_len);
+          g_signal_emit (self, signals[FRAGMENT], 0, (int)opcode, message, fin);
+          g_bytes_unref (message);
+        }
 
+      /* Actually deliver the message? */
+      else if (fin)
+        {
           opcode = pv->message_opcode;
-          message = g_byte_array_free_to_bytes (pv->message_data);
+          if (pv->message_data)
+            {
+              /* Always null terminate, as a convenience */
+              g_byte_array_append (pv->message_data, (guchar *)"\0", 1);
+
+              /* But don't include the null terminator in the byte count */
+              pv->message_data->len--;
+
+              message = g_byte_array_free_to_bytes (pv->message_data);
+            }
+          else
+            {
+              /* Null terminated too, and unknown opcodes carry no data */
+              if (opcode != 0x01 && opcode != 0x02)
+                payload_len = 0;
+              message = cockpit_buffer_pool_copy_bytes (payload, payload_len);
+            }
+
           pv->message_data = NULL;
           pv->message_opcode = 0;
+          pv->message_size = 0;
           g_debug ("message: delivering %d with %d length",
                    (int)opcode, (int)g_bytes_get_size (message));
           g_signal_emit (self, signals[MESSAGE], 0, (int)opcode, message);
@@ -844,11 +1147,13 @@ process_frame_rfc6455 (WebSocketConnection *self)
   gsize len;
   gsize at;
 
-  len = self->pv->incoming->len;
+  /* Frames already processed are skipped, rather than removed one by one */
+  g_assert (self->pv->incoming_offset <= self->pv->incoming->len);
+  len = self->pv->incoming->len - self->pv->incoming_offset;
   if (len < 2)
     return FALSE; /* need more data */
 
-  header = self->pv->incoming->data;
+  header = self->pv->incoming->data + self->pv->incoming_offset;
   fin = ((header[0] & 0x80) != 0);
   control = header[0] & 0x08;
   opcode = header[0] & 0x0f;
@@ -885,7 +1190,7 @@ process_frame_rfc6455 (WebSocketConnection *self)
   /* Safety valve */
   if (payload_len >= MAX_PAYLOAD)
     {
-      too_big_error_and_close (self, payload_len);
+      too_big_error_and_close (self, payload_len, MAX_PAYLOAD);
       return FALSE;
     }
 
@@ -913,7 +1218,7 @@ process_frame_rfc6455 (WebSocketConnection *self)
   process_contents_rfc6455 (self, control, fin, opcode, payload, payload_len);
 
   /* Move past the parsed frame */
-  g_byte_array_remove_range (self->pv->incoming, 0, at + payload_len);
+  self->pv->incoming_offset += at + payload_len;
   return TRUE;
 }
 
@@ -943,6 +1248,13 @@ process_incoming (WebSocketConnection *self)
           more = process_frame_rfc6455 (self);
         }
       while (more);
+
+      /* Only the start of an incomplete frame is ever moved */
+      if (pv->incoming_offset > 0)
+        {
+          g_byte_array_remove_range (pv->incoming, 0, pv->incoming_offset);
+          pv->incoming_offset = 0;
+        }
     }
 }
 
@@ -960,11 +1272,12 @@ on_web_socket_input (GObject *pollable_stream,
   do
     {
       len = pv->incoming->len;
-      g_byte_array_set_size (pv->incoming, len + 1024);
+      g_byte_array_set_size (pv->incoming, len + pv->read_size);
+      pv->incoming_size = MAX (pv->incoming_size, pv->incoming->len);
 
       count = g_pollable_input_stream_read_nonblocking (pv->input,
                                                         pv->incoming->data + len,
-                                                        1024, NULL, &error);
+                                                        pv->read_size, NULL, &error);
 
       if (count < 0)
         {
@@ -985,6 +1298,12 @@ on_web_socket_input (GObject *pollable_stream,
         }
 
       pv->incoming->len = len + count;
+
+      /* Larger reads while the peer is sending a lot, smaller when it calms down */
+      if ((gsize)count == pv->read_size && pv->read_size < MAX_READ_SIZE)
+        pv->read_size *= 2;
+      else if (count > 0 && (gsize)count < pv->read_size / 4 && pv->read_size > MIN_READ_SIZE)
+        pv->read_size /= 2;
     }
   while (count > 0);
 
@@ -1019,63 +1338,103 @@ start_input (WebSocketConnection *self)
   g_source_attach (pv->input_source, pv->main_context);
 }
 
-static gboolean
-on_web_socket_output (GObject *pollable_stream,
-                      gpointer user_data)
+/* The contiguous piece of @frame at @offset, either header or payload */
+static const guint8 *
+frame_chunk (Frame *frame,
+             gsize offset,
+             gsize *len)
 {
-  WebSocketConnection *self = WEB_SOCKET_CONNECTION (user_data);
-  WebSocketConnectionPrivate *pv = self->pv;
   const guint8 *data;
-  GError *error = NULL;
-  gsize before;
-  Frame *frame;
-  gssize count;
-  gsize len;
-
-  frame = g_queue_peek_head (&pv->outgoing);
+  gsize size;
 
-  /* No more frames to send */
-  if (frame == NULL)
+  data = g_bytes_get_data (frame->data, &size);
+  if (offset < size)
     {
-      stop_output (self);
-      return TRUE;
+      *len = size - offset;
+      return data + offset;
     }
 
-  data = g_bytes_get_data (frame->data, &len);
-  g_assert (len > 0);
-  g_assert (len > frame->sent);
+  g_assert (frame->payload != NULL);
+  offset -= size;
+  data = g_bytes_get_data (frame->payload, &size);
+  g_assert (offset < size);
+  *len = size - offset;
+  return data + offset;
+}
 
-  count = g_pollable_output_stream_write_nonblocking (pv->output,
-                                                      data + frame->sent,
-                                                      len - frame->sent,
-                                                      NULL, &error);
+/* Fill in vectors for the head of the queue, from where it was sent up to */
+static guint
+build_vectors (WebSocketConnectionPrivate *pv,
+               struct iovec *iov,
+               gsize *total)
+{
+  const guint8 *chunk;
+  gsize chunk_len;
+  gsize offset;
+  guint n_iov = 0;
+  Frame *frame;
+  GList *l;
 
-  if (count < 0)
+  *total = 0;
+  for (l = pv->outgoing.head; l != NULL; l = g_list_next (l))
     {
-      if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
-        {
-          g_clear_error (&error);
-          count = 0;
-        }
-      else
+      frame = l->data;
+      for (offset = frame->sent; offset < frame->length; offset += chunk_len)
         {
-          _web_socket_connection_error_and_close (self, error, TRUE);
-          return FALSE;
+          if (n_iov == COCKPIT_SOCKET_OUTPUT_VECTORS)
+            return n_iov;
+          chunk = frame_chunk (frame, offset, &chunk_len);
+          iov[n_iov].iov_base = (guint8 *)chunk;
+          iov[n_iov].iov_len = chunk_len;
+          n_iov++;
+          *total += chunk_len;
         }
+
+      /* Nothing goes out after the closing frame */
+      if (frame->last)
+        break;
     }
 
-  before = pv->output_queued;
+  return n_iov;
+}
 
-  frame->sent += count;
-  if (frame->sent >= len)
+/*
+ * Account for @count bytes written from the head of the queue, adding
+ * the buffered amount of completed frames to @amount. Returns FALSE if
+ * the last frame was sent and the stream is being closed.
+ */
+static gboolean
+complete_output (WebSocketConnection *self,
+                 gsize count,
+                 gsize *amount)
+{
+  WebSocketConnectionPrivate *pv = self->pv;
+  Frame *frame;
+  gsize n;
+
+  while (count > 0)
     {
+      frame = g_queue_peek_head (&pv->outgoing);
+      g_assert (frame != NULL);
+
+      n = MIN (count, frame->length - frame->sent);
+      frame->sent += n;
+      count -= n;
+
+      if (frame->sent < frame->length)
+        break;
+
       g_debug ("sent frame");
       g_queue_pop_head (&pv->outgoing);
-      g_assert (len <= pv->output_queued);
-      pv->output_queued -= len;
+      g_assert (frame->length <= pv->output_queued);
+      pv->output_queued -= frame->length;
+      g_assert (frame->amount <= pv->buffered_amount);
+      pv->buffered_amount -= frame->amount;
+      *amount += frame->amount;
 
       if (frame->last)
         {
+          frame_free (frame);
           if (pv->server_side)
             {
               close_io_stream (self);
@@ -1085,10 +1444,70 @@ on_web_socket_output (GObject *pollable_stream,
               shutdown_wr_io_stream (self);
               close_io_after_timeout (self);
             }
+          return FALSE;
         }
+
       frame_free (frame);
     }
 
+  return TRUE;
+}
+
+static gboolean
+on_web_socket_output (GObject *pollable_stream,
+                      gpointer user_data)
+{
+  WebSocketConnection *self = WEB_SOCKET_CONNECTION (user_data);
+  WebSocketConnectionPrivate *pv = self->pv;
+  struct iovec iov[COCKPIT_SOCKET_OUTPUT_VECTORS];
+  GError *error = NULL;
+  gsize written = 0;
+  gsize amount = 0;
+  gsize before;
+  gssize count;
+  guint n_iov;
+  gsize len;
+
+  before = pv->output_queued;
+
+  /* Keep writing until the peer can't take any more */
+  while (written < MAX_OUTPUT_BATCH)
+    {
+      /* No more frames to send */
+      if (g_queue_is_empty (&pv->outgoing))
+        {
+          stop_output (self);
+          break;
+        }
+
+      n_iov = build_vectors (pv, iov, &len);
+      g_assert (len > 0);
+
+      count = cockpit_socket_write_vectors (pv->io_stream, pv->output, iov, n_iov, &error);
+
+      if (count < 0)
+        {
+          if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+            {
+              g_clear_error (&error);
+              count = 0;
+            }
+          else
+            {
+              _web_socket_connection_error_and_close (self, error, TRUE);
+              return FALSE;
+            }
+        }
+
+      written += count;
+      if (!complete_output (self, count, &amount) || (gsize)count < len)
+        break;
+    }
+
+  /* Let senders that pace themselves know there's room */
+  if (amount > 0)
+    g_object_notify (G_OBJECT (self), "buffered-amount");
+
   /*
    * If we're controlling another flow, turn off back pressure when
    * our output buffer size becomes less than the low mark.
@@ -1119,19 +1538,51 @@ _web_socket_connection_queue (WebSocketConnection *self,
                               gpointer data,
                               gsize len,
                               gsize amount)
+{
+  g_return_if_fail (data != NULL);
+  g_return_if_fail (len > 0);
+
+  _web_socket_connection_queue_bytes (self, flags, g_bytes_new_take (data, len), amount);
+}
+
+void
+_web_socket_connection_queue_bytes (WebSocketConnection *self,
+                                    WebSocketQueueFlags flags,
+                                    GBytes *data,
+                                    gsize amount)
+{
+  queue_frame (self, flags, data, NULL, amount);
+}
+
+static void
+queue_frame (WebSocketConnection *self,
+             WebSocketQueueFlags flags,
+             GBytes *data,
+             GBytes *payload,
+             gsize amount)
 {
   WebSocketConnectionPrivate *pv = self->pv;
   gsize before;
+  gsize len;
   Frame *frame;
   Frame *prev;
 
   g_return_if_fail (WEB_SOCKET_IS_CONNECTION (self));
   g_return_if_fail (pv->close_sent == FALSE);
   g_return_if_fail (data != NULL);
+
+  len = g_bytes_get_size (data);
   g_return_if_fail (len > 0);
+  if (payload)
+    {
+      g_return_if_fail (G_MAXSIZE - len > g_bytes_get_size (payload));
+      len += g_bytes_get_size (payload);
+    }
 
   frame = g_slice_new0 (Frame);
-  frame->data = g_bytes_new_take (data, len);
+  frame->data = data;
+  frame->payload = payload;
+  frame->length = len;
   frame->amount = amount;
   frame->last = (flags & WEB_SOCKET_QUEUE_LAST) ? TRUE : FALSE;
 
@@ -1163,6 +1614,7 @@ _web_socket_connection_queue (WebSocketConnection *self,
   before = pv->output_queued;
   g_return_if_fail (G_MAXSIZE - len > pv->output_queued);
   pv->output_queued += len;
+  pv->buffered_amount += amount;
 
   /*
    * If we have two much data queued, and are controlling another flow
@@ -1272,7 +1724,9 @@ web_socket_connection_constructed (GObject *object)
   pv->server_side = klass->server_behavior;
 
   if (!pv->incoming)
-    pv->incoming = g_byte_array_sized_new (1024);
+    pv->incoming = g_byte_array_sized_new (MIN_READ_SIZE);
+  pv->incoming_size = MAX (pv->incoming->len, MIN_READ_SIZE);
+  pv->read_size = MIN_READ_SIZE;
 }
 
 static void
@@ -1305,6 +1759,18 @@ web_socket_connection_get_property (GObject *object,
       g_value_set_object (value, web_socket_connection_get_io_stream (self));
       break;
 
+    case PROP_STREAMING:
+      g_value_set_boolean (value, self->pv->streaming);
+      break;
+
+    case PROP_MAX_MESSAGE_SIZE:
+      g_value_set_ulong (value, self->pv->max_message_size);
+      break;
+
+    case PROP_FRAGMENT_SIZE:
+      g_value_set_ulong (value, self->pv->fragment_size);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -1335,6 +1801,18 @@ web_socket_connection_set_property (GObject *object,
         _web_socket_connection_take_io_stream (self, io_stream);
       break;
 
+    case PROP_STREAMING:
+      pv->streaming = g_value_get_boolean (value);
+      break;
+
+    case PROP_MAX_MESSAGE_SIZE:
+      pv->max_message_size = g_value_get_ulong (value);
+      break;
+
+    case PROP_FRAGMENT_SIZE:
+      pv->fragment_size = g_value_get_ulong (value);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -1372,6 +1850,7 @@ web_socket_connection_finalize (GObject *object)
   while (!g_queue_is_empty (&pv->outgoing))
     frame_free (g_queue_pop_head (&pv->outgoing));
   pv->output_queued = 0;
+  pv->buffered_amount = 0;
 
   g_clear_object (&pv->io_stream);
   g_assert (!pv->input_source);
@@ -1461,6 +1940,47 @@ web_socket_connection_class_init (WebSocketConnectionClass *klass)
                                    g_param_spec_object ("io-stream", "IO Stream", "Underlying io stream", G_TYPE_IO_STREAM,
                                                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
 
+  /**
+   * WebSocketConnection:streaming:
+   *
+   * When set, messages which the peer splits into several frames are not
+   * assembled. Each frame is handed out as it arrives via the
+   * #WebSocketConnection::fragment signal instead. Unfragmented messages are
+   * still delivered via #WebSocketConnection::message.
+   *
+   * Changing this only affects messages that start afterwards.
+   */
+  g_object_class_install_property (gobject_class, PROP_STREAMING,
+                                   g_param_spec_boolean ("streaming", "Streaming", "Deliver message fragments as they arrive",
+                                                         FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * WebSocketConnection:max-message-size:
+   *
+   * The largest message accepted from the peer, counting all of its
+   * fragments, whether they are assembled or streamed. Larger messages
+   * close the connection with %WEB_SOCKET_CLOSE_TOO_BIG. Zero means no
+   * limit, other than the one on the size of a single frame.
+   */
+  g_object_class_install_property (gobject_class, PROP_MAX_MESSAGE_SIZE,
+                                   g_param_spec_ulong ("max-message-size", "Max message size", "Largest message accepted",
+                                                       0, G_MAXULONG, 0,
+                                                       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * WebSocketConnection:fragment-size:
+   *
+   * Messages sent that are larger than this are split into several
+   * frames of about this size, so that control frames such as pongs
+   * and the close frame don't wait until a large message has been
+   * written. Text messages are split between UTF-8 characters. Zero,
+   * the default, sends each message as a single frame.
+   */
+  g_object_class_install_property (gobject_class, PROP_FRAGMENT_SIZE,
+                                   g_param_spec_ulong ("fragment-size", "Fragment size", "Size of outgoing fragments",
+                                                       0, G_MAXULONG, 0,
+                                                       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   /**
    * WebSocketConnection::open:
    * @self: the WebSocket
@@ -1496,6 +2016,27 @@ web_socket_connection_class_init (WebSocketConnectionClass *klass)
                                    NULL, NULL, g_cclosure_marshal_generic,
                                    G_TYPE_NONE, 2, G_TYPE_INT, G_TYPE_BYTES);
 
+  /**
+   * WebSocketConnection::fragment:
+   * @self: the WebSocket
+   * @type: the type of message contents
+   * @fragment: the data in this fragment
+   * @last: whether this is the last fragment of the message
+   *
+   * Emitted for each frame of a fragmented message from the peer, when
+   * #WebSocketConnection:streaming is set. Fragments of one message are
+   * never interleaved with other messages, but if the connection closes
+   * the last fragment of a message may never arrive.
+   *
+   * Like messages, the @fragment data is always null-terminated.
+   */
+  signals[FRAGMENT] = g_signal_new ("fragment",
+                                    WEB_SOCKET_TYPE_CONNECTION,
+                                    G_SIGNAL_RUN_FIRST,
+                                    G_STRUCT_OFFSET (WebSocketConnectionClass, fragment),
+                                    NULL, NULL, g_cclosure_marshal_generic,
+                                    G_TYPE_NONE, 3, G_TYPE_INT, G_TYPE_BYTES, G_TYPE_BOOLEAN);
+
   /**
    * WebSocketConnection::error:
    * @self: the WebSocket
@@ -1623,19 +2164,63 @@ web_socket_connection_get_ready_state (WebSocketConnection *self)
 gsize
 web_socket_connection_get_buffered_amount (WebSocketConnection *self)
 {
-  gsize amount = 0;
-  Frame *frame;
-  GList *l;
+  g_return_val_if_fail (WEB_SOCKET_IS_CONNECTION (self), 0);
+  return self->pv->buffered_amount;
+}
+
+/**
+ * web_socket_connection_get_memory_size:
+ * @self: the WebSocket
+ *
+ * Get an estimate of the memory held by this WebSocket: its input
+ * buffer, any message being assembled, and queued output.
+ *
+ * Returns: the number of bytes held
+ */
+gsize
+web_socket_connection_get_memory_size (WebSocketConnection *self)
+{
+  WebSocketConnectionPrivate *pv;
+  gsize size;
 
   g_return_val_if_fail (WEB_SOCKET_IS_CONNECTION (self), 0);
 
-  for (l = self->pv->outgoing.head; l != NULL; l = g_list_next (l))
-    {
-      frame = l->data;
-      amount += frame->amount;
-    }
+  pv = self->pv;
+  size = pv->incoming_size + pv->output_queued;
+  if (pv->message_data)
+    size += pv->message_data->len;
+
+  return size;
+}
+
+/**
+ * web_socket_connection_compact:
+ * @self: the WebSocket
+ *
+ * The input buffer grows to fit the largest frames that arrive, and
+ * never shrinks by itself. Callers use this after the WebSocket has
+ * been quiet for a while, to shrink it back to its initial size.
+ */
+void
+web_socket_connection_compact (WebSocketConnection *self)
+{
+  WebSocketConnectionPrivate *pv;
+  GByteArray *incoming;
+
+  g_return_if_fail (WEB_SOCKET_IS_CONNECTION (self));
 
-  return amount;
+  pv = self->pv;
+  pv->read_size = MIN_READ_SIZE;
+
+  if (!pv->incoming || pv->incoming_size <= MIN_READ_SIZE)
+    return;
+
+  /* Holds the start of an incomplete frame at most */
+  incoming = g_byte_array_sized_new (MAX (pv->incoming->len, MIN_READ_SIZE));
+  g_byte_array_append (incoming, pv->incoming->data, pv->incoming->len);
+  g_byte_array_unref (pv->incoming);
+  pv->incoming = incoming;
+  pv->incoming_size = MAX (incoming->len, MIN_READ_SIZE);
 }
 
 /**
@@ -1739,8 +2324,8 @@ web_socket_connection_send (WebSocketConnection *self,
     {
     case WEB_SOCKET_DATA_TEXT:
       opcode = 0x01;
-      if (!g_utf8_validate (pref, prefix_len, NULL) ||
-          !g_utf8_validate (payload, payload_len, NULL))
+      if (!cockpit_unicode_validate (pref, prefix_len, NULL) ||
+          !cockpit_unicode_validate (payload, payload_len, NULL))
         {
           g_critical ("invalid non-UTF8 @data passed as text to web_socket_connection_send()");
           return;
@@ -1754,8 +2339,11 @@ web_socket_connection_send (WebSocketConnection *self,
       return;
     }
 
-  send_prefixed_message_rfc6455 (self, WEB_SOCKET_QUEUE_NORMAL, opcode,
-                                 pref, prefix_len, payload, payload_len);
+  if (self->pv->fragment_size && prefix_len + payload_len > self->pv->fragment_size)
+    send_fragmented_message_rfc6455 (self, opcode, pref, prefix_len, message);
+  else
+    send_prefixed_message_rfc6455 (self, WEB_SOCKET_QUEUE_NORMAL, opcode, TRUE,
+                                   pref, prefix_len, payload, payload_len, message);
 
   g_object_notify (G_OBJECT (self), "buffered-amount");
 }
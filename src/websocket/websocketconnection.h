@@ -61,6 +61,11 @@ struct _WebSocketConnectionClass
                              WebSocketDataType type,
                              GBytes *message);
 
+  void      (* fragment)    (WebSocketConnection *self,
+                             WebSocketDataType type,
+                             GBytes *fragment,
+                             gboolean last);
+
   gboolean  (* error)       (WebSocketConnection *self,
                              GError *error);
 
@@ -79,6 +84,10 @@ WebSocketState  web_socket_connection_get_ready_state     (WebSocketConnection *
 
 gsize           web_socket_connection_get_buffered_amount (WebSocketConnection *self);
 
+gsize           web_socket_connection_get_memory_size     (WebSocketConnection *self);
+
+void            web_socket_connection_compact             (WebSocketConnection *self);
+
 gushort         web_socket_connection_get_close_code      (WebSocketConnection *self);
 
 const gchar *   web_socket_connection_get_close_data      (WebSocketConnection *self);
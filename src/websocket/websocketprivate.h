@@ -53,6 +53,11 @@ void             _web_socket_connection_queue             (WebSocketConnection *
                                                            gsize length,
                                                            gsize buffered_amount);
 
+void             _web_socket_connection_queue_bytes       (WebSocketConnection *conn,
+                                                           WebSocketQueueFlags flags,
+                                                           GBytes *frame,
+                                                           gsize buffered_amount);
+
 GMainContext *   _web_socket_connection_get_main_context  (WebSocketConnection *self);
 
 gboolean         _web_socket_connection_error             (WebSocketConnection *self,
@@ -74,6 +79,11 @@ gboolean         _web_socket_connection_choose_protocol   (WebSocketConnection *
 
 gchar *          _web_socket_complete_accept_key_rfc6455  (const gchar *key);
 
+void             _web_socket_xor_mask                     (const guint8 *mask,
+                                                           gsize offset,
+                                                           guint8 *data,
+                                                           gsize len);
+
 G_END_DECLS
 
 #endif /* __WEB_SOCKET_PRIVATE_H__ */
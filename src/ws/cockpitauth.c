@@ -64,6 +64,7 @@ const gchar *cockpit_ws_max_startups = NULL;
 static guint max_startups = 10;
 
 static guint sig__idling = 0;
+static guint sig__conversation = 0;
 
 /* Tristate tracking whether gssapi works properly */
 static gint gssapi_available = -1;
@@ -315,6 +316,43 @@ cockpit_auth_nonce (CockpitAuth *self)
                                   (guchar *)&seed, sizeof (seed));
 }
 
+/**
+ * cockpit_auth_set_affinity:
+ * @self: the auth
+ * @index: the index of this worker process
+ * @count: the number of worker processes
+ *
+ * When several cockpit-ws processes serve the same port, only give
+ * out session cookies that cockpit_auth_affinity() routes back to
+ * this process.
+ */
+void
+cockpit_auth_set_affinity (CockpitAuth *self,
+                           guint index,
+                           guint count)
+{
+  g_return_if_fail (count == 0 || index < count);
+  self->affinity_index = index;
+  self->affinity_count = count;
+}
+
+static gchar *
+session_cookie_nonce (CockpitAuth *self)
+{
+  gchar *id;
+
+  /* On average this takes as many tries as there are workers */
+  id = cockpit_auth_nonce (self);
+  while (self->affinity_count > 1 &&
+         g_str_hash (id) % self->affinity_count != self->affinity_index)
+    {
+      g_free (id);
+      id = cockpit_auth_nonce (self);
+    }
+
+  return id;
+}
+
 static JsonObject *
 get_connection_metadata (GIOStream *io)
 {
@@ -1286,6 +1324,9 @@ cockpit_auth_class_init (CockpitAuthClass *klass)
   sig__idling = g_signal_new ("idling", COCKPIT_TYPE_AUTH, G_SIGNAL_RUN_FIRST,
                               0, NULL, NULL, NULL, G_TYPE_NONE, 0);
 
+  sig__conversation = g_signal_new ("conversation", COCKPIT_TYPE_AUTH, G_SIGNAL_RUN_FIRST,
+                                    0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_STRING);
+
   cockpit_authorize_logger (authorize_logger, 0);
 }
 
@@ -1353,6 +1394,52 @@ session_for_headers (CockpitAuth *self,
   return ret;
 }
 
+/**
+ * cockpit_auth_affinity:
+ * @path: the request path
+ * @headers: the request headers
+ * @count: the number of worker processes
+ *
+ * Find the worker process that handed out the session cookie in
+ * @headers. See cockpit_auth_set_affinity().
+ *
+ * Returns: the index of the worker, or -1 if there is no cookie
+ */
+gint
+cockpit_auth_affinity (const gchar *path,
+                       GHashTable *headers,
+                       guint count)
+{
+  const char *prefix = "v=2;k=";
+  gchar *application;
+  gchar *cookie_name;
+  gchar *cookie = NULL;
+  gchar *raw;
+  gint ret = -1;
+
+  g_return_val_if_fail (headers != NULL, -1);
+  g_return_val_if_fail (count > 0, -1);
+
+  application = cockpit_auth_parse_application (path, NULL);
+  if (!application)
+    return -1;
+
+  cookie_name = application_cookie_name (application);
+  raw = cockpit_web_server_parse_cookie (headers, cookie_name);
+  if (raw)
+    {
+      cookie = base64_decode_string (raw);
+      if (cookie && g_str_has_prefix (cookie, prefix))
+        ret = g_str_hash (cookie + strlen (prefix)) % count;
+    }
+
+  g_free (cookie);
+  g_free (raw);
+  g_free (cookie_name);
+  g_free (application);
+  return ret;
+}
+
 CockpitWebService *
 cockpit_auth_check_cookie (CockpitAuth *self,
                            const gchar *path,
@@ -1498,6 +1585,15 @@ cockpit_auth_login_async (CockpitAuth *self,
       goto out;
     }
 
+  if (cockpit_web_service_saturated ())
+    {
+      g_message ("Request dropped; sessions are buffering too much output");
+      g_simple_async_result_set_error (result, G_IO_ERROR, G_IO_ERROR_BUSY,
+                                       "Too busy, try again later");
+      g_simple_async_result_complete_in_idle (result);
+      goto out;
+    }
+
   application = cockpit_auth_parse_application (path, NULL);
 
   /* If the client sends a TLS certificate to cockpit-tls, treat this as a
@@ -1621,6 +1717,7 @@ cockpit_auth_login_finish (CockpitAuth *self,
             {
               reset_authorize_timeout (session, TRUE);
               g_hash_table_replace (self->conversations, session->conversation, cockpit_session_ref (session));
+              g_signal_emit (self, sig__conversation, 0, session->conversation);
             }
         }
     }
@@ -1631,7 +1728,7 @@ cockpit_auth_login_finish (CockpitAuth *self,
       on_web_service_idling (session->service, session);
       creds = cockpit_web_service_get_creds (session->service);
 
-      id = cockpit_auth_nonce (self);
+      id = session_cookie_nonce (self);
       session->cookie = g_strdup_printf ("v=2;k=%s", id);
       g_hash_table_insert (self->sessions, session->cookie, cockpit_session_ref (session));
       g_free (id);
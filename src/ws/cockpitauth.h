@@ -58,6 +58,8 @@ struct _CockpitAuth
   GHashTable *conversations;
 
   guint64 nonce_seed;
+  guint affinity_index;
+  guint affinity_count;
   gboolean login_loopback;
   gulong timeout_tag;
   guint startups;
@@ -77,6 +79,14 @@ CockpitAuth *   cockpit_auth_new             (gboolean login_loopback, CockpitAu
 
 gchar *         cockpit_auth_nonce           (CockpitAuth *self);
 
+void            cockpit_auth_set_affinity    (CockpitAuth *self,
+                                              guint index,
+                                              guint count);
+
+gint            cockpit_auth_affinity        (const gchar *path,
+                                              GHashTable *headers,
+                                              guint count);
+
 void            cockpit_auth_login_async     (CockpitAuth *self,
                                               const gchar *path,
                                               GIOStream *connection,
@@ -22,6 +22,7 @@
 #include "cockpitchannelresponse.h"
 
 #include "common/cockpitchannel.h"
+#include "common/cockpitcontentcache.h"
 #include "common/cockpitflow.h"
 #include "common/cockpitwebinject.h"
 #include "common/cockpitwebserver.h"
@@ -35,6 +36,19 @@ typedef struct {
   gchar *host;
 } CockpitChannelInject;
 
+static const gchar *inject_marker = "<head>";
+
+/*
+ * Pages with an injected <base> are gzipped here, once per base and
+ * language, rather than being sent uncompressed every time. The
+ * language comes from the browser, so long ones aren't cached; with
+ * keys that small the cache size bounds the memory it takes.
+ */
+#define INJECT_CACHE_SIZE (4 * 1024 * 1024)
+#define INJECT_LANGUAGE_MAX 128
+
+static CockpitContentCache *inject_cache = NULL;
+
 static void
 cockpit_channel_inject_free (gpointer data)
 {
@@ -76,21 +90,15 @@ cockpit_channel_inject_update_checksum (CockpitChannelInject *inject,
   g_hash_table_remove (headers, COCKPIT_CHECKSUM_HEADER);
 }
 
-static void
-cockpit_channel_inject_perform (CockpitChannelInject *inject,
-                                CockpitWebResponse *response,
-                                CockpitTransport *transport)
+static GBytes *
+cockpit_channel_inject_build_base (CockpitChannelInject *inject,
+                                   CockpitWebResponse *response,
+                                   gboolean *checksummed)
 {
-  static const gchar *marker = "<head>";
-  CockpitWebFilter *filter;
   CockpitCreds *creds;
   gchar *prefixed_application = NULL;
   const gchar *checksum;
   GString *str;
-  GBytes *base;
-
-  if (!inject->base_path)
-    return;
 
   str = g_string_new ("");
   creds = cockpit_web_service_get_creds (inject->service);
@@ -118,13 +126,30 @@ cockpit_channel_inject_perform (CockpitChannelInject *inject,
                        prefixed_application, inject->host, inject->base_path);
     }
 
-  base = g_string_free_to_bytes (str);
-  filter = cockpit_web_inject_new (marker, base, 1);
+  if (checksummed)
+    *checksummed = checksum != NULL;
+
+  g_free (prefixed_application);
+  return g_string_free_to_bytes (str);
+}
+
+static void
+cockpit_channel_inject_perform (CockpitChannelInject *inject,
+                                CockpitWebResponse *response,
+                                CockpitTransport *transport)
+{
+  CockpitWebFilter *filter;
+  GBytes *base;
+
+  if (!inject->base_path)
+    return;
+
+  base = cockpit_channel_inject_build_base (inject, response, NULL);
+  filter = cockpit_web_inject_new (inject_marker, base, 1);
   g_bytes_unref (base);
 
   cockpit_web_response_add_filter (response, filter);
   g_object_unref (filter);
-  g_free (prefixed_application);
 }
 
 #define COCKPIT_TYPE_CHANNEL_RESPONSE  (cockpit_channel_response_get_type ())
@@ -144,6 +169,14 @@ typedef struct {
 
   /* Set when injecting data into response */
   CockpitChannelInject *inject;
+
+  /* Set when injecting into a page that we then gzip */
+  gboolean inject_gzip;
+  gchar *language;
+  gchar *cache_key;
+  CockpitWebFilter *filter;
+  GByteArray *collected;
+  gboolean cached;
 } CockpitChannelResponse;
 
 typedef struct {
@@ -168,10 +201,129 @@ cockpit_channel_response_finalize (GObject *object)
   g_object_unref (self->response);
   g_hash_table_unref (self->headers);
   cockpit_channel_inject_free (self->inject);
+  g_free (self->language);
+  g_free (self->cache_key);
+  if (self->filter)
+    g_object_unref (self->filter);
+  if (self->collected)
+    g_byte_array_unref (self->collected);
 
   G_OBJECT_CLASS (cockpit_channel_response_parent_class)->finalize (object);
 }
 
+static gboolean
+begin_gzip_inject (CockpitChannelResponse *self,
+                   guint status,
+                   const gchar *reason)
+{
+  const gchar *content_type;
+  gboolean checksummed;
+  GBytes *base;
+  GBytes *bytes;
+
+  if (!self->inject_gzip || !self->inject->base_path || status != 200)
+    return FALSE;
+
+  /* Only pages we asked for uncompressed, and that we know how to inject into */
+  content_type = g_hash_table_lookup (self->headers, "Content-Type");
+  if (!content_type || !g_str_has_prefix (content_type, "text/html") ||
+      g_hash_table_lookup (self->headers, "Content-Encoding"))
+    return FALSE;
+
+  base = cockpit_channel_inject_build_base (self->inject, self->response, &checksummed);
+
+  /* Without a checksum the package content may change, so don't cache it */
+  if (checksummed && (!self->language || strlen (self->language) <= INJECT_LANGUAGE_MAX))
+    {
+      self->cache_key = g_strdup_printf ("%.*s\n%s", (gint)g_bytes_get_size (base),
+                                         (const gchar *)g_bytes_get_data (base, NULL),
+                                         self->language ? self->language : "");
+      if (!inject_cache)
+        inject_cache = cockpit_content_cache_new (INJECT_CACHE_SIZE);
+      bytes = cockpit_content_cache_lookup (inject_cache, self->cache_key);
+    }
+  else
+    {
+      bytes = NULL;
+    }
+
+  g_hash_table_replace (self->headers, g_strdup ("Content-Encoding"), g_strdup ("gzip"));
+  g_hash_table_replace (self->headers, g_strdup ("Vary"), g_strdup ("Accept-Encoding"));
+  cockpit_web_response_headers_full (self->response, status, reason, -1, self->headers);
+
+  if (bytes)
+    {
+      g_debug ("%s: serving cached page", self->logname);
+      if (cockpit_web_response_queue (self->response, bytes))
+        cockpit_web_response_complete (self->response);
+      g_bytes_unref (bytes);
+      self->cached = TRUE;
+    }
+  else
+    {
+      self->filter = cockpit_web_inject_new (inject_marker, base, 1);
+      self->collected = g_byte_array_new ();
+    }
+
+  g_bytes_unref (base);
+  return TRUE;
+}
+
+static void
+on_inject_output (gpointer user_data,
+                  GBytes *bytes)
+{
+  GByteArray *output = user_data;
+  gsize length;
+  gconstpointer data;
+
+  data = g_bytes_get_data (bytes, &length);
+  g_byte_array_append (output, data, length);
+}
+
+static void
+finish_gzip_inject (CockpitChannelResponse *self)
+{
+  GError *error = NULL;
+  GBytes *compressed;
+  GBytes *bytes;
+
+  bytes = g_byte_array_free_to_bytes (self->collected);
+  self->collected = NULL;
+
+  compressed = cockpit_web_response_gzip (bytes, &error);
+  g_bytes_unref (bytes);
+
+  if (!compressed)
+    {
+      g_message ("%s: couldn't compress page: %s", self->logname, error->message);
+      g_error_free (error);
+      cockpit_web_response_abort (self->response);
+      return;
+    }
+
+  if (self->cache_key)
+    cockpit_content_cache_insert (inject_cache, self->cache_key, compressed);
+
+  cockpit_web_response_queue (self->response, compressed);
+  g_bytes_unref (compressed);
+  cockpit_web_response_complete (self->response);
+}
+
+/*
+ * The cached page has been sent in full, so stop the bridge from
+ * sending it again. The channel may be freed by this.
+ */
+static gboolean
+close_if_cached (CockpitChannelResponse *self)
+{
+  if (!self->cached)
+    return FALSE;
+
+  cockpit_channel_close (COCKPIT_CHANNEL (self), NULL);
+  return TRUE;
+}
+
 static gboolean
 ensure_headers (CockpitChannelResponse *self,
                 guint status,
@@ -184,6 +336,8 @@ ensure_headers (CockpitChannelResponse *self,
       if (self->inject && self->inject->service)
         {
           cockpit_channel_inject_update_checksum (self->inject, self->headers);
+          if (begin_gzip_inject (self, status, reason))
+            return TRUE;
           cockpit_channel_inject_perform (self->inject, self->response,
                                           cockpit_channel_get_transport (COCKPIT_CHANNEL (self)));
         }
@@ -260,6 +414,8 @@ cockpit_channel_response_close (CockpitChannel *channel,
       if (state < COCKPIT_WEB_RESPONSE_COMPLETE)
         cockpit_web_response_abort (self->response);
     }
+
+  COCKPIT_CHANNEL_CLASS (cockpit_channel_response_parent_class)->close (channel, problem);
 }
 
 static void
@@ -375,13 +531,21 @@ cockpit_channel_response_recv (CockpitChannel *channel,
   /* First response payload message is meta data, then switch to actual data */
   if (self->http_stream1_prefix)
     {
-      process_httpstream1_recv (self, payload);
       self->http_stream1_prefix = FALSE;
+      process_httpstream1_recv (self, payload);
+      close_if_cached (self);
       return;
     }
 
   ensure_headers (self, 200, "OK", -1);
-  cockpit_web_response_queue (self->response, payload);
+
+  if (close_if_cached (self))
+    return;
+
+  if (self->collected)
+    cockpit_web_filter_push (self->filter, payload, on_inject_output, self->collected);
+  else
+    cockpit_web_response_queue (self->response, payload);
 }
 
 static gboolean
@@ -407,6 +571,7 @@ cockpit_channel_response_control (CockpitChannel *channel,
             {
               cockpit_web_response_error (self->response, 500, NULL, NULL);
             }
+          close_if_cached (self);
           return TRUE;
         }
     }
@@ -414,7 +579,12 @@ cockpit_channel_response_control (CockpitChannel *channel,
   if (g_str_equal (command, "done"))
     {
       ensure_headers (self, 200, "OK", 0);
-      cockpit_web_response_complete (self->response);
+      if (close_if_cached (self))
+        return TRUE;
+      if (self->collected)
+        finish_gzip_inject (self);
+      else
+        cockpit_web_response_complete (self->response);
       return TRUE;
     }
 
@@ -514,6 +684,7 @@ parse_host_and_etag (CockpitWebService *service,
                      gchar **etag)
 {
   const gchar *accept = NULL;
+  const gchar *encoding = "";
   gchar **languages = NULL;
   gboolean translatable;
   gchar *language;
@@ -546,17 +717,22 @@ parse_host_and_etag (CockpitWebService *service,
   /* Top level resources (like the /manifests) are not translatable */
   translatable = is_resource_a_package_file (path);
 
+  /* A Brotli variant is only served when accepted, and gets its own ETag */
+  accept = g_hash_table_lookup (headers, "Accept-Encoding");
+  if (cockpit_web_response_accepted_encodings (accept) & COCKPIT_WEB_ENCODING_BROTLI)
+    encoding = "-br";
+
   /* The ETag contains the language setting */
   if (translatable)
     {
       accept = g_hash_table_lookup (headers, "Accept-Language");
       languages = cockpit_web_server_parse_accept_list (accept, "C");
-      *etag = g_strdup_printf ("\"%s-%s\"", where, languages[0]);
+      *etag = g_strdup_printf ("\"%s-%s%s\"", where, languages[0], encoding);
       g_strfreev (languages);
     }
   else
     {
-      *etag = g_strdup_printf ("\"%s\"", where);
+      *etag = g_strdup_printf ("\"%s%s\"", where, encoding);
     }
 
   return TRUE;
@@ -702,6 +878,15 @@ cockpit_channel_response_serve (CockpitWebService *service,
                                        out_headers, object);
 
   self->inject = cockpit_channel_inject_new (service, injecting_base_path, host);
+
+  /* The injected page is gzipped here, if the browser takes that */
+  if (injecting_base_path &&
+      cockpit_web_response_accepted_encodings (g_hash_table_lookup (in_headers, "Accept-Encoding")) & COCKPIT_WEB_ENCODING_GZIP)
+    {
+      self->inject_gzip = TRUE;
+      self->language = g_strdup (g_hash_table_lookup (in_headers, "Accept-Language"));
+    }
+
   handled = TRUE;
 
   /* Unref when the channel closes */
@@ -780,3 +965,15 @@ cockpit_channel_response_open (CockpitWebService *service,
   /* Unref when the channel closes */
   g_signal_connect_after (self, "closed", G_CALLBACK (g_object_unref), NULL);
 }
+
+/**
+ * cockpit_channel_response_cleanup:
+ *
+ * Drop the pages cached for all sessions.
+ */
+void
+cockpit_channel_response_cleanup (void)
+{
+  cockpit_content_cache_free (inject_cache);
+  inject_cache = NULL;
+}
@@ -36,6 +36,8 @@ void             cockpit_channel_response_open        (CockpitWebService *servic
                                                        CockpitWebResponse *response,
                                                        JsonObject *open);
 
+void             cockpit_channel_response_cleanup     (void);
+
 G_END_DECLS
 
 #endif /* __COCKPIT_CHANNEL_RESPONSE_H__ */
@@ -29,6 +29,7 @@
 
 #include "common/cockpitconf.h"
 #include "common/cockpitjson.h"
+#include "common/cockpitsystem.h"
 #include "common/cockpitwebcertificate.h"
 #include "common/cockpitwebinject.h"
 
@@ -39,10 +40,13 @@
 #include <gio/gio.h>
 #include <glib/gi18n.h>
 
+#include <sys/stat.h>
 #include <string.h>
+#include <unistd.h>
 
 /* For overriding during tests */
 const gchar *cockpit_ws_shell_component = "/shell/index.html";
+guint cockpit_ws_login_check_interval = 1000;
 
 static gchar *
 locate_selfsign_ca (void)
@@ -309,6 +313,17 @@ add_page_to_environment (JsonObject *object,
   json_object_set_object_member (object, "page", page);
 }
 
+static gchar *
+current_hostname (void)
+{
+  gchar *hostname;
+
+  hostname = g_malloc0 (HOST_NAME_MAX + 1);
+  gethostname (hostname, HOST_NAME_MAX);
+  hostname[HOST_NAME_MAX] = '\0';
+  return hostname;
+}
+
 static GBytes *
 build_environment (GHashTable *os_release)
 {
@@ -343,9 +358,7 @@ build_environment (GHashTable *os_release)
 
   add_page_to_environment (object, is_cockpit_client);
 
-  hostname = g_malloc0 (HOST_NAME_MAX + 1);
-  gethostname (hostname, HOST_NAME_MAX);
-  hostname[HOST_NAME_MAX] = '\0';
+  hostname = current_hostname ();
   json_object_set_string_member (object, "hostname", hostname);
   g_free (hostname);
 
@@ -391,50 +404,358 @@ build_environment (GHashTable *os_release)
   return g_byte_array_free_to_bytes (buffer);
 }
 
+/*
+ * The rendered login page is kept around, as building it means
+ * reading os-release, the banner, the page and its translations and
+ * scanning the page for markers. Each page remembers the files it was
+ * built from, and is thrown away when any of them changes.
+ */
+
+#define LOGIN_CACHE_MAX 32
+
+typedef struct {
+  gchar *path;
+  gboolean os_release;
+  gboolean exists;
+  dev_t dev;
+  ino_t ino;
+  gint64 mtime;
+  goffset size;
+} LoginStamp;
+
+typedef struct {
+  GBytes *html;
+  GBytes *gzip;
+  GPtrArray *stamps;
+  gchar *hostname;
+  gchar *ca_path;
+  gint64 checked;
+} LoginPage;
+
 static void
-send_login_html (CockpitWebResponse *response,
-                 CockpitHandlerData *ws,
-                 const gchar *path,
-                 GHashTable *headers)
+login_stamp_free (gpointer data)
+{
+  LoginStamp *stamp = data;
+  g_free (stamp->path);
+  g_free (stamp);
+}
+
+static gboolean
+login_stamp_update (LoginStamp *stamp)
+{
+  LoginStamp previous = *stamp;
+  struct stat st;
+
+  if (stat (stamp->path, &st) < 0)
+    {
+      stamp->exists = FALSE;
+      stamp->dev = 0;
+      stamp->ino = 0;
+      stamp->mtime = 0;
+      stamp->size = 0;
+    }
+  else
+    {
+      stamp->exists = TRUE;
+      stamp->dev = st.st_dev;
+      stamp->ino = st.st_ino;
+      stamp->mtime = (gint64)st.st_mtim.tv_sec * G_GINT64_CONSTANT (1000000000) + st.st_mtim.tv_nsec;
+      stamp->size = st.st_size;
+    }
+
+  return previous.exists == stamp->exists && previous.dev == stamp->dev &&
+         previous.ino == stamp->ino && previous.mtime == stamp->mtime &&
+         previous.size == stamp->size;
+}
+
+static void
+login_page_add_stamp (LoginPage *page,
+                      const gchar *path,
+                      gboolean os_release)
+{
+  LoginStamp *stamp;
+
+  stamp = g_new0 (LoginStamp, 1);
+  stamp->path = g_strdup (path);
+  stamp->os_release = os_release;
+  login_stamp_update (stamp);
+  g_ptr_array_add (page->stamps, stamp);
+}
+
+static void
+login_page_free (gpointer data)
+{
+  LoginPage *page = data;
+  g_bytes_unref (page->html);
+  if (page->gzip)
+    g_bytes_unref (page->gzip);
+  g_ptr_array_unref (page->stamps);
+  g_free (page->hostname);
+  g_free (page->ca_path);
+  g_free (page);
+}
+
+static void
+on_inject_output (gpointer user_data,
+                  GBytes *bytes)
+{
+  GByteArray *output = user_data;
+  gsize length;
+  gconstpointer data;
+
+  data = g_bytes_get_data (bytes, &length);
+  g_byte_array_append (output, data, length);
+}
+
+static GBytes *
+inject_bytes (GBytes *input,
+              const gchar *marker,
+              GBytes *inject)
+{
+  CockpitWebFilter *filter;
+  GByteArray *output;
+
+  output = g_byte_array_sized_new (g_bytes_get_size (input) + g_bytes_get_size (inject));
+  filter = cockpit_web_inject_new (marker, inject, 1);
+  cockpit_web_filter_push (filter, input, on_inject_output, output);
+  g_object_unref (filter);
+
+  g_bytes_unref (input);
+  return g_byte_array_free_to_bytes (output);
+}
+
+static LoginPage *
+render_login_page (CockpitHandlerData *ws,
+                   const gchar *url_root,
+                   const gchar *language,
+                   GError **error)
 {
   static const gchar *marker = "<meta insert_dynamic_content_here>";
   static const gchar *po_marker = "/*insert_translations_here*/";
 
-  CockpitWebFilter *filter;
+  LoginPage *page = NULL;
   GBytes *environment;
-  GError *error = NULL;
+  GBytes *url_bytes;
+  GBytes *po_bytes;
   GBytes *bytes;
-
-  GBytes *url_bytes = NULL;
-  CockpitWebFilter *filter2 = NULL;
-  const gchar *url_root = NULL;
-  const gchar *accept = NULL;
-  gchar *content_security_policy = NULL;
-  gchar *cookie_line = NULL;
+  GError *po_error = NULL;
+  gchar *chosen = NULL;
+  gchar *po_chosen = NULL;
+  const gchar *banner;
   gchar *base;
 
-  gchar *language = NULL;
-  gchar **languages = NULL;
-  GBytes *po_bytes;
-  CockpitWebFilter *filter3 = NULL;
+  bytes = cockpit_web_response_negotiation (ws->login_html, NULL, NULL, &chosen, error);
+  if (!bytes)
+    goto out;
+
+  page = g_new0 (LoginPage, 1);
+  page->stamps = g_ptr_array_new_with_free_func (login_stamp_free);
 
+  /* Stamp everything before reading, so changes while rendering show up */
+  login_page_add_stamp (page, chosen, FALSE);
+  login_page_add_stamp (page, "/etc/os-release", TRUE);
+  login_page_add_stamp (page, "/usr/lib/os-release", TRUE);
+  banner = cockpit_conf_string ("Session", "Banner");
+  if (banner)
+    login_page_add_stamp (page, banner, FALSE);
+  page->hostname = current_hostname ();
+  page->ca_path = locate_selfsign_ca ();
+
+  /* In the same order the filters were once applied while streaming */
   environment = build_environment (ws->os_release);
-  filter = cockpit_web_inject_new (marker, environment, 1);
+  bytes = inject_bytes (bytes, marker, environment);
   g_bytes_unref (environment);
-  cockpit_web_response_add_filter (response, filter);
-  g_object_unref (filter);
 
-  url_root = cockpit_web_response_get_url_root (response);
   if (url_root)
     base = g_strdup_printf ("<base href=\"%s/\">", url_root);
   else
     base = g_strdup ("<base href=\"/\">");
-
-  url_bytes = g_bytes_new_take (base, strlen(base));
-  filter2 = cockpit_web_inject_new (marker, url_bytes, 1);
+  url_bytes = g_bytes_new_take (base, strlen (base));
+  bytes = inject_bytes (bytes, marker, url_bytes);
   g_bytes_unref (url_bytes);
-  cockpit_web_response_add_filter (response, filter2);
-  g_object_unref (filter2);
+
+  if (ws->login_po_js)
+    {
+      po_bytes = cockpit_web_response_negotiation (ws->login_po_js, NULL, language, &po_chosen, &po_error);
+      if (po_error)
+        {
+          g_message ("%s", po_error->message);
+          g_clear_error (&po_error);
+        }
+      else if (po_bytes)
+        {
+          login_page_add_stamp (page, po_chosen, FALSE);
+          bytes = inject_bytes (bytes, po_marker, po_bytes);
+          g_bytes_unref (po_bytes);
+        }
+    }
+
+  page->html = bytes;
+  page->gzip = cockpit_web_response_gzip (bytes, &po_error);
+  if (!page->gzip)
+    {
+      g_message ("couldn't compress login page: %s", po_error->message);
+      g_clear_error (&po_error);
+    }
+
+out:
+  g_free (chosen);
+  g_free (po_chosen);
+  return page;
+}
+
+static gboolean
+login_page_is_current (LoginPage *page,
+                       CockpitHandlerData *ws)
+{
+  gboolean current = TRUE;
+  gboolean reload = FALSE;
+  gchar *hostname;
+  gchar *ca_path;
+  gint64 now;
+  guint i;
+
+  now = g_get_monotonic_time ();
+  if (now - page->checked < (gint64)cockpit_ws_login_check_interval * 1000)
+    return TRUE;
+
+  for (i = 0; i < page->stamps->len; i++)
+    {
+      LoginStamp *stamp = page->stamps->pdata[i];
+      if (!login_stamp_update (stamp))
+        {
+          current = FALSE;
+          if (stamp->os_release)
+            reload = TRUE;
+        }
+    }
+
+  hostname = current_hostname ();
+  if (!g_str_equal (hostname, page->hostname))
+    current = FALSE;
+  g_free (hostname);
+
+  ca_path = locate_selfsign_ca ();
+  if (g_strcmp0 (ca_path, page->ca_path) != 0)
+    current = FALSE;
+  g_free (ca_path);
+
+  /* The branding served with the page uses this too */
+  if (reload && ws->os_release)
+    {
+      g_hash_table_unref (ws->os_release);
+      ws->os_release = cockpit_system_load_os_release ();
+    }
+
+  page->checked = now;
+  return current;
+}
+
+/**
+ * cockpit_handler_new_login_cache:
+ *
+ * Create a cache of rendered login pages to be used as the
+ * login_cache field of #CockpitHandlerData.
+ *
+ * Returns: (transfer full): the new cache
+ */
+GHashTable *
+cockpit_handler_new_login_cache (void)
+{
+  return g_hash_table_new_full (g_str_hash, g_str_equal, g_free, login_page_free);
+}
+
+static GBytes *
+lookup_login_page (CockpitHandlerData *ws,
+                   const gchar *url_root,
+                   const gchar *language,
+                   gboolean *gzip,
+                   GError **error)
+{
+  LoginPage *page = NULL;
+  GBytes *bytes;
+  gchar *key;
+
+  key = g_strdup_printf ("%s\n%s", url_root ? url_root : "", language ? language : "");
+
+  if (ws->login_cache)
+    {
+      page = g_hash_table_lookup (ws->login_cache, key);
+      if (page && !login_page_is_current (page, ws))
+        {
+          g_debug ("login page changed, rendering again");
+          g_hash_table_remove (ws->login_cache, key);
+          page = NULL;
+        }
+    }
+
+  if (!page)
+    {
+      page = render_login_page (ws, url_root, language, error);
+      if (!page)
+        {
+          g_free (key);
+          return NULL;
+        }
+
+      if (ws->login_cache)
+        {
+          /* Languages come from the client, so don't let this grow without bounds */
+          if (g_hash_table_size (ws->login_cache) >= LOGIN_CACHE_MAX)
+            g_hash_table_remove_all (ws->login_cache);
+          page->checked = g_get_monotonic_time ();
+          g_hash_table_insert (ws->login_cache, key, page);
+          key = NULL;
+        }
+    }
+
+  /* Only claim gzip when compressing the page actually worked */
+  *gzip = *gzip && page->gzip != NULL;
+  if (*gzip)
+    bytes = g_bytes_ref (page->gzip);
+  else
+    bytes = g_bytes_ref (page->html);
+
+  if (!ws->login_cache)
+    login_page_free (page);
+  g_free (key);
+  return bytes;
+}
+
+static gboolean
+accepts_gzip (GHashTable *headers)
+{
+  gboolean ret = FALSE;
+  gchar **encodings;
+  gint i;
+
+  encodings = cockpit_web_server_parse_accept_list (g_hash_table_lookup (headers, "Accept-Encoding"), NULL);
+  for (i = 0; encodings[i] != NULL; i++)
+    {
+      if (g_str_equal (encodings[i], "gzip"))
+        ret = TRUE;
+    }
+
+  g_strfreev (encodings);
+  return ret;
+}
+
+static void
+send_login_html (CockpitWebResponse *response,
+                 CockpitHandlerData *ws,
+                 const gchar *path,
+                 GHashTable *headers)
+{
+  GError *error = NULL;
+  GBytes *bytes;
+
+  const gchar *accept = NULL;
+  gchar *content_security_policy = NULL;
+  gchar *cookie_line = NULL;
+  gboolean gzip;
+
+  gchar *language = NULL;
+  gchar **languages = NULL;
 
   cockpit_web_response_set_cache_type (response, COCKPIT_WEB_RESPONSE_NO_CACHE);
 
@@ -447,23 +768,10 @@ send_login_html (CockpitWebResponse *response,
           languages = cockpit_web_server_parse_accept_list (accept, NULL);
           language = languages[0];
         }
-
-      po_bytes = cockpit_web_response_negotiation (ws->login_po_js, NULL, language, NULL, &error);
-      if (error)
-        {
-          g_message ("%s", error->message);
-          g_clear_error (&error);
-        }
-      else if (po_bytes)
-        {
-          filter3 = cockpit_web_inject_new (po_marker, po_bytes, 1);
-          g_bytes_unref (po_bytes);
-          cockpit_web_response_add_filter (response, filter3);
-          g_object_unref (filter3);
-        }
     }
 
-  bytes = cockpit_web_response_negotiation (ws->login_html, NULL, NULL, NULL, &error);
+  gzip = accepts_gzip (headers);
+  bytes = lookup_login_page (ws, cockpit_web_response_get_url_root (response), language, &gzip, &error);
   if (error)
     {
       g_message ("%s", error->message);
@@ -482,10 +790,12 @@ send_login_html (CockpitWebResponse *response,
       content_security_policy = cockpit_web_response_security_policy ("default-src 'self' 'unsafe-inline'",
                                                                       cockpit_web_response_get_origin (response));
 
-      cockpit_web_response_headers (response, 200, "OK", -1,
+      cockpit_web_response_headers (response, 200, "OK", g_bytes_get_size (bytes),
                                     "Content-Type", "text/html",
                                     "Content-Security-Policy", content_security_policy,
                                     "Set-Cookie", cookie_line,
+                                    "Vary", "Accept-Encoding",
+                                    gzip ? "Content-Encoding" : NULL, "gzip",
                                     NULL);
       if (cockpit_web_response_queue (response, bytes))
         cockpit_web_response_complete (response);
@@ -495,7 +805,10 @@ send_login_html (CockpitWebResponse *response,
 
   g_free (cookie_line);
   g_free (content_security_policy);
-  g_strfreev (languages);
+  if (languages)
+    g_strfreev (languages);
+  else
+    g_free (language);
 }
 
 static void
@@ -545,6 +858,9 @@ on_login_complete (GObject *object,
         }
       else
         {
+          /* Refused while saturated, the client can come back shortly */
+          if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_BUSY))
+            g_hash_table_insert (headers, g_strdup ("Retry-After"), g_strdup ("10"));
           cockpit_web_response_gerror (response, headers, error);
         }
       g_error_free (error);
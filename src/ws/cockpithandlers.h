@@ -27,14 +27,19 @@
 
 extern const gchar *cockpit_ws_shell_component;
 
+extern guint cockpit_ws_login_check_interval;
+
 typedef struct {
   CockpitAuth *auth;
   const gchar *login_html;
   const gchar *login_po_js;
   const gchar **branding_roots;
   GHashTable *os_release;
+  GHashTable *login_cache;
 } CockpitHandlerData;
 
+GHashTable *   cockpit_handler_new_login_cache   (void);
+
 gboolean       cockpit_handler_socket            (CockpitWebServer *server,
                                                   const gchar *original_path,
                                                   const gchar *path,
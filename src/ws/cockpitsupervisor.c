@@ -0,0 +1,1016 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpitsupervisor.h"
+
+#include "common/cockpitauthorize.h"
+#include "common/cockpitfdpassing.h"
+#include "common/cockpithttpparser.h"
+
+#include <glib-unix.h>
+
+#include <sys/socket.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * CockpitSupervisor:
+ *
+ * Spreads the connections to cockpit-ws over several worker processes.
+ *
+ * The supervisor owns the listening sockets. It reads the start of each
+ * request until it has the headers, and then passes the connection and
+ * what it read to a worker over a unix socket. A request with a session
+ * cookie goes to the worker that made the cookie: each worker only hands
+ * out cookies that hash to its own index. Login conversations go to the
+ * worker that started them, which tells the supervisor about them. Any
+ * other request goes to the next worker in turn.
+ *
+ * Workers are started when the first request for them arrives, and say
+ * so when they have no sessions and no connections left. The supervisor
+ * then closes their socket and they exit. They are started again as
+ * needed.
+ *
+ * The supervisor never blocks on a busy worker: connections it can't pass
+ * on right away wait in a queue for that worker.
+ */
+
+/* Enough to trip the request size limit of the worker's web server */
+#define DISPATCH_MAXIMUM (cockpit_webserver_request_maximum * 2 + 1)
+
+/* How often a worker without sessions offers to exit */
+#define WORKER_IDLE_INTERVAL 10
+
+typedef struct {
+  CockpitSupervisor *supervisor;
+  guint index;
+  gint control;
+  guint watch;
+  GSubprocess *process;
+  guint64 sent;
+  gboolean retired;
+  GQueue queue;
+  guint out_watch;
+} Worker;
+
+typedef struct {
+  CockpitSupervisor *supervisor;
+  GSocketConnection *connection;
+  GSource *source;
+  GSource *timeout;
+  GByteArray *buffer;
+  CockpitHttpParser parser;
+} Pending;
+
+typedef struct {
+  guint index;
+  gint64 expires;
+} Conversation;
+
+struct _CockpitSupervisor {
+  gchar **argv;
+  guint n_workers;
+  Worker **workers;
+  guint next;
+  GHashTable *running;
+  GHashTable *pending;
+  GHashTable *conversations;
+  GSocketService *service;
+  GCancellable *cancellable;
+  GMainLoop *quit_loop;
+};
+
+static void
+worker_free (gpointer data)
+{
+  Worker *worker = data;
+  g_clear_object (&worker->process);
+  g_free (worker);
+}
+
+static void
+pending_free (gpointer data)
+{
+  Pending *pending = data;
+  if (pending->source)
+    {
+      g_source_destroy (pending->source);
+      g_source_unref (pending->source);
+    }
+  if (pending->timeout)
+    {
+      g_source_destroy (pending->timeout);
+      g_source_unref (pending->timeout);
+    }
+  g_byte_array_unref (pending->buffer);
+  cockpit_http_parser_clear (&pending->parser);
+
+  /* The worker has its own copy of the socket */
+  g_io_stream_close (G_IO_STREAM (pending->connection), NULL, NULL);
+  g_object_unref (pending->connection);
+  g_free (pending);
+}
+
+static void
+maybe_quit (CockpitSupervisor *self)
+{
+  if (self->quit_loop &&
+      g_hash_table_size (self->running) == 0 &&
+      g_hash_table_size (self->pending) == 0)
+    {
+      g_debug ("no workers left, quitting");
+      g_main_loop_quit (self->quit_loop);
+    }
+}
+
+static gboolean
+remove_conversation_of (gpointer key,
+                        gpointer value,
+                        gpointer user_data)
+{
+  Conversation *conversation = value;
+  return conversation->index == GPOINTER_TO_UINT (user_data);
+}
+
+static void
+retire_worker (Worker *worker)
+{
+  CockpitSupervisor *self = worker->supervisor;
+  Pending *pending;
+
+  if (worker->retired)
+    return;
+  worker->retired = TRUE;
+
+  if (worker->watch)
+    {
+      g_source_remove (worker->watch);
+      worker->watch = 0;
+    }
+
+  if (worker->out_watch)
+    {
+      g_source_remove (worker->out_watch);
+      worker->out_watch = 0;
+    }
+
+  /* Connections that never made it to the worker are dropped */
+  while ((pending = g_queue_pop_head (&worker->queue)))
+    pending_free (pending);
+
+  /* The worker sees this as the end of its work, and exits */
+  if (worker->control >= 0)
+    {
+      close (worker->control);
+      worker->control = -1;
+    }
+
+  if (self)
+    {
+      if (self->workers[worker->index] == worker)
+        self->workers[worker->index] = NULL;
+      g_hash_table_foreach_remove (self->conversations, remove_conversation_of,
+                                   GUINT_TO_POINTER (worker->index));
+    }
+}
+
+static void
+add_conversation (CockpitSupervisor *self,
+                  const gchar *id,
+                  guint index)
+{
+  GHashTableIter iter;
+  Conversation *conversation;
+  gint64 now;
+
+  now = g_get_monotonic_time ();
+
+  /* Forget about logins that have certainly timed out by now */
+  if (g_hash_table_size (self->conversations) > 64)
+    {
+      g_hash_table_iter_init (&iter, self->conversations);
+      while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&conversation))
+        {
+          if (conversation->expires < now)
+            g_hash_table_iter_remove (&iter);
+        }
+    }
+
+  conversation = g_new0 (Conversation, 1);
+  conversation->index = index;
+  conversation->expires = now + MAX_AUTH_TIMEOUT * G_TIME_SPAN_SECOND;
+  g_hash_table_replace (self->conversations, g_strdup (id), conversation);
+}
+
+/*
+ * Returns 1 when a message was handled, 0 when there's nothing to read,
+ * or -1 when the worker went away.
+ */
+static gint
+receive_from_worker (Worker *worker)
+{
+  gchar message[1024];
+  guint64 count;
+  gssize len;
+
+  do
+    len = recv (worker->control, message, sizeof (message) - 1, MSG_DONTWAIT);
+  while (len < 0 && errno == EINTR);
+
+  if (len < 0)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return 0;
+      g_message ("couldn't receive from worker %u: %s", worker->index, g_strerror (errno));
+      return -1;
+    }
+  else if (len == 0)
+    {
+      return -1;
+    }
+
+  message[len] = '\0';
+
+  /* "I <received>": the worker has no sessions, and has seen this many connections */
+  if (message[0] == 'I' && message[1] == ' ')
+    {
+      count = g_ascii_strtoull (message + 2, NULL, 10);
+      if (count == worker->sent && g_queue_is_empty (&worker->queue))
+        {
+          g_debug ("worker %u is idle", worker->index);
+          retire_worker (worker);
+        }
+    }
+
+  /* "C <conversation>": a login conversation that continues on this worker */
+  else if (message[0] == 'C' && message[1] == ' ' && message[2] != '\0')
+    {
+      if (worker->supervisor)
+        add_conversation (worker->supervisor, message + 2, worker->index);
+    }
+
+  else
+    {
+      g_message ("received invalid message from worker %u", worker->index);
+    }
+
+  return 1;
+}
+
+static gboolean
+on_worker_input (gint fd,
+                 GIOCondition condition,
+                 gpointer user_data)
+{
+  Worker *worker = user_data;
+
+  if (receive_from_worker (worker) < 0)
+    {
+      worker->watch = 0;
+      retire_worker (worker);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+on_worker_exit (GObject *object,
+                GAsyncResult *result,
+                gpointer user_data)
+{
+  Worker *worker = user_data;
+  CockpitSupervisor *self = worker->supervisor;
+  GError *error = NULL;
+
+  if (!g_subprocess_wait_finish (G_SUBPROCESS (object), result, &error))
+    {
+      /* Only cancelled when the supervisor is gone */
+      g_error_free (error);
+      worker_free (worker);
+      return;
+    }
+
+  if (!worker->retired)
+    g_message ("worker %u exited unexpectedly", worker->index);
+  else if (!g_subprocess_get_successful (worker->process))
+    g_message ("worker %u failed", worker->index);
+
+  retire_worker (worker);
+  g_hash_table_remove (self->running, worker);
+  worker_free (worker);
+  maybe_quit (self);
+}
+
+static Worker *
+spawn_worker (CockpitSupervisor *self,
+              guint index,
+              GError **error)
+{
+  g_autoptr(GSubprocessLauncher) launcher = NULL;
+  g_autoptr(GPtrArray) args = NULL;
+  g_autofree gchar *option = NULL;
+  GSubprocess *process;
+  Worker *worker;
+  int fds[2];
+  int errn;
+  guint i;
+
+  if (socketpair (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0)
+    {
+      errn = errno;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errn),
+                   "Couldn't create socket for worker: %s", g_strerror (errn));
+      return NULL;
+    }
+
+  /* Same arguments as we got, the workers know how many of them there are */
+  args = g_ptr_array_new ();
+  for (i = 0; self->argv[i] != NULL; i++)
+    g_ptr_array_add (args, self->argv[i]);
+  option = g_strdup_printf ("--worker=%u", index);
+  g_ptr_array_add (args, option);
+  g_ptr_array_add (args, NULL);
+
+  launcher = g_subprocess_launcher_new (G_SUBPROCESS_FLAGS_NONE);
+  g_subprocess_launcher_take_fd (launcher, fds[1], COCKPIT_SUPERVISOR_WORKER_FD);
+
+  process = g_subprocess_launcher_spawnv (launcher, (const gchar * const *)args->pdata, error);
+  if (!process)
+    {
+      close (fds[0]);
+      return NULL;
+    }
+
+  worker = g_new0 (Worker, 1);
+  worker->supervisor = self;
+  worker->index = index;
+  worker->control = fds[0];
+  worker->process = process;
+  worker->watch = g_unix_fd_add (worker->control, G_IO_IN, on_worker_input, worker);
+  g_subprocess_wait_async (process, self->cancellable, on_worker_exit, worker);
+
+  g_debug ("started worker %u: %s", index, g_subprocess_get_identifier (process));
+
+  self->workers[index] = worker;
+  g_hash_table_add (self->running, worker);
+  return worker;
+}
+
+static gint
+lookup_conversation (CockpitSupervisor *self,
+                     CockpitHttpParser *parser)
+{
+  GHashTableIter iter;
+  Conversation *conversation;
+  const gchar *authorization;
+  char *type = NULL;
+  char *id = NULL;
+  Worker *worker;
+  gint ret = -1;
+
+  authorization = cockpit_http_parser_get_header (parser, "Authorization");
+  if (!authorization || !cockpit_authorize_type (authorization, &type))
+    goto out;
+
+  if (!g_str_equal (type, "x-conversation") ||
+      !cockpit_authorize_subject (authorization, &id))
+    goto out;
+
+  /* The worker may have answered before its message about it got here */
+  g_hash_table_iter_init (&iter, self->running);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&worker, NULL))
+    {
+      while (!worker->retired && receive_from_worker (worker) > 0);
+    }
+
+  conversation = g_hash_table_lookup (self->conversations, id);
+  if (conversation)
+    ret = conversation->index;
+
+out:
+  free (type);
+  free (id);
+  return ret;
+}
+
+static guint
+choose_worker (CockpitSupervisor *self,
+               CockpitHttpParser *parser)
+{
+  GHashTable *headers;
+  gint index = -1;
+
+  if (cockpit_http_parser_get_path (parser))
+    {
+      headers = cockpit_http_parser_build_headers (parser);
+      index = cockpit_auth_affinity (cockpit_http_parser_get_path (parser),
+                                     headers, self->n_workers);
+      g_hash_table_unref (headers);
+
+      if (index < 0)
+        index = lookup_conversation (self, parser);
+    }
+
+  /* New sessions are spread over all the workers */
+  if (index < 0)
+    index = self->next++ % self->n_workers;
+
+  return index;
+}
+
+/*
+ * Returns 1 when the connection was passed on, 0 when the worker can't
+ * take it right now, or -1 on failure.
+ */
+static gint
+send_to_worker (Worker *worker,
+                Pending *pending)
+{
+  GSocket *socket;
+  struct cmsghdr cmsg[2];
+  struct iovec iov = { pending->buffer->data, pending->buffer->len };
+  struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+  gssize ret;
+
+  socket = g_socket_connection_get_socket (pending->connection);
+  cockpit_socket_msghdr_add_fd (&msg, cmsg, sizeof cmsg, g_socket_get_fd (socket));
+
+  do
+    ret = sendmsg (worker->control, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+  while (ret < 0 && errno == EINTR);
+
+  if (ret < 0)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return 0;
+      g_message ("couldn't pass connection to worker %u: %s", worker->index, g_strerror (errno));
+      return -1;
+    }
+
+  worker->sent++;
+  return 1;
+}
+
+static gboolean on_worker_output (gint fd,
+                                  GIOCondition condition,
+                                  gpointer user_data);
+
+/* Pass on queued connections until the worker is busy */
+static gboolean
+flush_worker (Worker *worker)
+{
+  Pending *pending;
+  gint ret;
+
+  while ((pending = g_queue_peek_head (&worker->queue)))
+    {
+      ret = send_to_worker (worker, pending);
+      if (ret < 0)
+        return FALSE;
+      if (ret == 0)
+        {
+          if (!worker->out_watch)
+            worker->out_watch = g_unix_fd_add (worker->control, G_IO_OUT, on_worker_output, worker);
+          return TRUE;
+        }
+
+      g_queue_pop_head (&worker->queue);
+      pending_free (pending);
+    }
+
+  if (worker->out_watch)
+    {
+      g_source_remove (worker->out_watch);
+      worker->out_watch = 0;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+on_worker_output (gint fd,
+                  GIOCondition condition,
+                  gpointer user_data)
+{
+  Worker *worker = user_data;
+  CockpitSupervisor *self = worker->supervisor;
+
+  if (!flush_worker (worker))
+    {
+      worker->out_watch = 0;
+      retire_worker (worker);
+      if (self)
+        maybe_quit (self);
+      return FALSE;
+    }
+
+  return worker->out_watch != 0;
+}
+
+static void
+dispatch_pending (Pending *pending)
+{
+  CockpitSupervisor *self = pending->supervisor;
+  GError *error = NULL;
+  Worker *worker;
+  guint index;
+
+  index = choose_worker (self, &pending->parser);
+  worker = self->workers[index];
+  if (!worker)
+    worker = spawn_worker (self, index, &error);
+
+  if (!worker)
+    {
+      g_warning ("couldn't start cockpit-ws worker: %s", error->message);
+      g_error_free (error);
+      g_hash_table_remove (self->pending, pending);
+    }
+  else
+    {
+      /* Nothing more to read, it waits for the worker now */
+      g_source_destroy (pending->source);
+      g_source_unref (pending->source);
+      pending->source = NULL;
+      g_source_destroy (pending->timeout);
+      g_source_unref (pending->timeout);
+      pending->timeout = NULL;
+
+      g_hash_table_steal (self->pending, pending);
+      g_queue_push_tail (&worker->queue, pending);
+      if (!flush_worker (worker))
+        retire_worker (worker);
+    }
+
+  maybe_quit (self);
+}
+
+static void
+pending_finish (Pending *pending)
+{
+  CockpitSupervisor *self = pending->supervisor;
+  g_hash_table_remove (self->pending, pending);
+  maybe_quit (self);
+}
+
+static gboolean
+on_pending_input (GSocket *socket,
+                  GIOCondition condition,
+                  gpointer user_data)
+{
+  Pending *pending = user_data;
+  CockpitHttpParseResult result;
+  GError *error = NULL;
+  gsize length;
+  gssize count;
+
+  length = pending->buffer->len;
+  g_byte_array_set_size (pending->buffer, DISPATCH_MAXIMUM);
+
+  count = g_socket_receive (socket, (gchar *)pending->buffer->data + length,
+                            DISPATCH_MAXIMUM - length, NULL, &error);
+  if (count < 0)
+    {
+      g_byte_array_set_size (pending->buffer, length);
+
+      /* Just wait and try again */
+      if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+        {
+          g_error_free (error);
+          return TRUE;
+        }
+
+      g_debug ("couldn't read from connection: %s", error->message);
+      g_error_free (error);
+      pending_finish (pending);
+      return FALSE;
+    }
+
+  g_byte_array_set_size (pending->buffer, length + count);
+
+  if (count == 0)
+    {
+      g_debug ("connection closed before a request");
+      pending_finish (pending);
+      return FALSE;
+    }
+
+  result = cockpit_http_parser_feed (&pending->parser,
+                                     (const gchar *)pending->buffer->data,
+                                     pending->buffer->len);
+  if (result == COCKPIT_HTTP_PARSE_MORE && pending->buffer->len < DISPATCH_MAXIMUM)
+    return TRUE;
+
+  /* Bad and oversized requests are answered by a worker like any other */
+  dispatch_pending (pending);
+  return FALSE;
+}
+
+static gboolean
+on_pending_timeout (gpointer user_data)
+{
+  Pending *pending = user_data;
+  g_debug ("request timed out before it was dispatched, closing");
+  pending_finish (pending);
+  return FALSE;
+}
+
+static gboolean
+on_incoming (GSocketService *service,
+             GSocketConnection *connection,
+             GObject *source_object,
+             gpointer user_data)
+{
+  CockpitSupervisor *self = user_data;
+  GSocket *socket;
+  Pending *pending;
+
+  pending = g_new0 (Pending, 1);
+  pending->supervisor = self;
+  pending->connection = g_object_ref (connection);
+  pending->buffer = g_byte_array_new ();
+  cockpit_http_parser_init (&pending->parser);
+
+  socket = g_socket_connection_get_socket (connection);
+  g_socket_set_blocking (socket, FALSE);
+
+  pending->source = g_socket_create_source (socket, G_IO_IN, NULL);
+  g_source_set_callback (pending->source, (GSourceFunc)on_pending_input, pending, NULL);
+  g_source_attach (pending->source, NULL);
+
+  pending->timeout = g_timeout_source_new_seconds (cockpit_webserver_request_timeout);
+  g_source_set_callback (pending->timeout, on_pending_timeout, pending, NULL);
+  g_source_attach (pending->timeout, NULL);
+
+  g_hash_table_add (self->pending, pending);
+
+  /* handled */
+  return TRUE;
+}
+
+/**
+ * cockpit_supervisor_new:
+ * @argv: the command line to start a worker with
+ * @workers: the number of workers
+ * @quit_when_idle: (nullable): a main loop to quit when all workers exited
+ *
+ * Returns: (transfer full): the new supervisor, not yet accepting connections
+ */
+CockpitSupervisor *
+cockpit_supervisor_new (const gchar **argv,
+                        guint workers,
+                        GMainLoop *quit_when_idle)
+{
+  CockpitSupervisor *self;
+
+  g_return_val_if_fail (argv != NULL && argv[0] != NULL, NULL);
+  g_return_val_if_fail (workers > 0, NULL);
+
+  self = g_new0 (CockpitSupervisor, 1);
+  self->argv = g_strdupv ((gchar **)argv);
+  self->n_workers = workers;
+  self->workers = g_new0 (Worker *, workers);
+  self->running = g_hash_table_new (g_direct_hash, g_direct_equal);
+  self->pending = g_hash_table_new_full (g_direct_hash, g_direct_equal, pending_free, NULL);
+  self->conversations = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  self->cancellable = g_cancellable_new ();
+  if (quit_when_idle)
+    self->quit_loop = g_main_loop_ref (quit_when_idle);
+
+  self->service = g_socket_service_new ();
+  g_socket_service_stop (self->service);
+  g_signal_connect (self->service, "incoming", G_CALLBACK (on_incoming), self);
+
+  return self;
+}
+
+void
+cockpit_supervisor_free (CockpitSupervisor *self)
+{
+  GHashTableIter iter;
+  Worker *worker;
+
+  if (!self)
+    return;
+
+  g_socket_service_stop (self->service);
+  g_signal_handlers_disconnect_by_func (self->service, on_incoming, self);
+  g_object_unref (self->service);
+
+  g_hash_table_destroy (self->pending);
+
+  /* Workers exit once their socket closes, and are freed when waited for */
+  g_hash_table_iter_init (&iter, self->running);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&worker, NULL))
+    {
+      retire_worker (worker);
+      worker->supervisor = NULL;
+    }
+  g_cancellable_cancel (self->cancellable);
+  g_object_unref (self->cancellable);
+
+  g_hash_table_destroy (self->running);
+  g_hash_table_destroy (self->conversations);
+  if (self->quit_loop)
+    g_main_loop_unref (self->quit_loop);
+  g_free (self->workers);
+  g_strfreev (self->argv);
+  g_free (self);
+}
+
+guint16
+cockpit_supervisor_add_inet_listener (CockpitSupervisor *self,
+                                      const gchar *address,
+                                      guint16 port,
+                                      GError **error)
+{
+  g_autoptr(GSocketAddress) socket_address = NULL;
+  g_autoptr(GSocketAddress) result_address = NULL;
+
+  if (address != NULL)
+    {
+      socket_address = g_inet_socket_address_new_from_string (address, port);
+      if (socket_address == NULL)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "Couldn't parse IP address from `%s`", address);
+          return 0;
+        }
+
+      if (!g_socket_listener_add_address (G_SOCKET_LISTENER (self->service), socket_address,
+                                          G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT,
+                                          NULL, &result_address, error))
+        return 0;
+
+      return g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (result_address));
+    }
+  else if (port > 0)
+    {
+      if (g_socket_listener_add_inet_port (G_SOCKET_LISTENER (self->service), port, NULL, error))
+        return port;
+      else
+        return 0;
+    }
+  else
+    return g_socket_listener_add_any_inet_port (G_SOCKET_LISTENER (self->service), NULL, error);
+}
+
+gboolean
+cockpit_supervisor_add_fd_listener (CockpitSupervisor *self,
+                                    int fd,
+                                    GError **error)
+{
+  g_autoptr(GSocket) socket = g_socket_new_from_fd (fd, error);
+  if (socket == NULL)
+    {
+      g_prefix_error (error, "Failed to acquire passed socket %i: ", fd);
+      return FALSE;
+    }
+
+  if (!g_socket_listener_add_socket (G_SOCKET_LISTENER (self->service), socket, NULL, error))
+    {
+      g_prefix_error (error, "Failed to add listener for socket %i: ", fd);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+void
+cockpit_supervisor_start (CockpitSupervisor *self)
+{
+  g_socket_service_start (self->service);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+typedef struct {
+  CockpitWebServer *server;
+  CockpitAuth *auth;
+  GMainLoop *loop;
+  gint fd;
+  guint watch;
+  guint idle_tag;
+  gulong idling_sig;
+  gulong conversation_sig;
+  guint64 received;
+  gchar *buffer;
+} WorkerLink;
+
+static void
+worker_link_free (gpointer data)
+{
+  WorkerLink *link = data;
+
+  if (link->watch)
+    g_source_remove (link->watch);
+  if (link->idle_tag)
+    g_source_remove (link->idle_tag);
+  g_signal_handler_disconnect (link->auth, link->idling_sig);
+  g_signal_handler_disconnect (link->auth, link->conversation_sig);
+  g_object_unref (link->auth);
+  g_main_loop_unref (link->loop);
+  close (link->fd);
+  g_free (link->buffer);
+  g_free (link);
+}
+
+static void
+send_to_supervisor (WorkerLink *link,
+                    const gchar *message)
+{
+  gssize ret;
+
+  do
+    ret = send (link->fd, message, strlen (message), MSG_NOSIGNAL);
+  while (ret < 0 && errno == EINTR);
+
+  if (ret < 0)
+    g_debug ("couldn't send to supervisor: %s", g_strerror (errno));
+}
+
+static gboolean
+on_idle_interval (gpointer user_data)
+{
+  WorkerLink *link = user_data;
+  gchar *message;
+
+  /*
+   * The supervisor ignores this if it passed us connections since. Keep
+   * serving the connections we have, such as WebSockets, until they close.
+   */
+  if (g_hash_table_size (link->auth->sessions) == 0 && link->auth->startups == 0 &&
+      cockpit_web_server_get_n_connections (link->server) == 0)
+    {
+      message = g_strdup_printf ("I %" G_GUINT64_FORMAT, link->received);
+      send_to_supervisor (link, message);
+      g_free (message);
+    }
+
+  return TRUE;
+}
+
+static void
+on_auth_idling (CockpitAuth *auth,
+                gpointer user_data)
+{
+  WorkerLink *link = user_data;
+
+  on_idle_interval (link);
+
+  /* Connections without a session don't make the auth idle again */
+  if (!link->idle_tag)
+    link->idle_tag = g_timeout_add_seconds (WORKER_IDLE_INTERVAL, on_idle_interval, link);
+}
+
+static void
+on_auth_conversation (CockpitAuth *auth,
+                      const gchar *conversation,
+                      gpointer user_data)
+{
+  WorkerLink *link = user_data;
+  gchar *message;
+
+  message = g_strdup_printf ("C %s", conversation);
+  send_to_supervisor (link, message);
+  g_free (message);
+}
+
+static gboolean
+on_supervisor_input (gint fd,
+                     GIOCondition condition,
+                     gpointer user_data)
+{
+  WorkerLink *link = user_data;
+  union {
+    struct cmsghdr align;
+    gchar buf[CMSG_SPACE (sizeof (int))];
+  } control;
+  struct iovec iov = { link->buffer, DISPATCH_MAXIMUM };
+  struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+                        .msg_control = &control, .msg_controllen = sizeof (control) };
+  struct cmsghdr *cmsg;
+  GError *error = NULL;
+  GBytes *received;
+  gssize count;
+  int connection = -1;
+
+  do
+    count = recvmsg (fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+  while (count < 0 && errno == EINTR);
+
+  if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    return TRUE;
+
+  if (count <= 0)
+    {
+      if (count < 0)
+        g_message ("couldn't receive from supervisor: %s", g_strerror (errno));
+      else
+        g_debug ("supervisor has no more work for us");
+      link->watch = 0;
+      g_main_loop_quit (link->loop);
+      return FALSE;
+    }
+
+  for (cmsg = CMSG_FIRSTHDR (&msg); cmsg != NULL; cmsg = CMSG_NXTHDR (&msg, cmsg))
+    {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+          cmsg->cmsg_len == CMSG_LEN (sizeof (int)))
+        memcpy (&connection, CMSG_DATA (cmsg), sizeof (int));
+    }
+
+  if (connection < 0)
+    {
+      g_warning ("received request from supervisor without a connection");
+      return TRUE;
+    }
+
+  link->received++;
+
+  if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))
+    {
+      g_message ("received truncated request from supervisor");
+      close (connection);
+      return TRUE;
+    }
+
+  received = g_bytes_new (link->buffer, count);
+  if (!cockpit_web_server_add_fd_connection (link->server, connection, received, &error))
+    {
+      g_message ("%s", error->message);
+      g_error_free (error);
+      close (connection);
+    }
+  g_bytes_unref (received);
+
+  return TRUE;
+}
+
+/**
+ * cockpit_supervisor_serve_worker:
+ * @server: the web server of this worker
+ * @auth: the auth of this worker
+ * @control_fd: the socket to the supervisor
+ * @loop: the main loop to quit once the supervisor has no more work
+ * @error: location to place an error
+ *
+ * Run this cockpit-ws as a worker, serving connections that the supervisor
+ * passes on. Also see cockpit_auth_set_affinity().
+ *
+ * Returns: FALSE if @control_fd is not usable
+ */
+gboolean
+cockpit_supervisor_serve_worker (CockpitWebServer *server,
+                                 CockpitAuth *auth,
+                                 int control_fd,
+                                 GMainLoop *loop,
+                                 GError **error)
+{
+  WorkerLink *link;
+  int flags;
+
+  flags = fcntl (control_fd, F_GETFD);
+  if (flags < 0 || fcntl (control_fd, F_SETFD, flags | FD_CLOEXEC) < 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_CONNECTED,
+                   "No socket to the supervisor on fd %d", control_fd);
+      return FALSE;
+    }
+
+  link = g_new0 (WorkerLink, 1);
+  link->server = server;
+  link->auth = g_object_ref (auth);
+  link->loop = g_main_loop_ref (loop);
+  link->fd = control_fd;
+  link->buffer = g_malloc (DISPATCH_MAXIMUM);
+  link->watch = g_unix_fd_add (control_fd, G_IO_IN, on_supervisor_input, link);
+  link->idling_sig = g_signal_connect (auth, "idling", G_CALLBACK (on_auth_idling), link);
+  link->conversation_sig = g_signal_connect (auth, "conversation", G_CALLBACK (on_auth_conversation), link);
+
+  /* Lives as long as the web server */
+  g_object_set_data_full (G_OBJECT (server), "cockpit-supervisor-link", link, worker_link_free);
+  return TRUE;
+}
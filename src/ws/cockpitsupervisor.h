@@ -0,0 +1,61 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __COCKPIT_SUPERVISOR_H__
+#define __COCKPIT_SUPERVISOR_H__
+
+#include <gio/gio.h>
+
+#include "cockpitauth.h"
+
+#include "common/cockpitwebserver.h"
+
+G_BEGIN_DECLS
+
+/* Where a worker finds its end of the socket to the supervisor */
+#define COCKPIT_SUPERVISOR_WORKER_FD 3
+
+typedef struct _CockpitSupervisor CockpitSupervisor;
+
+CockpitSupervisor *  cockpit_supervisor_new                (const gchar **argv,
+                                                            guint workers,
+                                                            GMainLoop *quit_when_idle);
+
+void                 cockpit_supervisor_free               (CockpitSupervisor *self);
+
+guint16              cockpit_supervisor_add_inet_listener  (CockpitSupervisor *self,
+                                                            const gchar *address,
+                                                            guint16 port,
+                                                            GError **error);
+
+gboolean             cockpit_supervisor_add_fd_listener    (CockpitSupervisor *self,
+                                                            int fd,
+                                                            GError **error);
+
+void                 cockpit_supervisor_start              (CockpitSupervisor *self);
+
+gboolean             cockpit_supervisor_serve_worker       (CockpitWebServer *server,
+                                                            CockpitAuth *auth,
+                                                            int control_fd,
+                                                            GMainLoop *loop,
+                                                            GError **error);
+
+G_END_DECLS
+
+#endif /* __COCKPIT_SUPERVISOR_H__ */
@@ -21,6 +21,7 @@
 
 #include "cockpitwebservice.h"
 
+#include "cockpitchannelresponse.h"
 #include "cockpitcompat.h"
 #include "cockpitws.h"
 
@@ -32,9 +33,11 @@
 
 #include "common/cockpitauthorize.h"
 #include "common/cockpitconf.h"
+#include "common/cockpitflow.h"
 #include "common/cockpithex.h"
 #include "common/cockpitjson.h"
 #include "common/cockpitmemory.h"
+#include "common/cockpitpipetransport.h"
 #include "common/cockpitsystem.h"
 #include "common/cockpitwebresponse.h"
 #include "common/cockpitwebserver.h"
@@ -51,6 +54,13 @@ const gchar *cockpit_ws_default_protocol_header = NULL;
 
 guint cockpit_ws_ping_interval = 5;
 
+guint cockpit_ws_resume_timeout = 30;
+
+guint cockpit_ws_compact_timeout = 60;
+
+/* Overrides the OutputBudget setting when not zero */
+gsize cockpit_ws_output_budget = 0;
+
 /* ----------------------------------------------------------------------------
  * Web Socket Info
  */
@@ -59,19 +69,197 @@ typedef struct {
   gchar *id;
   WebSocketConnection *connection;
   GHashTable *channels;
+  GHashTable *groups;
   JsonObject *init_received;
+
+  /* A fragmented message in progress, relayed as it comes or assembled */
+  gchar *fragment_channel;
+  GByteArray *fragments;
+
+  /* Messages held back while the WebSocket is busy, sent in turn per channel */
+  GHashTable *pending;
+  GQueue rotation;
+  gsize pending_size;
+  gboolean flushing;
+
+  /* Counts of messages each way, that a resumed socket picks up from */
+  guint64 sent;
+  guint64 received;
+  guint64 acked_received;
+
+  /* Sent messages the frontend hasn't acknowledged yet, the last is number @sent */
+  gchar *resume_token;
+  gboolean resumable;
+  GQueue replay;
+  gsize replay_size;
+
+  /* Dropped without closing, waiting for the frontend to come back */
+  CockpitWebService *service;
+  gboolean closing;
+  gboolean detached;
+  guint resume_timeout;
 } CockpitSocket;
 
+typedef struct {
+  gchar *channel;
+  GQueue messages;
+} CockpitSocketPending;
+
+typedef struct {
+  WebSocketDataType data_type;
+  GBytes *prefix;
+  GBytes *payload;
+  gboolean stream;
+} CockpitSocketMessage;
+
+/* Only this much is queued in the WebSocket, the rest waits its turn */
+#define SOCKET_WINDOW   (64 * 1024)
+
+/* Byte streams are sent in pieces this size, taking turns with other channels */
+#define SOCKET_SLICE    (16 * 1024)
+
+/* A resumable socket keeps at most this much that the frontend hasn't acknowledged */
+#define RESUME_BUFFER   (1024 * 1024)
+
+/* A session always gets to buffer this much output, however many there are */
+#define MIN_OUTPUT_SHARE  (2 * SOCKET_WINDOW)
+
+/*
+ * Output buffered for the frontends of all sessions together. Each session
+ * gets a fair share of the limit. Over its share, a session holds back the
+ * "pong" replies of its frontends, so channels with flow control stop in the
+ * bridge while everything else keeps flowing. Only at twice its share does
+ * it stop reading from the bridge altogether. Logins are refused once
+ * another session's minimum share would take more than @admission percent
+ * of the limit. With several worker processes each has its part of the limit.
+ */
+static struct {
+  gsize limit;
+  guint admission;
+  guint workers;
+  gsize used;
+  GList *sessions;
+  guint n_sessions;
+} output_budget;
+
+typedef struct {
+  CockpitSocket *socket;
+  WebSocketDataType data_type;
+  gchar *group;
+
+  /* A byte stream, where message boundaries don't matter */
+  gboolean stream;
+
+  /* Goes in front of each message to the frontend */
+  GBytes *prefix;
+
+  /* Payload bytes from and to the frontend */
+  guint64 in_bytes;
+  guint64 out_bytes;
+} CockpitSocketChannel;
+
+/* An open-batch waiting for its reply */
+typedef struct {
+  gchar *id;
+  CockpitSocket *socket;
+
+  /* Collected here when the bridge can't open a batch itself */
+  GHashTable *pending;
+  JsonObject *ready;
+  JsonObject *problems;
+} CockpitSocketBatch;
+
 typedef struct {
   GHashTable *by_channel;
   GHashTable *by_connection;
+  GHashTable *batches;
+  GHashTable *batched;
   guint next_socket_id;
 } CockpitSockets;
 
+static void
+cockpit_socket_channel_free (gpointer data)
+{
+  CockpitSocketChannel *chan = data;
+  g_bytes_unref (chan->prefix);
+  g_free (chan->group);
+  g_free (chan);
+}
+
+static void
+cockpit_socket_batch_free (gpointer data)
+{
+  CockpitSocketBatch *batch = data;
+  if (batch->pending)
+    g_hash_table_destroy (batch->pending);
+  if (batch->ready)
+    json_object_unref (batch->ready);
+  if (batch->problems)
+    json_object_unref (batch->problems);
+  g_free (batch->id);
+  g_free (batch);
+}
+
+static void
+cockpit_socket_message_free (gpointer data)
+{
+  CockpitSocketMessage *message = data;
+  g_bytes_unref (message->prefix);
+  g_bytes_unref (message->payload);
+  g_free (message);
+}
+
+static CockpitSocketMessage *
+cockpit_socket_message_new (WebSocketDataType data_type,
+                            GBytes *prefix,
+                            GBytes *payload,
+                            gboolean stream)
+{
+  CockpitSocketMessage *message;
+
+  message = g_new0 (CockpitSocketMessage, 1);
+  message->data_type = data_type;
+  message->prefix = g_bytes_ref (prefix);
+  message->payload = g_bytes_ref (payload);
+  message->stream = stream;
+
+  return message;
+}
+
+static gsize
+cockpit_socket_message_size (CockpitSocketMessage *message)
+{
+  return g_bytes_get_size (message->prefix) + g_bytes_get_size (message->payload);
+}
+
+static void
+cockpit_socket_pending_free (gpointer data)
+{
+  CockpitSocketPending *pending = data;
+  CockpitSocketMessage *message;
+  while ((message = g_queue_pop_head (&pending->messages)))
+    cockpit_socket_message_free (message);
+  g_free (pending->channel);
+  g_free (pending);
+}
+
 static void
 cockpit_socket_free (gpointer data)
 {
   CockpitSocket *socket = data;
+  CockpitSocketMessage *message;
+  g_signal_handlers_disconnect_by_data (socket->connection, socket);
+  if (socket->resume_timeout)
+    g_source_remove (socket->resume_timeout);
+  while ((message = g_queue_pop_head (&socket->replay)))
+    cockpit_socket_message_free (message);
+  g_free (socket->resume_token);
+  g_queue_clear (&socket->rotation);
+  g_hash_table_unref (socket->pending);
+  g_free (socket->fragment_channel);
+  if (socket->fragments)
+    g_byte_array_unref (socket->fragments);
+  g_hash_table_unref (socket->groups);
   g_hash_table_unref (socket->channels);
   if (socket->init_received)
     json_object_unref (socket->init_received);
@@ -87,6 +275,10 @@ cockpit_sockets_init (CockpitSockets *sockets)
 
   sockets->by_channel = g_hash_table_new (g_str_hash, g_str_equal);
 
+  /* Batches by id, and by the channels a batch is still waiting for */
+  sockets->batches = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, cockpit_socket_batch_free);
+  sockets->batched = g_hash_table_new (g_str_hash, g_str_equal);
+
   /* This owns the socket */
   sockets->by_connection = g_hash_table_new_full (g_direct_hash, g_direct_equal,
                                                   NULL, cockpit_socket_free);
@@ -99,11 +291,19 @@ cockpit_socket_lookup_by_connection (CockpitSockets *sockets,
   return g_hash_table_lookup (sockets->by_connection, connection);
 }
 
+inline static CockpitSocketChannel *
+cockpit_socket_lookup_channel (CockpitSockets *sockets,
+                               const gchar *channel)
+{
+  return g_hash_table_lookup (sockets->by_channel, channel);
+}
+
 inline static CockpitSocket *
 cockpit_socket_lookup_by_channel (CockpitSockets *sockets,
                                   const gchar *channel)
 {
-  return g_hash_table_lookup (sockets->by_channel, channel);
+  CockpitSocketChannel *chan = g_hash_table_lookup (sockets->by_channel, channel);
+  return chan ? chan->socket : NULL;
 }
 
 static void
@@ -111,7 +311,23 @@ cockpit_socket_remove_channel (CockpitSockets *sockets,
                                CockpitSocket *socket,
                                const gchar *channel)
 {
+  CockpitSocketChannel *chan;
+  GHashTable *members;
+
   g_debug ("%s remove channel %s for socket", socket->id, channel);
+
+  chan = g_hash_table_lookup (socket->channels, channel);
+  if (chan)
+    {
+      members = g_hash_table_lookup (socket->groups, chan->group);
+      if (members)
+        {
+          g_hash_table_remove (members, channel);
+          if (g_hash_table_size (members) == 0)
+            g_hash_table_remove (socket->groups, chan->group);
+        }
+    }
+
   g_hash_table_remove (sockets->by_channel, channel);
   g_hash_table_remove (socket->channels, channel);
 }
@@ -120,27 +336,281 @@ static void
 cockpit_socket_add_channel (CockpitSockets *sockets,
                             CockpitSocket *socket,
                             const gchar *channel,
-                            WebSocketDataType data_type)
+                            WebSocketDataType data_type,
+                            const gchar *group,
+                            gboolean stream)
 {
-  gchar *chan;
+  CockpitSocketChannel *chan;
+  GHashTable *members;
+  gchar *prefix;
+  gchar *id;
+
+  if (g_hash_table_contains (socket->channels, channel))
+    cockpit_socket_remove_channel (sockets, socket, channel);
+
+  chan = g_new0 (CockpitSocketChannel, 1);
+  chan->socket = socket;
+  chan->data_type = data_type;
+  chan->group = g_strdup (group ? group : "default");
+  chan->stream = stream;
+
+  prefix = g_strconcat (channel, "\n", NULL);
+  chan->prefix = g_bytes_new_take (prefix, strlen (prefix));
 
-  chan = g_strdup (channel);
-  g_hash_table_insert (sockets->by_channel, chan, socket);
-  g_hash_table_replace (socket->channels, chan, GINT_TO_POINTER (data_type));
+  /* Each group knows its channels, so a kill doesn't look through all of them */
+  members = g_hash_table_lookup (socket->groups, chan->group);
+  if (!members)
+    {
+      members = g_hash_table_new (g_str_hash, g_str_equal);
+      g_hash_table_insert (socket->groups, g_strdup (chan->group), members);
+    }
+
+  id = g_strdup (channel);
+  g_hash_table_insert (sockets->by_channel, id, chan);
+  g_hash_table_insert (socket->channels, id, chan);
+  g_hash_table_add (members, id);
 
   g_debug ("%s added channel %s to socket", socket->id, channel);
 }
 
+static gboolean on_resume_timeout (gpointer user_data);
+
+static void     update_output     (CockpitWebService *self);
+
+/* Whether messages for the frontend go anywhere, if only to be kept for later */
+static gboolean
+cockpit_socket_is_open (CockpitSocket *socket)
+{
+  return socket->detached ||
+         web_socket_connection_get_ready_state (socket->connection) == WEB_SOCKET_STATE_OPEN;
+}
+
+/* Stop waiting for a detached socket to be resumed */
+static void
+cockpit_socket_give_up (CockpitSocket *socket)
+{
+  if (socket->resume_timeout)
+    g_source_remove (socket->resume_timeout);
+  socket->resume_timeout = g_idle_add (on_resume_timeout, socket);
+}
+
+/*
+ * Send a numbered message to the frontend. A resumable socket keeps it
+ * until the frontend says it got it, and while detached that's all that
+ * happens. Once too much piles up, the socket can no longer be resumed.
+ */
+static void
+cockpit_socket_deliver (CockpitSocket *socket,
+                        WebSocketDataType data_type,
+                        GBytes *prefix,
+                        GBytes *payload)
+{
+  CockpitSocketMessage *message;
+
+  socket->sent++;
+
+  if (socket->resumable)
+    {
+      message = cockpit_socket_message_new (data_type, prefix, payload, FALSE);
+      g_queue_push_tail (&socket->replay, message);
+      socket->replay_size += cockpit_socket_message_size (message);
+
+      if (socket->replay_size > RESUME_BUFFER)
+        {
+          g_debug ("%s too much unacknowledged output, no longer resumable", socket->id);
+          socket->resumable = FALSE;
+          while ((message = g_queue_pop_head (&socket->replay)))
+            cockpit_socket_message_free (message);
+          socket->replay_size = 0;
+          if (socket->detached)
+            cockpit_socket_give_up (socket);
+        }
+    }
+
+  if (!socket->detached)
+    web_socket_connection_send (socket->connection, data_type, prefix, payload);
+}
+
+/* The frontend got the first @received messages, they needn't be kept */
+static void
+cockpit_socket_acknowledge (CockpitSocket *socket,
+                            guint64 received)
+{
+  CockpitSocketMessage *message;
+  guint64 oldest;
+
+  oldest = socket->sent - socket->replay.length + 1;
+  while (oldest <= received && (message = g_queue_pop_head (&socket->replay)))
+    {
+      socket->replay_size -= cockpit_socket_message_size (message);
+      cockpit_socket_message_free (message);
+      oldest++;
+    }
+}
+
+static void
+cockpit_socket_flush (CockpitSocket *socket)
+{
+  WebSocketConnection *connection = socket->connection;
+  CockpitSocketPending *pending;
+  CockpitSocketMessage *message;
+  GBytes *piece;
+  GBytes *rest;
+  gsize size;
+
+  /* Sending below tells us about the buffered amount again */
+  if (socket->flushing)
+    return;
+
+  socket->flushing = TRUE;
+
+  while (web_socket_connection_get_ready_state (connection) == WEB_SOCKET_STATE_OPEN &&
+         web_socket_connection_get_buffered_amount (connection) < SOCKET_WINDOW)
+    {
+      pending = g_queue_pop_head (&socket->rotation);
+      if (!pending)
+        break;
+
+      message = g_queue_peek_head (&pending->messages);
+      size = g_bytes_get_size (message->payload);
+
+      if (message->stream && size > SOCKET_SLICE)
+        {
+          piece = g_bytes_new_from_bytes (message->payload, 0, SOCKET_SLICE);
+          rest = g_bytes_new_from_bytes (message->payload, SOCKET_SLICE, size - SOCKET_SLICE);
+          g_bytes_unref (message->payload);
+          message->payload = rest;
+          socket->pending_size -= SOCKET_SLICE;
+          cockpit_socket_deliver (socket, message->data_type, message->prefix, piece);
+          g_bytes_unref (piece);
+        }
+      else
+        {
+          g_queue_pop_head (&pending->messages);
+          socket->pending_size -= size;
+          cockpit_socket_deliver (socket, message->data_type, message->prefix, message->payload);
+          cockpit_socket_message_free (message);
+        }
+
+      /* Go round the channels that have something to send */
+      if (g_queue_is_empty (&pending->messages))
+        g_hash_table_remove (socket->pending, pending->channel);
+      else
+        g_queue_push_tail (&socket->rotation, pending);
+    }
+
+  socket->flushing = FALSE;
+}
+
+/*
+ * Send a message for a channel to the frontend. Once the WebSocket has
+ * enough queued, messages wait here instead, and the channels take turns.
+ * So a channel sending lots of data doesn't hold up the others, and for a
+ * byte @stream not even a single large message does.
+ */
+static void
+cockpit_socket_send (CockpitSocket *socket,
+                     const gchar *channel,
+                     WebSocketDataType data_type,
+                     GBytes *prefix,
+                     GBytes *payload,
+                     gboolean stream)
+{
+  CockpitSocketPending *pending;
+  CockpitSocketMessage *message;
+
+  pending = g_hash_table_lookup (socket->pending, channel);
+  if (socket->detached || (!pending && !(stream && g_bytes_get_size (payload) > SOCKET_SLICE) &&
+      web_socket_connection_get_buffered_amount (socket->connection) < SOCKET_WINDOW))
+    {
+      cockpit_socket_deliver (socket, data_type, prefix, payload);
+      return;
+    }
+
+  if (!pending)
+    {
+      pending = g_new0 (CockpitSocketPending, 1);
+      pending->channel = g_strdup (channel);
+      g_queue_init (&pending->messages);
+      g_hash_table_insert (socket->pending, pending->channel, pending);
+      g_queue_push_tail (&socket->rotation, pending);
+    }
+
+  message = cockpit_socket_message_new (data_type, prefix, payload, stream);
+  g_queue_push_tail (&pending->messages, message);
+  socket->pending_size += g_bytes_get_size (payload);
+
+  cockpit_socket_flush (socket);
+}
+
+static void
+on_socket_buffered_amount (GObject *object,
+                           GParamSpec *pspec,
+                           gpointer user_data)
+{
+  CockpitSocket *socket = user_data;
+  if (socket->rotation.length > 0)
+    cockpit_socket_flush (socket);
+  update_output (socket->service);
+}
+
+/*
+ * The WebSocket went away without closing. Keep the socket and its
+ * channels for a while, in case the frontend comes back to resume it.
+ */
+static void
+cockpit_socket_detach (CockpitSocket *socket)
+{
+  CockpitSocketPending *pending;
+  CockpitSocketMessage *message;
+
+  g_debug ("%s socket dropped, waiting for it to be resumed", socket->id);
+  socket->detached = TRUE;
+
+  /* The frontend sends a message it was in the middle of again */
+  g_clear_pointer (&socket->fragments, g_byte_array_unref);
+
+  /* What was waiting its turn now waits for the frontend to come back */
+  while ((pending = g_queue_pop_head (&socket->rotation)))
+    {
+      while ((message = g_queue_pop_head (&pending->messages)))
+        {
+          cockpit_socket_deliver (socket, message->data_type, message->prefix, message->payload);
+          cockpit_socket_message_free (message);
+        }
+      g_hash_table_remove (socket->pending, pending->channel);
+    }
+  socket->pending_size = 0;
+
+  if (!socket->resume_timeout)
+    socket->resume_timeout = g_timeout_add_seconds (cockpit_ws_resume_timeout, on_resume_timeout, socket);
+}
+
 static CockpitSocket *
 cockpit_socket_track (CockpitSockets *sockets,
+                      CockpitWebService *service,
                       WebSocketConnection *connection)
 {
   CockpitSocket *socket;
+  void *nonce;
 
   socket = g_new0 (CockpitSocket, 1);
   socket->id = g_strdup_printf ("%u:", sockets->next_socket_id++);
   socket->connection = g_object_ref (connection);
-  socket->channels = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  socket->channels = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, cockpit_socket_channel_free);
+  socket->groups = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_hash_table_unref);
+  socket->pending = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, cockpit_socket_pending_free);
+  g_queue_init (&socket->rotation);
+  g_queue_init (&socket->replay);
+  socket->service = service;
+
+  /* The frontend shows this to resume the socket after losing the connection */
+  nonce = cockpit_authorize_nonce (16);
+  if (nonce)
+    socket->resume_token = cockpit_hex_encode (nonce, 16);
+  free (nonce);
+
+  g_signal_connect (connection, "notify::buffered-amount", G_CALLBACK (on_socket_buffered_amount), socket);
 
   g_debug ("%s new socket", socket->id);
 
@@ -150,18 +620,51 @@ cockpit_socket_track (CockpitSockets *sockets,
   return socket;
 }
 
+static void
+cockpit_socket_remove_batch (CockpitSockets *sockets,
+                             CockpitSocketBatch *batch)
+{
+  GHashTableIter iter;
+  gpointer channel;
+
+  if (batch->pending)
+    {
+      g_hash_table_iter_init (&iter, batch->pending);
+      while (g_hash_table_iter_next (&iter, &channel, NULL))
+        g_hash_table_remove (sockets->batched, channel);
+    }
+
+  /* Frees the batch */
+  g_hash_table_remove (sockets->batches, batch->id);
+}
+
 static void
 cockpit_socket_destroy (CockpitSockets *sockets,
                         CockpitSocket *socket)
 {
+  CockpitSocketBatch *batch;
   GHashTableIter iter;
   const gchar *chan;
+  GList *batches = NULL;
+  GList *l;
 
   g_debug ("%s destroy socket", socket->id);
 
+  /* Nobody is left to answer, so don't wait for the replies */
+  g_hash_table_iter_init (&iter, sockets->batches);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&batch))
+    {
+      if (batch->socket == socket)
+        batches = g_list_prepend (batches, batch);
+    }
+  for (l = batches; l != NULL; l = g_list_next (l))
+    cockpit_socket_remove_batch (sockets, l->data);
+  g_list_free (batches);
+
   g_hash_table_iter_init (&iter, socket->channels);
   while (g_hash_table_iter_next (&iter, (gpointer *)&chan, NULL))
     g_hash_table_remove (sockets->by_channel, chan);
+  g_hash_table_remove_all (socket->groups);
   g_hash_table_remove_all (socket->channels);
 
   /* This owns the socket */
@@ -189,6 +692,8 @@ cockpit_sockets_close (CockpitSockets *sockets,
 static void
 cockpit_sockets_cleanup (CockpitSockets *sockets)
 {
+  g_hash_table_destroy (sockets->batched);
+  g_hash_table_destroy (sockets->batches);
   g_hash_table_destroy (sockets->by_connection);
   g_hash_table_destroy (sockets->by_channel);
 }
@@ -212,12 +717,24 @@ struct _CockpitWebService {
 
   CockpitTransport *transport;
   JsonObject *init_received;
+  gboolean open_batch;
   gulong control_sig;
   gulong recv_sig;
   gulong closed_sig;
   gboolean sent_done;
   guint credentials_timeout;
 
+  /* Channel traffic since the last ping, and seconds without */
+  gboolean busy;
+  guint quiet;
+
+  /* Our part of the output budget */
+  gboolean budgeted;
+  gsize output_size;
+  gboolean throttled;
+  gboolean stalled;
+  GQueue held_pongs;
+
   GHashTable *checksum_by_host;
   GHashTable *host_by_checksum;
 };
@@ -229,12 +746,156 @@ typedef struct {
 static guint sig_idling = 0;
 static guint sig_destroy = 0;
 
-G_DEFINE_TYPE (CockpitWebService, cockpit_web_service, G_TYPE_OBJECT);
+static void  cockpit_web_service_flow_iface_init  (CockpitFlowInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (CockpitWebService, cockpit_web_service, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (COCKPIT_TYPE_FLOW, cockpit_web_service_flow_iface_init));
+
+static gsize
+output_budget_limit (void)
+{
+  gsize limit = cockpit_ws_output_budget ? cockpit_ws_output_budget : output_budget.limit;
+  return limit / MAX (output_budget.workers, 1);
+}
+
+static void
+release_pongs (CockpitWebService *self)
+{
+  GBytes *payload;
+
+  while ((payload = g_queue_pop_head (&self->held_pongs)))
+    {
+      if (!self->sent_done)
+        cockpit_transport_send (self->transport, NULL, payload);
+      g_bytes_unref (payload);
+    }
+}
+
+/*
+ * Throttles the channels of this session while it has more than its share
+ * of the output budget buffered, and lets them go again once half of that
+ * has made it to the frontend. Channels without flow control don't care
+ * about pongs, so far over the share, stop reading from the bridge.
+ */
+static void
+check_output_share (CockpitWebService *self)
+{
+  gsize share;
+
+  share = MAX (output_budget_limit () / MAX (output_budget.n_sessions, 1), MIN_OUTPUT_SHARE);
+
+  if (!self->throttled && self->output_size > share)
+    {
+      g_debug ("%s: over its share of output, holding back pongs", self->id);
+      self->throttled = TRUE;
+    }
+  else if (self->throttled && self->output_size <= share / 2)
+    {
+      g_debug ("%s: back under its share of output", self->id);
+      self->throttled = FALSE;
+      release_pongs (self);
+    }
+
+  if (!self->stalled && self->output_size > 2 * share)
+    {
+      g_debug ("%s: far over its share of output, throttling bridge", self->id);
+      self->stalled = TRUE;
+      cockpit_flow_emit_pressure (COCKPIT_FLOW (self), TRUE);
+    }
+  else if (self->stalled && self->output_size <= share)
+    {
+      self->stalled = FALSE;
+      cockpit_flow_emit_pressure (COCKPIT_FLOW (self), FALSE);
+    }
+}
+
+/* The shares change as sessions come and go */
+static void
+check_output_shares (void)
+{
+  GList *l;
+
+  for (l = output_budget.sessions; l != NULL; l = g_list_next (l))
+    check_output_share (l->data);
+}
+
+static void
+join_output_budget (CockpitWebService *self)
+{
+  output_budget.sessions = g_list_prepend (output_budget.sessions, self);
+  output_budget.n_sessions++;
+  self->budgeted = TRUE;
+
+  check_output_shares ();
+}
+
+static void
+leave_output_budget (CockpitWebService *self)
+{
+  GBytes *payload;
+
+  if (!self->budgeted)
+    return;
+
+  output_budget.used -= self->output_size;
+  output_budget.sessions = g_list_remove (output_budget.sessions, self);
+  output_budget.n_sessions--;
+  self->output_size = 0;
+  self->budgeted = FALSE;
+
+  /* Nobody is left to acknowledge anything */
+  while ((payload = g_queue_pop_head (&self->held_pongs)))
+    g_bytes_unref (payload);
+  self->throttled = FALSE;
+
+  if (self->stalled)
+    {
+      self->stalled = FALSE;
+      cockpit_flow_emit_pressure (COCKPIT_FLOW (self), FALSE);
+    }
+
+  check_output_shares ();
+}
+
+/* Called whenever output is queued or written */
+static void
+update_output (CockpitWebService *self)
+{
+  CockpitSocket *socket;
+  GHashTableIter iter;
+  gsize size = 0;
+
+  if (!self->budgeted)
+    return;
+
+  g_hash_table_iter_init (&iter, self->sockets.by_connection);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&socket))
+    size += web_socket_connection_get_buffered_amount (socket->connection) + socket->pending_size;
+
+  output_budget.used -= self->output_size;
+  output_budget.used += size;
+  self->output_size = size;
+
+  check_output_share (self);
+}
+
+/* A frontend acknowledging channel data, which waits while we hold too much */
+static void
+relay_pong (CockpitWebService *self,
+            GBytes *payload)
+{
+  if (self->throttled)
+    g_queue_push_tail (&self->held_pongs, g_bytes_ref (payload));
+  else if (!self->sent_done)
+    cockpit_transport_send (self->transport, NULL, payload);
+}
 
 static void
 cockpit_web_service_dispose (GObject *object)
 {
   CockpitWebService *self = COCKPIT_WEB_SERVICE (object);
+  CockpitSocket *socket;
+  GHashTableIter iter;
   gboolean emit = FALSE;
 
   if (self->control_sig)
@@ -267,6 +928,19 @@ cockpit_web_service_dispose (GObject *object)
   self->closing = TRUE;
 
   cockpit_sockets_close (&self->sockets, NULL);
+  leave_output_budget (self);
+
+  /* Nobody is left to load the cached pages */
+  if (output_budget.n_sessions == 0)
+    cockpit_channel_response_cleanup ();
+
+  /* Nobody gets to resume a socket of a session that's going away */
+  g_hash_table_iter_init (&iter, self->sockets.by_connection);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&socket))
+    {
+      if (socket->detached)
+        cockpit_socket_give_up (socket);
+    }
 
   if (emit)
     g_signal_emit (self, sig_destroy, 0);
@@ -357,15 +1031,87 @@ process_and_relay_close (CockpitWebService *self,
   return valid;
 }
 
+static void
+add_kill_stats (CockpitSocketChannel *chan,
+                guint64 *in_bytes,
+                guint64 *out_bytes)
+{
+  *in_bytes += chan->in_bytes;
+  *out_bytes += chan->out_bytes;
+}
+
+/*
+ * The bridge doesn't report what a kill terminated, so this counts what
+ * cockpit-ws knows about: the channels of this socket, by group alone.
+ * The kill itself reaches matching channels of the whole session, and
+ * also looks at "host". See doc/protocol.md.
+ */
+static void
+reply_kill (CockpitWebService *self,
+            CockpitSocket *socket,
+            JsonObject *options,
+            const gchar *group)
+{
+  GHashTable *members;
+  GHashTableIter iter;
+  gpointer chan;
+  gpointer id;
+  guint64 in_bytes = 0;
+  guint64 out_bytes = 0;
+  guint count = 0;
+  GBytes *payload;
+
+  if (group)
+    {
+      members = g_hash_table_lookup (socket->groups, group);
+      if (members)
+        {
+          g_hash_table_iter_init (&iter, members);
+          while (g_hash_table_iter_next (&iter, &id, NULL))
+            {
+              add_kill_stats (g_hash_table_lookup (socket->channels, id), &in_bytes, &out_bytes);
+              count++;
+            }
+        }
+    }
+  else
+    {
+      g_hash_table_iter_init (&iter, socket->channels);
+      while (g_hash_table_iter_next (&iter, NULL, &chan))
+        {
+          add_kill_stats (chan, &in_bytes, &out_bytes);
+          count++;
+        }
+    }
+
+  json_object_set_string_member (options, "command", "killed");
+  json_object_set_int_member (options, "channels", count);
+  json_object_set_int_member (options, "sent-bytes", in_bytes);
+  json_object_set_int_member (options, "recv-bytes", out_bytes);
+
+  payload = cockpit_json_write_bytes (options);
+  if (cockpit_socket_is_open (socket))
+    cockpit_socket_deliver (socket, WEB_SOCKET_DATA_TEXT, self->control_prefix, payload);
+  g_bytes_unref (payload);
+}
+
 static gboolean
 process_kill (CockpitWebService *self,
               CockpitSocket *socket,
               JsonObject *options,
               GBytes *payload)
 {
+  const gchar *cookie;
+  const gchar *group;
+
   if (!self->sent_done)
     cockpit_transport_send (self->transport, NULL, payload);
 
+  /* Tell the caller what went away, when asked to. The bridge complains about invalid fields */
+  if (cockpit_json_get_string (options, "cookie", NULL, &cookie) && cookie &&
+      cockpit_json_get_string (options, "group", NULL, &group))
+    reply_kill (self, socket, options, group);
+
   return TRUE;
 }
 
@@ -386,6 +1132,24 @@ process_ping (CockpitWebService *self,
   return TRUE;
 }
 
+static gboolean
+process_ack (CockpitWebService *self,
+             CockpitSocket *socket,
+             JsonObject *options)
+{
+  gint64 received;
+
+  if (!cockpit_json_get_int (options, "received", -1, &received) ||
+      received < 0 || (guint64)received > socket->sent)
+    {
+      g_warning ("%s: received invalid \"received\" field in ack command", socket->id);
+      return FALSE;
+    }
+
+  cockpit_socket_acknowledge (socket, received);
+  return TRUE;
+}
+
 static void
 clear_and_free_string (gpointer data)
 {
@@ -628,6 +1392,8 @@ process_transport_init (CockpitWebService *self,
         {
           if (!cockpit_json_get_bool (capabilities, "explicit-superuser", FALSE, &explicit_superuser_capability))
             g_warning ("invalued 'explicit-superuser' value in init message");
+          if (!cockpit_json_get_bool (capabilities, "open-batch", FALSE, &self->open_batch))
+            g_warning ("invalid 'open-batch' value in init message");
         }
 
       /* If the bridge has the explicit-superuser capability, it will
@@ -678,6 +1444,98 @@ process_transport_init (CockpitWebService *self,
   return NULL;
 }
 
+static void
+finish_batch (CockpitWebService *self,
+              CockpitSocketBatch *batch,
+              GBytes *payload)
+{
+  if (batch->socket && cockpit_socket_is_open (batch->socket))
+    {
+      cockpit_socket_deliver (batch->socket, WEB_SOCKET_DATA_TEXT,
+                              self->control_prefix, payload);
+    }
+
+  cockpit_socket_remove_batch (&self->sockets, batch);
+}
+
+static gboolean
+process_transport_ready_batch (CockpitWebService *self,
+                               JsonObject *options,
+                               GBytes *payload)
+{
+  CockpitSocketBatch *batch;
+  const gchar *id;
+
+  if (!cockpit_json_get_string (options, "batch", NULL, &id) || !id)
+    {
+      g_warning ("invalid \"batch\" field in ready-batch message");
+      return FALSE;
+    }
+
+  /* The socket that sent the batch may have gone away in the meantime */
+  batch = g_hash_table_lookup (self->sockets.batches, id);
+  if (batch)
+    finish_batch (self, batch, payload);
+  else
+    g_debug ("received ready-batch for unknown batch %s", id);
+
+  return TRUE;
+}
+
+/*
+ * For a bridge that can't open a batch, each channel was opened on its
+ * own. Collect what it says about them, and reply once like it would have.
+ */
+static void
+collect_batch_control (CockpitWebService *self,
+                       CockpitSocketBatch *batch,
+                       const gchar *command,
+                       const gchar *channel,
+                       JsonObject *options)
+{
+  const gchar *problem;
+  JsonObject *ready;
+  JsonObject *object;
+  GList *members, *l;
+  GBytes *payload;
+
+  if (g_str_equal (command, "ready"))
+    {
+      ready = json_object_new ();
+      members = json_object_get_members (options);
+      for (l = members; l != NULL; l = g_list_next (l))
+        {
+          if (!g_str_equal (l->data, "command") && !g_str_equal (l->data, "channel"))
+            json_object_set_member (ready, l->data, json_object_dup_member (options, l->data));
+        }
+      g_list_free (members);
+      json_object_set_object_member (batch->ready, channel, ready);
+    }
+  else
+    {
+      if (!cockpit_json_get_string (options, "problem", NULL, &problem) || !problem)
+        problem = "";
+      json_object_set_string_member (batch->problems, channel, problem);
+    }
+
+  g_hash_table_remove (self->sockets.batched, channel);
+  g_hash_table_remove (batch->pending, channel);
+  if (g_hash_table_size (batch->pending) > 0)
+    return;
+
+  object = cockpit_transport_build_json ("command", "ready-batch",
+                                         "batch", batch->id,
+                                         NULL);
+  json_object_set_object_member (object, "channels", json_object_ref (batch->ready));
+  if (json_object_get_size (batch->problems) > 0)
+    json_object_set_object_member (object, "problems", json_object_ref (batch->problems));
+
+  payload = cockpit_json_write_bytes (object);
+  json_object_unref (object);
+  finish_batch (self, batch, payload);
+  g_bytes_unref (payload);
+}
+
 static gboolean
 on_transport_control (CockpitTransport *transport,
                       const gchar *command,
@@ -688,6 +1546,7 @@ on_transport_control (CockpitTransport *transport,
 {
   const gchar *problem = "protocol-error";
   CockpitWebService *self = user_data;
+  CockpitSocketBatch *batch = NULL;
   CockpitSocket *socket = NULL;
   gboolean valid = FALSE;
   gboolean forward;
@@ -713,6 +1572,10 @@ on_transport_control (CockpitTransport *transport,
           cockpit_creds_poison (self->creds);
           valid = TRUE;
         }
+      else if (g_strcmp0 (command, "ready-batch") == 0)
+        {
+          valid = process_transport_ready_batch (self, options, payload);
+        }
       else
         {
           g_debug ("received a %s unknown control command", command);
@@ -726,24 +1589,35 @@ on_transport_control (CockpitTransport *transport,
       /* Usually all control messages with a channel are forwarded */
       forward = TRUE;
 
+      if (g_strcmp0 (command, "ready") == 0 || g_strcmp0 (command, "close") == 0)
+        batch = g_hash_table_lookup (self->sockets.batched, channel);
+
       if (g_strcmp0 (command, "close") == 0)
         {
           valid = process_close (self, socket, channel);
         }
       else
         {
+          /* Part of the batch reply instead */
+          if (batch)
+            forward = FALSE;
           valid = TRUE;
         }
 
       if (forward)
         {
           /* Forward this message to the right websocket */
-          if (socket && web_socket_connection_get_ready_state (socket->connection) == WEB_SOCKET_STATE_OPEN)
+          if (socket && cockpit_socket_is_open (socket))
             {
-              web_socket_connection_send (socket->connection, WEB_SOCKET_DATA_TEXT,
-                                          self->control_prefix, payload);
+              /* Stays in order with the data for the channel */
+              cockpit_socket_send (socket, channel, WEB_SOCKET_DATA_TEXT,
+                                   self->control_prefix, payload, FALSE);
             }
         }
+
+      /* A channel that closes is still reported on its own, before the batch reply */
+      if (batch)
+        collect_batch_control (self, batch, command, channel, options);
     }
 
   if (!valid)
@@ -761,23 +1635,19 @@ on_transport_recv (CockpitTransport *transport,
                    gpointer user_data)
 {
   CockpitWebService *self = user_data;
-  WebSocketDataType data_type;
-  CockpitSocket *socket;
-  gchar *string;
-  GBytes *prefix;
+  CockpitSocketChannel *chan;
 
   if (!channel)
     return FALSE;
 
   /* Forward the message to the right socket */
-  socket = cockpit_socket_lookup_by_channel (&self->sockets, channel);
-  if (socket && web_socket_connection_get_ready_state (socket->connection) == WEB_SOCKET_STATE_OPEN)
-    {
-      string = g_strdup_printf ("%s\n", channel);
-      prefix = g_bytes_new_take (string, strlen (string));
-      data_type = GPOINTER_TO_INT (g_hash_table_lookup (socket->channels, channel));
-      web_socket_connection_send (socket->connection, data_type, prefix, payload);
-      g_bytes_unref (prefix);
+  chan = cockpit_socket_lookup_channel (&self->sockets, channel);
+  if (chan && cockpit_socket_is_open (chan->socket))
+    {
+      self->busy = TRUE;
+      chan->out_bytes += g_bytes_get_size (payload);
+      cockpit_socket_send (chan->socket, channel, chan->data_type, chan->prefix, payload, chan->stream);
+      update_output (self);
       return TRUE;
     }
 
@@ -798,6 +1668,21 @@ on_transport_closed (CockpitTransport *transport,
   g_object_run_dispose (G_OBJECT (self));
 }
 
+/*
+ * Binary channels of these payloads carry a plain stream of bytes, so
+ * messages may be split up on the way in either direction.
+ */
+static gboolean
+is_byte_stream (WebSocketDataType data_type,
+                const gchar *payload)
+{
+  return data_type == WEB_SOCKET_DATA_BINARY && payload &&
+         (g_str_equal (payload, "stream") ||
+          g_str_equal (payload, "fsread1") ||
+          g_str_equal (payload, "fsreplace1") ||
+          g_str_equal (payload, "http-stream2"));
+}
+
 gboolean
 cockpit_web_service_parse_binary (JsonObject *options,
                                   WebSocketDataType *data_type)
@@ -906,6 +1791,8 @@ process_and_relay_open (CockpitWebService *self,
                         JsonObject *options)
 {
   WebSocketDataType data_type = WEB_SOCKET_DATA_TEXT;
+  const gchar *group;
+  const gchar *type;
   GBytes *payload;
 
   if (self->closing)
@@ -916,49 +1803,316 @@ process_and_relay_open (CockpitWebService *self,
 
   if (channel == NULL)
     {
-      g_warning ("open command is missing the 'channel' field");
-      return FALSE;
+      g_warning ("open command is missing the 'channel' field");
+      return FALSE;
+    }
+
+  if (cockpit_socket_lookup_by_channel (&self->sockets, channel))
+    {
+      g_warning ("cannot open a channel %s with the same id as another channel", channel);
+      return FALSE;
+    }
+
+  if (!cockpit_web_service_parse_binary (options, &data_type))
+    return FALSE;
+
+  /* The bridge complains about an invalid group */
+  if (!cockpit_json_get_string (options, "group", NULL, &group))
+    group = NULL;
+  if (!cockpit_json_get_string (options, "payload", NULL, &type))
+    type = NULL;
+
+  if (socket)
+    cockpit_socket_add_channel (&self->sockets, socket, channel, data_type, group,
+                                is_byte_stream (data_type, type));
+
+  if (!self->sent_done)
+    {
+      payload = cockpit_json_write_bytes (options);
+      cockpit_transport_send (self->transport, NULL, payload);
+      g_bytes_unref (payload);
+    }
+
+  return TRUE;
+}
+
+static gboolean
+process_and_relay_open_batch (CockpitWebService *self,
+                              CockpitSocket *socket,
+                              JsonObject *options,
+                              GBytes *payload)
+{
+  WebSocketDataType shared_type = WEB_SOCKET_DATA_TEXT;
+  WebSocketDataType data_type;
+  CockpitSocketBatch *batch;
+  const gchar *shared_group = NULL;
+  const gchar *shared_payload = NULL;
+  const gchar *group;
+  const gchar *type;
+  const gchar *id;
+  JsonObject *shared;
+  JsonObject *entry;
+  JsonObject *open;
+  JsonArray *channels;
+  JsonNode *node;
+  const gchar *channel;
+  GHashTable *seen;
+  GBytes *bytes;
+  gchar *key;
+  guint i, length;
+
+  if (self->closing)
+    {
+      g_debug ("Ignoring open-batch command while web socket is closing");
+      return TRUE;
+    }
+
+  if (!cockpit_json_get_string (options, "batch", NULL, &id) || !id)
+    {
+      g_warning ("invalid \"batch\" field in open-batch command");
+      return FALSE;
+    }
+  if (g_hash_table_lookup (self->sockets.batches, id))
+    {
+      g_warning ("cannot open a batch %s with the same id as another batch", id);
+      return FALSE;
+    }
+
+  if (!cockpit_json_get_object (options, "options", NULL, &shared))
+    {
+      g_warning ("invalid \"options\" field in open-batch command");
+      return FALSE;
+    }
+  if (shared && !cockpit_web_service_parse_binary (shared, &shared_type))
+    return FALSE;
+  if (shared && !cockpit_json_get_string (shared, "group", NULL, &shared_group))
+    shared_group = NULL;
+  if (shared && !cockpit_json_get_string (shared, "payload", NULL, &shared_payload))
+    shared_payload = NULL;
+
+  node = json_object_get_member (options, "channels");
+  if (!node || !JSON_NODE_HOLDS_ARRAY (node))
+    {
+      g_warning ("invalid \"channels\" field in open-batch command");
+      return FALSE;
+    }
+
+  channels = json_node_get_array (node);
+  length = json_array_get_length (channels);
+
+  /* Check everything before tracking any of the channels */
+  seen = g_hash_table_new (g_str_hash, g_str_equal);
+  for (i = 0; i < length; i++)
+    {
+      node = json_array_get_element (channels, i);
+      if (!JSON_NODE_HOLDS_OBJECT (node) ||
+          !cockpit_json_get_string (json_node_get_object (node), "channel", NULL, &channel) ||
+          channel == NULL)
+        {
+          g_warning ("open-batch command has a channel without a 'channel' field");
+          g_hash_table_destroy (seen);
+          return FALSE;
+        }
+      if (!g_hash_table_add (seen, (gpointer)channel) ||
+          cockpit_socket_lookup_by_channel (&self->sockets, channel))
+        {
+          g_warning ("cannot open a channel %s with the same id as another channel", channel);
+          g_hash_table_destroy (seen);
+          return FALSE;
+        }
+      if (json_object_has_member (json_node_get_object (node), "binary") &&
+          !cockpit_web_service_parse_binary (json_node_get_object (node), &data_type))
+        {
+          g_hash_table_destroy (seen);
+          return FALSE;
+        }
+    }
+  g_hash_table_destroy (seen);
+
+  /* The reply goes back to this socket, even if none of the channels open */
+  batch = g_new0 (CockpitSocketBatch, 1);
+  batch->id = g_strdup (id);
+  batch->socket = socket;
+  g_hash_table_replace (self->sockets.batches, batch->id, batch);
+
+  for (i = 0; i < length; i++)
+    {
+      entry = json_array_get_object_element (channels, i);
+      cockpit_json_get_string (entry, "channel", NULL, &channel);
+
+      data_type = shared_type;
+      if (json_object_has_member (entry, "binary"))
+        cockpit_web_service_parse_binary (entry, &data_type);
+
+      if (!cockpit_json_get_string (entry, "group", shared_group, &group))
+        group = shared_group;
+      if (!cockpit_json_get_string (entry, "payload", shared_payload, &type))
+        type = shared_payload;
+
+      if (socket)
+        cockpit_socket_add_channel (&self->sockets, socket, channel, data_type, group,
+                                    is_byte_stream (data_type, type));
+    }
+
+  if (self->sent_done)
+    return TRUE;
+
+  if (self->open_batch)
+    {
+      cockpit_transport_send (self->transport, NULL, payload);
+      return TRUE;
+    }
+
+  /* The bridge doesn't know about batches, so open the channels one by one */
+  batch->pending = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  batch->ready = json_object_new ();
+  batch->problems = json_object_new ();
+
+  for (i = 0; i < length; i++)
+    {
+      entry = json_array_get_object_element (channels, i);
+      cockpit_json_get_string (entry, "channel", NULL, &channel);
+
+      open = cockpit_transport_build_batch_open (channel, shared, entry);
+      bytes = cockpit_json_write_bytes (open);
+      cockpit_transport_send (self->transport, NULL, bytes);
+      g_bytes_unref (bytes);
+      json_object_unref (open);
+
+      key = g_strdup (channel);
+      g_hash_table_add (batch->pending, key);
+      g_hash_table_replace (self->sockets.batched, key, batch);
+    }
+
+  /* Nothing to wait for */
+  if (length == 0)
+    {
+      open = cockpit_transport_build_json ("command", "ready-batch", "batch", id, NULL);
+      json_object_set_object_member (open, "channels", json_object_new ());
+      bytes = cockpit_json_write_bytes (open);
+      json_object_unref (open);
+      finish_batch (self, batch, bytes);
+      g_bytes_unref (bytes);
+    }
+
+  return TRUE;
+}
+
+static void
+process_logout (CockpitWebService *self,
+                JsonObject *options)
+{
+  /* Makes the credentials unusable */
+  cockpit_creds_poison (self->creds);
+
+  /* Destroys our web service, disconnects everything */
+  g_info ("Logging out session %s", self->id);
+  g_object_run_dispose (G_OBJECT (self));
+}
+
+/*
+ * The frontend lost its connection and came back on a new one, with the
+ * token of the socket it had. Move the new connection over to that socket
+ * and replay what the frontend missed. The new socket goes away.
+ */
+static gboolean
+resume_socket (CockpitWebService *self,
+               CockpitSocket *socket,
+               const gchar *token,
+               guint64 received)
+{
+  WebSocketConnection *connection = socket->connection;
+  CockpitSocket *previous = NULL;
+  CockpitSocket *candidate;
+  CockpitSocketMessage *message;
+  GHashTableIter iter;
+  JsonObject *object;
+  GBytes *payload;
+  GList *l;
+
+  g_hash_table_iter_init (&iter, self->sockets.by_connection);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&candidate))
+    {
+      if (candidate != socket && g_strcmp0 (candidate->resume_token, token) == 0)
+        previous = candidate;
+    }
+
+  /* Everything the frontend missed has to still be here */
+  if (previous && previous->resumable && !previous->closing && !previous->fragment_channel &&
+      g_hash_table_size (socket->channels) == 0 &&
+      received <= previous->sent && received >= previous->sent - previous->replay.length)
+    {
+      /* The frontend knows the old connection is gone, even if we haven't noticed */
+      if (!previous->detached)
+        {
+          g_signal_handlers_disconnect_by_data (previous->connection, self);
+          cockpit_socket_detach (previous);
+          if (web_socket_connection_get_ready_state (previous->connection) < WEB_SOCKET_STATE_CLOSING)
+            web_socket_connection_close (previous->connection, WEB_SOCKET_CLOSE_GOING_AWAY, "resumed");
+        }
+    }
+  else
+    {
+      previous = NULL;
     }
 
-  if (cockpit_socket_lookup_by_channel (&self->sockets, channel))
+  if (!previous || !previous->resumable)
     {
-      g_warning ("cannot open a channel %s with the same id as another channel", channel);
+      g_info ("Could not resume connection to session %s", self->id);
+      payload = cockpit_transport_build_control ("command", "resume", "problem", "not-resumable", NULL);
+      web_socket_connection_send (connection, WEB_SOCKET_DATA_TEXT, self->control_prefix, payload);
+      g_bytes_unref (payload);
       return FALSE;
     }
 
-  if (!cockpit_web_service_parse_binary (options, &data_type))
-    return FALSE;
+  g_debug ("%s resuming socket %s", socket->id, previous->id);
 
-  if (socket)
-    cockpit_socket_add_channel (&self->sockets, socket, channel, data_type);
+  if (previous->resume_timeout)
+    g_source_remove (previous->resume_timeout);
+  previous->resume_timeout = 0;
+  cockpit_socket_acknowledge (previous, received);
 
-  if (!self->sent_done)
+  g_signal_handlers_disconnect_by_data (previous->connection, self);
+  g_signal_handlers_disconnect_by_data (previous->connection, previous);
+  g_hash_table_steal (self->sockets.by_connection, previous->connection);
+  g_object_unref (previous->connection);
+  previous->connection = g_object_ref (connection);
+  previous->detached = FALSE;
+
+  json_object_unref (previous->init_received);
+  previous->init_received = json_object_ref (socket->init_received);
+
+  /* This frees the new socket, nothing but the connection was in it */
+  g_hash_table_insert (self->sockets.by_connection, connection, previous);
+  g_signal_connect (connection, "notify::buffered-amount", G_CALLBACK (on_socket_buffered_amount), previous);
+
+  object = json_object_new ();
+  json_object_set_string_member (object, "command", "resume");
+  json_object_set_int_member (object, "received", previous->received);
+  payload = cockpit_json_write_bytes (object);
+  json_object_unref (object);
+  web_socket_connection_send (connection, WEB_SOCKET_DATA_TEXT, self->control_prefix, payload);
+  g_bytes_unref (payload);
+
+  for (l = previous->replay.head; l != NULL; l = g_list_next (l))
     {
-      payload = cockpit_json_write_bytes (options);
-      cockpit_transport_send (self->transport, NULL, payload);
-      g_bytes_unref (payload);
+      message = l->data;
+      web_socket_connection_send (connection, message->data_type, message->prefix, message->payload);
     }
 
+  /* The old connection no longer holds the service */
+  caller_end (self);
   return TRUE;
 }
 
-static void
-process_logout (CockpitWebService *self,
-                JsonObject *options)
-{
-  /* Makes the credentials unusable */
-  cockpit_creds_poison (self->creds);
-
-  /* Destroys our web service, disconnects everything */
-  g_info ("Logging out session %s", self->id);
-  g_object_run_dispose (G_OBJECT (self));
-}
-
 static const gchar *
 process_socket_init (CockpitWebService *self,
                      CockpitSocket *socket,
                      JsonObject *options)
 {
+  const gchar *token;
+  gboolean resume;
+  gint64 received;
   gint64 version;
 
   if (!cockpit_json_get_int (options, "version", -1, &version))
@@ -969,10 +2123,25 @@ process_socket_init (CockpitWebService *self,
 
   if (version == 1)
     {
+      if (!cockpit_json_get_bool (options, "resume", FALSE, &resume) ||
+          !cockpit_json_get_string (options, "resume-token", NULL, &token) ||
+          !cockpit_json_get_int (options, "received", 0, &received) || received < 0)
+        {
+          g_warning ("invalid resume fields in init message");
+          return "protocol-error";
+        }
+
       g_debug ("received web socket init message");
       if (socket->init_received)
         json_object_unref (socket->init_received);
       socket->init_received = json_object_ref (options);
+
+      /* A resumed socket replaces this one */
+      if (token && resume_socket (self, socket, token, received))
+        return NULL;
+
+      if (resume && socket->resume_token)
+        socket->resumable = TRUE;
       return NULL;
     }
   else
@@ -1002,6 +2171,18 @@ inbound_protocol_error (CockpitWebService *self,
     }
 }
 
+/* Commands about the connection itself, which a resumed socket doesn't count */
+static gboolean
+is_unnumbered_command (const gchar *command,
+                       const gchar *channel)
+{
+  return !channel &&
+         (g_strcmp0 (command, "init") == 0 ||
+          g_strcmp0 (command, "ping") == 0 ||
+          g_strcmp0 (command, "pong") == 0 ||
+          g_strcmp0 (command, "ack") == 0);
+}
+
 static void
 dispatch_inbound_command (CockpitWebService *self,
                           CockpitSocket *socket,
@@ -1017,6 +2198,9 @@ dispatch_inbound_command (CockpitWebService *self,
   if (!valid)
     goto out;
 
+  if (!is_unnumbered_command (command, channel))
+    socket->received++;
+
   if (g_strcmp0 (command, "init") == 0)
     {
       problem = process_socket_init (self, socket, options);
@@ -1037,6 +2221,10 @@ dispatch_inbound_command (CockpitWebService *self,
     {
       valid = process_and_relay_open (self, socket, channel, options);
     }
+  else if (g_strcmp0 (command, "open-batch") == 0)
+    {
+      valid = process_and_relay_open_batch (self, socket, options, payload);
+    }
   else if (g_strcmp0 (command, "authorize") == 0)
     {
       valid = process_socket_authorize (self, socket, channel, options, payload);
@@ -1065,6 +2253,14 @@ dispatch_inbound_command (CockpitWebService *self,
     {
       valid = process_ping (self, socket, options);
     }
+  else if (!channel && g_strcmp0 (command, "ack") == 0)
+    {
+      valid = process_ack (self, socket, options);
+    }
+  else if (channel && g_strcmp0 (command, "pong") == 0)
+    {
+      relay_pong (self, payload);
+    }
   else if (channel)
     {
       /* Relay anything with a channel by default */
@@ -1080,16 +2276,56 @@ out:
 }
 
 static void
-on_web_socket_message (WebSocketConnection *connection,
-                       WebSocketDataType type,
-                       GBytes *message,
-                       CockpitWebService *self)
+relay_inbound_payload (CockpitWebService *self,
+                       const gchar *channel,
+                       GBytes *payload)
+{
+  CockpitSocketChannel *chan;
+
+  if (self->closing)
+    return;
+
+  self->busy = TRUE;
+  chan = cockpit_socket_lookup_channel (&self->sockets, channel);
+  if (chan)
+    chan->in_bytes += g_bytes_get_size (payload);
+  if (!self->sent_done)
+    cockpit_transport_send (self->transport, channel, payload);
+}
+
+static void
+relay_inbound_frame (CockpitWebService *self,
+                     const gchar *channel,
+                     GBytes *frame)
+{
+  CockpitSocketChannel *chan;
+
+  if (self->closing)
+    return;
+
+  self->busy = TRUE;
+  chan = cockpit_socket_lookup_channel (&self->sockets, channel);
+  if (chan)
+    chan->in_bytes += g_bytes_get_size (frame) - (strlen (channel) + 1);
+  if (!self->sent_done)
+    cockpit_transport_send_frame (self->transport, channel, frame);
+}
+
+static void
+dispatch_inbound_message (CockpitWebService *self,
+                          CockpitSocket *socket,
+                          GBytes *message)
 {
-  CockpitSocket *socket;
   g_autofree gchar *channel = NULL;
+  gchar buffer[128];
 
-  socket = cockpit_socket_lookup_by_connection (&self->sockets, connection);
-  g_return_if_fail (socket != NULL);
+  /* Payloads go to the bridge with the channel prefix they came with */
+  if (cockpit_transport_peek_channel (message, buffer, sizeof (buffer)))
+    {
+      socket->received++;
+      relay_inbound_frame (self, buffer, message);
+      return;
+    }
 
   g_autoptr(GBytes) payload = cockpit_transport_parse_frame (message, &channel);
   if (!payload)
@@ -1100,10 +2336,95 @@ on_web_socket_message (WebSocketConnection *connection,
     dispatch_inbound_command (self, socket, payload);
 
   /* An actual payload message */
-  else if (!self->closing)
+  else
     {
-      if (!self->sent_done)
-        cockpit_transport_send (self->transport, channel, payload);
+      socket->received++;
+      relay_inbound_payload (self, channel, payload);
+    }
+}
+
+static void
+on_web_socket_message (WebSocketConnection *connection,
+                       WebSocketDataType type,
+                       GBytes *message,
+                       CockpitWebService *self)
+{
+  CockpitSocket *socket;
+
+  socket = cockpit_socket_lookup_by_connection (&self->sockets, connection);
+  g_return_if_fail (socket != NULL);
+
+  dispatch_inbound_message (self, socket, message);
+}
+
+static void
+on_web_socket_fragment (WebSocketConnection *connection,
+                        WebSocketDataType type,
+                        GBytes *fragment,
+                        gboolean last,
+                        CockpitWebService *self)
+{
+  CockpitSocketChannel *chan = NULL;
+  CockpitSocket *socket;
+  GBytes *payload = NULL;
+  gchar *channel = NULL;
+  gconstpointer data;
+  gsize length;
+
+  socket = cockpit_socket_lookup_by_connection (&self->sockets, connection);
+  g_return_if_fail (socket != NULL);
+
+  /*
+   * The first fragment decides: data for a byte stream channel is relayed
+   * to the bridge as it arrives. Anything else is assembled here and then
+   * handled like any other message.
+   */
+  if (!socket->fragment_channel && !socket->fragments)
+    {
+      payload = cockpit_transport_maybe_frame (fragment, &channel);
+      if (payload && channel)
+        chan = cockpit_socket_lookup_channel (&self->sockets, channel);
+
+      if (chan && chan->socket == socket && chan->stream)
+        {
+          socket->fragment_channel = channel;
+          channel = NULL;
+        }
+      else
+        {
+          g_clear_pointer (&payload, g_bytes_unref);
+          socket->fragments = g_byte_array_new ();
+        }
+
+      g_free (channel);
+    }
+
+  if (socket->fragment_channel)
+    {
+      if (!payload)
+        payload = g_bytes_ref (fragment);
+      if (g_bytes_get_size (payload) > 0)
+        relay_inbound_payload (self, socket->fragment_channel, payload);
+      g_bytes_unref (payload);
+
+      if (last)
+        {
+          socket->received++;
+          g_clear_pointer (&socket->fragment_channel, g_free);
+        }
+    }
+  else
+    {
+      data = g_bytes_get_data (fragment, &length);
+      g_byte_array_append (socket->fragments, data, length);
+
+      if (last)
+        {
+          payload = g_byte_array_free_to_bytes (socket->fragments);
+          socket->fragments = NULL;
+          dispatch_inbound_message (self, socket, payload);
+          g_bytes_unref (payload);
+        }
     }
 }
 
@@ -1136,6 +2457,11 @@ on_web_socket_open (WebSocketConnection *connection,
   json_array_add_string_element (capabilities, "multi");
   json_array_add_string_element (capabilities, "credentials");
   json_array_add_string_element (capabilities, "binary");
+  if (socket->resume_token)
+    {
+      json_array_add_string_element (capabilities, "resume");
+      json_object_set_string_member (object, "resume-token", socket->resume_token);
+    }
   json_object_set_array_member (object, "capabilities", capabilities);
 
   info = json_object_new ();
@@ -1150,33 +2476,25 @@ on_web_socket_open (WebSocketConnection *connection,
 
   g_signal_connect (connection, "message",
                     G_CALLBACK (on_web_socket_message), self);
+  g_signal_connect (connection, "fragment",
+                    G_CALLBACK (on_web_socket_fragment), self);
 }
 
-static gboolean
-on_web_socket_closing (WebSocketConnection *connection,
-                       CockpitWebService *self)
+static void
+close_socket_channels (CockpitWebService *self,
+                       CockpitSocket *socket)
 {
-  CockpitSocket *socket;
   GHashTable *snapshot;
   GHashTableIter iter;
   const gchar *channel;
   GBytes *payload;
 
-  g_debug ("web socket closing");
-
-  if (self->sent_done)
-    return TRUE;
-
   /* Close any channels that were opened by this web socket */
   snapshot = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
-  socket = cockpit_socket_lookup_by_connection (&self->sockets, connection);
-  if (socket)
+  g_hash_table_iter_init (&iter, socket->channels);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&channel, NULL))
     {
-      g_hash_table_iter_init (&iter, socket->channels);
-      while (g_hash_table_iter_next (&iter, (gpointer *)&channel, NULL))
-        {
-          g_hash_table_add (snapshot, g_strdup (channel));
-        }
+      g_hash_table_add (snapshot, g_strdup (channel));
     }
 
   g_hash_table_iter_init (&iter, snapshot);
@@ -1190,6 +2508,23 @@ on_web_socket_closing (WebSocketConnection *connection,
       g_bytes_unref (payload);
     }
   g_hash_table_destroy (snapshot);
+}
+
+static gboolean
+on_web_socket_closing (WebSocketConnection *connection,
+                       CockpitWebService *self)
+{
+  CockpitSocket *socket;
+
+  g_debug ("web socket closing");
+
+  /* Closed on purpose, so not coming back */
+  socket = cockpit_socket_lookup_by_connection (&self->sockets, connection);
+  if (socket)
+    socket->closing = TRUE;
+
+  if (socket && !self->sent_done)
+    close_socket_channels (self, socket);
 
   return TRUE;
 }
@@ -1212,29 +2547,101 @@ on_web_socket_close (WebSocketConnection *connection,
   socket = cockpit_socket_lookup_by_connection (&self->sockets, connection);
   g_return_if_fail (socket != NULL);
 
+  /* Dropped without closing, the frontend may come back for it, which keeps holding us */
+  if (socket->resumable && !socket->closing && !socket->fragment_channel && !self->closing)
+    {
+      g_signal_handlers_disconnect_by_data (connection, self);
+      cockpit_socket_detach (socket);
+      update_output (self);
+      return;
+    }
+
+  cockpit_socket_destroy (&self->sockets, socket);
+  update_output (self);
+
+  caller_end (self);
+}
+
+static void
+expire_socket (CockpitWebService *self,
+               CockpitSocket *socket)
+{
+  g_debug ("%s dropped socket was not resumed", socket->id);
+
+  if (socket->resume_timeout)
+    g_source_remove (socket->resume_timeout);
+  socket->resume_timeout = 0;
+
+  if (!self->sent_done)
+    close_socket_channels (self, socket);
   cockpit_socket_destroy (&self->sockets, socket);
+  update_output (self);
 
+  /* The hold from the connection that went away */
   caller_end (self);
 }
 
+static gboolean
+on_resume_timeout (gpointer user_data)
+{
+  CockpitSocket *socket = user_data;
+
+  socket->resume_timeout = 0;
+  expire_socket (socket->service, socket);
+
+  return G_SOURCE_REMOVE;
+}
+
 static gboolean
 on_ping_time (gpointer user_data)
 {
   CockpitWebService *self = user_data;
   WebSocketConnection *connection;
+  CockpitSocket *socket;
   GHashTableIter iter;
+  JsonObject *object;
   GBytes *payload;
+  GBytes *ack;
 
   payload = cockpit_transport_build_control ("command", "ping", NULL);
 
   g_hash_table_iter_init (&iter, self->sockets.by_connection);
-  while (g_hash_table_iter_next (&iter, (gpointer *)&connection, NULL))
+  while (g_hash_table_iter_next (&iter, (gpointer *)&connection, (gpointer *)&socket))
     {
-      if (web_socket_connection_get_ready_state (connection) == WEB_SOCKET_STATE_OPEN)
-        web_socket_connection_send (connection, WEB_SOCKET_DATA_TEXT, self->control_prefix, payload);
+      if (web_socket_connection_get_ready_state (connection) != WEB_SOCKET_STATE_OPEN)
+        continue;
+
+      web_socket_connection_send (connection, WEB_SOCKET_DATA_TEXT, self->control_prefix, payload);
+
+      /* Lets a resumable frontend forget what we got */
+      if (socket->resumable && socket->received != socket->acked_received)
+        {
+          object = json_object_new ();
+          json_object_set_string_member (object, "command", "ack");
+          json_object_set_int_member (object, "received", socket->received);
+          ack = cockpit_json_write_bytes (object);
+          json_object_unref (object);
+          web_socket_connection_send (connection, WEB_SOCKET_DATA_TEXT, self->control_prefix, ack);
+          g_bytes_unref (ack);
+          socket->acked_received = socket->received;
+        }
     }
 
   g_bytes_unref (payload);
+
+  /* Give back what a burst of traffic left behind, once things calm down */
+  if (self->busy)
+    {
+      self->busy = FALSE;
+      self->quiet = 0;
+    }
+  else if (self->quiet < cockpit_ws_compact_timeout)
+    {
+      self->quiet += cockpit_ws_ping_interval;
+      if (self->quiet >= cockpit_ws_compact_timeout)
+        cockpit_web_service_compact (self);
+    }
+
   return TRUE;
 }
 
@@ -1262,6 +2669,15 @@ cockpit_web_service_class_init (CockpitWebServiceClass *klass)
   sig_destroy = g_signal_new ("destroy", COCKPIT_TYPE_WEB_SERVICE,
                               G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL,
                               G_TYPE_NONE, 0);
+
+  output_budget.limit = (gsize)cockpit_conf_uint ("WebService", "OutputBudget", 1, 2048, 256) * 1024 * 1024;
+  output_budget.admission = cockpit_conf_uint ("WebService", "AdmissionLimit", 1, 100, 90);
+}
+
+static void
+cockpit_web_service_flow_iface_init (CockpitFlowInterface *iface)
+{
+  /* Only used to stall the bridge when far over our share of output */
 }
 
 /**
@@ -1292,9 +2708,58 @@ cockpit_web_service_new (CockpitCreds *creds,
   self->recv_sig = g_signal_connect_after (self->transport, "recv", G_CALLBACK (on_transport_recv), self);
   self->closed_sig = g_signal_connect_after (self->transport, "closed", G_CALLBACK (on_transport_closed), self);
 
+  join_output_budget (self);
+
+  /* Reading from the bridge stops while we're far over our share */
+  if (COCKPIT_IS_PIPE_TRANSPORT (transport))
+    cockpit_flow_throttle (COCKPIT_FLOW (cockpit_pipe_transport_get_pipe (COCKPIT_PIPE_TRANSPORT (transport))),
+                           COCKPIT_FLOW (self));
+
   return self;
 }
 
+/**
+ * cockpit_web_service_saturated:
+ *
+ * Whether the sessions together are buffering so much output for their
+ * frontends that no new ones should be started right now.
+ *
+ * Returns: TRUE if new logins should be refused
+ */
+gboolean
+cockpit_web_service_saturated (void)
+{
+  if (output_budget.n_sessions == 0)
+    return FALSE;
+
+  /* Another session needs room for at least its minimum share */
+  return output_budget.used + MIN_OUTPUT_SHARE > output_budget_limit () / 100 * output_budget.admission;
+}
+
+/**
+ * cockpit_web_service_set_workers:
+ * @n_workers: the number of worker processes serving sessions
+ *
+ * Sessions in each worker process only get their part of the
+ * output budget, so that all of them together stay within it.
+ */
+void
+cockpit_web_service_set_workers (guint n_workers)
+{
+  output_budget.workers = n_workers;
+}
+
+/**
+ * cockpit_web_service_get_output_used:
+ *
+ * Returns: the number of bytes all sessions together hold for their frontends
+ */
+gsize
+cockpit_web_service_get_output_used (void)
+{
+  return output_budget.used;
+}
+
 WebSocketConnection *
 cockpit_web_service_create_socket (const gchar **protocols,
                                    const gchar *path,
@@ -1384,11 +2849,18 @@ cockpit_web_service_socket (CockpitWebService *self,
 
   connection = cockpit_web_service_create_socket (protocols, path, io_stream, headers, input_buffer, for_tls_proxy);
 
+  /* Large messages split up by the frontend don't have to be held whole */
+  g_object_set (connection,
+                "streaming", TRUE,
+                "max-message-size", (gulong)cockpit_conf_uint ("WebService", "MaxMessageSize", 0, G_MAXUINT, 0),
+                "fragment-size", (gulong)cockpit_conf_uint ("WebService", "FragmentSize", 0, G_MAXUINT, 0),
+                NULL);
+
   g_signal_connect (connection, "open", G_CALLBACK (on_web_socket_open), self);
   g_signal_connect (connection, "closing", G_CALLBACK (on_web_socket_closing), self);
   g_signal_connect (connection, "close", G_CALLBACK (on_web_socket_close), self);
 
-  cockpit_socket_track (&self->sockets, connection);
+  cockpit_socket_track (&self->sockets, self, connection);
   g_object_unref (connection);
 
   caller_begin (self);
@@ -1449,6 +2921,63 @@ cockpit_web_service_disconnect (CockpitWebService *self)
   g_object_run_dispose (G_OBJECT (self));
 }
 
+/**
+ * cockpit_web_service_get_memory_size:
+ * @self: the service
+ *
+ * An estimate of the memory this session holds in buffers: those of
+ * its WebSockets, messages waiting for them or kept to resume them,
+ * and those of the pipe to the bridge.
+ *
+ * Returns: the number of bytes held
+ */
+gsize
+cockpit_web_service_get_memory_size (CockpitWebService *self)
+{
+  WebSocketConnection *connection;
+  CockpitSocket *socket;
+  GHashTableIter iter;
+  gsize size = 0;
+
+  g_return_val_if_fail (COCKPIT_IS_WEB_SERVICE (self), 0);
+
+  g_hash_table_iter_init (&iter, self->sockets.by_connection);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&connection, (gpointer *)&socket))
+    size += web_socket_connection_get_memory_size (connection) + socket->pending_size + socket->replay_size;
+
+  if (COCKPIT_IS_PIPE_TRANSPORT (self->transport))
+    size += cockpit_pipe_get_memory_size (cockpit_pipe_transport_get_pipe (COCKPIT_PIPE_TRANSPORT (self->transport)));
+
+  return size;
+}
+
+/**
+ * cockpit_web_service_compact:
+ * @self: the service
+ *
+ * Shrink the buffers of this session back to their initial size.
+ * This happens by itself after cockpit_ws_compact_timeout seconds
+ * without any channel traffic.
+ */
+void
+cockpit_web_service_compact (CockpitWebService *self)
+{
+  WebSocketConnection *connection;
+  GHashTableIter iter;
+
+  g_return_if_fail (COCKPIT_IS_WEB_SERVICE (self));
+
+  g_hash_table_iter_init (&iter, self->sockets.by_connection);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&connection, NULL))
+    web_socket_connection_compact (connection);
+
+  if (COCKPIT_IS_PIPE_TRANSPORT (self->transport))
+    cockpit_pipe_compact (cockpit_pipe_transport_get_pipe (COCKPIT_PIPE_TRANSPORT (self->transport)));
+
+  g_debug ("%s: compacted session, holding %" G_GSIZE_FORMAT " bytes",
+           self->id, cockpit_web_service_get_memory_size (self));
+}
+
 gboolean
 cockpit_web_service_get_idling (CockpitWebService *self)
 {
@@ -57,6 +57,16 @@ void                 cockpit_web_service_set_id      (CockpitWebService *self,
 
 gboolean             cockpit_web_service_get_idling  (CockpitWebService *self);
 
+gsize                cockpit_web_service_get_memory_size (CockpitWebService *self);
+
+void                 cockpit_web_service_compact     (CockpitWebService *self);
+
+gboolean             cockpit_web_service_saturated   (void);
+
+void                 cockpit_web_service_set_workers (guint n_workers);
+
+gsize                cockpit_web_service_get_output_used (void);
+
 WebSocketConnection *   cockpit_web_service_create_socket    (const gchar **protocols,
                                                               const gchar *path,
                                                               GIOStream *io_stream,
@@ -32,6 +32,9 @@ extern const gchar *cockpit_ws_ssh_program;
 extern const gchar *cockpit_ws_default_host_header;
 extern gint cockpit_ws_specific_ssh_port;
 extern guint cockpit_ws_ping_interval;
+extern guint cockpit_ws_resume_timeout;
+extern guint cockpit_ws_compact_timeout;
+extern gsize cockpit_ws_output_budget;
 extern gint cockpit_ws_session_timeout;
 extern guint cockpit_ws_auth_process_timeout;
 extern guint cockpit_ws_auth_response_timeout;
@@ -0,0 +1,1054 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "common/cockpitjson.h"
+#include "common/cockpittransport.h"
+
+#include "websocket/websocket.h"
+
+#include "ws/mock-service.h"
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * A load generator for cockpit-ws.
+ *
+ * Unless told the --address of a running cockpit-ws, this starts its own
+ * on a free port, which logs in with mock-auth-command and runs the --bridge
+ * command. The mock D-Bus service is put on a private session bus for
+ * the dbus-json3 channels to talk to.
+ *
+ * Each WebSocket logs in separately, like a browser session would, and
+ * opens its channels. Every channel has one request in flight at a time,
+ * the time until the whole reply is back is its round trip. Channels
+ * of metrics1 only receive.
+ */
+
+#define MOCK_SERVICE_NAME "com.redhat.Cockpit.DBusTests.Test"
+
+static gint opt_sockets = 1;
+static gint opt_channels = 1;
+static gchar **opt_payloads = NULL;
+static gint opt_size = 64;
+static gint opt_duration = 10;
+static gchar *opt_address = NULL;
+static gint opt_pid = 0;
+static gint opt_workers = 1;
+static gchar *opt_bridge = NULL;
+static gchar *opt_user = NULL;
+static gchar *opt_password = NULL;
+
+static const gchar *known_payloads[] = {
+  "echo", "upper", "lower", "stream", "dbus-json3", "metrics1", NULL
+};
+
+typedef struct _LoadSocket LoadSocket;
+
+typedef struct {
+  LoadSocket *socket;
+  gchar *id;
+  const gchar *payload;
+  WebSocketDataType data_type;
+  GBytes *prefix;
+  GBytes *request;
+  gsize received;
+  gint64 sent_at;
+} LoadChannel;
+
+struct _LoadSocket {
+  guint number;
+  WebSocketConnection *connection;
+  GHashTable *channels;
+};
+
+static GMainLoop *loop = NULL;
+static GPtrArray *sockets = NULL;
+static gint exit_code = 0;
+
+static guint channels_ready = 0;
+static guint sockets_closed = 0;
+static gboolean running = FALSE;
+static gboolean finished = FALSE;
+static gint64 started_at = 0;
+static gint64 finished_at = 0;
+static guint64 round_trips = 0;
+static guint64 received_messages = 0;
+static guint64 received_bytes = 0;
+static guint64 sent_bytes = 0;
+static GArray *round_trip_usec = NULL;
+
+static GPid ws_pid = 0;
+static guint64 ws_ticks_start = 0;
+static guint64 ws_ticks_end = 0;
+static guint64 ws_rss = 0;
+static guint64 ws_peak_rss = 0;
+
+static GTestDBus *bus = NULL;
+static GObject *exported = NULL;
+static GSubprocess *ws_process = NULL;
+static gchar *config_dir = NULL;
+static gchar *config_file = NULL;
+
+/* ----------------------------------------------------------------------------
+ * Process statistics
+ */
+
+static gboolean
+read_process_stat (GPid pid,
+                   GPid *ppid,
+                   gchar **comm,
+                   guint64 *ticks)
+{
+  gchar *filename;
+  gchar *contents = NULL;
+  gchar **fields = NULL;
+  gchar *start;
+  gchar *end;
+  gboolean ret = FALSE;
+
+  filename = g_strdup_printf ("/proc/%d/stat", (int)pid);
+  if (!g_file_get_contents (filename, &contents, NULL, NULL))
+    goto out;
+
+  /* The command name may contain spaces, the fields after it don't */
+  start = strchr (contents, '(');
+  end = strrchr (contents, ')');
+  if (!start || !end || end < start)
+    goto out;
+
+  /* Field 3 comes first, the parent is field 4, utime and stime are fields 14 and 15 */
+  fields = g_strsplit (end + 2, " ", -1);
+  if (g_strv_length (fields) < 13)
+    goto out;
+
+  if (ppid)
+    *ppid = atoi (fields[1]);
+  if (comm)
+    *comm = g_strndup (start + 1, end - start - 1);
+  if (ticks)
+    *ticks = g_ascii_strtoull (fields[11], NULL, 10) + g_ascii_strtoull (fields[12], NULL, 10);
+  ret = TRUE;
+
+out:
+  g_strfreev (fields);
+  g_free (contents);
+  g_free (filename);
+  return ret;
+}
+
+/* The cockpit-ws, and its workers when it has any */
+static GArray *
+list_ws_processes (void)
+{
+  GArray *pids;
+  GDir *dir;
+  const gchar *name;
+  gchar *comm;
+  GPid ppid;
+  GPid pid;
+
+  pids = g_array_new (FALSE, FALSE, sizeof (GPid));
+  g_array_append_val (pids, ws_pid);
+
+  dir = g_dir_open ("/proc", 0, NULL);
+  if (!dir)
+    return pids;
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      pid = atoi (name);
+      if (pid <= 0 || pid == ws_pid)
+        continue;
+      if (read_process_stat (pid, &ppid, &comm, NULL))
+        {
+          if (ppid == ws_pid && g_str_equal (comm, "cockpit-ws"))
+            g_array_append_val (pids, pid);
+          g_free (comm);
+        }
+    }
+
+  g_dir_close (dir);
+  return pids;
+}
+
+static void
+read_ws_ticks (guint64 *ticks)
+{
+  GArray *pids;
+  guint64 value;
+  guint i;
+
+  *ticks = 0;
+  pids = list_ws_processes ();
+  for (i = 0; i < pids->len; i++)
+    {
+      if (read_process_stat (g_array_index (pids, GPid, i), NULL, NULL, &value))
+        *ticks += value;
+    }
+  g_array_unref (pids);
+}
+
+static guint64
+parse_status_kb (const gchar *contents,
+                 const gchar *field)
+{
+  const gchar *line;
+
+  line = strstr (contents, field);
+  if (!line)
+    return 0;
+
+  return g_ascii_strtoull (line + strlen (field), NULL, 10);
+}
+
+static void
+read_ws_memory (void)
+{
+  GArray *pids;
+  gchar *filename;
+  gchar *contents;
+  guint i;
+
+  ws_rss = ws_peak_rss = 0;
+  pids = list_ws_processes ();
+  for (i = 0; i < pids->len; i++)
+    {
+      filename = g_strdup_printf ("/proc/%d/status", (int)g_array_index (pids, GPid, i));
+      if (g_file_get_contents (filename, &contents, NULL, NULL))
+        {
+          ws_rss += parse_status_kb (contents, "\nVmRSS:");
+          ws_peak_rss += parse_status_kb (contents, "\nVmHWM:");
+          g_free (contents);
+        }
+      g_free (filename);
+    }
+  g_array_unref (pids);
+}
+
+/* ----------------------------------------------------------------------------
+ * Reporting
+ */
+
+static gint
+compare_usec (gconstpointer a,
+              gconstpointer b)
+{
+  gint64 one = *(const gint64 *)a;
+  gint64 two = *(const gint64 *)b;
+  return one < two ? -1 : (one > two ? 1 : 0);
+}
+
+static gdouble
+percentile_msec (gdouble fraction)
+{
+  guint index;
+
+  if (round_trip_usec->len == 0)
+    return 0;
+
+  index = MIN (round_trip_usec->len - 1, (guint)(fraction * round_trip_usec->len));
+  return g_array_index (round_trip_usec, gint64, index) / 1000.0;
+}
+
+static void
+report (void)
+{
+  gdouble seconds;
+  gchar *payloads;
+
+  seconds = (finished_at - started_at) / (gdouble)G_USEC_PER_SEC;
+  g_array_sort (round_trip_usec, compare_usec);
+
+  payloads = g_strjoinv (",", opt_payloads);
+  g_print ("sockets: %d, channels per socket: %d, payloads: %s, size: %d, workers: %d\n",
+           opt_sockets, opt_channels, payloads, opt_size, opt_workers);
+  g_free (payloads);
+
+  g_print ("duration: %.1f s\n", seconds);
+  g_print ("round trips: %" G_GUINT64_FORMAT " (%.1f/s)\n",
+           round_trips, round_trips / seconds);
+  g_print ("messages received: %" G_GUINT64_FORMAT " (%.1f/s)\n",
+           received_messages, received_messages / seconds);
+  g_print ("throughput: sent %.2f MB/s, received %.2f MB/s\n",
+           sent_bytes / seconds / (1024 * 1024), received_bytes / seconds / (1024 * 1024));
+
+  if (round_trip_usec->len > 0)
+    {
+      g_print ("round trip: p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+               percentile_msec (0.50), percentile_msec (0.99), percentile_msec (1.0));
+    }
+
+  if (ws_pid)
+    {
+      g_print ("cockpit-ws: cpu %.1f%%, rss %" G_GUINT64_FORMAT " kB, peak rss %" G_GUINT64_FORMAT " kB\n",
+               100.0 * (ws_ticks_end - ws_ticks_start) / sysconf (_SC_CLK_TCK) / seconds,
+               ws_rss, ws_peak_rss);
+    }
+}
+
+/* ----------------------------------------------------------------------------
+ * Channels
+ */
+
+static void
+load_channel_free (gpointer data)
+{
+  LoadChannel *chan = data;
+  if (chan->request)
+    g_bytes_unref (chan->request);
+  g_bytes_unref (chan->prefix);
+  g_free (chan->id);
+  g_free (chan);
+}
+
+static GBytes *
+build_request (const gchar *payload)
+{
+  gchar *string;
+  gchar *request;
+
+  if (g_str_equal (payload, "metrics1"))
+    return NULL;
+
+  string = g_strnfill (opt_size, 'x');
+  if (!g_str_equal (payload, "dbus-json3"))
+    return g_bytes_new_take (string, opt_size);
+
+  request = g_strdup_printf ("{\"call\":[\"/otree/frobber\",\"com.redhat.Cockpit.DBusTests.Frobber\","
+                             "\"HelloWorld\",[\"%s\"]],\"id\":\"1\"}", string);
+  g_free (string);
+  return g_bytes_new_take (request, strlen (request));
+}
+
+static LoadChannel *
+load_channel_new (LoadSocket *socket,
+                  guint number)
+{
+  LoadChannel *chan;
+  gchar *prefix;
+
+  chan = g_new0 (LoadChannel, 1);
+  chan->socket = socket;
+  chan->id = g_strdup_printf ("%u", number + 1);
+  chan->payload = opt_payloads[number % g_strv_length (opt_payloads)];
+  chan->data_type = g_str_equal (chan->payload, "stream") ? WEB_SOCKET_DATA_BINARY : WEB_SOCKET_DATA_TEXT;
+  chan->request = build_request (chan->payload);
+
+  prefix = g_strdup_printf ("%s\n", chan->id);
+  chan->prefix = g_bytes_new_take (prefix, strlen (prefix));
+
+  return chan;
+}
+
+static JsonObject *
+build_open (LoadChannel *chan)
+{
+  JsonObject *object;
+  JsonObject *metric;
+  JsonArray *array;
+
+  object = cockpit_transport_build_json ("command", "open",
+                                         "channel", chan->id,
+                                         "payload", chan->payload,
+                                         NULL);
+
+  if (g_str_equal (chan->payload, "stream"))
+    {
+      array = json_array_new ();
+      json_array_add_string_element (array, "cat");
+      json_object_set_array_member (object, "spawn", array);
+      json_object_set_string_member (object, "binary", "raw");
+    }
+  else if (g_str_equal (chan->payload, "dbus-json3"))
+    {
+      json_object_set_string_member (object, "bus", "session");
+      json_object_set_string_member (object, "name", MOCK_SERVICE_NAME);
+    }
+  else if (g_str_equal (chan->payload, "metrics1"))
+    {
+      json_object_set_string_member (object, "source", "internal");
+      json_object_set_int_member (object, "interval", 100);
+      array = json_array_new ();
+      metric = json_object_new ();
+      json_object_set_string_member (metric, "name", "cpu.basic.user");
+      json_object_set_string_member (metric, "derive", "rate");
+      json_array_add_object_element (array, metric);
+      metric = json_object_new ();
+      json_object_set_string_member (metric, "name", "memory.used");
+      json_array_add_object_element (array, metric);
+      json_object_set_array_member (object, "metrics", array);
+    }
+
+  return object;
+}
+
+static void
+send_control (LoadSocket *socket,
+              JsonObject *object)
+{
+  GBytes *prefix;
+  GBytes *payload;
+
+  prefix = g_bytes_new_static ("\n", 1);
+  payload = cockpit_json_write_bytes (object);
+  web_socket_connection_send (socket->connection, WEB_SOCKET_DATA_TEXT, prefix, payload);
+  g_bytes_unref (payload);
+  g_bytes_unref (prefix);
+}
+
+static void
+load_channel_send (LoadChannel *chan)
+{
+  if (!running || !chan->request)
+    return;
+
+  chan->received = 0;
+  chan->sent_at = g_get_monotonic_time ();
+  sent_bytes += g_bytes_get_size (chan->request);
+  web_socket_connection_send (chan->socket->connection, chan->data_type, chan->prefix, chan->request);
+}
+
+static void
+load_channel_recv (LoadChannel *chan,
+                   GBytes *payload)
+{
+  gint64 usec;
+
+  if (!running)
+    return;
+
+  received_messages++;
+  received_bytes += g_bytes_get_size (payload);
+
+  if (!chan->request)
+    return;
+
+  /* A stream may come back in several pieces */
+  chan->received += g_bytes_get_size (payload);
+  if (chan->data_type == WEB_SOCKET_DATA_BINARY && chan->received < g_bytes_get_size (chan->request))
+    return;
+
+  usec = g_get_monotonic_time () - chan->sent_at;
+  g_array_append_val (round_trip_usec, usec);
+  round_trips++;
+
+  load_channel_send (chan);
+}
+
+/* ----------------------------------------------------------------------------
+ * Sockets
+ */
+
+static void
+close_sockets (void)
+{
+  LoadSocket *socket;
+  guint i;
+
+  for (i = 0; i < sockets->len; i++)
+    {
+      socket = sockets->pdata[i];
+      if (web_socket_connection_get_ready_state (socket->connection) < WEB_SOCKET_STATE_CLOSING)
+        web_socket_connection_close (socket->connection, WEB_SOCKET_CLOSE_NORMAL, NULL);
+    }
+}
+
+static gboolean
+on_run_finished (gpointer user_data)
+{
+  running = FALSE;
+  finished = TRUE;
+  finished_at = g_get_monotonic_time ();
+
+  if (ws_pid)
+    {
+      read_ws_ticks (&ws_ticks_end);
+      read_ws_memory ();
+    }
+
+  report ();
+  close_sockets ();
+  return FALSE;
+}
+
+static void
+start_run (void)
+{
+  GHashTableIter iter;
+  LoadSocket *socket;
+  LoadChannel *chan;
+  guint i;
+
+  running = TRUE;
+  started_at = g_get_monotonic_time ();
+  if (ws_pid)
+    read_ws_ticks (&ws_ticks_start);
+
+  for (i = 0; i < sockets->len; i++)
+    {
+      socket = sockets->pdata[i];
+      g_hash_table_iter_init (&iter, socket->channels);
+      while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&chan))
+        load_channel_send (chan);
+    }
+
+  g_timeout_add_seconds (opt_duration, on_run_finished, NULL);
+}
+
+static void
+fail (const gchar *format,
+      ...) G_GNUC_PRINTF (1, 2);
+
+static void
+fail (const gchar *format,
+      ...)
+{
+  gchar *message;
+  va_list va;
+
+  va_start (va, format);
+  message = g_strdup_vprintf (format, va);
+  va_end (va);
+
+  g_printerr ("load-ws: %s\n", message);
+  g_free (message);
+
+  if (!finished)
+    {
+      finished = TRUE;
+      running = FALSE;
+      exit_code = 1;
+      close_sockets ();
+    }
+}
+
+static void
+open_channels (LoadSocket *socket)
+{
+  JsonObject *object;
+  LoadChannel *chan;
+  guint i;
+
+  object = cockpit_transport_build_json ("command", "init", "host", "localhost", NULL);
+  json_object_set_int_member (object, "version", 1);
+  send_control (socket, object);
+  json_object_unref (object);
+
+  for (i = 0; i < (guint)opt_channels; i++)
+    {
+      chan = load_channel_new (socket, i);
+      g_hash_table_insert (socket->channels, chan->id, chan);
+
+      object = build_open (chan);
+      send_control (socket, object);
+      json_object_unref (object);
+    }
+}
+
+static void
+process_control (LoadSocket *socket,
+                 GBytes *payload)
+{
+  const gchar *command;
+  const gchar *channel;
+  const gchar *problem;
+  JsonObject *options;
+
+  if (!cockpit_transport_parse_command (payload, &command, &channel, &options))
+    {
+      fail ("socket %u: invalid control message", socket->number);
+      return;
+    }
+
+  if (!channel)
+    {
+      if (g_str_equal (command, "init"))
+        open_channels (socket);
+    }
+  else if (g_hash_table_lookup (socket->channels, channel))
+    {
+      if (g_str_equal (command, "ready"))
+        {
+          channels_ready++;
+          if (channels_ready == (guint)(opt_sockets * opt_channels))
+            start_run ();
+        }
+      else if (g_str_equal (command, "close"))
+        {
+          if (!cockpit_json_get_string (options, "problem", NULL, &problem) || !problem)
+            problem = "closed";
+          fail ("socket %u: channel %s closed: %s", socket->number, channel, problem);
+        }
+    }
+
+  json_object_unref (options);
+}
+
+static void
+on_socket_message (WebSocketConnection *connection,
+                   WebSocketDataType type,
+                   GBytes *message,
+                   gpointer user_data)
+{
+  LoadSocket *socket = user_data;
+  LoadChannel *chan;
+  GBytes *payload;
+  gchar *channel;
+
+  payload = cockpit_transport_parse_frame (message, &channel);
+  if (!payload)
+    {
+      fail ("socket %u: invalid message", socket->number);
+      return;
+    }
+
+  if (!channel)
+    {
+      process_control (socket, payload);
+    }
+  else
+    {
+      chan = g_hash_table_lookup (socket->channels, channel);
+      if (chan)
+        load_channel_recv (chan, payload);
+    }
+
+  g_bytes_unref (payload);
+  g_free (channel);
+}
+
+static gboolean
+on_socket_error (WebSocketConnection *connection,
+                 GError *error,
+                 gpointer user_data)
+{
+  LoadSocket *socket = user_data;
+  fail ("socket %u: %s", socket->number, error->message);
+  return TRUE;
+}
+
+static void
+on_socket_close (WebSocketConnection *connection,
+                 gpointer user_data)
+{
+  LoadSocket *socket = user_data;
+  const gchar *reason;
+
+  if (!finished)
+    {
+      reason = web_socket_connection_get_close_data (connection);
+      fail ("socket %u: closed early: %s", socket->number, reason ? reason : "disconnected");
+    }
+
+  sockets_closed++;
+  if (sockets_closed == sockets->len)
+    g_main_loop_quit (loop);
+}
+
+static void
+load_socket_free (gpointer data)
+{
+  LoadSocket *socket = data;
+  g_signal_handlers_disconnect_by_data (socket->connection, socket);
+  g_object_unref (socket->connection);
+  g_hash_table_unref (socket->channels);
+  g_free (socket);
+}
+
+static LoadSocket *
+load_socket_new (guint number,
+                 const gchar *cookie)
+{
+  const gchar *protocols[] = { "cockpit1", NULL };
+  LoadSocket *socket;
+  gchar *origin;
+  gchar *url;
+
+  url = g_strdup_printf ("ws://%s/cockpit/socket", opt_address);
+  origin = g_strdup_printf ("http://%s", opt_address);
+
+  socket = g_new0 (LoadSocket, 1);
+  socket->number = number;
+  socket->channels = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, load_channel_free);
+  socket->connection = web_socket_client_new (url, origin, protocols);
+  web_socket_client_include_header (WEB_SOCKET_CLIENT (socket->connection), "Cookie", cookie);
+
+  g_signal_connect (socket->connection, "message", G_CALLBACK (on_socket_message), socket);
+  g_signal_connect (socket->connection, "error", G_CALLBACK (on_socket_error), socket);
+  g_signal_connect (socket->connection, "close", G_CALLBACK (on_socket_close), socket);
+
+  g_free (origin);
+  g_free (url);
+  return socket;
+}
+
+/* ----------------------------------------------------------------------------
+ * Logging in
+ */
+
+static gchar *
+login (GError **error)
+{
+  GSocketClient *client;
+  GSocketConnection *connection = NULL;
+  GHashTable *headers = NULL;
+  GString *response = NULL;
+  const gchar *cookie;
+  gchar buffer[4096];
+  gchar *credentials;
+  gchar *encoded;
+  gchar *request;
+  gchar *ret = NULL;
+  guint status = 0;
+  gssize offset;
+  gssize count;
+
+  client = g_socket_client_new ();
+  connection = g_socket_client_connect_to_host (client, opt_address, 9090, NULL, error);
+  if (!connection)
+    goto out;
+
+  credentials = g_strdup_printf ("%s:%s", opt_user, opt_password);
+  encoded = g_base64_encode ((const guchar *)credentials, strlen (credentials));
+  request = g_strdup_printf ("GET /cockpit/login HTTP/1.1\r\n"
+                             "Host: %s\r\n"
+                             "Authorization: Basic %s\r\n"
+                             "Connection: close\r\n"
+                             "\r\n", opt_address, encoded);
+  g_free (credentials);
+  g_free (encoded);
+
+  if (!g_output_stream_write_all (g_io_stream_get_output_stream (G_IO_STREAM (connection)),
+                                  request, strlen (request), NULL, NULL, error))
+    {
+      g_free (request);
+      goto out;
+    }
+  g_free (request);
+
+  /* The server closes the connection after its response */
+  response = g_string_new ("");
+  while ((count = g_input_stream_read (g_io_stream_get_input_stream (G_IO_STREAM (connection)),
+                                       buffer, sizeof (buffer), NULL, error)) > 0)
+    g_string_append_len (response, buffer, count);
+  if (count < 0)
+    goto out;
+
+  offset = web_socket_util_parse_status_line (response->str, response->len, NULL, &status, NULL);
+  if (offset > 0)
+    offset = web_socket_util_parse_headers (response->str + offset, response->len - offset, &headers);
+  if (offset <= 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "invalid login response");
+      goto out;
+    }
+
+  if (status != 200)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED, "login failed with status %u", status);
+      goto out;
+    }
+
+  cookie = g_hash_table_lookup (headers, "Set-Cookie");
+  if (!cookie || !g_str_has_prefix (cookie, "cockpit="))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "no cookie in login response");
+      goto out;
+    }
+
+  ret = g_strndup (cookie, strcspn (cookie, ";"));
+
+out:
+  if (headers)
+    g_hash_table_unref (headers);
+  if (response)
+    g_string_free (response, TRUE);
+  if (connection)
+    g_object_unref (connection);
+  g_object_unref (client);
+  return ret;
+}
+
+/* ----------------------------------------------------------------------------
+ * A local cockpit-ws
+ */
+
+static guint16
+find_free_port (void)
+{
+  GInetAddress *inet;
+  GSocketAddress *address;
+  GSocket *sock;
+  guint16 port = 0;
+
+  sock = g_socket_new (G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT, NULL);
+  g_return_val_if_fail (sock != NULL, 0);
+
+  inet = g_inet_address_new_loopback (G_SOCKET_FAMILY_IPV4);
+  address = g_inet_socket_address_new (inet, 0);
+  g_object_unref (inet);
+
+  if (g_socket_bind (sock, address, TRUE, NULL))
+    {
+      g_object_unref (address);
+      address = g_socket_get_local_address (sock, NULL);
+      if (address)
+        port = g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (address));
+    }
+
+  g_clear_object (&address);
+  g_object_unref (sock);
+  return port;
+}
+
+static gboolean
+wait_for_listening (GError **error)
+{
+  GSocketClient *client;
+  GSocketConnection *connection = NULL;
+  gint64 until;
+
+  client = g_socket_client_new ();
+  until = g_get_monotonic_time () + 10 * G_USEC_PER_SEC;
+
+  while (!connection)
+    {
+      g_clear_error (error);
+      connection = g_socket_client_connect_to_host (client, opt_address, 9090, NULL, error);
+      if (connection || g_get_monotonic_time () > until)
+        break;
+      g_usleep (G_USEC_PER_SEC / 20);
+    }
+
+  g_object_unref (client);
+  if (!connection)
+    return FALSE;
+
+  g_object_unref (connection);
+  return TRUE;
+}
+
+static gboolean
+start_local (GError **error)
+{
+  GSubprocessLauncher *launcher;
+  GDBusConnection *connection;
+  gchar *directory;
+  gchar *contents;
+  gchar *port;
+  gchar *workers;
+  const gchar *argv[] = {
+    BUILDDIR "/cockpit-ws", "--no-tls", "--address", "127.0.0.1", "--port", NULL,
+    "--workers", NULL, NULL
+  };
+
+  /* The mock service for dbus-json3 channels, on a bus of our own */
+  bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+  g_test_dbus_up (bus);
+
+  connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, error);
+  if (!connection)
+    return FALSE;
+  exported = mock_service_create_and_export (connection, "/otree");
+  g_bus_own_name_on_connection (connection, MOCK_SERVICE_NAME, G_BUS_NAME_OWNER_FLAGS_NONE,
+                                NULL, NULL, NULL, NULL);
+  g_object_unref (connection);
+
+  /* Basic authentication goes to mock-auth-command, which starts the bridge */
+  config_dir = g_dir_make_tmp ("load-ws.XXXXXX", error);
+  if (!config_dir)
+    return FALSE;
+  directory = g_build_filename (config_dir, "cockpit", NULL);
+  g_mkdir (directory, 0700);
+  config_file = g_build_filename (directory, "cockpit.conf", NULL);
+  g_free (directory);
+
+  contents = g_strdup_printf ("[basic]\ncommand = %s\n", BUILDDIR "/mock-auth-command");
+  if (!g_file_set_contents (config_file, contents, -1, error))
+    {
+      g_free (contents);
+      return FALSE;
+    }
+  g_free (contents);
+
+  port = g_strdup_printf ("%u", (guint)find_free_port ());
+  argv[5] = port;
+  workers = g_strdup_printf ("%d", opt_workers);
+  argv[7] = workers;
+  opt_address = g_strdup_printf ("127.0.0.1:%s", port);
+
+  launcher = g_subprocess_launcher_new (G_SUBPROCESS_FLAGS_NONE);
+  g_subprocess_launcher_setenv (launcher, "XDG_CONFIG_DIRS", config_dir, TRUE);
+  g_subprocess_launcher_setenv (launcher, "MOCK_AUTH_COMMAND_BRIDGE", opt_bridge, TRUE);
+  ws_process = g_subprocess_launcher_spawnv (launcher, argv, error);
+  g_object_unref (launcher);
+  g_free (workers);
+  g_free (port);
+
+  if (!ws_process)
+    return FALSE;
+
+  ws_pid = atoi (g_subprocess_get_identifier (ws_process));
+  return wait_for_listening (error);
+}
+
+static void
+stop_local (void)
+{
+  gchar *directory;
+
+  if (ws_process)
+    {
+      g_subprocess_send_signal (ws_process, SIGTERM);
+      g_subprocess_wait (ws_process, NULL, NULL);
+      g_object_unref (ws_process);
+    }
+
+  if (config_file)
+    {
+      g_unlink (config_file);
+      directory = g_path_get_dirname (config_file);
+      g_rmdir (directory);
+      g_free (directory);
+    }
+  if (config_dir)
+    g_rmdir (config_dir);
+
+  g_clear_object (&exported);
+  if (bus)
+    {
+      g_test_dbus_down (bus);
+      g_object_unref (bus);
+    }
+}
+
+int
+main (int argc,
+      char *argv[])
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  gchar *cookie;
+  guint i;
+
+  GOptionEntry entries[] = {
+    { "sockets", 's', 0, G_OPTION_ARG_INT, &opt_sockets, "Number of WebSockets, each logged in separately", "N" },
+    { "channels", 'c', 0, G_OPTION_ARG_INT, &opt_channels, "Number of channels on each WebSocket", "M" },
+    { "payload", 'p', 0, G_OPTION_ARG_STRING_ARRAY, &opt_payloads,
+      "Channel payload, repeat to mix: echo, upper, lower, stream, dbus-json3, metrics1", "PAYLOAD" },
+    { "size", 0, 0, G_OPTION_ARG_INT, &opt_size, "Size of each request in bytes", "BYTES" },
+    { "duration", 'd', 0, G_OPTION_ARG_INT, &opt_duration, "How long to run in seconds", "SECONDS" },
+    { "bridge", 0, 0, G_OPTION_ARG_STRING, &opt_bridge, "Bridge command line for the local cockpit-ws", "COMMAND" },
+    { "address", 0, 0, G_OPTION_ARG_STRING, &opt_address, "Use a running cockpit-ws instead of starting one", "HOST:PORT" },
+    { "pid", 0, 0, G_OPTION_ARG_INT, &opt_pid, "Process of the running cockpit-ws to measure", "PID" },
+    { "workers", 'w', 0, G_OPTION_ARG_INT, &opt_workers, "Number of worker processes of the local cockpit-ws", "N" },
+    { "user", 0, 0, G_OPTION_ARG_STRING, &opt_user, "User name to log in with", "USER" },
+    { "password", 0, 0, G_OPTION_ARG_STRING, &opt_password, "Password to log in with", "PASSWORD" },
+    { NULL }
+  };
+
+  signal (SIGPIPE, SIG_IGN);
+
+  context = g_option_context_new ("- generate load on cockpit-ws");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("load-ws: %s\n", error->message);
+      return 2;
+    }
+  g_option_context_free (context);
+
+  if (!opt_payloads)
+    opt_payloads = g_strsplit ("echo", " ", -1);
+  for (i = 0; opt_payloads[i]; i++)
+    {
+      if (!g_strv_contains (known_payloads, opt_payloads[i]))
+        {
+          g_printerr ("load-ws: unsupported payload: %s\n", opt_payloads[i]);
+          return 2;
+        }
+    }
+
+  if (opt_sockets < 1 || opt_channels < 1 || opt_size < 1 || opt_duration < 1 || opt_workers < 1)
+    {
+      g_printerr ("load-ws: sockets, channels, size, duration and workers must be positive\n");
+      return 2;
+    }
+
+  /* These are the credentials that make mock-auth-command start a bridge */
+  if (!opt_user)
+    opt_user = g_strdup ("bridge-user");
+  if (!opt_password)
+    opt_password = g_strdup ("this is the password");
+  if (!opt_bridge)
+    opt_bridge = g_strdup (BUILDDIR "/cockpit-bridge");
+
+  loop = g_main_loop_new (NULL, FALSE);
+  round_trip_usec = g_array_new (FALSE, FALSE, sizeof (gint64));
+  sockets = g_ptr_array_new_with_free_func (load_socket_free);
+
+  if (opt_address)
+    ws_pid = opt_pid;
+  else if (!start_local (&error))
+    {
+      g_printerr ("load-ws: couldn't start cockpit-ws: %s\n", error->message);
+      g_error_free (error);
+      exit_code = 1;
+      goto out;
+    }
+
+  for (i = 0; i < (guint)opt_sockets; i++)
+    {
+      cookie = login (&error);
+      if (!cookie)
+        {
+          g_printerr ("load-ws: couldn't log in: %s\n", error->message);
+          g_error_free (error);
+          exit_code = 1;
+          goto out;
+        }
+
+      g_ptr_array_add (sockets, load_socket_new (i, cookie));
+      g_free (cookie);
+    }
+
+  g_main_loop_run (loop);
+
+out:
+  g_ptr_array_unref (sockets);
+  g_array_unref (round_trip_usec);
+  g_main_loop_unref (loop);
+  stop_local ();
+
+  g_strfreev (opt_payloads);
+  g_free (opt_address);
+  g_free (opt_bridge);
+  g_free (opt_user);
+  g_free (opt_password);
+
+  return exit_code;
+}
@@ -32,6 +32,9 @@
 
 #include "cockpithandlers.h"
 #include "cockpitbranding.h"
+#include "cockpitchannelresponse.h"
+#include "cockpitsupervisor.h"
+#include "cockpitwebservice.h"
 
 #include "common/cockpitconf.h"
 #include "common/cockpithacks-glib.h"
@@ -49,6 +52,8 @@ static gboolean  opt_for_tls_proxy    = FALSE;
 static gboolean  opt_local_ssh    = FALSE;
 static gchar     *opt_local_session = NULL;
 static gboolean  opt_version      = FALSE;
+static gint      opt_workers      = 1;
+static gint      opt_worker       = -1;
 
 static GOptionEntry cmd_entries[] = {
   {"port", 'p', 0, G_OPTION_ARG_INT, &opt_port, "Local port to bind to (9090 if unset)", NULL},
@@ -61,6 +66,9 @@ static GOptionEntry cmd_entries[] = {
   {"local-session", 0, 0, G_OPTION_ARG_STRING, &opt_local_session,
       "Launch a bridge in the local session (path to cockpit-bridge or '-' for stdin/out); implies --no-tls",
       "BRIDGE" },
+  {"workers", 0, 0, G_OPTION_ARG_INT, &opt_workers,
+      "Serve sessions from this many processes (1 if unset); needs --no-tls or --for-tls-proxy", "N" },
+  {"worker", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_INT, &opt_worker, "Run as worker of a supervisor", "INDEX" },
   {"version", 0, 0, G_OPTION_ARG_NONE, &opt_version, "Print version information", NULL },
   {NULL}
 };
@@ -123,6 +131,8 @@ main (int argc,
   g_autofree gchar *login_html = NULL;
   g_autofree gchar *login_po_js = NULL;
   g_autoptr(CockpitWebServer) server = NULL;
+  g_auto(GStrv) worker_argv = NULL;
+  CockpitSupervisor *supervisor = NULL;
   CockpitWebServerFlags server_flags = COCKPIT_WEB_SERVER_NONE;
   CockpitHandlerData data;
 
@@ -136,6 +146,9 @@ main (int argc,
 
   memset (&data, 0, sizeof (data));
 
+  /* Workers are started with the same arguments */
+  worker_argv = g_strdupv (argv);
+
   context = g_option_context_new (NULL);
   g_option_context_add_main_entries (context, cmd_entries, NULL);
   if (!g_option_context_parse (context, &argc, &argv, &error))
@@ -158,6 +171,25 @@ main (int argc,
   if (opt_for_tls_proxy || cockpit_conf_bool ("WebService", "X-For-CockpitClient", FALSE))
     opt_no_tls = TRUE;
 
+  if (opt_workers < 1)
+    {
+      g_printerr ("--workers must be at least 1\n");
+      goto out;
+    }
+
+  if (opt_worker >= opt_workers)
+    {
+      g_printerr ("--worker must be less than --workers\n");
+      goto out;
+    }
+
+  /* The supervisor needs to see the cookies to pick a worker */
+  if (opt_workers > 1 && (!opt_no_tls || opt_local_session))
+    {
+      g_printerr ("--workers needs --no-tls or --for-tls-proxy, and can't be used with --local-session\n");
+      goto out;
+    }
+
   cockpit_hacks_redirect_gdebug_to_stderr ();
 
   if (opt_local_session || opt_no_tls)
@@ -184,6 +216,34 @@ main (int argc,
 
   loop = g_main_loop_new (NULL, FALSE);
 
+  if (opt_workers > 1 && opt_worker < 0)
+    {
+      const gint n_listen_fds = sd_listen_fds (true);
+
+      /* When socket activated, quit after the last worker has gone idle */
+      supervisor = cockpit_supervisor_new ((const gchar **)worker_argv, opt_workers,
+                                           n_listen_fds ? loop : NULL);
+      if (n_listen_fds)
+        {
+          for (gint fd = SD_LISTEN_FDS_START; fd < SD_LISTEN_FDS_START + n_listen_fds; fd++)
+            if (!cockpit_supervisor_add_fd_listener (supervisor, fd, &error))
+              {
+                g_prefix_error (&error, "Unable to acquire LISTEN_FDS: ");
+                goto out;
+              }
+        }
+      else if (!cockpit_supervisor_add_inet_listener (supervisor, opt_address, opt_port, &error))
+        {
+          g_prefix_error (&error, "Error starting web server: ");
+          goto out;
+        }
+
+      cockpit_supervisor_start (supervisor);
+      g_main_loop_run (loop);
+      ret = 0;
+      goto out;
+    }
+
   data.os_release = cockpit_system_load_os_release ();
   data.auth = cockpit_auth_new (opt_local_ssh, opt_for_tls_proxy ? COCKPIT_AUTH_FOR_TLS_PROXY : COCKPIT_AUTH_NONE);
   roots = setup_static_roots (data.os_release);
@@ -193,6 +253,7 @@ main (int argc,
   data.login_html = (const gchar *)login_html;
   login_po_js = g_strdup (DATADIR "/cockpit/static/po.js");
   data.login_po_js = (const gchar *)login_po_js;
+  data.login_cache = cockpit_handler_new_login_cache ();
 
   if (opt_for_tls_proxy)
     server_flags |= COCKPIT_WEB_SERVER_FOR_TLS_PROXY;
@@ -204,8 +265,15 @@ main (int argc,
 
   server = cockpit_web_server_new (certificate, server_flags);
 
-  const gint n_listen_fds = sd_listen_fds (true);
-  if (n_listen_fds)
+  const gint n_listen_fds = opt_worker < 0 ? sd_listen_fds (true) : 0;
+  if (opt_worker >= 0)
+    {
+      cockpit_auth_set_affinity (data.auth, opt_worker, opt_workers);
+      cockpit_web_service_set_workers (opt_workers);
+      if (!cockpit_supervisor_serve_worker (server, data.auth, COCKPIT_SUPERVISOR_WORKER_FD, loop, &error))
+        goto out;
+    }
+  else if (n_listen_fds)
     {
       for (gint fd = SD_LISTEN_FDS_START; fd < SD_LISTEN_FDS_START + n_listen_fds; fd++)
         if (!cockpit_web_server_add_fd_listener (server, fd, &error))
@@ -300,11 +368,15 @@ main (int argc,
 out:
   if (error)
     g_printerr ("cockpit-ws: %s\n", error->message);
+  cockpit_supervisor_free (supervisor);
   g_clear_object (&data.auth);
   if (data.os_release)
     g_hash_table_unref (data.os_release);
+  if (data.login_cache)
+    g_hash_table_unref (data.login_cache);
   g_free (opt_address);
   g_free (opt_local_session);
+  cockpit_channel_response_cleanup ();
   cockpit_conf_cleanup ();
   return ret;
 }
@@ -320,7 +320,9 @@ out:
   free (message);
   if (success)
     {
-      if (launch_bridge)
+      if (launch_bridge && getenv ("MOCK_AUTH_COMMAND_BRIDGE"))
+        execl ("/bin/sh", "sh", "-c", getenv ("MOCK_AUTH_COMMAND_BRIDGE"), NULL);
+      else if (launch_bridge)
         execlp (BUILDDIR "/cockpit-bridge", BUILDDIR "/cockpit-bridge", NULL);
       else
         execlp ("cat", "cat", NULL);
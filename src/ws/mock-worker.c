@@ -0,0 +1,195 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include <sys/socket.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Stands in for a cockpit-ws worker of a CockpitSupervisor. Answers each
+ * passed connection with its index, its pid and the requested path.
+ * Some paths do more:
+ *
+ *  /cockpit/conversation/ID: tells the supervisor about conversation ID
+ *  /cockpit/idle: tells the supervisor that it's idle
+ *  /cockpit/stall: doesn't take more connections until the client of
+ *                  this one closes it
+ */
+
+/* Same as COCKPIT_SUPERVISOR_WORKER_FD */
+#define WORKER_FD 3
+
+static void
+send_to_supervisor (const gchar *message)
+{
+  if (send (WORKER_FD, message, strlen (message), MSG_NOSIGNAL) < 0)
+    g_printerr ("mock-worker: couldn't send to supervisor: %s\n", g_strerror (errno));
+}
+
+static void
+respond (int fd,
+         guint index,
+         const gchar *path)
+{
+  gchar *response;
+  gsize written;
+  gssize count;
+  gsize length;
+
+  response = g_strdup_printf ("HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\n\r\n%u %d %s\n",
+                              index, (int)getpid (), path);
+  length = strlen (response);
+
+  for (written = 0; written < length; written += count)
+    {
+      count = write (fd, response + written, length - written);
+      if (count < 0)
+        {
+          if (errno == EINTR)
+            {
+              count = 0;
+              continue;
+            }
+          g_printerr ("mock-worker: couldn't write response: %s\n", g_strerror (errno));
+          break;
+        }
+    }
+
+  g_free (response);
+}
+
+static void
+wait_for_close (int fd)
+{
+  gchar buffer[256];
+  gssize count;
+
+  /* The answer is complete, the client closes when it wants us back */
+  shutdown (fd, SHUT_WR);
+  do
+    count = read (fd, buffer, sizeof (buffer));
+  while (count > 0 || (count < 0 && errno == EINTR));
+}
+
+int
+main (int argc,
+      char *argv[])
+{
+  gchar buffer[16384];
+  union {
+    struct cmsghdr align;
+    gchar buf[CMSG_SPACE (sizeof (int))];
+  } control;
+  struct iovec iov;
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  guint64 received = 0;
+  guint index = 0;
+  gchar *message;
+  gchar *path;
+  gssize count;
+  int connection;
+  int flags;
+  int i;
+
+  for (i = 1; i < argc; i++)
+    {
+      if (g_str_has_prefix (argv[i], "--worker="))
+        index = atoi (argv[i] + strlen ("--worker="));
+    }
+
+  for (;;)
+    {
+      iov.iov_base = buffer;
+      iov.iov_len = sizeof (buffer) - 1;
+      memset (&msg, 0, sizeof (msg));
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = &control;
+      msg.msg_controllen = sizeof (control);
+
+      count = recvmsg (WORKER_FD, &msg, MSG_CMSG_CLOEXEC);
+      if (count < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          g_printerr ("mock-worker: couldn't receive from supervisor: %s\n", g_strerror (errno));
+          return 1;
+        }
+
+      /* The supervisor retired us */
+      if (count == 0)
+        return 0;
+
+      connection = -1;
+      for (cmsg = CMSG_FIRSTHDR (&msg); cmsg != NULL; cmsg = CMSG_NXTHDR (&msg, cmsg))
+        {
+          if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            memcpy (&connection, CMSG_DATA (cmsg), sizeof (int));
+        }
+
+      if (connection < 0)
+        {
+          g_printerr ("mock-worker: received request without a connection\n");
+          return 1;
+        }
+
+      received++;
+
+      /* The supervisor made it non-blocking */
+      flags = fcntl (connection, F_GETFL);
+      fcntl (connection, F_SETFL, flags & ~O_NONBLOCK);
+
+      /* The request line has what we need: GET /path HTTP/1.x */
+      buffer[count] = '\0';
+      path = strchr (buffer, ' ');
+      if (path)
+        path = g_strndup (path + 1, strcspn (path + 1, " \r\n"));
+      else
+        path = g_strdup ("");
+
+      if (g_str_has_prefix (path, "/cockpit/conversation/"))
+        {
+          message = g_strdup_printf ("C %s", path + strlen ("/cockpit/conversation/"));
+          send_to_supervisor (message);
+          g_free (message);
+        }
+      else if (g_str_equal (path, "/cockpit/idle"))
+        {
+          message = g_strdup_printf ("I %" G_GUINT64_FORMAT, received);
+          send_to_supervisor (message);
+          g_free (message);
+        }
+
+      respond (connection, index, path);
+
+      if (g_str_equal (path, "/cockpit/stall"))
+        wait_for_close (connection);
+
+      close (connection);
+      g_free (path);
+    }
+}
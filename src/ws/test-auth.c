@@ -232,6 +232,60 @@ test_userpass_cookie_check (Test *test,
   json_object_unref (response);
 }
 
+static void
+test_affinity (Test *test,
+               gconstpointer data)
+{
+  GAsyncResult *result = NULL;
+  CockpitWebService *service;
+  JsonObject *response;
+  GError *error = NULL;
+  GHashTable *headers;
+  guint count = 3;
+  guint index;
+  guint i;
+
+  /* No cookie, no preference */
+  headers = web_socket_util_new_headers ();
+  g_assert_cmpint (cockpit_auth_affinity ("/cockpit/", headers, count), ==, -1);
+  g_hash_table_insert (headers, g_strdup ("Cookie"), g_strdup ("cockpit=blah"));
+  g_assert_cmpint (cockpit_auth_affinity ("/cockpit/", headers, count), ==, -1);
+  g_hash_table_unref (headers);
+
+  for (index = 0; index < count; index++)
+    {
+      cockpit_auth_set_affinity (test->auth, index, count);
+
+      for (i = 0; i < 3; i++)
+        {
+          headers = mock_auth_basic_header ("me", "this is the password");
+          cockpit_auth_login_async (test->auth, "/cockpit/", NULL, headers, on_ready_get_result, &result);
+          g_hash_table_unref (headers);
+
+          while (result == NULL)
+            g_main_context_iteration (NULL, TRUE);
+
+          headers = web_socket_util_new_headers ();
+          response = cockpit_auth_login_finish (test->auth, result, NULL, headers, &error);
+          g_assert_no_error (error);
+          g_clear_object (&result);
+
+          /* The cookie leads back to the worker that handed it out */
+          mock_auth_include_cookie_as_if_client (headers, headers, "cockpit");
+          g_assert_cmpint (cockpit_auth_affinity ("/cockpit/", headers, count), ==, index);
+          g_assert_cmpint (cockpit_auth_affinity ("/cockpit/@localhost/system/index.html", headers, count), ==, index);
+
+          /* And still works with that worker */
+          service = cockpit_auth_check_cookie (test->auth, "/cockpit", headers);
+          g_assert (service != NULL);
+          g_object_unref (service);
+
+          g_hash_table_unref (headers);
+          json_object_unref (response);
+        }
+    }
+}
+
 static void
 test_userpass_bad (Test *test,
                    gconstpointer data)
@@ -1201,6 +1255,7 @@ main (int argc,
   g_test_add ("/auth/userpass-header-check", Test, NULL, setup, test_userpass_cookie_check, teardown);
   g_test_add ("/auth/userpass-store-check", Test, &fixture_superuser_any, setup, test_userpass_cookie_check, teardown);
   g_test_add ("/auth/userpass-bad", Test, NULL, setup, test_userpass_bad, teardown);
+  g_test_add ("/auth/affinity", Test, NULL, setup, test_affinity, teardown);
   g_test_add ("/auth/userpass-emptypass", Test, NULL, setup, test_userpass_emptypass, teardown);
   g_test_add ("/auth/headers-bad", Test, NULL, setup, test_headers_bad, teardown);
   g_test_add ("/auth/idle-timeout", Test, NULL, setup, test_idle_timeout, teardown);
@@ -677,6 +677,42 @@ test_resource_not_modified (TestResourceCase *tc,
   g_object_unref (response);
 }
 
+static void
+test_resource_not_modified_brotli (TestResourceCase *tc,
+                                   gconstpointer data)
+{
+  CockpitWebResponse *response;
+  GError *error = NULL;
+  GBytes *bytes;
+  gconstpointer str;
+
+  request_checksum (tc);
+
+  /* The ETag of the identity or gzip variant doesn't match a Brotli one */
+  g_hash_table_replace (tc->headers, g_strdup ("Accept-Encoding"), g_strdup ("gzip, br"));
+  g_hash_table_insert (tc->headers, g_strdup ("If-None-Match"),
+                       g_strdup ("\"" CHECKSUM "-c\""));
+
+  response = cockpit_web_response_new (tc->io, "/unused", "/unused", NULL, tc->headers, COCKPIT_WEB_RESPONSE_NONE);
+  cockpit_channel_response_serve (tc->service, tc->headers, response,
+                                CHECKSUM,
+                                "/test/sub/file.ext");
+
+  while (cockpit_web_response_get_state (response) != COCKPIT_WEB_RESPONSE_SENT)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_output_stream_close (G_OUTPUT_STREAM (tc->output), NULL, &error);
+  g_assert_no_error (error);
+
+  bytes = g_memory_output_stream_steal_as_bytes (tc->output);
+  str = g_bytes_get_data (bytes, NULL);
+  g_assert (g_str_has_prefix (str, "HTTP/1.1 200 OK\r\n"));
+  g_assert (strstr (str, "\r\nETag: \"" CHECKSUM "-c-br\"\r\n") != NULL);
+
+  g_bytes_unref (bytes);
+  g_object_unref (response);
+}
+
 static void
 test_resource_not_modified_new_language (TestResourceCase *tc,
                                          gconstpointer data)
@@ -1000,7 +1036,7 @@ test_resource_gzip_encoding (TestResourceCase *tc,
     "Access-Control-Allow-Origin: http://localhost\r\n"
     "Content-Type: text/plain\r\n"
     "Transfer-Encoding: chunked\r\n"
-    "Vary: Cookie\r\n"
+    "Vary: Cookie, Accept-Encoding\r\n"
     "\r\n"
     "34\r\n"
     "\x1F\x8B\x08\x08N1\x03U\x00\x03test-file.txt\x00sT(\xCEM\xCC\xC9Q(I-"
@@ -1107,6 +1143,8 @@ main (int argc,
               setup_resource, test_resource_checksum, teardown_resource);
   g_test_add ("/web-channel/resource/not-modified", TestResourceCase, &checksum_fixture,
               setup_resource, test_resource_not_modified, teardown_resource);
+  g_test_add ("/web-channel/resource/not-modified-brotli", TestResourceCase, &checksum_fixture,
+              setup_resource, test_resource_not_modified_brotli, teardown_resource);
   g_test_add ("/web-channel/resource/not-modified-new-language", TestResourceCase, &checksum_fixture,
               setup_resource, test_resource_not_modified_new_language, teardown_resource);
   g_test_add ("/web-channel/resource/not-modified-cookie-language", TestResourceCase, &checksum_fixture,
@@ -31,6 +31,7 @@
 #include "common/cockpitwebserver.h"
 
 #include <glib.h>
+#include <glib/gstdio.h>
 
 #include <limits.h>
 #include <stdlib.h>
@@ -143,6 +144,8 @@ teardown (Test *test,
   g_free (test->scratch);
   g_object_unref (test->response);
   g_strfreev (test->roots);
+  if (test->data.login_cache)
+    g_hash_table_unref (test->data.login_cache);
 
   cockpit_assert_expected ();
 }
@@ -314,6 +317,44 @@ test_login_accept (Test *test,
   g_object_unref (service);
 }
 
+static void
+test_login_busy (Test *test,
+                 gconstpointer path)
+{
+  GError *error = NULL;
+  GAsyncResult *result = NULL;
+  JsonObject *response;
+  GHashTable *headers;
+  const gchar *output;
+  gboolean ret;
+
+  /* One session is already running */
+  headers = mock_auth_basic_header ("me", PASSWORD);
+  cockpit_auth_login_async (test->auth, path, NULL, headers, on_ready_get_result, &result);
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+  response = cockpit_auth_login_finish (test->auth, result, NULL, test->headers, &error);
+  g_object_unref (result);
+  g_assert_no_error (error);
+  json_object_unref (response);
+
+  /* Too small to make room for another one */
+  cockpit_ws_output_budget = 1024;
+  g_assert (cockpit_web_service_saturated ());
+
+  cockpit_expect_message ("Request dropped; sessions are buffering too much output");
+
+  ret = cockpit_handler_default (test->server, path, headers, test->response, &test->data);
+  g_hash_table_unref (headers);
+  g_assert (ret == TRUE);
+
+  output = output_as_string (test);
+  cockpit_assert_strmatch (output, "HTTP/1.1 503 *\r\n*");
+  cockpit_assert_strmatch (output, "*Retry-After: 10\r\n*");
+
+  cockpit_ws_output_budget = 0;
+}
+
 static void
 test_favicon_ico (Test *test,
                   gconstpointer path)
@@ -809,6 +850,321 @@ test_socket_unauthenticated (void)
   g_object_unref (server);
 }
 
+static GBytes *
+dechunk_body (const gchar *body,
+              gsize length)
+{
+  GByteArray *output;
+  const gchar *end = body + length;
+  gchar *next;
+  guint64 size;
+
+  output = g_byte_array_new ();
+  while (body < end)
+    {
+      size = g_ascii_strtoull (body, &next, 16);
+      g_assert (next != body);
+      g_assert (strncmp (next, "\r\n", 2) == 0);
+      body = next + 2;
+      if (size == 0)
+        break;
+      g_assert_cmpuint (size, <=, end - body);
+      g_byte_array_append (output, (const guint8 *)body, size);
+      body += size + 2;
+    }
+
+  return g_byte_array_free_to_bytes (output);
+}
+
+static void
+assert_bytes_match (GBytes *bytes,
+                    const gchar *pattern)
+{
+  gchar *string;
+
+  string = g_strndup (g_bytes_get_data (bytes, NULL), g_bytes_get_size (bytes));
+  cockpit_assert_strmatch (string, pattern);
+  g_free (string);
+}
+
+static GBytes *
+request_page (Test *test,
+              const gchar *url_root,
+              const gchar *accept_encoding,
+              gboolean *gzipped)
+{
+  CockpitWebResponse *response;
+  gboolean response_done = FALSE;
+  GOutputStream *output;
+  GInputStream *input;
+  GHashTable *headers;
+  GHashTableIter iter;
+  gpointer key, value;
+  GIOStream *io;
+  const gchar *data;
+  const gchar *body;
+  gchar *original;
+  GBytes *bytes;
+  gsize length;
+
+  output = g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
+  input = g_memory_input_stream_new ();
+  io = g_simple_io_stream_new (input, output);
+
+  original = g_strconcat (url_root ? url_root : "", "/system/host", NULL);
+  response = cockpit_web_response_new (io, original, "/system/host", NULL, NULL, COCKPIT_WEB_RESPONSE_NONE);
+  g_signal_connect (response, "done", G_CALLBACK (on_web_response_done_set_flag), &response_done);
+  g_free (original);
+
+  /* Along with any login cookie */
+  headers = cockpit_web_server_new_table ();
+  g_hash_table_iter_init (&iter, test->headers);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    g_hash_table_insert (headers, g_strdup (key), g_strdup (value));
+  if (accept_encoding)
+    g_hash_table_insert (headers, g_strdup ("Accept-Encoding"), g_strdup (accept_encoding));
+
+  g_assert (cockpit_handler_default (test->server, "/system/host", headers, response, &test->data));
+  while (!response_done)
+    g_main_context_iteration (NULL, TRUE);
+
+  data = g_memory_output_stream_get_data (G_MEMORY_OUTPUT_STREAM (output));
+  length = g_memory_output_stream_get_data_size (G_MEMORY_OUTPUT_STREAM (output));
+  g_assert (length > 0);
+  g_assert (g_str_has_prefix (data, "HTTP/1.1 200 OK\r\n"));
+
+  body = g_strstr_len (data, length, "\r\n\r\n");
+  g_assert (body != NULL);
+  body += 4;
+
+  *gzipped = g_strstr_len (data, body - data, "\r\nContent-Encoding: gzip\r\n") != NULL;
+  if (g_strstr_len (data, body - data, "\r\nTransfer-Encoding: chunked\r\n"))
+    bytes = dechunk_body (body, length - (body - data));
+  else
+    bytes = g_bytes_new (body, length - (body - data));
+
+  g_hash_table_unref (headers);
+  g_object_unref (response);
+  g_object_unref (io);
+  g_object_unref (input);
+  g_object_unref (output);
+  return bytes;
+}
+
+static void
+test_login_page_cached (Test *test,
+                        gconstpointer data)
+{
+  GBytes *one;
+  GBytes *two;
+  gboolean gzipped;
+
+  test->data.login_cache = cockpit_handler_new_login_cache ();
+
+  one = request_page (test, NULL, NULL, &gzipped);
+  g_assert (!gzipped);
+  g_assert_cmpuint (g_hash_table_size (test->data.login_cache), ==, 1);
+  assert_bytes_match (one, "<html>*<base href=\"/\">*var environment = *login-button*");
+
+  /* Served from the cache the second time */
+  two = request_page (test, NULL, NULL, &gzipped);
+  g_assert (g_bytes_equal (one, two));
+  g_assert_cmpuint (g_hash_table_size (test->data.login_cache), ==, 1);
+  g_bytes_unref (two);
+
+  /* A different url root is a different page */
+  two = request_page (test, "/path", NULL, &gzipped);
+  g_assert_cmpuint (g_hash_table_size (test->data.login_cache), ==, 2);
+  assert_bytes_match (two, "<html>*<base href=\"/path/\">*");
+  g_bytes_unref (two);
+
+  g_bytes_unref (one);
+}
+
+static void
+test_login_page_uncached (Test *test,
+                          gconstpointer data)
+{
+  GBytes *one;
+  GBytes *two;
+  gboolean gzipped;
+
+  /* Without a cache the page is the same, just rendered each time */
+  one = request_page (test, NULL, NULL, &gzipped);
+  test->data.login_cache = cockpit_handler_new_login_cache ();
+  two = request_page (test, NULL, NULL, &gzipped);
+  g_assert (g_bytes_equal (one, two));
+
+  g_bytes_unref (one);
+  g_bytes_unref (two);
+}
+
+static void
+test_login_page_gzip (Test *test,
+                      gconstpointer data)
+{
+  GError *error = NULL;
+  GBytes *plain;
+  GBytes *compressed;
+  GBytes *bytes;
+  gboolean gzipped;
+
+  test->data.login_cache = cockpit_handler_new_login_cache ();
+
+  plain = request_page (test, NULL, "identity", &gzipped);
+  g_assert (!gzipped);
+
+  compressed = request_page (test, NULL, "gzip, deflate, br", &gzipped);
+  g_assert (gzipped);
+  g_assert_cmpuint (g_bytes_get_size (compressed), <, g_bytes_get_size (plain));
+
+  bytes = cockpit_web_response_gunzip (compressed, &error);
+  g_assert_no_error (error);
+  g_assert (g_bytes_equal (bytes, plain));
+  g_bytes_unref (bytes);
+  g_bytes_unref (compressed);
+
+  /* Not when the browser says no */
+  compressed = request_page (test, NULL, "gzip;q=0, deflate", &gzipped);
+  g_assert (!gzipped);
+  g_assert (g_bytes_equal (compressed, plain));
+  g_bytes_unref (compressed);
+
+  g_bytes_unref (plain);
+}
+
+static void
+test_login_page_changed (Test *test,
+                         gconstpointer data)
+{
+  GError *error = NULL;
+  gchar *directory;
+  gchar *contents;
+  GBytes *bytes;
+  gboolean gzipped;
+
+  directory = g_dir_make_tmp ("cockpit-test-handlers-XXXXXX", &error);
+  g_assert_no_error (error);
+
+  g_free (test->login_html);
+  test->login_html = g_build_filename (directory, "login.html", NULL);
+  test->data.login_html = test->login_html;
+  test->data.login_cache = cockpit_handler_new_login_cache ();
+  cockpit_ws_login_check_interval = 0;
+
+  g_file_get_contents (SRCDIR "/pkg/static/login.html", &contents, NULL, &error);
+  g_assert_no_error (error);
+  g_file_set_contents (test->login_html, contents, -1, &error);
+  g_assert_no_error (error);
+
+  bytes = request_page (test, NULL, NULL, &gzipped);
+  assert_bytes_match (bytes, "*login-button*");
+  g_bytes_unref (bytes);
+
+  /* Rebranded */
+  g_file_set_contents (test->login_html,
+                       "<html><head><meta insert_dynamic_content_here></head><body>rebranded</body></html>",
+                       -1, &error);
+  g_assert_no_error (error);
+
+  bytes = request_page (test, NULL, NULL, &gzipped);
+  assert_bytes_match (bytes, "<html><head><meta insert_dynamic_content_here>"
+                             "<base href=\"/\">*var environment = *rebranded*");
+  g_bytes_unref (bytes);
+  g_assert_cmpuint (g_hash_table_size (test->data.login_cache), ==, 1);
+
+  g_unlink (test->login_html);
+  g_rmdir (directory);
+  g_free (directory);
+  g_free (contents);
+  cockpit_ws_login_check_interval = 1000;
+}
+
+static void
+test_shell_gzip (Test *test,
+                 gconstpointer data)
+{
+  GError *error = NULL;
+  GBytes *plain;
+  GBytes *compressed;
+  GBytes *again;
+  GBytes *bytes;
+  gboolean gzipped;
+
+  plain = request_page (test, NULL, "identity", &gzipped);
+  g_assert (!gzipped);
+  assert_bytes_match (plain, "<html>*<base href=\"/cockpit/" CHECKSUM "/another/test.html\">*"
+                      "<title>In system dir</title>*");
+
+  /* The injected page is compressed by cockpit-ws */
+  compressed = request_page (test, NULL, "gzip, deflate", &gzipped);
+  g_assert (gzipped);
+
+  bytes = cockpit_web_response_gunzip (compressed, &error);
+  g_assert_no_error (error);
+  g_assert (g_bytes_equal (bytes, plain));
+  g_bytes_unref (bytes);
+
+  /* And the second time comes out of the cache */
+  again = request_page (test, NULL, "gzip, deflate", &gzipped);
+  g_assert (gzipped);
+  g_assert (g_bytes_equal (again, compressed));
+  g_bytes_unref (again);
+
+  /* A different url root is a different page */
+  again = request_page (test, "/path", "gzip", &gzipped);
+  g_assert (gzipped);
+  bytes = cockpit_web_response_gunzip (again, &error);
+  g_assert_no_error (error);
+  assert_bytes_match (bytes, "<html>*<base href=\"/path/cockpit/" CHECKSUM "/another/test.html\">*");
+  g_bytes_unref (bytes);
+  g_bytes_unref (again);
+
+  g_bytes_unref (compressed);
+  g_bytes_unref (plain);
+}
+
+#define N_LOGIN_REQUESTS 2000
+
+static void
+measure_login_pages (Test *test,
+                     gboolean cached)
+{
+  gboolean gzipped;
+  gdouble elapsed;
+  GBytes *bytes;
+  guint i;
+
+  if (cached)
+    test->data.login_cache = cockpit_handler_new_login_cache ();
+
+  g_test_timer_start ();
+
+  for (i = 0; i < N_LOGIN_REQUESTS; i++)
+    {
+      bytes = request_page (test, NULL, "gzip, deflate", &gzipped);
+      g_bytes_unref (bytes);
+    }
+
+  elapsed = g_test_timer_elapsed ();
+  g_test_maximized_result (N_LOGIN_REQUESTS / elapsed, "%s: %.0f login pages/s",
+                           cached ? "cached" : "uncached", N_LOGIN_REQUESTS / elapsed);
+}
+
+static void
+test_login_page_perf_uncached (Test *test,
+                               gconstpointer data)
+{
+  measure_login_pages (test, FALSE);
+}
+
+static void
+test_login_page_perf_cached (Test *test,
+                             gconstpointer data)
+{
+  measure_login_pages (test, TRUE);
+}
+
 int
 main (int argc,
       char *argv[])
@@ -829,6 +1185,8 @@ main (int argc,
               setup, test_login_fail, teardown);
   g_test_add ("/handlers/login/post-accept", Test, "/cockpit/login",
               setup, test_login_accept, teardown);
+  g_test_add ("/handlers/login/busy", Test, "/cockpit/login",
+              setup, test_login_busy, teardown);
 
   g_test_add ("/handlers/ping", Test, "/ping",
               setup, test_ping, teardown);
@@ -841,6 +1199,8 @@ main (int argc,
               setup_default, test_default, teardown_default);
   g_test_add ("/handlers/shell/package", Test, &fixture_shell_package,
               setup_default, test_default, teardown_default);
+  g_test_add ("/handlers/shell/gzip", Test, &fixture_shell_package,
+              setup_default, test_shell_gzip, teardown_default);
   g_test_add ("/handlers/shell/host", Test, &fixture_shell_host,
               setup_default, test_default, teardown_default);
   g_test_add ("/handlers/shell/host-short", Test, &fixture_shell_host_short,
@@ -900,5 +1260,22 @@ main (int argc,
 
   g_test_add_func ("/handlers/noauth", test_socket_unauthenticated);
 
+  g_test_add ("/handlers/login-page/cached", Test, "/system/host",
+              setup, test_login_page_cached, teardown);
+  g_test_add ("/handlers/login-page/uncached", Test, "/system/host",
+              setup, test_login_page_uncached, teardown);
+  g_test_add ("/handlers/login-page/gzip", Test, "/system/host",
+              setup, test_login_page_gzip, teardown);
+  g_test_add ("/handlers/login-page/changed", Test, "/system/host",
+              setup, test_login_page_changed, teardown);
+
+  if (g_test_perf ())
+    {
+      g_test_add ("/handlers/login-page/perf/uncached", Test, "/system/host",
+                  setup, test_login_page_perf_uncached, teardown);
+      g_test_add ("/handlers/login-page/perf/cached", Test, "/system/host",
+                  setup, test_login_page_perf_cached, teardown);
+    }
+
   return g_test_run ();
 }
@@ -0,0 +1,356 @@
+/*
+ * This file is part of Cockpit.
+ *
+ * Copyright (C) 2026 Red Hat, Inc.
+ *
+ * Cockpit is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * Cockpit is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with Cockpit; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cockpitsupervisor.h"
+
+#include "common/cockpittest.h"
+
+#include <glib.h>
+#include <glib-unix.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Enough connections with big enough requests to fill the socket to a worker */
+#define N_QUEUED 64
+#define QUEUED_PADDING 8000
+
+typedef struct {
+  CockpitSupervisor *supervisor;
+  guint16 port;
+} Test;
+
+static void
+setup (Test *test,
+       gconstpointer data)
+{
+  const gchar *argv[] = { BUILDDIR "/mock-worker", NULL };
+  GError *error = NULL;
+
+  /* The mock workers answer with their index, pid and the path */
+  test->supervisor = cockpit_supervisor_new (argv, GPOINTER_TO_UINT (data), NULL);
+  test->port = cockpit_supervisor_add_inet_listener (test->supervisor, "127.0.0.1", 0, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (test->port, !=, 0);
+
+  cockpit_supervisor_start (test->supervisor);
+}
+
+static void
+teardown (Test *test,
+          gconstpointer data)
+{
+  cockpit_supervisor_free (test->supervisor);
+}
+
+static int
+open_connection (Test *test,
+                 const gchar *request)
+{
+  struct sockaddr_in addr;
+  int fd;
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons (test->port);
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+  fd = socket (AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  g_assert_cmpint (fd, >=, 0);
+  g_assert_cmpint (connect (fd, (struct sockaddr *)&addr, sizeof (addr)), ==, 0);
+
+  if (request)
+    g_assert_cmpint (write (fd, request, strlen (request)), ==, strlen (request));
+
+  g_assert (g_unix_set_fd_nonblocking (fd, TRUE, NULL));
+  return fd;
+}
+
+static gchar *
+build_request (const gchar *path,
+               const gchar *headers)
+{
+  return g_strdup_printf ("GET %s HTTP/1.0\r\nHost: test\r\n%s\r\n", path, headers ? headers : "");
+}
+
+static gchar *
+cookie_for_worker (guint index,
+                   guint count)
+{
+  gchar *encoded;
+  gchar *header;
+  gchar *value;
+  gchar *id;
+  guint i;
+
+  /* Session ids hash to the worker that handed them out */
+  for (i = 0; ; i++)
+    {
+      id = g_strdup_printf ("session%u", i);
+      if (g_str_hash (id) % count == index)
+        break;
+      g_free (id);
+    }
+
+  value = g_strdup_printf ("v=2;k=%s", id);
+  encoded = g_base64_encode ((const guchar *)value, strlen (value));
+  header = g_strdup_printf ("Cookie: cockpit=%s\r\n", encoded);
+
+  g_free (encoded);
+  g_free (value);
+  g_free (id);
+  return header;
+}
+
+/* Reads until the worker is done, and checks who answered */
+static void
+assert_answer (int fd,
+               const gchar *path,
+               guint index,
+               gint *pid)
+{
+  GString *response;
+  gchar buffer[1024];
+  gchar *expected;
+  const gchar *body;
+  guint answered_index;
+  gint answered_pid;
+  gssize count;
+
+  response = g_string_new ("");
+  for (;;)
+    {
+      count = read (fd, buffer, sizeof (buffer));
+      if (count == 0)
+        break;
+      else if (count > 0)
+        g_string_append_len (response, buffer, count);
+      else if (errno == EAGAIN)
+        g_main_context_iteration (NULL, TRUE);
+      else
+        g_assert_not_reached ();
+    }
+
+  cockpit_assert_strmatch (response->str, "HTTP/1.0 200 OK\r\n*\r\n\r\n*");
+  body = strstr (response->str, "\r\n\r\n") + 4;
+  g_assert_cmpint (sscanf (body, "%u %d", &answered_index, &answered_pid), ==, 2);
+  g_assert_cmpuint (answered_index, ==, index);
+  g_assert_cmpint (answered_pid, !=, getpid ());
+
+  expected = g_strdup_printf ("%u %d %s\n", answered_index, answered_pid, path);
+  g_assert_cmpstr (body, ==, expected);
+  g_free (expected);
+
+  if (pid)
+    *pid = answered_pid;
+
+  g_string_free (response, TRUE);
+}
+
+static void
+assert_request (Test *test,
+                const gchar *path,
+                const gchar *headers,
+                guint index,
+                gint *pid)
+{
+  gchar *request;
+  int fd;
+
+  request = build_request (path, headers);
+  fd = open_connection (test, request);
+  assert_answer (fd, path, index, pid);
+  close (fd);
+  g_free (request);
+}
+
+static void
+test_pass_connection (Test *test,
+                      gconstpointer data)
+{
+  const gchar *start = "GET /cockpit/login HTTP/1.0\r\nHo";
+  const gchar *rest = "st: test\r\n\r\n";
+  int fd;
+
+  /* The worker gets the connection and what the supervisor read of it */
+  fd = open_connection (test, start);
+  while (g_main_context_iteration (NULL, FALSE));
+  g_assert_cmpint (write (fd, rest, strlen (rest)), ==, strlen (rest));
+
+  assert_answer (fd, "/cockpit/login", 0, NULL);
+  close (fd);
+}
+
+static void
+test_round_robin (Test *test,
+                  gconstpointer data)
+{
+  /* Without a cookie requests go to the next worker in turn */
+  assert_request (test, "/cockpit/login", NULL, 0, NULL);
+  assert_request (test, "/cockpit/login", NULL, 1, NULL);
+  assert_request (test, "/", NULL, 0, NULL);
+}
+
+static void
+test_cookie (Test *test,
+             gconstpointer data)
+{
+  guint count = GPOINTER_TO_UINT (data);
+  gchar *cookie;
+  gint first;
+  gint pid;
+  guint index;
+
+  for (index = 0; index < count; index++)
+    {
+      cookie = cookie_for_worker (index, count);
+      assert_request (test, "/cockpit/socket", cookie, index, &first);
+      assert_request (test, "/cockpit/@localhost/system/index.html", cookie, index, &pid);
+      g_assert_cmpint (pid, ==, first);
+      g_free (cookie);
+    }
+
+  /* The cookie of another application doesn't count */
+  cookie = cookie_for_worker (1, count);
+  assert_request (test, "/cockpit+other/socket", cookie, 0, NULL);
+  g_free (cookie);
+}
+
+static void
+test_conversation (Test *test,
+                   gconstpointer data)
+{
+  /* The worker tells the supervisor about the conversation before it answers */
+  assert_request (test, "/cockpit/conversation/abc", NULL, 0, NULL);
+
+  /* So the next step of the login goes to the same worker */
+  assert_request (test, "/cockpit/login", "Authorization: X-Conversation abc eHh4\r\n", 0, NULL);
+
+  /* While others are still spread over the workers */
+  assert_request (test, "/cockpit/login", NULL, 1, NULL);
+  assert_request (test, "/cockpit/login", "Authorization: X-Conversation unknown eHh4\r\n", 0, NULL);
+}
+
+static void
+test_busy_worker (Test *test,
+                  gconstpointer data)
+{
+  gchar *cookies[2];
+  gchar *headers;
+  gchar *padding;
+  gchar *request;
+  gchar *path;
+  gchar buffer[16];
+  int queued[N_QUEUED];
+  int stall;
+  guint i;
+
+  cookies[0] = cookie_for_worker (0, 2);
+  cookies[1] = cookie_for_worker (1, 2);
+
+  /* Worker 0 takes no connections until we close this one */
+  request = build_request ("/cockpit/stall", cookies[0]);
+  stall = open_connection (test, request);
+  assert_answer (stall, "/cockpit/stall", 0, NULL);
+  g_free (request);
+
+  /* More than fit into its socket, so the rest wait in a queue */
+  padding = g_strnfill (QUEUED_PADDING, 'x');
+  headers = g_strdup_printf ("%sX-Padding: %s\r\n", cookies[0], padding);
+  for (i = 0; i < N_QUEUED; i++)
+    {
+      path = g_strdup_printf ("/cockpit/queued/%u", i);
+      request = build_request (path, headers);
+      queued[i] = open_connection (test, request);
+      g_free (request);
+      g_free (path);
+    }
+  g_free (headers);
+  g_free (padding);
+
+  /* The supervisor doesn't wait for worker 0 to serve worker 1 */
+  assert_request (test, "/cockpit/socket", cookies[1], 1, NULL);
+  for (i = 0; i < N_QUEUED; i++)
+    {
+      g_assert_cmpint (read (queued[i], buffer, sizeof (buffer)), ==, -1);
+      g_assert_cmpint (errno, ==, EAGAIN);
+    }
+
+  /* Once worker 0 is back, it gets all of them */
+  close (stall);
+  for (i = 0; i < N_QUEUED; i++)
+    {
+      path = g_strdup_printf ("/cockpit/queued/%u", i);
+      assert_answer (queued[i], path, 0, NULL);
+      close (queued[i]);
+      g_free (path);
+    }
+
+  g_free (cookies[0]);
+  g_free (cookies[1]);
+}
+
+static void
+test_idle_worker (Test *test,
+                  gconstpointer data)
+{
+  gint first;
+  gint pid;
+
+  assert_request (test, "/cockpit/login", NULL, 0, &first);
+
+  /* Says it's idle and has seen every connection, so it's retired */
+  assert_request (test, "/cockpit/idle", NULL, 0, &pid);
+  g_assert_cmpint (pid, ==, first);
+  while (kill (first, 0) == 0)
+    g_main_context_iteration (NULL, TRUE);
+
+  /* And a new one is started for the next request */
+  assert_request (test, "/cockpit/login", NULL, 0, &pid);
+  g_assert_cmpint (pid, !=, first);
+}
+
+int
+main (int argc,
+      char *argv[])
+{
+  cockpit_test_init (&argc, &argv);
+
+  g_test_add ("/supervisor/pass-connection", Test, GUINT_TO_POINTER (1),
+              setup, test_pass_connection, teardown);
+  g_test_add ("/supervisor/round-robin", Test, GUINT_TO_POINTER (2),
+              setup, test_round_robin, teardown);
+  g_test_add ("/supervisor/cookie", Test, GUINT_TO_POINTER (3),
+              setup, test_cookie, teardown);
+  g_test_add ("/supervisor/conversation", Test, GUINT_TO_POINTER (2),
+              setup, test_conversation, teardown);
+  g_test_add ("/supervisor/busy-worker", Test, GUINT_TO_POINTER (2),
+              setup, test_busy_worker, teardown);
+  g_test_add ("/supervisor/idle-worker", Test, GUINT_TO_POINTER (1),
+              setup, test_idle_worker, teardown);
+
+  return g_test_run ();
+}
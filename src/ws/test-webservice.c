@@ -23,21 +23,26 @@
 #include "cockpitwebservice.h"
 #include "cockpitws.h"
 
+#include "common/cockpitbufferpool.h"
 #include "common/cockpitconf.h"
 #include "common/cockpitjson.h"
+#include "common/cockpitmemory.h"
 #include "common/cockpitpipe.h"
 #include "common/cockpitpipetransport.h"
 #include "common/cockpitsocket.h"
 #include "common/cockpittest.h"
 #include "common/cockpittransport.h"
 #include "common/cockpitwebserver.h"
+#include "common/mock-pressure.h"
 
 #include "websocket/websocket.h"
 
 #include <glib.h>
 
-#include <string.h>
 #include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 /* Mock override from cockpitconf.c */
 extern const gchar *cockpit_config_file;
@@ -78,6 +83,7 @@ typedef struct {
   const char *forward;
   const char *bridge;
   gboolean for_tls_proxy;
+  guint drop_after;
 } TestFixture;
 
 static gboolean
@@ -596,6 +602,391 @@ test_echo_large (TestCase *test,
   close_client_and_stop_web_service (test, ws, service);
 }
 
+static void
+on_message_record_non_control (WebSocketConnection *ws,
+                               WebSocketDataType type,
+                               GBytes *message,
+                               gpointer user_data)
+{
+  GPtrArray *received = user_data;
+  const gchar *data = g_bytes_get_data (message, NULL);
+
+  if (!g_str_has_prefix (data, "\n"))
+    g_ptr_array_add (received, g_strdup (data));
+}
+
+static void
+test_fragmented (TestCase *test,
+                 gconstpointer data)
+{
+  WebSocketConnection *ws;
+  CockpitWebService *service;
+  GOutputStream *output;
+  GPtrArray *received;
+  gsize written;
+  gulong handler;
+
+  /* Text is assembled whole, the binary stream is relayed piece by piece */
+  const gchar frames[] = "\x01\x03""4\nh"
+                         "\x80\x04""ello"
+                         "\x02\x04""5\nab"
+                         "\x89\x00"
+                         "\x80\x02""cd";
+
+  /* Sends a "test" message in channel "4" */
+  start_web_service_and_connect_client (test, data, &ws, &service);
+
+  received = g_ptr_array_new_with_free_func (g_free);
+  handler = g_signal_connect (ws, "message", G_CALLBACK (on_message_record_non_control), received);
+
+  WAIT_UNTIL (received->len == 1);
+  g_assert_cmpstr (received->pdata[0], ==, "4\ntest");
+
+  send_control_message (ws, "open", "5", "payload", "stream", "binary", "raw", NULL);
+  WAIT_UNTIL (web_socket_connection_get_buffered_amount (ws) == 0);
+
+  /* The client can't send fragments, so write the frames underneath it */
+  output = g_io_stream_get_output_stream (web_socket_connection_get_io_stream (ws));
+  g_assert (g_output_stream_write_all (output, frames, sizeof (frames) - 1, &written, NULL, NULL));
+  g_assert_cmpuint (written, ==, sizeof (frames) - 1);
+
+  WAIT_UNTIL (received->len == 4);
+  g_assert_cmpstr (received->pdata[1], ==, "4\nhello");
+  g_assert_cmpstr (received->pdata[2], ==, "5\nab");
+  g_assert_cmpstr (received->pdata[3], ==, "5\ncd");
+
+  g_signal_handler_disconnect (ws, handler);
+  g_ptr_array_free (received, TRUE);
+
+  close_client_and_stop_web_service (test, ws, service);
+}
+
+#define N_SMALL_MESSAGES 20000
+
+static void
+on_message_count_echo (WebSocketConnection *ws,
+                       WebSocketDataType type,
+                       GBytes *message,
+                       gpointer user_data)
+{
+  guint *count = user_data;
+  const gchar *data;
+  gsize length;
+
+  data = g_bytes_get_data (message, &length);
+  if (length >= 2 && memcmp (data, "4\n", 2) == 0)
+    (*count)++;
+}
+
+static void
+test_perf_forward_small (TestCase *test,
+                         gconstpointer data)
+{
+  WebSocketConnection *ws;
+  CockpitWebService *service;
+  GBytes *message;
+  gdouble elapsed;
+  gulong handler;
+  guint count = 0;
+  guint i;
+
+  /* Sends a "test" message in channel "4" */
+  start_web_service_and_connect_client (test, data, &ws, &service);
+
+  handler = g_signal_connect (ws, "message", G_CALLBACK (on_message_count_echo), &count);
+  WAIT_UNTIL (count == 1);
+
+  /* Through the service to the mock bridge and back again */
+  message = g_bytes_new_static ("4\n{\"small\":\"message\"}", 21);
+
+  g_test_timer_start ();
+
+  for (i = 0; i < N_SMALL_MESSAGES; i++)
+    {
+      web_socket_connection_send (ws, WEB_SOCKET_DATA_TEXT, NULL, message);
+      if (i % 100 == 0)
+        while (g_main_context_iteration (NULL, FALSE));
+    }
+
+  WAIT_UNTIL (count == N_SMALL_MESSAGES + 1);
+
+  elapsed = g_test_timer_elapsed ();
+  g_test_maximized_result (N_SMALL_MESSAGES / elapsed, "%s: %u small messages, %.0f messages/s",
+                           g_test_get_path (), N_SMALL_MESSAGES, N_SMALL_MESSAGES / elapsed);
+
+  g_bytes_unref (message);
+  g_signal_handler_disconnect (ws, handler);
+
+  close_client_and_stop_web_service (test, ws, service);
+}
+
+#define N_BURST_MESSAGES 128
+#define BURST_MESSAGE_SIZE (100 * 1000)
+
+#ifndef __has_feature
+#define __has_feature(x) 0
+#endif
+
+/*
+ * Freed memory only leaves the resident size where the C library can
+ * trim it, and not when valgrind or ASan wrap the allocator. Returns
+ * zero when resident size says nothing about what we hold on to.
+ */
+static gsize
+resident_size (void)
+{
+#if defined(HAVE_MALLOC_TRIM) && !defined(__SANITIZE_ADDRESS__) && !__has_feature(address_sanitizer)
+  g_autofree gchar *contents = NULL;
+  gulong pages;
+
+  if (strstr (g_getenv ("LD_PRELOAD") ?: "", "valgrind") != NULL)
+    return 0;
+
+  if (!g_file_get_contents ("/proc/self/statm", &contents, NULL, NULL) ||
+      sscanf (contents, "%*u %lu", &pages) != 1)
+    return 0;
+
+  return pages * sysconf (_SC_PAGESIZE);
+#else
+  return 0;
+#endif
+}
+
+static void
+test_memory_compact (TestCase *test,
+                     gconstpointer data)
+{
+  WebSocketConnection *ws;
+  CockpitWebService *service;
+  GBytes *message;
+  gchar *contents;
+  gsize baseline_size;
+  gsize baseline_rss;
+  gsize client_size;
+  gsize rss;
+  gulong handler;
+  guint count = 0;
+  guint i;
+
+  /* Sends a "test" message in channel "4" */
+  start_web_service_and_connect_client (test, data, &ws, &service);
+
+  handler = g_signal_connect (ws, "message", G_CALLBACK (on_message_count_echo), &count);
+  WAIT_UNTIL (count == 1);
+
+  cockpit_web_service_compact (service);
+  web_socket_connection_compact (ws);
+  cockpit_buffer_pool_trim ();
+  cockpit_memory_trim ();
+
+  baseline_size = cockpit_web_service_get_memory_size (service);
+  client_size = web_socket_connection_get_memory_size (ws);
+  baseline_rss = resident_size ();
+
+  /* All of this is queued at once, before any of it goes out */
+  contents = g_malloc (BURST_MESSAGE_SIZE);
+  memset (contents, 'x', BURST_MESSAGE_SIZE);
+  memcpy (contents, "4\n", 2);
+  message = g_bytes_new_take (contents, BURST_MESSAGE_SIZE);
+  for (i = 0; i < N_BURST_MESSAGES; i++)
+    web_socket_connection_send (ws, WEB_SOCKET_DATA_TEXT, NULL, message);
+  g_bytes_unref (message);
+
+  WAIT_UNTIL (count == N_BURST_MESSAGES + 1);
+
+  g_assert_cmpuint (cockpit_web_service_get_memory_size (service), >, baseline_size);
+
+  /* More than ten megabytes went through, none of the buffers stay that large */
+  cockpit_web_service_compact (service);
+  web_socket_connection_compact (ws);
+
+  g_assert_cmpuint (cockpit_web_service_get_memory_size (service), <=, baseline_size);
+  g_assert_cmpuint (web_socket_connection_get_memory_size (ws), <=, client_size);
+
+  /* And little of it sticks to the process either */
+  cockpit_buffer_pool_trim ();
+  cockpit_memory_trim ();
+  rss = resident_size ();
+  if (baseline_rss == 0 || rss == 0)
+    g_test_message ("not checking resident memory");
+  else
+    g_assert_cmpuint (rss, <, baseline_rss + 2 * 1024 * 1024);
+
+  g_signal_handler_disconnect (ws, handler);
+
+  close_client_and_stop_web_service (test, ws, service);
+}
+
+typedef struct {
+  gsize stream_bytes;
+  gsize stream_before;
+  gboolean urgent;
+} Latency;
+
+static void
+on_message_latency (WebSocketConnection *ws,
+                    WebSocketDataType type,
+                    GBytes *message,
+                    gpointer user_data)
+{
+  Latency *latency = user_data;
+  const gchar *data;
+  gsize length;
+
+  data = g_bytes_get_data (message, &length);
+  if (length >= 2 && memcmp (data, "5\n", 2) == 0)
+    {
+      latency->stream_bytes += length - 2;
+    }
+  else if (length == 8 && memcmp (data, "4\nurgent", 8) == 0)
+    {
+      g_assert (!latency->urgent);
+      latency->stream_before = latency->stream_bytes;
+      latency->urgent = TRUE;
+    }
+}
+
+static gboolean
+on_timeout_set_flag (gpointer user_data)
+{
+  gboolean *flag = user_data;
+  *flag = TRUE;
+  return FALSE;
+}
+
+static void
+test_latency (TestCase *test,
+              gconstpointer data)
+{
+  CockpitFlow *pressure = mock_pressure_new ();
+  Latency latency = { 0, 0, FALSE };
+  WebSocketConnection *ws;
+  CockpitWebService *service;
+  gboolean timeout = FALSE;
+  GBytes *message;
+  gchar *string;
+  gulong handler;
+
+  const gsize size = 4 * 1024 * 1024;
+
+  start_web_service_and_connect_client (test, data, &ws, &service);
+  handler = g_signal_connect (ws, "message", G_CALLBACK (on_message_latency), &latency);
+
+  send_control_message (ws, "open", "5", "payload", "stream", "binary", "raw", NULL);
+  WAIT_UNTIL (web_socket_connection_get_buffered_amount (ws) == 0);
+
+  /* A slow link: the client stops reading */
+  cockpit_flow_throttle (COCKPIT_FLOW (ws), pressure);
+  g_signal_emit_by_name (pressure, "pressure", TRUE);
+
+  string = g_malloc (size + 2);
+  memcpy (string, "5\n", 2);
+  memset (string + 2, 'x', size);
+  message = g_bytes_new_take (string, size + 2);
+  web_socket_connection_send (ws, WEB_SOCKET_DATA_BINARY, NULL, message);
+  g_bytes_unref (message);
+
+  message = g_bytes_new_static ("4\nurgent", 8);
+  web_socket_connection_send (ws, WEB_SOCKET_DATA_TEXT, NULL, message);
+  g_bytes_unref (message);
+
+  /* Let both echoes come back from the bridge and queue up */
+  g_timeout_add (500, on_timeout_set_flag, &timeout);
+  WAIT_UNTIL (timeout == TRUE);
+  g_signal_emit_by_name (pressure, "pressure", FALSE);
+
+  WAIT_UNTIL (latency.urgent && latency.stream_bytes == size);
+
+  /* The small message didn't wait for the whole large one */
+  g_assert_cmpuint (latency.stream_before, <, size / 4);
+
+  g_signal_handler_disconnect (ws, handler);
+  cockpit_flow_throttle (COCKPIT_FLOW (ws), NULL);
+  g_object_unref (pressure);
+
+  close_client_and_stop_web_service (test, ws, service);
+}
+
+static const TestFixture fixture_flood = {
+    .bridge = SRCDIR "/src/ws/mock-flood"
+};
+
+#define N_FLOOD_SESSIONS 8
+#define FLOOD_BUDGET (4 * 1024 * 1024)
+
+static void
+test_output_budget (TestCase *test,
+                    gconstpointer data)
+{
+  CockpitFlow *pressure = mock_pressure_new ();
+  TestCase cases[N_FLOOD_SESSIONS] = { { NULL, } };
+  WebSocketConnection *ws[N_FLOOD_SESSIONS];
+  CockpitWebService *service[N_FLOOD_SESSIONS];
+  gboolean timeout = FALSE;
+  gsize baseline_rss;
+  gsize size = 0;
+  gsize rss;
+  guint i;
+
+  cockpit_ws_output_budget = FLOOD_BUDGET;
+
+  /* Each bridge floods its session, and none of the clients read */
+  for (i = 0; i < N_FLOOD_SESSIONS; i++)
+    {
+      setup_for_socket (&cases[i], data);
+      start_web_service_and_connect_client (&cases[i], data, &ws[i], &service[i]);
+      cockpit_flow_throttle (COCKPIT_FLOW (ws[i]), pressure);
+    }
+
+  cockpit_buffer_pool_trim ();
+  cockpit_memory_trim ();
+  baseline_rss = resident_size ();
+
+  g_signal_emit_by_name (pressure, "pressure", TRUE);
+
+  WAIT_UNTIL (cockpit_web_service_saturated ());
+
+  /* Nothing more piles up once the bridges are throttled */
+  g_timeout_add (1000, on_timeout_set_flag, &timeout);
+  WAIT_UNTIL (timeout == TRUE);
+
+  /*
+   * None of these channels have flow control, so each bridge is only
+   * stopped at twice its share, give or take what it had already read.
+   */
+  g_assert_cmpuint (cockpit_web_service_get_output_used (), <=,
+                    2 * FLOOD_BUDGET + N_FLOOD_SESSIONS * 128 * 1024);
+  for (i = 0; i < N_FLOOD_SESSIONS; i++)
+    size += cockpit_web_service_get_memory_size (service[i]);
+  g_assert_cmpuint (size, <=, 2 * FLOOD_BUDGET + N_FLOOD_SESSIONS * 256 * 1024);
+  g_assert (cockpit_web_service_saturated ());
+
+  /* Nor does the process grow by much more than that */
+  rss = resident_size ();
+  if (baseline_rss == 0 || rss == 0)
+    g_test_message ("not checking resident memory");
+  else
+    g_assert_cmpuint (rss, <, baseline_rss + size + 4 * 1024 * 1024);
+
+  /* Stop the floods before the clients catch up */
+  for (i = 0; i < N_FLOOD_SESSIONS; i++)
+    cockpit_transport_close (cases[i].mock_bridge, "terminate");
+  g_signal_emit_by_name (pressure, "pressure", FALSE);
+
+  for (i = 0; i < N_FLOOD_SESSIONS; i++)
+    {
+      cockpit_flow_throttle (COCKPIT_FLOW (ws[i]), NULL);
+      close_client_and_stop_web_service (&cases[i], ws[i], service[i]);
+      teardown_for_socket (&cases[i], data);
+    }
+
+  g_assert (!cockpit_web_service_saturated ());
+  g_assert_cmpuint (cockpit_web_service_get_output_used (), ==, 0);
+
+  g_object_unref (pressure);
+  cockpit_ws_output_budget = 0;
+}
+
 static void
 test_close_error (TestCase *test,
                   gconstpointer data)
@@ -929,6 +1320,104 @@ test_kill_group (TestCase *test,
   close_client_and_stop_web_service (test, ws, service);
 }
 
+static JsonObject *
+wait_for_command (WebSocketConnection *ws,
+                  GBytes **received,
+                  const gchar *wanted,
+                  gchar **channel_data)
+{
+  JsonObject *options;
+  const gchar *command;
+  const gchar *channel;
+  gchar *ochannel;
+  GBytes *payload;
+
+  for (;;)
+    {
+      WAIT_UNTIL (*received != NULL);
+
+      payload = cockpit_transport_parse_frame (*received, &ochannel);
+      g_bytes_unref (*received);
+      *received = NULL;
+      g_assert (payload != NULL);
+
+      /* A data message on a channel */
+      if (ochannel)
+        {
+          if (channel_data && !wanted)
+            {
+              *channel_data = g_strndup (g_bytes_get_data (payload, NULL), g_bytes_get_size (payload));
+              g_bytes_unref (payload);
+              g_free (ochannel);
+              return NULL;
+            }
+          g_bytes_unref (payload);
+          g_free (ochannel);
+          continue;
+        }
+
+      g_assert (cockpit_transport_parse_command (payload, &command, &channel, &options));
+      g_bytes_unref (payload);
+      if (wanted && g_str_equal (command, wanted))
+        return options;
+      json_object_unref (options);
+    }
+}
+
+static void
+test_kill_reply (TestCase *test,
+                 gconstpointer data)
+{
+  WebSocketConnection *ws;
+  GBytes *received = NULL;
+  CockpitWebService *service;
+  JsonObject *options;
+  gchar *echo = NULL;
+  GBytes *sent;
+  gulong handler;
+
+  /* Sends a "test" message in channel "4" */
+  start_web_service_and_connect_client (test, data, &ws, &service);
+
+  handler = g_signal_connect (ws, "message", G_CALLBACK (on_message_get_non_control), &received);
+  WAIT_UNTIL (received != NULL);
+  g_bytes_unref (received);
+  received = NULL;
+  g_signal_handler_disconnect (ws, handler);
+
+  handler = g_signal_connect (ws, "message", G_CALLBACK (on_message_get_bytes), &received);
+
+  send_control_message (ws, "open", "a", "payload", "echo", "group", "test", NULL);
+  send_control_message (ws, "open", "b", "payload", "echo", "group", "test", NULL);
+  send_control_message (ws, "open", "c", "payload", "echo", "group", "other", NULL);
+
+  sent = g_bytes_new_static ("a\nhello", 7);
+  web_socket_connection_send (ws, WEB_SOCKET_DATA_TEXT, NULL, sent);
+  g_bytes_unref (sent);
+
+  wait_for_command (ws, &received, NULL, &echo);
+  g_assert_cmpstr (echo, ==, "hello");
+  g_free (echo);
+
+  /* Only channels in the group are counted */
+  send_control_message (ws, "kill", NULL, "group", "test", "cookie", "k1", NULL);
+  options = wait_for_command (ws, &received, "killed", NULL);
+  cockpit_assert_json_eq (options, "{'command':'killed','group':'test','cookie':'k1',"
+                          "'channels':2,'sent-bytes':5,'recv-bytes':5}");
+  json_object_unref (options);
+
+  /* Without a cookie there's no reply */
+  send_control_message (ws, "kill", NULL, "group", "nothing", NULL);
+  send_control_message (ws, "kill", NULL, "group", "other", "cookie", "k2", NULL);
+  options = wait_for_command (ws, &received, "killed", NULL);
+  cockpit_assert_json_eq (options, "{'command':'killed','group':'other','cookie':'k2',"
+                          "'channels':1,'sent-bytes':0,'recv-bytes':0}");
+  json_object_unref (options);
+
+  g_signal_handler_disconnect (ws, handler);
+  close_client_and_stop_web_service (test, ws, service);
+}
+
 static void
 test_kill_host (TestCase *test,
                 gconstpointer data)
@@ -1002,6 +1491,128 @@ test_kill_host (TestCase *test,
   close_client_and_stop_web_service (test, ws, service);
 }
 
+static void
+send_open_batch (WebSocketConnection *ws,
+                 const gchar *json)
+{
+  gchar *control;
+  GBytes *payload;
+
+  control = g_strconcat ("\n", json, NULL);
+  payload = g_bytes_new_take (control, strlen (control));
+  web_socket_connection_send (ws, WEB_SOCKET_DATA_TEXT, NULL, payload);
+  g_bytes_unref (payload);
+}
+
+static void
+start_and_drain_echo (TestCase *test,
+                      gconstpointer data,
+                      WebSocketConnection **ws,
+                      CockpitWebService **service,
+                      GBytes **received)
+{
+  gulong handler;
+
+  /* Sends a "test" message in channel "4" */
+  start_web_service_and_connect_client (test, data, ws, service);
+
+  handler = g_signal_connect (*ws, "message", G_CALLBACK (on_message_get_non_control), received);
+  WAIT_UNTIL (*received != NULL);
+  g_bytes_unref (*received);
+  *received = NULL;
+  g_signal_handler_disconnect (*ws, handler);
+}
+
+static void
+test_open_batch (TestCase *test,
+                 gconstpointer data)
+{
+  WebSocketConnection *ws;
+  GBytes *received = NULL;
+  CockpitWebService *service;
+  JsonObject *options;
+  gchar *echo = NULL;
+  GBytes *sent;
+  gulong handler;
+
+  start_and_drain_echo (test, data, &ws, &service, &received);
+  handler = g_signal_connect (ws, "message", G_CALLBACK (on_message_get_bytes), &received);
+
+  send_open_batch (ws, "{\"command\": \"open-batch\", \"batch\": \"one\", \"options\": { \"payload\": \"echo\" },"
+                   " \"channels\": [ { \"channel\": \"a\" }, { \"channel\": \"b\", \"group\": \"other\" } ] }");
+
+  options = wait_for_command (ws, &received, "ready-batch", NULL);
+  cockpit_assert_json_eq (options, "{'command':'ready-batch','batch':'one','channels':{'a':{},'b':{}}}");
+  json_object_unref (options);
+
+  sent = g_bytes_new_static ("b\nhello", 7);
+  web_socket_connection_send (ws, WEB_SOCKET_DATA_TEXT, NULL, sent);
+  g_bytes_unref (sent);
+
+  wait_for_command (ws, &received, NULL, &echo);
+  g_assert_cmpstr (echo, ==, "hello");
+  g_free (echo);
+
+  g_signal_handler_disconnect (ws, handler);
+  close_client_and_stop_web_service (test, ws, service);
+}
+
+static void
+test_open_batch_problem (TestCase *test,
+                         gconstpointer data)
+{
+  WebSocketConnection *ws;
+  GBytes *received = NULL;
+  CockpitWebService *service;
+  JsonObject *options;
+  gulong handler;
+
+  start_and_drain_echo (test, data, &ws, &service, &received);
+  handler = g_signal_connect (ws, "message", G_CALLBACK (on_message_get_bytes), &received);
+
+  send_open_batch (ws, "{\"command\": \"open-batch\", \"batch\": \"two\", \"options\": { \"payload\": \"echo\" },"
+                   " \"channels\": [ { \"channel\": \"a\" }, { \"channel\": \"b\", \"payload\": \"unknown\" } ] }");
+
+  /* The failed channel is closed before the reply */
+  options = wait_for_command (ws, &received, "close", NULL);
+  cockpit_assert_json_eq (options, "{'command':'close','channel':'b','problem':'not-supported'}");
+  json_object_unref (options);
+
+  options = wait_for_command (ws, &received, "ready-batch", NULL);
+  cockpit_assert_json_eq (options, "{'command':'ready-batch','batch':'two','channels':{'a':{}},"
+                          "'problems':{'b':'not-supported'}}");
+  json_object_unref (options);
+
+  g_signal_handler_disconnect (ws, handler);
+  close_client_and_stop_web_service (test, ws, service);
+}
+
+static void
+test_open_batch_all_fail (TestCase *test,
+                          gconstpointer data)
+{
+  WebSocketConnection *ws;
+  GBytes *received = NULL;
+  CockpitWebService *service;
+  JsonObject *options;
+  gulong handler;
+
+  start_and_drain_echo (test, data, &ws, &service, &received);
+  handler = g_signal_connect (ws, "message", G_CALLBACK (on_message_get_bytes), &received);
+
+  send_open_batch (ws, "{\"command\": \"open-batch\", \"batch\": \"three\", \"options\": { \"payload\": \"unknown\" },"
+                   " \"channels\": [ { \"channel\": \"a\" }, { \"channel\": \"b\" } ] }");
+
+  /* None of the channels are left, but the reply still arrives */
+  options = wait_for_command (ws, &received, "ready-batch", NULL);
+  cockpit_assert_json_eq (options, "{'command':'ready-batch','batch':'three','channels':{},"
+                          "'problems':{'a':'not-supported','b':'not-supported'}}");
+  json_object_unref (options);
+
+  g_signal_handler_disconnect (ws, handler);
+  close_client_and_stop_web_service (test, ws, service);
+}
+
 static void
 on_idling_set_flag (CockpitWebService *service,
                     gpointer data)
@@ -1136,6 +1747,377 @@ test_logout (TestCase *test,
   close_client_and_stop_web_service (test, ws, service);
 }
 
+/* Numbered messages the resume tests send on channel "4" */
+#define RESUME_MESSAGES 10
+
+typedef struct {
+  WebSocketConnection *ws;
+  gulong handler;
+
+  /* From the first connection, whose token resumes */
+  JsonObject *init;
+  JsonObject *resume;
+
+  /* Numbered messages, to send again what didn't arrive */
+  guint64 received;
+  GPtrArray *sent;
+  GPtrArray *echoed;
+} ResumeClient;
+
+static void
+on_resume_client_message (WebSocketConnection *ws,
+                          WebSocketDataType type,
+                          GBytes *message,
+                          gpointer user_data)
+{
+  ResumeClient *client = user_data;
+  const gchar *command;
+  const gchar *channel;
+  JsonObject *options;
+  gchar *outer_channel;
+  GBytes *payload;
+  gconstpointer data;
+  gsize length;
+
+  payload = cockpit_transport_parse_frame (message, &outer_channel);
+  g_assert (payload != NULL);
+
+  if (outer_channel)
+    {
+      data = g_bytes_get_data (payload, &length);
+      g_ptr_array_add (client->echoed, g_strndup (data, length));
+      client->received++;
+    }
+  else
+    {
+      g_assert (cockpit_transport_parse_command (payload, &command, &channel, &options));
+      if (g_str_equal (command, "init"))
+        {
+          if (!client->init)
+            client->init = json_object_ref (options);
+        }
+      else if (g_str_equal (command, "resume"))
+        {
+          g_assert (client->resume == NULL);
+          client->resume = json_object_ref (options);
+        }
+      else if (channel || (!g_str_equal (command, "ping") && !g_str_equal (command, "pong") &&
+                           !g_str_equal (command, "ack")))
+        {
+          client->received++;
+        }
+      json_object_unref (options);
+    }
+
+  g_free (outer_channel);
+  g_bytes_unref (payload);
+}
+
+static void
+resume_client_send_text (ResumeClient *client,
+                         const gchar *text)
+{
+  GBytes *message = g_bytes_new (text, strlen (text));
+  web_socket_connection_send (client->ws, WEB_SOCKET_DATA_TEXT, NULL, message);
+  g_bytes_unref (message);
+}
+
+static void
+resume_client_send (ResumeClient *client,
+                    const gchar *text)
+{
+  g_ptr_array_add (client->sent, g_strdup (text));
+  resume_client_send_text (client, text);
+}
+
+static void
+resume_client_attach (ResumeClient *client,
+                      WebSocketConnection *ws)
+{
+  client->ws = ws;
+  client->handler = g_signal_connect (ws, "message", G_CALLBACK (on_resume_client_message), client);
+  WAIT_UNTIL (web_socket_connection_get_ready_state (ws) != WEB_SOCKET_STATE_CONNECTING);
+  g_assert (web_socket_connection_get_ready_state (ws) == WEB_SOCKET_STATE_OPEN);
+}
+
+static void
+resume_client_detach (ResumeClient *client)
+{
+  g_signal_handler_disconnect (client->ws, client->handler);
+  client->handler = 0;
+}
+
+static void
+resume_client_start (ResumeClient *client,
+                     TestCase *test,
+                     const TestFixture *fixture,
+                     CockpitWebService **service)
+{
+  WebSocketConnection *ws;
+  gchar *text;
+  guint i;
+
+  client->sent = g_ptr_array_new_with_free_func (g_free);
+  client->echoed = g_ptr_array_new_with_free_func (g_free);
+
+  start_web_service_and_create_client (test, fixture, &ws, service);
+  resume_client_attach (client, ws);
+
+  resume_client_send_text (client, "\n{ \"command\": \"init\", \"version\": 1, \"resume\": true }");
+  WAIT_UNTIL (client->init != NULL);
+
+  resume_client_send (client, "\n{ \"command\": \"open\", \"channel\": \"4\", \"payload\": \"echo\" }");
+  for (i = 0; i < RESUME_MESSAGES; i++)
+    {
+      text = g_strdup_printf ("4\nmessage %u", i);
+      resume_client_send (client, text);
+      g_free (text);
+    }
+}
+
+static WebSocketConnection *
+resume_client_reconnect (ResumeClient *client,
+                         CockpitWebService *service,
+                         const gchar *token)
+{
+  GIOStream *io_a;
+  GIOStream *io_b;
+  WebSocketConnection *ws;
+  gchar *text;
+
+  cockpit_socket_streampair (&io_a, &io_b);
+
+  ws = g_object_new (WEB_SOCKET_TYPE_CLIENT,
+                     "url", "ws://127.0.0.1/unused",
+                     "origin", "http://127.0.0.1",
+                     "io-stream", io_a,
+                     NULL);
+  g_signal_connect (ws, "error", G_CALLBACK (on_error_not_reached), NULL);
+
+  cockpit_web_service_socket (service, "/unused", io_b, NULL, NULL, FALSE);
+  g_object_unref (io_a);
+  g_object_unref (io_b);
+
+  resume_client_attach (client, ws);
+
+  text = g_strdup_printf ("\n{ \"command\": \"init\", \"version\": 1, \"resume\": true,"
+                          " \"resume-token\": \"%s\", \"received\": %" G_GUINT64_FORMAT " }",
+                          token, client->received);
+  resume_client_send_text (client, text);
+  g_free (text);
+
+  WAIT_UNTIL (client->resume != NULL);
+  return ws;
+}
+
+static void
+resume_client_finish (ResumeClient *client)
+{
+  gint64 received;
+  guint i;
+
+  /* Send again what the web service missed, and something more */
+  g_assert (cockpit_json_get_int (client->resume, "received", -1, &received));
+  g_assert_cmpint (received, >=, 0);
+  g_assert_cmpint (received, <=, client->sent->len);
+  for (i = received; i < client->sent->len; i++)
+    resume_client_send_text (client, client->sent->pdata[i]);
+  resume_client_send_text (client, "4\nafter");
+
+  /* Everything arrives once and in order */
+  WAIT_UNTIL (client->echoed->len == RESUME_MESSAGES + 1);
+  for (i = 0; i < RESUME_MESSAGES; i++)
+    {
+      gchar *expected = g_strdup_printf ("message %u", i);
+      g_assert_cmpstr (client->echoed->pdata[i], ==, expected);
+      g_free (expected);
+    }
+  g_assert_cmpstr (client->echoed->pdata[RESUME_MESSAGES], ==, "after");
+}
+
+static void
+resume_client_clear (ResumeClient *client)
+{
+  if (client->handler)
+    resume_client_detach (client);
+  if (client->init)
+    json_object_unref (client->init);
+  if (client->resume)
+    json_object_unref (client->resume);
+  g_ptr_array_free (client->sent, TRUE);
+  g_ptr_array_free (client->echoed, TRUE);
+}
+
+static const gchar *
+resume_client_token (ResumeClient *client)
+{
+  const gchar *token = NULL;
+  JsonArray *capabilities;
+  gboolean found = FALSE;
+  guint i;
+
+  capabilities = json_object_get_array_member (client->init, "capabilities");
+  for (i = 0; i < json_array_get_length (capabilities); i++)
+    found = found || g_str_equal (json_array_get_string_element (capabilities, i), "resume");
+  g_assert (found);
+
+  g_assert (cockpit_json_get_string (client->init, "resume-token", NULL, &token));
+  g_assert (token != NULL);
+  return token;
+}
+
+static void
+on_log_set_flag (const gchar *log_domain,
+                 GLogLevelFlags log_level,
+                 const gchar *message,
+                 gpointer user_data)
+{
+  gboolean *flag = user_data;
+  *flag = TRUE;
+}
+
+/* Drop the connection without closing it, and wait for the web service to notice */
+static void
+drop_client (WebSocketConnection *ws)
+{
+  gboolean noticed = FALSE;
+  guint handler;
+
+  handler = g_log_set_handler ("WebSocket", G_LOG_LEVEL_MESSAGE, on_log_set_flag, &noticed);
+  g_object_run_dispose (G_OBJECT (ws));
+  WAIT_UNTIL (noticed);
+  g_log_remove_handler ("WebSocket", handler);
+}
+
+static void
+test_resume_dropped (TestCase *test,
+                     gconstpointer data)
+{
+  const TestFixture *fixture = data;
+  ResumeClient client = { NULL, };
+  CockpitWebService *service;
+  WebSocketConnection *old;
+  WebSocketConnection *ws;
+
+  resume_client_start (&client, test, fixture, &service);
+
+  /* The connection drops somewhere in the middle of things */
+  WAIT_UNTIL (client.echoed->len >= fixture->drop_after);
+  old = client.ws;
+  resume_client_detach (&client);
+  drop_client (old);
+  g_object_unref (old);
+
+  ws = resume_client_reconnect (&client, service, resume_client_token (&client));
+  g_assert (!json_object_has_member (client.resume, "problem"));
+  resume_client_finish (&client);
+
+  resume_client_clear (&client);
+  close_client_and_stop_web_service (test, ws, service);
+}
+
+static void
+test_resume_half_open (TestCase *test,
+                       gconstpointer data)
+{
+  ResumeClient client = { NULL, };
+  CockpitWebService *service;
+  WebSocketConnection *old;
+  WebSocketConnection *ws;
+
+  resume_client_start (&client, test, data, &service);
+  WAIT_UNTIL (client.echoed->len >= RESUME_MESSAGES / 2);
+
+  /* The frontend gave up on a connection the web service still thinks is fine */
+  old = client.ws;
+  resume_client_detach (&client);
+
+  ws = resume_client_reconnect (&client, service, resume_client_token (&client));
+  g_assert (!json_object_has_member (client.resume, "problem"));
+
+  /* The web service closes the old one */
+  WAIT_UNTIL (web_socket_connection_get_ready_state (old) == WEB_SOCKET_STATE_CLOSED);
+  g_assert_cmpstr (web_socket_connection_get_close_data (old), ==, "resumed");
+  g_object_unref (old);
+
+  resume_client_finish (&client);
+
+  resume_client_clear (&client);
+  close_client_and_stop_web_service (test, ws, service);
+}
+
+static void
+test_resume_expired (TestCase *test,
+                     gconstpointer data)
+{
+  ResumeClient client = { NULL, };
+  CockpitWebService *service;
+  WebSocketConnection *old;
+  WebSocketConnection *ws;
+  gboolean idling = FALSE;
+  gulong handler;
+  gchar *token;
+
+  cockpit_ws_resume_timeout = 1;
+
+  resume_client_start (&client, test, data, &service);
+  WAIT_UNTIL (client.echoed->len == RESUME_MESSAGES);
+  token = g_strdup (resume_client_token (&client));
+
+  old = client.ws;
+  resume_client_detach (&client);
+  drop_client (old);
+  g_object_unref (old);
+
+  /* Nothing holds the web service once it stops waiting */
+  handler = g_signal_connect (service, "idling", G_CALLBACK (on_idling_set_flag), &idling);
+  WAIT_UNTIL (idling);
+  g_signal_handler_disconnect (service, handler);
+
+  ws = resume_client_reconnect (&client, service, token);
+  cockpit_assert_json_eq (client.resume, "{ \"command\": \"resume\", \"problem\": \"not-resumable\" }");
+
+  /* The new connection works like a fresh one */
+  send_control_message (ws, "open", "5", "payload", "echo", NULL);
+  resume_client_send_text (&client, "5\nfresh");
+  WAIT_UNTIL (client.echoed->len == RESUME_MESSAGES + 1);
+  g_assert_cmpstr (client.echoed->pdata[RESUME_MESSAGES], ==, "fresh");
+
+  g_free (token);
+  resume_client_clear (&client);
+  close_client_and_stop_web_service (test, ws, service);
+
+  cockpit_ws_resume_timeout = 30;
+}
+
+static void
+test_resume_unknown (TestCase *test,
+                     gconstpointer data)
+{
+  ResumeClient client = { NULL, };
+  CockpitWebService *service;
+  WebSocketConnection *old;
+  WebSocketConnection *ws;
+
+  resume_client_start (&client, test, data, &service);
+  WAIT_UNTIL (client.echoed->len == RESUME_MESSAGES);
+
+  old = client.ws;
+  resume_client_detach (&client);
+
+  ws = resume_client_reconnect (&client, service, "0123456789abcdef");
+  cockpit_assert_json_eq (client.resume, "{ \"command\": \"resume\", \"problem\": \"not-resumable\" }");
+
+  /* The original connection was left alone */
+  g_assert (web_socket_connection_get_ready_state (old) == WEB_SOCKET_STATE_OPEN);
+  web_socket_connection_close (old, 0, NULL);
+  WAIT_UNTIL (web_socket_connection_get_ready_state (old) == WEB_SOCKET_STATE_CLOSED);
+  g_object_unref (old);
+
+  resume_client_clear (&client);
+  close_client_and_stop_web_service (test, ws, service);
+}
+
 static void
 test_parse_external (void)
 {
@@ -1349,6 +2331,15 @@ main (int argc,
               &fixture_bad_origin_tls_proxy, setup_for_socket,
               test_bad_origin, teardown_for_socket);
 
+  g_test_add ("/web-service/fragmented", TestCase, NULL,
+              setup_for_socket, test_fragmented, teardown_for_socket);
+  g_test_add ("/web-service/latency", TestCase, NULL,
+              setup_for_socket, test_latency, teardown_for_socket);
+  g_test_add ("/web-service/memory/compact", TestCase, NULL,
+              setup_for_socket, test_memory_compact, teardown_for_socket);
+  g_test_add ("/web-service/output-budget", TestCase, &fixture_flood,
+              NULL, test_output_budget, NULL);
+
   g_test_add ("/web-service/close-error", TestCase,
               NULL, setup_for_socket,
               test_close_error, teardown_for_socket);
@@ -1357,6 +2348,35 @@ main (int argc,
               setup_for_socket, test_kill_group, teardown_for_socket);
   g_test_add ("/web-service/kill-host", TestCase, &fixture_kill_group,
               setup_for_socket, test_kill_host, teardown_for_socket);
+  g_test_add ("/web-service/kill-reply", TestCase, &fixture_kill_group,
+              setup_for_socket, test_kill_reply, teardown_for_socket);
+
+  g_test_add ("/web-service/open-batch/ready", TestCase, &fixture_kill_group,
+              setup_for_socket, test_open_batch, teardown_for_socket);
+  g_test_add ("/web-service/open-batch/problem", TestCase, &fixture_kill_group,
+              setup_for_socket, test_open_batch_problem, teardown_for_socket);
+  g_test_add ("/web-service/open-batch/all-fail", TestCase, &fixture_kill_group,
+              setup_for_socket, test_open_batch_all_fail, teardown_for_socket);
+
+  static const TestFixture fixture_drops[] = {
+      { .drop_after = 1 },
+      { .drop_after = 4 },
+      { .drop_after = RESUME_MESSAGES },
+  };
+
+  for (i = 0; i < G_N_ELEMENTS (fixture_drops); i++)
+    {
+      name = g_strdup_printf ("/web-service/resume/drop-%u", fixture_drops[i].drop_after);
+      g_test_add (name, TestCase, fixture_drops + i,
+                  setup_for_socket, test_resume_dropped, teardown_for_socket);
+      g_free (name);
+    }
+  g_test_add ("/web-service/resume/half-open", TestCase, NULL,
+              setup_for_socket, test_resume_half_open, teardown_for_socket);
+  g_test_add ("/web-service/resume/expired", TestCase, NULL,
+              setup_for_socket, test_resume_expired, teardown_for_socket);
+  g_test_add ("/web-service/resume/unknown-token", TestCase, NULL,
+              setup_for_socket, test_resume_unknown, teardown_for_socket);
 
   g_test_add ("/web-service/idling-signal", TestCase, NULL,
               setup_for_socket, test_idling, teardown_for_socket);
@@ -1365,6 +2385,12 @@ main (int argc,
   g_test_add ("/web-service/logout", TestCase, NULL,
               setup_for_socket, test_logout, teardown_for_socket);
 
+  if (g_test_perf ())
+    {
+      g_test_add ("/web-service/perf/forward-small", TestCase, NULL,
+                  setup_for_socket, test_perf_forward_small, teardown_for_socket);
+    }
+
   g_test_add_func ("/web-service/parse-external/success", test_parse_external);
   g_test_add_func ("/web-service/host-checksums", test_host_checksums);
   for (i = 0; i < G_N_ELEMENTS (external_failure_fixtures); i++)